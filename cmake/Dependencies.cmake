@@ -65,6 +65,14 @@ include_directories(SYSTEM ${OpenCV_INCLUDE_DIRS})
 list(APPEND Caffe_LINKER_LIBS ${OpenCV_LIBS})
 message(STATUS "OpenCV found (${OpenCV_CONFIG_PATH})")
 
+# ---[ libjpeg
+if(USE_LIBJPEG)
+  find_package(JPEG REQUIRED)
+  include_directories(SYSTEM ${JPEG_INCLUDE_DIR})
+  list(APPEND Caffe_LINKER_LIBS ${JPEG_LIBRARIES})
+  add_definitions(-DUSE_LIBJPEG)
+endif()
+
 # ---[ BLAS
 if(NOT APPLE)
   set(BLAS "Atlas" CACHE STRING "Selected BLAS library")
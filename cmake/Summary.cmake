@@ -125,6 +125,7 @@ function(caffe_print_configuration_summary)
   caffe_status("  Snappy            : " SNAPPY_FOUND THEN "Yes (ver. ${Snappy_VERSION})" ELSE "No" )
   caffe_status("  LevelDB           : " LEVELDB_FOUND THEN  "Yes (ver. ${LEVELDB_VERSION})" ELSE "No")
   caffe_status("  OpenCV            :   Yes (ver. ${OpenCV_VERSION})")
+  caffe_status("  libjpeg           : " USE_LIBJPEG THEN "Yes" ELSE "No")
   caffe_status("  CUDA              : " HAVE_CUDA THEN "Yes (ver. ${CUDA_VERSION})" ELSE "No" )
   caffe_status("")
   if(HAVE_CUDA)
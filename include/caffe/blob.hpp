@@ -20,7 +20,8 @@ class Blob {
  public:
   Blob()
        : data_(), diff_(), num_(0), channels_(0), height_(0), width_(0),
-       count_(0), capacity_(0) {}
+       count_(0), capacity_(0), half_precision_(FLOAT32), half_memory_(NULL),
+       half_version_(0) {}
   explicit Blob(const int num, const int channels, const int height,
     const int width);
   /**
@@ -81,6 +82,7 @@ class Blob {
 
   inline const shared_ptr<SyncedMemory>& data() const {
     CHECK(data_);
+    UnpackHalf();
     return data_;
   }
 
@@ -134,8 +136,36 @@ class Blob {
    * shared_ptr calls its destructor when reset with the "=" operator.
    */
   void ShareDiff(const Blob& other);
+  /**
+   * @brief Make the data_ and diff_ of this Blob views of the count()
+   *        elements of the data_ and diff_ of Blob other starting at
+   *        element offset, so that writing this Blob writes other.
+   *
+   * A later Reshape beyond count() allocates new memory and ends the view.
+   */
+  void ShareSlice(const Blob& other, int offset);
+
+  /**
+   * @brief Keep the data as 16-bit floats in the given precision only,
+   *        freeing the Dtype data unless another Blob shares it.
+   *
+   * Reading the data converts it back to Dtype, keeping both copies, and
+   * writing it, through this Blob or another one sharing it, drops the
+   * 16-bit copy. Saved with ToProto, the data stays in 16 bits.
+   */
+  void StoreHalf(Precision precision);
+  /// @brief The data as kept by StoreHalf, or NULL if it has been written
+  ///        since.
+  const uint16_t* cpu_half_data() const;
 
  protected:
+  /// @brief Convert the 16-bit data back to Dtype if the Dtype data was
+  ///        freed.
+  void UnpackHalf() const;
+  /// @brief Whether the 16-bit data is set and the Dtype data has not been
+  ///        written since.
+  bool HalfIsCurrent() const;
+
   shared_ptr<SyncedMemory> data_;
   shared_ptr<SyncedMemory> diff_;
   int num_;
@@ -144,6 +174,13 @@ class Blob {
   int width_;
   int count_;
   int capacity_;
+  /// The data as 16-bit floats in half_precision_, when set by StoreHalf.
+  shared_ptr<SyncedMemory> half_;
+  Precision half_precision_;
+  /// The Dtype data half_ matches, and its version then. Blobs sharing the
+  /// data write it without resetting half_.
+  const SyncedMemory* half_memory_;
+  mutable unsigned int half_version_;
 
   DISABLE_COPY_AND_ASSIGN(Blob);
 };  // class Blob
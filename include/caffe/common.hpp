@@ -92,6 +92,8 @@ using std::vector;
 // Currently it initializes google flags and google logging.
 void GlobalInit(int* pargc, char*** pargv);
 
+class ThreadPool;
+
 // A singleton class to hold common caffe stuff, such as the handler that
 // caffe is going to use for cublas, curand, etc.
 class Caffe {
@@ -148,6 +150,13 @@ class Caffe {
   static void SetDevice(const int device_id);
   // Prints the current GPU status.
   static void DeviceQuery();
+  // The pool that runs the parallel loops of the CPU code (see
+  // util/thread_pool.hpp).
+  static ThreadPool& thread_pool();
+  // Sets the number of threads of the pool, including the thread calling
+  // it; 0, the default, means one per core. The pool is replaced, so this
+  // must not be called while other threads use it.
+  static void set_cpu_threads(int threads);
 
  protected:
 #ifndef CPU_ONLY
@@ -155,6 +164,10 @@ class Caffe {
   curandGenerator_t curand_generator_;
 #endif
   shared_ptr<RNG> random_generator_;
+  shared_ptr<ThreadPool> thread_pool_;
+  int cpu_threads_;
+  // Creates the pool on the first call of thread_pool().
+  static void CreateThreadPool();
 
   Brew mode_;
   static shared_ptr<Caffe> singleton_;
@@ -1,6 +1,8 @@
 #ifndef CAFFE_COMMON_LAYERS_HPP_
 #define CAFFE_COMMON_LAYERS_HPP_
 
+#include <stdint.h>
+
 #include <string>
 #include <utility>
 #include <vector>
@@ -12,6 +14,9 @@
 #include "caffe/loss_layers.hpp"
 #include "caffe/neuron_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/packed_gemm.hpp"
+#include "caffe/util/quantize.hpp"
+#include "caffe/util/sparse.hpp"
 
 namespace caffe {
 
@@ -183,6 +188,33 @@ class EltwiseLayer : public Layer<Dtype> {
   bool stable_prod_grad_;
 };
 
+/**
+ * @brief Converts a blob between the NCHW and NHWC layouts; inserted by the
+ *        Net around the layers that run in another layout than their
+ *        neighbors (see NetParameter.layout).
+ *
+ * The shape of the blobs is always given as N x C x H x W; only the order of
+ * the elements changes. LayerParameter.layout is the layout of the top.
+ */
+template <typename Dtype>
+class LayoutLayer : public Layer<Dtype> {
+ public:
+  explicit LayoutLayer(const LayerParameter& param)
+      : Layer<Dtype>(param) {}
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  virtual inline const char* type() const { return "Layout"; }
+  virtual inline int ExactNumBottomBlobs() const { return 1; }
+  virtual inline int ExactNumTopBlobs() const { return 1; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+};
+
 /**
  * @brief Reshapes the input Blob into flat vectors.
  *
@@ -265,12 +297,25 @@ class InnerProductLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  // The int8 forward pass, for layers with a quantization_param. The weights
+  // are quantized again after they change.
+  void forward_cpu_s8(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
 
   int M_;
   int K_;
   int N_;
   bool bias_term_;
   Blob<Dtype> bias_multiplier_;
+  // The quantized weights and their scale per output, and the quantized
+  // bottom and int32 top of forward_cpu_s8.
+  QuantizedWeights<Dtype> weights_s8_;
+  vector<int8_t> bottom_s8_;
+  vector<int32_t> top_s32_;
+  // The weights in sparse form, when pruned enough (see sparse_density).
+  SparseWeights<Dtype> sparse_weights_;
+  // The weights packed for gemm_packed_cpu (see prepack_weights).
+  PackedWeights<Dtype> packed_weights_;
 };
 
 /**
@@ -361,6 +406,9 @@ class SoftmaxLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  /// The softmax of the images [begin, end); the tasks of Forward_cpu.
+  void ForwardImages_cpu(const Dtype* bottom_data, Dtype* top_data,
+      Dtype* scale_data, int begin, int end);
 
   /// sum_multiplier is used to carry out sum using BLAS
   Blob<Dtype> sum_multiplier_;
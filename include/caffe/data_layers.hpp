@@ -16,7 +16,11 @@
 #include "caffe/layer.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace boost { class mutex; }
 
 namespace caffe {
 
@@ -97,6 +101,7 @@ class DataLayer : public BasePrefetchingDataLayer<Dtype> {
 
  protected:
   virtual void InternalThreadEntry();
+  cv::Mat DecodeCrop(const string& data, int crop_size, bool force_color);
 
   shared_ptr<db::DB> db_;
   shared_ptr<db::Cursor> cursor_;
@@ -137,13 +142,18 @@ class DummyDataLayer : public Layer<Dtype> {
 /**
  * @brief Provides data to the Net from HDF5 files.
  *
- * TODO(dox): thorough documentation for Forward and proto params.
+ * The files listed in the source are streamed: a prefetch thread reads the
+ * rows of the next batch with hyperslab reads while the current batch is
+ * used, so memory use is bounded by the batch size, not the file size.
+ * With `shuffle`, the file order is permuted at every pass, the batch-sized
+ * blocks of rows of each file are read in random order, and the rows of each
+ * batch are permuted.
  */
 template <typename Dtype>
-class HDF5DataLayer : public Layer<Dtype> {
+class HDF5DataLayer : public Layer<Dtype>, public InternalThread {
  public:
   explicit HDF5DataLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param), file_id_(-1) {}
   virtual ~HDF5DataLayer();
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -164,25 +174,58 @@ class HDF5DataLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {}
-  virtual void LoadHDF5FileData(const char* filename);
+  // Reads the next batch into hdf_blobs_ on the prefetch thread.
+  virtual void InternalThreadEntry();
+  virtual void OpenHDF5File(const char* filename);
+  virtual void CloseHDF5File();
+  virtual void NextHDF5File();
+  virtual void ShuffleRows();
 
   std::vector<std::string> hdf_filenames_;
   unsigned int num_files_;
+  // Index into file_permutation_ of the open file.
   unsigned int current_file_;
+  std::vector<unsigned int> file_permutation_;
+  hid_t file_id_;
+  std::vector<hid_t> dataset_ids_;
+  hsize_t file_rows_;
+  // Rows are read in batch-sized blocks; current_row_ is the row within the
+  // current block.
+  std::vector<hsize_t> block_permutation_;
+  unsigned int current_block_;
   hsize_t current_row_;
+  shared_ptr<Caffe::RNG> prefetch_rng_;
+  // The batch being prefetched.
   std::vector<shared_ptr<Blob<Dtype> > > hdf_blobs_;
 };
 
+/**
+ * @brief Rows buffered by HDF5OutputLayer until its writer thread appends
+ *        them to the output file.
+ */
+template <typename Dtype>
+class HDF5OutputBuffer {
+ public:
+  HDF5OutputBuffer() : rows_(0) {}
+  Blob<Dtype> data_, label_;
+  int rows_;
+};
+
 /**
  * @brief Write blobs to disk as HDF5 files.
  *
- * TODO(dox): thorough documentation for Forward and proto params.
+ * By default every batch is written synchronously as a new dataset. With
+ * `append`, the batches are appended to one chunked, optionally compressed,
+ * dataset per bottom: rows are buffered in memory `buffer_batches` batches
+ * at a time and each full buffer is written by a background thread while
+ * Forward fills the other one.
  */
 template <typename Dtype>
-class HDF5OutputLayer : public Layer<Dtype> {
+class HDF5OutputLayer : public Layer<Dtype>, public InternalThread {
  public:
   explicit HDF5OutputLayer(const LayerParameter& param)
-      : Layer<Dtype>(param), file_opened_(false) {}
+      : Layer<Dtype>(param), file_opened_(false), data_dataset_id_(-1),
+        label_dataset_id_(-1), buffer_(NULL) {}
   virtual ~HDF5OutputLayer();
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -207,12 +250,28 @@ class HDF5OutputLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void SaveBlobs();
+  // Copies the rows of a batch into the append buffers; data and label may
+  // be host or device pointers.
+  virtual void BufferBatch(const vector<Blob<Dtype>*>& bottom,
+      const Dtype* data, const Dtype* label);
+  virtual void SetUpAppend(const vector<Blob<Dtype>*>& bottom);
+  // Flushes buffers handed over by Forward to the file.
+  virtual void InternalThreadEntry();
 
   bool file_opened_;
   std::string file_name_;
   hid_t file_id_;
   Blob<Dtype> data_blob_;
   Blob<Dtype> label_blob_;
+
+  hid_t data_dataset_id_;
+  hid_t label_dataset_id_;
+  vector<shared_ptr<HDF5OutputBuffer<Dtype> > > buffers_;
+  // The buffer being filled by Forward.
+  HDF5OutputBuffer<Dtype>* buffer_;
+  BlockingQueue<HDF5OutputBuffer<Dtype>*> buffer_free_;
+  // Full buffers waiting to be written; NULL stops the writer.
+  BlockingQueue<HDF5OutputBuffer<Dtype>*> buffer_full_;
 };
 
 /**
@@ -309,8 +368,24 @@ class WindowDataLayer : public BasePrefetchingDataLayer<Dtype> {
  protected:
   virtual unsigned int PrefetchRand();
   virtual void InternalThreadEntry();
+  // Crops the windows of the image-th image of batch_images_ into
+  // batch_data_; the tasks run by crop_pool_.
+  static void CropImageTask(void* layer, int image);
+  virtual void CropImageWindows(int image_index, const vector<int>& items,
+      Dtype* top_data);
+  // Warps a window into the item of the batch at `item_data`.
+  virtual void CropWindow(const cv::Mat& cv_img, const vector<float>& window,
+      bool do_mirror, Dtype* item_data);
 
   shared_ptr<Caffe::RNG> prefetch_rng_;
+  // The threads cropping the images of a batch, started once.
+  shared_ptr<ThreadPool> crop_pool_;
+  // The windows sampled for the batch being prefetched and their mirroring,
+  // per item, the items of every image of the batch, and its data.
+  vector<const vector<float>*> batch_windows_;
+  vector<bool> batch_mirror_;
+  vector<std::pair<int, vector<int> > > batch_images_;
+  Dtype* batch_data_;
   vector<std::pair<std::string, vector<int> > > image_database_;
   enum WindowField { IMAGE_INDEX, LABEL, OVERLAP, X1, Y1, X2, Y2, NUM };
   vector<vector<float> > fg_windows_;
@@ -21,12 +21,22 @@ class InternalThread {
   InternalThread() : thread_() {}
   virtual ~InternalThread();
 
-  /** Returns true if the thread was successfully started. **/
+  /**
+   * Returns true if the thread was successfully started. The thread runs on
+   * the NUMA node the calling thread is bound to, if any.
+   */
   bool StartInternalThread();
 
   /** Will not return until the internal thread has exited. */
   bool WaitForInternalThreadToExit();
 
+  /**
+   * Interrupts the thread at its next boost::thread interruption point
+   * (e.g. a wait on a BlockingQueue), then waits for it to exit. Use it for
+   * threads that loop forever instead of returning on their own.
+   */
+  bool StopInternalThread();
+
   bool is_started() const;
 
  protected:
@@ -35,6 +45,9 @@ class InternalThread {
   virtual void InternalThreadEntry() {}
 
   shared_ptr<boost::thread> thread_;
+
+ private:
+  void entry(int numa_node);
 };
 
 }  // namespace caffe
@@ -285,6 +285,28 @@ class Layer {
     param_propagate_down_[param_id] = value;
   }
 
+  /**
+   * @brief Returns whether Backward adds the gradient w.r.t. the bottom blob
+   *        at index bottom_id into its diff rather than overwriting the diff.
+   */
+  inline bool accumulate_bottom_diff(const int bottom_id) const {
+    return (accumulate_bottom_diff_.size() > bottom_id) ?
+        accumulate_bottom_diff_[bottom_id] : false;
+  }
+  /**
+   * @brief Sets whether Backward adds the gradient w.r.t. the bottom blob at
+   *        index bottom_id into its diff, so that several layers can share
+   *        the diff of a blob (see NetParameter.accumulate_diffs). Only
+   *        Backward_cpu of the layers for which LayerAccumulatesDiff holds
+   *        supports it.
+   */
+  inline void set_accumulate_bottom_diff(const int bottom_id,
+      const bool value) {
+    if (accumulate_bottom_diff_.size() <= bottom_id) {
+      accumulate_bottom_diff_.resize(bottom_id + 1, false);
+    }
+    accumulate_bottom_diff_[bottom_id] = value;
+  }
 
  protected:
   /** The protobuf that stores the layer parameters */
@@ -295,6 +317,9 @@ class Layer {
   vector<shared_ptr<Blob<Dtype> > > blobs_;
   /** Vector indicating whether to compute the diff of each param blob. */
   vector<bool> param_propagate_down_;
+  /** Vector indicating whether Backward adds into the diff of each bottom
+   *  blob. */
+  vector<bool> accumulate_bottom_diff_;
 
   /** The vector that indicates whether each top blob has a non-zero weight in
    *  the objective function. */
@@ -446,6 +471,9 @@ inline void Layer<Dtype>::Backward(const vector<Blob<Dtype>*>& top,
     Backward_cpu(top, propagate_down, bottom);
     break;
   case Caffe::GPU:
+    CHECK(std::find(accumulate_bottom_diff_.begin(),
+        accumulate_bottom_diff_.end(), true) == accumulate_bottom_diff_.end())
+        << "Only Backward_cpu can accumulate bottom diffs";
     Backward_gpu(top, propagate_down, bottom);
     break;
   default:
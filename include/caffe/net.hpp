@@ -181,6 +181,9 @@ class Net {
   inline const vector<int>& output_blob_indices() const {
     return net_output_blob_indices_;
   }
+  /// Blobs that only exist in another layout (see NetParameter.layout) are
+  /// also found under their original name, as NCHW copies converted when
+  /// they are looked up.
   bool has_blob(const string& blob_name) const;
   const shared_ptr<Blob<Dtype> > blob_by_name(const string& blob_name) const;
   bool has_layer(const string& layer_name) const;
@@ -224,6 +227,37 @@ class Net {
 
   /// @brief Get misc parameters, e.g. the LR multiplier and weight decay.
   void GetLearningRateAndWeightDecay();
+  /// @brief Set up the NCHW views of the blobs InsertLayouts left only in
+  ///        another layout, by their original name.
+  void SetUpLayoutViews(const map<string, string>& layout_blobs);
+  /// @brief Split the layers into the segments ending at each checkpoint
+  ///        (see NetParameter.checkpoint).
+  void SetUpCheckpoints(const NetParameter& param);
+  /// @brief Free the activations of a segment after its forward.
+  void ReleaseSegment(int segment);
+  /// @brief Recompute the activations of a released segment.
+  void RecomputeSegment(int segment);
+  /// @brief Make the layers sharing a blob add their gradients into its diff
+  ///        (see NetParameter.accumulate_diffs).
+  void SetUpDiffAccumulation();
+  /// @brief Make the bottoms of the Concat layers slices of their tops
+  ///        where possible (see NetParameter.zero_copy_concat), and return
+  ///        how many are.
+  int PlanConcats();
+  /// @brief After a Concat reshaped, stop treating the bottoms whose slice
+  ///        moved as slices of its top, and plan again on the next forward.
+  void DropStaleConcatSlices(int layer_id);
+  /// @brief Reshape a layer unless the shapes and memory of its bottoms and
+  ///        tops are the same as after its last Reshape.
+  void ReshapeLayer(int layer_id);
+  /// @brief Remember the shapes and memory of the bottoms and tops of a layer.
+  void RecordLayerShapes(int layer_id);
+  /// @brief Choose the blobs padded up to the bucket sizes
+  ///        (see NetParameter.bucket_blob).
+  void SetUpBuckets(const NetParameter& param);
+  /// @brief Pad the height and width of a blob up to the bucket sizes
+  ///        (see NetParameter.bucket_size).
+  void PadToBucket(Blob<Dtype>* blob);
 
   /// @brief The network name
   string name_;
@@ -238,6 +272,17 @@ class Net {
   vector<shared_ptr<Blob<Dtype> > > blobs_;
   vector<string> blob_names_;
   map<string, int> blob_names_index_;
+  /// The NCHW copy of a blob kept in another layout, converted from
+  /// `source` by `layer` when the source has changed since (see
+  /// blob_by_name).
+  struct LayoutView {
+    shared_ptr<Layer<Dtype> > layer;
+    shared_ptr<Blob<Dtype> > source;
+    shared_ptr<Blob<Dtype> > blob;
+    const SyncedMemory* memory;
+    unsigned int version;
+  };
+  map<string, shared_ptr<LayoutView> > layout_views_;
   vector<bool> blob_need_backward_;
   /// bottom_vecs stores the vectors containing the input for each layer.
   /// They don't actually host the blobs (blobs_ does), so we simply store
@@ -271,6 +316,34 @@ class Net {
   size_t memory_used_;
   /// Whether to compute and display debug info for the net.
   bool debug_info_;
+  /// Whether to plan the Concat layers after every Reshape.
+  bool zero_copy_concat_;
+  /// The offset in the top of each Concat of its bottoms planned as slices
+  /// of it, or -1, the memory of those slices and of the top when planned,
+  /// and whether a reshape moved any since.
+  vector<vector<int> > concat_offsets_;
+  vector<vector<SyncedMemory*> > concat_slices_;
+  vector<SyncedMemory*> concat_tops_;
+  bool replan_concats_;
+  /// The first and the checkpoint layer of each segment whose activations
+  /// are recomputed, and the segment of each layer, or -1.
+  vector<int> segment_begin_;
+  vector<int> segment_end_;
+  vector<int> layer_segment_;
+  /// The blobs freed after the forward of each segment.
+  vector<vector<int> > segment_blob_ids_;
+  vector<bool> segment_released_;
+  /// The random number generator at the start of each segment's forward.
+  vector<shared_ptr<Caffe::RNG> > segment_rng_;
+  /// The shapes (four per blob) and the data of the bottoms and tops of
+  /// each layer after its last Reshape.
+  vector<vector<int> > layer_shapes_;
+  vector<vector<SyncedMemory*> > layer_memory_;
+  /// The sorted bucket sizes, and the unpadded copy of the blob being padded.
+  vector<int> bucket_sizes_;
+  Blob<Dtype> bucket_buffer_;
+  /// Whether each blob is padded up to the bucket sizes.
+  vector<bool> bucket_blobs_;
 
   DISABLE_COPY_AND_ASSIGN(Net);
 };
@@ -4,6 +4,7 @@
 #include <cstdlib>
 
 #include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
@@ -21,14 +22,16 @@ namespace caffe {
 // are constantly accessing them the memory pages almost always stays in
 // the physical memory (assuming we have large enough memory installed), and
 // does not seem to create a memory bottleneck here.
+//
+// The memory comes from the HostAllocator, which aligns it and pools large
+// buffers.
 
 inline void CaffeMallocHost(void** ptr, size_t size) {
-  *ptr = malloc(size);
-  CHECK(*ptr) << "host allocation of size " << size << " failed";
+  *ptr = HostAllocator::Get().Allocate(size);
 }
 
 inline void CaffeFreeHost(void* ptr) {
-  free(ptr);
+  HostAllocator::Get().Free(ptr);
 }
 
 
@@ -42,19 +45,29 @@ class SyncedMemory {
  public:
   SyncedMemory()
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(0), head_(UNINITIALIZED),
-        own_cpu_data_(false) {}
+        own_cpu_data_(false), offset_(0), version_(0) {}
   explicit SyncedMemory(size_t size)
       : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(size), head_(UNINITIALIZED),
-        own_cpu_data_(false) {}
+        own_cpu_data_(false), offset_(0), version_(0) {}
+  // A view of the `size` bytes of base starting at `offset`: it allocates
+  // nothing and shares the head of base.
+  SyncedMemory(const shared_ptr<SyncedMemory>& base, size_t offset,
+      size_t size);
   ~SyncedMemory();
   const void* cpu_data();
   void set_cpu_data(void* data);
   const void* gpu_data();
   void* mutable_cpu_data();
   void* mutable_gpu_data();
+  // Frees the memory, whose contents are then lost; it is allocated again
+  // when next used. Views do not free their base.
+  void release();
   enum SyncedHead { UNINITIALIZED, HEAD_AT_CPU, HEAD_AT_GPU, SYNCED };
-  SyncedHead head() { return head_; }
+  SyncedHead head() { return base_ ? base_->head() : head_; }
   size_t size() { return size_; }
+  // Counts the accesses that may have changed the contents, so that data
+  // derived from them can tell when it is out of date.
+  unsigned int version() { return base_ ? base_->version() : version_; }
 
  private:
   void to_cpu();
@@ -64,6 +77,10 @@ class SyncedMemory {
   size_t size_;
   SyncedHead head_;
   bool own_cpu_data_;
+  // The memory this is a view of, if any.
+  shared_ptr<SyncedMemory> base_;
+  size_t offset_;
+  unsigned int version_;
 
   DISABLE_COPY_AND_ASSIGN(SyncedMemory);
 };  // class SyncedMemory
@@ -0,0 +1,47 @@
+#ifndef CAFFE_UTIL_BLOCKING_QUEUE_HPP_
+#define CAFFE_UTIL_BLOCKING_QUEUE_HPP_
+
+#include <queue>
+#include <string>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A FIFO queue shared between producer and consumer threads.
+ *
+ * pop() blocks while the queue is empty, and push() blocks while it holds
+ * `capacity` elements (0 means unbounded), which keeps prefetching threads
+ * from running arbitrarily far ahead. Both waits are boost::thread
+ * interruption points, so InternalThread::StopInternalThread can stop a
+ * thread blocked on the queue.
+ *
+ * The synchronization primitives are kept out of the header to avoid
+ * including boost/thread.hpp in code compiled by NVCC (see internal_thread).
+ */
+template <typename T>
+class BlockingQueue {
+ public:
+  explicit BlockingQueue(size_t capacity = 0);
+
+  void push(const T& t);
+  bool try_pop(T* t);
+  // Logs `log_on_wait` if the caller has to wait, which is useful to detect
+  // when e.g. data feeding is too slow.
+  T pop(const string& log_on_wait = "");
+  size_t size() const;
+
+ protected:
+  class sync;
+
+  size_t capacity_;
+  std::queue<T> queue_;
+  shared_ptr<sync> sync_;
+
+  DISABLE_COPY_AND_ASSIGN(BlockingQueue);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_BLOCKING_QUEUE_HPP_
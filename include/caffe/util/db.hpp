@@ -1,6 +1,8 @@
 #ifndef CAFFE_UTIL_DB_HPP
 #define CAFFE_UTIL_DB_HPP
 
+#include <stdint.h>
+
 #include <string>
 
 #include "leveldb/db.h"
@@ -22,7 +24,24 @@ class Cursor {
   virtual void Next() = 0;
   virtual string key() = 0;
   virtual string value() = 0;
+  // Parses the value into `proto`, straight from the backend's buffer where
+  // possible instead of from the copy returned by value().
+  virtual bool ParseValue(google::protobuf::MessageLite* proto) {
+    return proto->ParseFromString(value());
+  }
   virtual bool valid() = 0;
+  // Positions the cursor at `key` for random access. Returns false if there
+  // is no such key, in which case the cursor position is unspecified.
+  virtual bool SeekToKey(const string& key) {
+    LOG(FATAL) << "This cursor does not support random access";
+    return false;
+  }
+  // Hints that the record at `key` will be read soon, so that it can be
+  // paged in ahead of SeekToKey.
+  virtual void WillNeed(const string& key) { }
+  // Returns the number of records, or -1 if the backend cannot tell without
+  // a full pass over them.
+  virtual int64_t count() { return -1; }
 
   DISABLE_COPY_AND_ASSIGN(Cursor);
 };
@@ -45,6 +64,11 @@ class DB {
   virtual void Close() = 0;
   virtual Cursor* NewCursor() = 0;
   virtual Transaction* NewTransaction() = 0;
+  // Hints for writers that fill a NEW database in ascending key order, such
+  // as convert_imageset. Must be set before Open; backends may ignore them.
+  // no_sync skips the fsync on every commit (the data is synced on Close),
+  // and write_map writes through the memory map instead of a private buffer.
+  virtual void SetBulkLoad(bool sorted_keys, bool no_sync, bool write_map) { }
 
   DISABLE_COPY_AND_ASSIGN(DB);
 };
@@ -58,7 +82,15 @@ class LevelDBCursor : public Cursor {
   virtual void Next() { iter_->Next(); }
   virtual string key() { return iter_->key().ToString(); }
   virtual string value() { return iter_->value().ToString(); }
+  virtual bool ParseValue(google::protobuf::MessageLite* proto) {
+    const leveldb::Slice value = iter_->value();
+    return proto->ParseFromArray(value.data(), value.size());
+  }
   virtual bool valid() { return iter_->Valid(); }
+  virtual bool SeekToKey(const string& key) {
+    iter_->Seek(key);
+    return iter_->Valid() && iter_->key().ToString() == key;
+  }
 
  private:
   leveldb::Iterator* iter_;
@@ -128,7 +160,18 @@ class LMDBCursor : public Cursor {
     return string(static_cast<const char*>(mdb_value_.mv_data),
         mdb_value_.mv_size);
   }
+  virtual bool ParseValue(google::protobuf::MessageLite* proto) {
+    return proto->ParseFromArray(mdb_value_.mv_data, mdb_value_.mv_size);
+  }
   virtual bool valid() { return valid_; }
+  virtual bool SeekToKey(const string& key) {
+    mdb_key_.mv_data = const_cast<char*>(key.data());
+    mdb_key_.mv_size = key.size();
+    Seek(MDB_SET_KEY);
+    return valid_;
+  }
+  virtual void WillNeed(const string& key);
+  virtual int64_t count();
 
  private:
   void Seek(MDB_cursor_op op) {
@@ -149,25 +192,36 @@ class LMDBCursor : public Cursor {
 
 class LMDBTransaction : public Transaction {
  public:
-  explicit LMDBTransaction(MDB_dbi* mdb_dbi, MDB_txn* mdb_txn)
-    : mdb_dbi_(mdb_dbi), mdb_txn_(mdb_txn) { }
+  explicit LMDBTransaction(MDB_dbi* mdb_dbi, MDB_txn* mdb_txn,
+      unsigned int put_flags = 0)
+    : mdb_dbi_(mdb_dbi), mdb_txn_(mdb_txn), put_flags_(put_flags) { }
   virtual void Put(const string& key, const string& value);
   virtual void Commit() { MDB_CHECK(mdb_txn_commit(mdb_txn_)); }
 
  private:
   MDB_dbi* mdb_dbi_;
   MDB_txn* mdb_txn_;
+  // MDB_APPEND when keys are known to arrive in ascending order: LMDB then
+  // fills leaf pages to the end instead of splitting them.
+  unsigned int put_flags_;
 
   DISABLE_COPY_AND_ASSIGN(LMDBTransaction);
 };
 
 class LMDB : public DB {
  public:
-  LMDB() : mdb_env_(NULL) { }
+  LMDB() : mdb_env_(NULL), env_flags_(0), put_flags_(0) { }
   virtual ~LMDB() { Close(); }
   virtual void Open(const string& source, Mode mode);
   virtual void Close() {
     if (mdb_env_ != NULL) {
+      // Only the envs opened for writing with SetBulkLoad's no_sync have
+      // MDB_NOSYNC; syncing a read-only env fails.
+      unsigned int flags;
+      MDB_CHECK(mdb_env_get_flags(mdb_env_, &flags));
+      if ((flags & MDB_NOSYNC) && !(flags & MDB_RDONLY)) {
+        MDB_CHECK(mdb_env_sync(mdb_env_, 1));
+      }
       mdb_dbi_close(mdb_env_, mdb_dbi_);
       mdb_env_close(mdb_env_);
       mdb_env_ = NULL;
@@ -175,14 +229,20 @@ class LMDB : public DB {
   }
   virtual LMDBCursor* NewCursor();
   virtual LMDBTransaction* NewTransaction();
+  virtual void SetBulkLoad(bool sorted_keys, bool no_sync, bool write_map);
 
  private:
   MDB_env* mdb_env_;
   MDB_dbi mdb_dbi_;
+  unsigned int env_flags_;
+  unsigned int put_flags_;
 };
 
 DB* GetDB(DataParameter::DB backend);
 DB* GetDB(const string& backend);
+// Returns a ShardedDB set up for reading if the source of `param` is a
+// sharded db (see ShardedDB), and a db of param.backend() otherwise.
+DB* GetDB(const DataParameter& param);
 
 }  // namespace db
 }  // namespace caffe
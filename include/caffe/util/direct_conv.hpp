@@ -0,0 +1,19 @@
+#ifndef _CAFFE_UTIL_DIRECT_CONV_HPP_
+#define _CAFFE_UTIL_DIRECT_CONV_HPP_
+
+namespace caffe {
+
+// Convolves one image with `weights` (num_output x channels / group x
+// kernel_h x kernel_w) without unrolling it into columns, writing
+// num_output x height_out x width_out to `data_out`. Meant for the
+// convolutions that make degenerate GEMMs, with few input channels per group.
+template <typename Dtype>
+void conv_direct_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int num_output, const int group,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const Dtype* weights,
+    Dtype* data_out);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_DIRECT_CONV_HPP_
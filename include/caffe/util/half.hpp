@@ -0,0 +1,93 @@
+#ifndef _CAFFE_UTIL_HALF_HPP_
+#define _CAFFE_UTIL_HALF_HPP_
+
+#include <stdint.h>
+
+#include <cstring>
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Conversions between float and the 16-bit formats of Precision, rounding to
+// nearest even. FLOAT16 overflows to infinity beyond 65504 and keeps
+// subnormals.
+inline float HalfToFloat(const uint16_t h, const Precision precision) {
+  uint32_t bits;
+  if (precision == BFLOAT16) {
+    bits = static_cast<uint32_t>(h) << 16;
+  } else {
+    const uint32_t kExponent = 0x7c00 << 13;
+    bits = (h & 0x7fff) << 13;
+    const uint32_t exponent = bits & kExponent;
+    bits += (127 - 15) << 23;
+    if (exponent == kExponent) {
+      // Infinity or NaN.
+      bits += (128 - 16) << 23;
+    } else if (exponent == 0) {
+      // Zero or subnormal: renormalize through a float subtraction.
+      const uint32_t kMagic = 113 << 23;
+      bits += 1 << 23;
+      float f, magic;
+      memcpy(&f, &bits, sizeof(f));
+      memcpy(&magic, &kMagic, sizeof(magic));
+      f -= magic;
+      memcpy(&bits, &f, sizeof(f));
+    }
+    bits |= static_cast<uint32_t>(h & 0x8000) << 16;
+  }
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+inline uint16_t FloatToHalf(const float f, const Precision precision) {
+  uint32_t bits;
+  memcpy(&bits, &f, sizeof(bits));
+  if (precision == BFLOAT16) {
+    if ((bits & 0x7fffffff) > 0x7f800000) {
+      return static_cast<uint16_t>((bits >> 16) | 0x40);  // Quiet NaN.
+    }
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return static_cast<uint16_t>(bits >> 16);
+  }
+  const uint32_t sign = bits & 0x80000000u;
+  bits ^= sign;
+  uint32_t h;
+  if (bits >= (127 + 16) << 23) {
+    // Overflow to infinity, or NaN.
+    h = bits > 0x7f800000 ? 0x7e00 : 0x7c00;
+  } else if (bits < (113 << 23)) {
+    // Subnormal or zero: let a float addition round the mantissa.
+    const uint32_t kMagic = ((127 - 15) + (23 - 10) + 1) << 23;
+    float v, magic;
+    memcpy(&v, &bits, sizeof(v));
+    memcpy(&magic, &kMagic, sizeof(magic));
+    v += magic;
+    memcpy(&bits, &v, sizeof(bits));
+    h = bits - kMagic;
+  } else {
+    const uint32_t odd = (bits >> 13) & 1;
+    // Rebias the exponent and round to nearest even.
+    bits += 0xc8000fffu + odd;
+    h = bits >> 13;
+  }
+  return static_cast<uint16_t>(h | (sign >> 16));
+}
+
+// Converts n 16-bit floats to Dtype.
+template <typename Dtype>
+void half_to_cpu(const int n, const uint16_t* x, const Precision precision,
+    Dtype* y);
+
+// C = A * B^T for A (M x K) and B (N x K) stored in the 16-bit precision.
+// Tiles of a few MB of rows of B are converted to Dtype in parallel as they
+// are needed, then multiplied by one BLAS call from the calling thread, so B
+// is read once, at half the bytes.
+template <typename Dtype>
+void gemm_half_cpu(const int M, const int N, const int K, const Dtype* A,
+    const uint16_t* B, const Precision precision, Dtype* C);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HALF_HPP_
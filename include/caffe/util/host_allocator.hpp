@@ -0,0 +1,84 @@
+#ifndef CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+#define CAFFE_UTIL_HOST_ALLOCATOR_HPP_
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace boost { class mutex; }
+
+namespace caffe {
+
+/**
+ * @brief The allocator behind CaffeMallocHost and CaffeFreeHost.
+ *
+ * All buffers are 64-byte aligned. Large buffers are rounded up to a size
+ * class and, when freed, kept in a pool from which later allocations of the
+ * same class are served, so that reshaping back and forth between sizes does
+ * not go back to the system each time. Large buffers can also be backed by
+ * huge pages. Pooled buffers are only reused on the NUMA node they were
+ * allocated for (see numa.hpp). The MALLOC mode gives every buffer back to
+ * the system on free, for debugging with memory checkers.
+ */
+class HostAllocator {
+ public:
+  enum Mode { POOL, MALLOC };
+
+  // The allocator shared by all SyncedMemory. It is never destroyed, so that
+  // static blobs can be freed at exit.
+  static HostAllocator& Get();
+  HostAllocator();
+  ~HostAllocator();
+
+  void* Allocate(size_t size);
+  void Free(void* ptr);
+  // Returns the pooled buffers to the system.
+  void Trim();
+
+  // The mode and huge_pages only change how later buffers are allocated.
+  void set_mode(Mode mode);
+  Mode mode() const;
+  void set_huge_pages(bool huge_pages);
+  // The most bytes kept in the pool; buffers beyond it are freed.
+  void set_pool_limit(size_t bytes);
+  // The size of the buffer actually allocated for `size` bytes.
+  static size_t SizeClass(size_t size);
+
+  // Metrics.
+  size_t allocations() const;
+  size_t pool_hits() const;
+  size_t bytes_in_use() const;
+  size_t peak_bytes_in_use() const;
+  size_t pooled_bytes() const;
+  // Pool hit rate and memory use, for logging.
+  string DebugString() const;
+
+ private:
+  struct Header;
+  // Called without mutex_ held.
+  static char* AllocateBlock(size_t capacity, int node, bool huge_pages);
+  static void FreeBlock(char* block);
+
+  shared_ptr<boost::mutex> mutex_;
+  Mode mode_;
+  bool huge_pages_;
+  size_t pool_limit_;
+  // Free buffers by NUMA node and size class.
+  typedef std::map<std::pair<int, size_t>, std::vector<char*> > Pool;
+  Pool pool_;
+
+  size_t allocations_;
+  size_t pool_hits_;
+  size_t bytes_in_use_;
+  size_t peak_bytes_in_use_;
+  size_t pooled_bytes_;
+
+  DISABLE_COPY_AND_ASSIGN(HostAllocator);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_HOST_ALLOCATOR_HPP_
@@ -0,0 +1,92 @@
+#ifndef CAFFE_UTIL_IMAGE_CACHE_HPP_
+#define CAFFE_UTIL_IMAGE_CACHE_HPP_
+
+#include <opencv2/core/core.hpp>
+
+#include <list>
+#include <map>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/proto/caffe.pb.h"
+
+namespace boost { class mutex; }
+
+namespace caffe {
+
+/**
+ * @brief A process-wide, size-bounded LRU cache of decoded images, shared by
+ *        the image reading layers and their prefetch threads.
+ *
+ * Images are keyed by path and by how they were decoded (see ImageKey).
+ * Images evicted from memory can be kept in a memory-mapped spill file, from
+ * which they are copied back instead of decoded again. The returned images
+ * share memory with the cache and must not be modified in place.
+ */
+class ImageCache {
+ public:
+  // The cache shared by the layers.
+  static ImageCache& Get();
+  ImageCache();
+  ~ImageCache();
+
+  // Grows the cache to the sizes requested by `param`. The first spill file
+  // requested is used.
+  void Reserve(const ImageCacheParameter& param);
+  bool enabled() const { return capacity_ > 0; }
+
+  static string ImageKey(const string& filename, int height, int width,
+      bool is_color, bool scaled_decode = false);
+  // Returns the image stored under `key`, or an empty image on a miss.
+  cv::Mat Lookup(const string& key);
+  void Insert(const string& key, const cv::Mat& image);
+  // ReadImageToCVMat through the cache.
+  cv::Mat ReadImage(const string& filename, int height, int width,
+      bool is_color, bool scaled_decode = false);
+
+  // Metrics.
+  size_t hits() const;
+  size_t spill_hits() const;
+  size_t misses() const;
+  size_t memory_bytes() const;
+  size_t spill_bytes() const;
+  // Hit rate and memory use, for logging.
+  string DebugString() const;
+
+ private:
+  struct Entry {
+    cv::Mat image;
+    std::list<string>::iterator lru;
+  };
+  struct SpillEntry {
+    size_t offset;
+    int rows, cols, type;
+  };
+  // Both require mutex_ to be held.
+  void Evict();
+  void Spill(const string& key, const cv::Mat& image);
+
+  shared_ptr<boost::mutex> mutex_;
+  size_t capacity_;
+  size_t memory_bytes_;
+  // Most recently used first.
+  std::list<string> lru_;
+  std::map<string, Entry> entries_;
+
+  string spill_file_;
+  int spill_fd_;
+  char* spill_data_;
+  size_t spill_capacity_;
+  size_t spill_used_;
+  std::map<string, SpillEntry> spilled_;
+
+  size_t hits_;
+  size_t spill_hits_;
+  size_t misses_;
+
+  DISABLE_COPY_AND_ASSIGN(ImageCache);
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_IMAGE_CACHE_HPP_
@@ -0,0 +1,27 @@
+#ifndef _CAFFE_UTIL_INSERT_LAYOUTS_HPP_
+#define _CAFFE_UTIL_INSERT_LAYOUTS_HPP_
+
+#include <map>
+#include <string>
+
+#include "caffe/proto/caffe.pb.h"
+
+namespace caffe {
+
+// Copy NetParameters with the layers that support param.layout() running in
+// it, and LayoutLayers added to convert their bottoms from and their tops to
+// NCHW where the other layers, or the net outputs, need them. Blobs stored in
+// the layout are renamed <name>_<layout>. If `layout_blobs` is given, it maps
+// the names of `param` left without an NCHW blob to their blob in the layout.
+void InsertLayouts(const NetParameter& param, NetParameter* param_layout,
+    std::map<string, string>* layout_blobs = NULL);
+
+// Whether the layer computes in `layout` when asked to by the net.
+bool LayerSupportsLayout(const LayerParameter& layer_param, Layout layout);
+
+// Whether the layer is elementwise, so that it runs in any layout.
+bool LayerIsLayoutAgnostic(const LayerParameter& layer_param);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_INSERT_LAYOUTS_HPP_
@@ -8,9 +8,16 @@
 namespace caffe {
 
 // Copy NetParameters with SplitLayers added to replace any shared bottom
-// blobs with unique bottom blobs provided by the SplitLayer.
+// blobs with unique bottom blobs provided by the SplitLayer. With
+// param.accumulate_diffs(), blobs whose consumers are all distinct layers
+// for which LayerAccumulatesDiff holds, none of them in place, and that are
+// not losses, are shared without a SplitLayer.
 void InsertSplits(const NetParameter& param, NetParameter* param_split);
 
+// Whether the layer can add its gradient into the diff of its bottoms
+// instead of overwriting it (see Layer::set_accumulate_bottom_diff).
+bool LayerAccumulatesDiff(const LayerParameter& layer_param);
+
 void ConfigureSplitLayer(const string& layer_name, const string& blob_name,
     const int blob_idx, const int split_count, const float loss_weight,
     LayerParameter* split_layer_param);
@@ -3,6 +3,7 @@
 
 #include <unistd.h>
 #include <string>
+#include <vector>
 
 #include "google/protobuf/message.h"
 #include "hdf5.h"
@@ -85,15 +86,20 @@ inline void WriteProtoToBinaryFile(
   WriteProtoToBinaryFile(proto, filename.c_str());
 }
 
+// Reads the whole file into `data`.
+bool ReadFileToString(const string& filename, string* data);
+
 bool ReadFileToDatum(const string& filename, const int label, Datum* datum);
 
 inline bool ReadFileToDatum(const string& filename, Datum* datum) {
   return ReadFileToDatum(filename, -1, datum);
 }
 
+// With scaled_decode, see ReadImageToCVMat.
 bool ReadImageToDatum(const string& filename, const int label,
     const int height, const int width, const bool is_color,
-    const std::string & encoding, Datum* datum);
+    const std::string & encoding, Datum* datum,
+    const bool scaled_decode = false);
 
 inline bool ReadImageToDatum(const string& filename, const int label,
     const int height, const int width, const bool is_color, Datum* datum) {
@@ -124,8 +130,13 @@ inline bool ReadImageToDatum(const string& filename, const int label,
 bool DecodeDatumNative(Datum* datum);
 bool DecodeDatum(Datum* datum, bool is_color);
 
+// With scaled_decode, JPEGs that are resized are decoded by libjpeg at the
+// smallest of 1/8, 1/4, 1/2 or full size that is still larger than the
+// target before resizing, which skips most of the decoding work for large
+// images. The result differs slightly from resizing the full image.
 cv::Mat ReadImageToCVMat(const string& filename,
-    const int height, const int width, const bool is_color);
+    const int height, const int width, const bool is_color,
+    const bool scaled_decode = false);
 
 cv::Mat ReadImageToCVMat(const string& filename,
     const int height, const int width);
@@ -135,11 +146,47 @@ cv::Mat ReadImageToCVMat(const string& filename,
 
 cv::Mat ReadImageToCVMat(const string& filename);
 
+// Direct libjpeg decoding, available when built with USE_LIBJPEG. The
+// functions return false or an empty image for data they cannot decode, in
+// which case the callers fall back to OpenCV.
+bool ReadJPEGHeader(const string& data, int* height, int* width,
+    int* channels);
+// Decodes at the smallest scale of 1/8, 1/4, 1/2 or 1 that keeps the image
+// at least min_height x min_width, using libjpeg's scaled IDCT.
+cv::Mat DecodeJPEGToCVMat(const string& data, bool is_color,
+    int min_height, int min_width);
+// Decodes only the given crop of the full size image.
+cv::Mat DecodeJPEGCropToCVMat(const string& data, bool is_color,
+    int h_off, int w_off, int height, int width);
+
 cv::Mat DecodeDatumToCVMatNative(const Datum& datum);
 cv::Mat DecodeDatumToCVMat(const Datum& datum, bool is_color);
 
 void CVMatToDatum(const cv::Mat& cv_img, Datum* datum);
 
+// The HDF5 library is usually built without thread safety. Hold an HDF5Lock
+// around HDF5 calls made by code that may run next to other HDF5 users, such
+// as prefetch or writer threads. The lock is recursive.
+class HDF5Lock {
+ public:
+  HDF5Lock();
+  ~HDF5Lock();
+
+  DISABLE_COPY_AND_ASSIGN(HDF5Lock);
+};
+
+// Gets the dims of a dataset, verifying that it holds floating point data
+// with a number of dims within [min_dim, max_dim].
+void hdf5_get_nd_dataset_dims(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
+    std::vector<hsize_t>* dims);
+
+// Reads rows [row, row + num_rows) along the first dimension of an open
+// dataset into `data` with a single hyperslab read.
+template <typename Dtype>
+void hdf5_load_nd_dataset_rows(
+    hid_t dataset_id, hsize_t row, hsize_t num_rows, Dtype* data);
+
 template <typename Dtype>
 void hdf5_load_nd_dataset_helper(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
@@ -154,6 +201,21 @@ template <typename Dtype>
 void hdf5_save_nd_dataset(
     const hid_t file_id, const string& dataset_name, const Blob<Dtype>& blob);
 
+// Creates an empty dataset of rows of shape `row_dims` that
+// hdf5_append_nd_dataset_rows can grow along the first dimension. It is
+// stored in chunks of `chunk_rows` rows, gzip compressed at level
+// `compression` if it is nonzero. Close the returned id with H5Dclose.
+template <typename Dtype>
+hid_t hdf5_create_extendible_dataset(
+    hid_t file_id, const string& dataset_name,
+    const std::vector<hsize_t>& row_dims, hsize_t chunk_rows,
+    int compression);
+
+// Appends `num_rows` rows to an extendible dataset with a single write.
+template <typename Dtype>
+void hdf5_append_nd_dataset_rows(
+    hid_t dataset_id, hsize_t num_rows, const Dtype* data);
+
 }  // namespace caffe
 
 #endif   // CAFFE_UTIL_IO_H_
@@ -0,0 +1,16 @@
+#ifndef _CAFFE_UTIL_LOW_RANK_HPP_
+#define _CAFFE_UTIL_LOW_RANK_HPP_
+
+namespace caffe {
+
+// Factorizes the M x N matrix W into U (M x rank) times V (rank x N) by
+// randomized subspace iteration, which converges to the truncated SVD: the
+// columns of U are orthonormal and in decreasing order of the singular value
+// of W they approximate, whose squares are written to energies (rank).
+template <typename Dtype>
+void low_rank_cpu(const int M, const int N, const Dtype* W, const int rank,
+    Dtype* U, Dtype* V, Dtype* energies);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_LOW_RANK_HPP_
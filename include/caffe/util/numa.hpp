@@ -0,0 +1,25 @@
+#ifndef CAFFE_UTIL_NUMA_HPP_
+#define CAFFE_UTIL_NUMA_HPP_
+
+#include <vector>
+
+namespace caffe {
+
+// NUMA placement. Memory is placed by first touch: a buffer lands on the
+// node of the thread that first writes it, which for blobs is the thread
+// that first reads or writes their data. Binding the thread that builds and
+// runs a Net therefore places the net's blobs on the node too, and the
+// threads it starts (prefetching, readers) inherit the binding.
+
+// The number of NUMA nodes, 1 when the system has none or does not say.
+int NumaNodeCount();
+// The cpus of `node`.
+std::vector<int> NumaNodeCpus(int node);
+// Pins the calling thread to the cpus of `node`.
+void BindThreadToNumaNode(int node);
+// The node the calling thread was bound to, -1 if it was not.
+int CurrentNumaNode();
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_NUMA_HPP_
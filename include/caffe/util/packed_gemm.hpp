@@ -0,0 +1,44 @@
+#ifndef _CAFFE_UTIL_PACKED_GEMM_HPP_
+#define _CAFFE_UTIL_PACKED_GEMM_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/syncedmem.hpp"
+
+namespace caffe {
+
+// The weights of a layer, `groups` matrices of rows / groups x cols, packed
+// for gemm_packed_cpu: each matrix is cut into blocks of columns that stay in
+// cache, and each block into panels of a few rows stored column by column
+// (zero padded), in the order the micro-kernel reads them. It is only packed
+// again after the weight blob's data has been written.
+template <typename Dtype>
+struct PackedWeights {
+  PackedWeights() : packed(false), rows(0), cols(0), groups(0), memory(NULL),
+      version(0) {}
+  bool packed;
+  int rows, cols, groups;
+  std::vector<Dtype> data;
+  // The data the weights were packed from, and its version then.
+  const SyncedMemory* memory;
+  unsigned int version;
+};
+
+// Packs the weights (rows x cols, rows split into groups) into *packed if
+// they have changed since the last call.
+template <typename Dtype>
+void update_packed_weights(const Blob<Dtype>& weights, const int rows,
+    const int groups, PackedWeights<Dtype>* packed);
+
+// C = A * B for the group-th matrix A of the packed weights (rows / groups x
+// cols) and B (cols x N), as convolution weights multiply their column
+// buffer. If trans, computes C^T = B^T * A^T instead for B^T (N x cols) and
+// C^T (N x rows), as InnerProduct weights multiply their bottom.
+template <typename Dtype>
+void gemm_packed_cpu(const PackedWeights<Dtype>& A, const int group,
+    const bool trans, const int N, const Dtype* B, Dtype* C);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PACKED_GEMM_HPP_
@@ -0,0 +1,59 @@
+#ifndef _CAFFE_UTIL_QUANTIZE_HPP_
+#define _CAFFE_UTIL_QUANTIZE_HPP_
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/syncedmem.hpp"
+
+namespace caffe {
+
+// Symmetric int8 quantization: y = x * scale rounded to the nearest integer
+// and clamped to [-127, 127].
+template <typename Dtype>
+void quantize_s8_cpu(const int n, const Dtype scale, const Dtype* x,
+    int8_t* y);
+
+// Quantizes each of the `rows` rows of `cols` values of x with its own scale,
+// 127 over its largest absolute value, which is written to scales.
+template <typename Dtype>
+void quantize_rows_s8_cpu(const int rows, const int cols, const Dtype* x,
+    int8_t* y, Dtype* scales);
+
+// The int8 weights of a layer and the scale of each of their rows (outputs),
+// quantized again after the weight blob's data has been written.
+template <typename Dtype>
+struct QuantizedWeights {
+  QuantizedWeights() : memory(NULL), version(0) {}
+  std::vector<int8_t> data;
+  std::vector<Dtype> scales;
+  // The data the weights were quantized from, and its version then.
+  const SyncedMemory* memory;
+  unsigned int version;
+};
+
+// Quantizes the rows of the weights into *quantized with
+// quantize_rows_s8_cpu if they have changed since the last call.
+template <typename Dtype>
+void update_quantized_weights(const Blob<Dtype>& weights, const int rows,
+    QuantizedWeights<Dtype>* quantized);
+
+// C = A * B for int8 A (M x K) and B (K x N, or N x K if trans_b), with the
+// products summed in int32 C (M x N).
+void gemm_s8_cpu(const bool trans_b, const int M, const int N, const int K,
+    const int8_t* A, const int8_t* B, int32_t* C);
+
+// Turns the int32 sums of gemm_s8_cpu back into y = x / (x_scale *
+// scales[o]) + bias[o] for the output o of each element, rectified if relu.
+// The outputs are the rows of x (M x N) if outputs_in_rows, else its columns.
+// bias may be NULL.
+template <typename Dtype>
+void dequantize_s8_cpu(const bool outputs_in_rows, const int M, const int N,
+    const int32_t* x, const Dtype x_scale, const Dtype* scales,
+    const Dtype* bias, const bool relu, Dtype* y);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_QUANTIZE_HPP_
@@ -0,0 +1,89 @@
+#ifndef CAFFE_UTIL_SAMPLING_CURSOR_HPP_
+#define CAFFE_UTIL_SAMPLING_CURSOR_HPP_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/db.hpp"
+
+namespace caffe { namespace db {
+
+/**
+ * @brief Shuffles the records of a cursor through a buffer of fixed size.
+ *
+ * The buffer is filled in cursor order; every step returns a random record
+ * of the buffer and replaces it by the next record of the underlying cursor,
+ * which wraps around at its end. The cursor is therefore always valid.
+ * A record stays in the buffer a random number of steps, buffer_size on
+ * average, so records come out mixed only with their neighbours in the db,
+ * and over as many steps as the db has records some come out twice and some
+ * not at all. This is no uniform permutation, even with a buffer as large
+ * as the db; see RandomAccessCursor for that. A buffer of one record gives
+ * the db order.
+ */
+class ShuffleBufferCursor : public Cursor {
+ public:
+  ShuffleBufferCursor(shared_ptr<Cursor> cursor, int buffer_size,
+      unsigned int seed);
+  virtual void SeekToFirst();
+  virtual void Next();
+  virtual string key() { return buffer_[current_].first; }
+  virtual string value() { return buffer_[current_].second; }
+  virtual bool valid() { return true; }
+
+ private:
+  void Pop(std::pair<string, string>* record);
+  void Choose();
+
+  shared_ptr<Cursor> cursor_;
+  const int buffer_size_;
+  shared_ptr<Caffe::RNG> rng_;
+  vector<std::pair<string, string> > buffer_;
+  int current_;
+};
+
+/**
+ * @brief Visits all records of a cursor once per epoch in a random order,
+ *        through SeekToKey lookups.
+ *
+ * The keys are indexed by one pass over the cursor. For backends that count
+ * their records (LMDB) the index is cached in `index_file` (a DBKeyIndex)
+ * for later runs, and built again when the db's record count or first or
+ * last key no longer match it. The records `lookahead` steps ahead are
+ * announced to the cursor with WillNeed so that random reads overlap.
+ * valid() becomes false at the end of each epoch and SeekToFirst() starts
+ * the next in a new order.
+ */
+class RandomAccessCursor : public Cursor {
+ public:
+  RandomAccessCursor(shared_ptr<Cursor> cursor, const string& index_file,
+      unsigned int seed, int lookahead);
+  virtual void SeekToFirst();
+  virtual void Next();
+  virtual string key() { return cursor_->key(); }
+  virtual string value() { return cursor_->value(); }
+  virtual bool ParseValue(google::protobuf::MessageLite* proto) {
+    return cursor_->ParseValue(proto);
+  }
+  virtual bool valid() { return position_ < order_.size(); }
+
+  const vector<string>& keys() const { return keys_; }
+
+ private:
+  void LoadOrBuildIndex(const string& index_file);
+  void Position();
+
+  shared_ptr<Cursor> cursor_;
+  const int lookahead_;
+  shared_ptr<Caffe::RNG> rng_;
+  vector<string> keys_;
+  vector<int> order_;
+  size_t position_;
+};
+
+}  // namespace db
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SAMPLING_CURSOR_HPP_
@@ -0,0 +1,157 @@
+#ifndef CAFFE_UTIL_SHARDED_DB_HPP_
+#define CAFFE_UTIL_SHARDED_DB_HPP_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/db.hpp"
+
+namespace caffe { namespace db {
+
+typedef std::pair<string, string> KeyValue;
+// A record and the index of its shard among the shards of a cursor.
+typedef std::pair<int, KeyValue> ShardRecord;
+
+/**
+ * @brief Reads a fixed subset of the shards of a ShardedDB on its own
+ *        thread, and queues their records.
+ *
+ * Every epoch the shards are visited round-robin in the epoch's shard order
+ * (see ShardedCursor), restricted to the shards of this reader, and the
+ * shards that have run out are skipped. The records of an epoch are followed
+ * by a NULL marker, after which the reader continues with the next epoch.
+ */
+class ShardReader : public InternalThread {
+ public:
+  // Reads sources[i], the shards[i]-th of the num_shards shards of a cursor.
+  ShardReader(const string& backend, const vector<string>& sources,
+      const vector<int>& shards, int num_shards, bool shuffle,
+      unsigned int seed);
+  virtual ~ShardReader();
+
+  // Starts reading from the first record of the given epoch.
+  void Start(int epoch);
+  // Stops the thread and drops the records it has queued.
+  void Stop();
+  // Returns the next record, or NULL at the end of an epoch. The caller
+  // takes ownership.
+  ShardRecord* Pop() { return queue_.pop(); }
+
+ protected:
+  virtual void InternalThreadEntry();
+
+  const string backend_;
+  const vector<string> sources_;
+  const vector<int> shards_;
+  const int num_shards_;
+  const bool shuffle_;
+  const unsigned int seed_;
+  int start_epoch_;
+  BlockingQueue<ShardRecord*> queue_;
+
+  DISABLE_COPY_AND_ASSIGN(ShardReader);
+};
+
+/**
+ * @brief Iterates over the records of a set of shards read by
+ *        ShardReader%s, taking one record from each shard in turn.
+ *
+ * The shards are taken in their order, or in an order permuted at every
+ * epoch if shuffling, and each record is taken from the reader of its
+ * shard. Without shuffling this restores the write order of a ShardedDB for
+ * any number of readers. A shard is done once its reader has moved past
+ * it.
+ *
+ * valid() becomes false at the end of every epoch, and SeekToFirst() then
+ * moves on to the next epoch, which the readers have already started to
+ * prefetch. Called in the middle of an epoch, SeekToFirst() restarts it.
+ */
+class ShardedCursor : public Cursor {
+ public:
+  // shard_reader[s] is the index in readers of the reader of shard s.
+  ShardedCursor(const vector<shared_ptr<ShardReader> >& readers,
+      const vector<int>& shard_reader, bool shuffle, unsigned int seed);
+  virtual ~ShardedCursor();
+  virtual void SeekToFirst();
+  virtual void Next();
+  virtual string key() { return current_->second.first; }
+  virtual string value() { return current_->second.second; }
+  virtual bool valid() { return current_ != NULL; }
+
+ private:
+  void StartEpoch();
+  void Fetch();
+  void DropRecords();
+
+  vector<shared_ptr<ShardReader> > readers_;
+  const vector<int> shard_reader_;
+  const bool shuffle_;
+  const unsigned int seed_;
+  int epoch_;
+  vector<int> shard_order_;
+  vector<bool> shard_done_;
+  int turn_;
+  // The record each reader returned for a later shard than the one asked
+  // for, and whether it has reached the end of the epoch.
+  vector<ShardRecord*> pending_;
+  vector<bool> reader_done_;
+  ShardRecord* current_;
+};
+
+/**
+ * @brief A db split into several shard dbs of the same backend, described by
+ *        a ShardManifest stored as `shards.prototxt` next to the shards.
+ *
+ * Writes are distributed round-robin over the shards, so keys written in
+ * ascending order stay in ascending order within each shard. Reads split
+ * the shards between ranks and reader threads as set by SetReadOptions.
+ */
+class ShardedDB : public DB {
+ public:
+  ShardedDB();
+  virtual ~ShardedDB() { Close(); }
+
+  // Returns true if `source` is a directory holding a shard manifest.
+  static bool IsSharded(const string& source);
+
+  // The layout of a NEW sharded db: `num_shards` dbs of type `backend`.
+  void SetShardLayout(const string& backend, int num_shards);
+  // How cursors share the shards, see the shard_* fields of DataParameter.
+  void SetReadOptions(const DataParameter& param);
+
+  virtual void Open(const string& source, Mode mode);
+  virtual void Close();
+  virtual ShardedCursor* NewCursor();
+  virtual Transaction* NewTransaction();
+  virtual void SetBulkLoad(bool sorted_keys, bool no_sync, bool write_map);
+
+  const ShardManifest& manifest() const { return manifest_; }
+
+ private:
+  friend class ShardedTransaction;
+
+  string ShardSource(int shard) const;
+
+  string source_;
+  Mode mode_;
+  bool open_;
+  ShardManifest manifest_;
+  int num_new_shards_;
+  bool sorted_keys_, no_sync_, write_map_;
+  int num_readers_, rank_, num_ranks_;
+  bool shuffle_;
+  unsigned int seed_;
+  // The shards opened for writing, and the shard that gets the next Put.
+  vector<shared_ptr<DB> > shards_;
+  int next_shard_;
+};
+
+}  // namespace db
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SHARDED_DB_HPP_
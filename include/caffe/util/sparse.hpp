@@ -0,0 +1,54 @@
+#ifndef _CAFFE_UTIL_SPARSE_HPP_
+#define _CAFFE_UTIL_SPARSE_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/syncedmem.hpp"
+
+namespace caffe {
+
+// The rows x cols weights of a layer in compressed sparse row form: the
+// nonzeros of row i are values[row_ptr[i]] to values[row_ptr[i + 1] - 1], in
+// the columns col of the same indices. It is only rebuilt from the weight
+// blob after its data has been written. The blob keeps its dense data, which
+// is what snapshots and the other passes read, so this copy adds to the
+// weight memory rather than replacing it.
+template <typename Dtype>
+struct SparseWeights {
+  SparseWeights() : sparse(false), rows(0), cols(0), memory(NULL),
+      version(0) {}
+  // Whether the weights were sparse enough to be kept in this form.
+  bool sparse;
+  int rows, cols;
+  std::vector<int> row_ptr;
+  std::vector<int> col;
+  std::vector<Dtype> values;
+  // The data the weights were converted from, and its version then.
+  const SyncedMemory* memory;
+  unsigned int version;
+};
+
+// Converts the weights to *sparse if at most max_density of them are nonzero
+// and they have changed since the last call, and returns sparse->sparse.
+template <typename Dtype>
+bool update_sparse_weights(const Blob<Dtype>& weights, const int rows,
+    const float max_density, SparseWeights<Dtype>* sparse);
+
+// C = A * B for the sparse A (rows x cols) and B (cols x N) split into
+// `groups` groups: group g multiplies its rows of A by the rows
+// g * cols to (g + 1) * cols - 1 of B, as the grouped weights of a
+// convolution multiply its column buffer.
+template <typename Dtype>
+void sparse_gemm_cpu(const SparseWeights<Dtype>& A, const int groups,
+    const int N, const Dtype* B, Dtype* C);
+
+// C = A * B^T for A (M x cols) and the sparse B (rows x cols), as the weights
+// of an InnerProduct multiply its bottom.
+template <typename Dtype>
+void gemm_sparse_trans_cpu(const int M, const Dtype* A,
+    const SparseWeights<Dtype>& B, Dtype* C);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_SPARSE_HPP_
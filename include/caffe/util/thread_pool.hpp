@@ -0,0 +1,139 @@
+#ifndef CAFFE_UTIL_THREAD_POOL_HPP_
+#define CAFFE_UTIL_THREAD_POOL_HPP_
+
+#include <algorithm>
+#include <vector>
+
+#include "caffe/common.hpp"
+
+namespace caffe {
+
+/**
+ * @brief A work-stealing pool of threads that runs the parallel loops of the
+ *        CPU layers. The pool shared by all layers is Caffe::thread_pool().
+ *
+ * Run queues a job's tasks in contiguous blocks on the workers' deques. Each
+ * worker takes the tasks of its own deque in order and steals from the far
+ * end of the other deques when it runs out; the calling thread helps until
+ * its job is done. Tasks that call Run again run their loop inline, so
+ * nested loops neither deadlock nor oversubscribe.
+ *
+ * The workers run BLAS single-threaded where the BLAS library allows it
+ * (MKL), so that a task calling BLAS does not start threads of its own.
+ * Layers call BLAS from the calling thread, between parallel loops, and the
+ * idle workers then sleep.
+ *
+ * The synchronization primitives are kept out of the header to avoid
+ * including boost/thread.hpp in code compiled by NVCC (see internal_thread).
+ */
+class ThreadPool {
+ public:
+  // `num_threads` counts the calling thread: the pool starts one less
+  // worker.
+  explicit ThreadPool(int num_threads);
+  ~ThreadPool();
+
+  int num_threads() const { return num_threads_; }
+  // Calls task(arg, i) for every i in [0, num_tasks) and returns when all
+  // the calls are done.
+  void Run(int num_tasks, void (*task)(void*, int), void* arg);
+
+ private:
+  class Impl;
+
+  int num_threads_;
+  shared_ptr<Impl> impl_;
+
+  DISABLE_COPY_AND_ASSIGN(ThreadPool);
+};
+
+// The number of elements of a task of parallel_for for elements each costing
+// about `work` simple operations, so that tasks are large enough to be worth
+// scheduling.
+inline int GrainSize(int work) {
+  const int kTaskWork = 1 << 15;
+  return work >= kTaskWork ? 1 : kTaskWork / std::max(work, 1);
+}
+
+namespace internal {
+
+template <typename Body>
+struct ParallelForTask {
+  const Body* body;
+  int n, grain;
+  static void Run(void* arg, int chunk) {
+    const ParallelForTask* task = static_cast<ParallelForTask*>(arg);
+    const int begin = chunk * task->grain;
+    (*task->body)(begin, std::min(begin + task->grain, task->n));
+  }
+};
+
+template <typename Dtype, typename Body>
+struct ParallelReduceTask {
+  const Body* body;
+  int n, grain;
+  Dtype* partial;
+  static void Run(void* arg, int chunk) {
+    const ParallelReduceTask* task = static_cast<ParallelReduceTask*>(arg);
+    const int begin = chunk * task->grain;
+    task->partial[chunk] =
+        (*task->body)(begin, std::min(begin + task->grain, task->n));
+  }
+};
+
+}  // namespace internal
+
+/**
+ * @brief Calls body(begin, end) on consecutive chunks of `grain` elements
+ *        covering [0, n), in parallel on Caffe::thread_pool().
+ *
+ * The chunks only depend on n and grain, never on the number of threads.
+ */
+template <typename Body>
+void parallel_for(int n, int grain, const Body& body) {
+  if (n <= 0) {
+    return;
+  }
+  grain = std::max(grain, 1);
+  const int chunks = (n + grain - 1) / grain;
+  if (chunks == 1) {
+    body(0, n);
+    return;
+  }
+  internal::ParallelForTask<Body> task = { &body, n, grain };
+  Caffe::thread_pool().Run(chunks, &internal::ParallelForTask<Body>::Run,
+      &task);
+}
+
+/**
+ * @brief Returns the sum of body(begin, end) over the chunks of
+ *        parallel_for.
+ *
+ * The partial sums are added in chunk order, so the result is the same
+ * whatever the number of threads and the order the chunks ran in.
+ */
+template <typename Dtype, typename Body>
+Dtype parallel_reduce(int n, int grain, const Body& body) {
+  if (n <= 0) {
+    return Dtype(0);
+  }
+  grain = std::max(grain, 1);
+  const int chunks = (n + grain - 1) / grain;
+  if (chunks == 1) {
+    return body(0, n);
+  }
+  std::vector<Dtype> partial(chunks);
+  internal::ParallelReduceTask<Dtype, Body> task =
+      { &body, n, grain, &partial[0] };
+  Caffe::thread_pool().Run(chunks,
+      &internal::ParallelReduceTask<Dtype, Body>::Run, &task);
+  Dtype sum = 0;
+  for (int i = 0; i < chunks; ++i) {
+    sum += partial[i];
+  }
+  return sum;
+}
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_THREAD_POOL_HPP_
@@ -1,6 +1,8 @@
 #ifndef CAFFE_VISION_LAYERS_HPP_
 #define CAFFE_VISION_LAYERS_HPP_
 
+#include <stdint.h>
+
 #include <string>
 #include <utility>
 #include <vector>
@@ -13,6 +15,9 @@
 #include "caffe/loss_layers.hpp"
 #include "caffe/neuron_layers.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/packed_gemm.hpp"
+#include "caffe/util/quantize.hpp"
+#include "caffe/util/sparse.hpp"
 
 namespace caffe {
 
@@ -24,7 +29,8 @@ template <typename Dtype>
 class BaseConvolutionLayer : public Layer<Dtype> {
  public:
   explicit BaseConvolutionLayer(const LayerParameter& param)
-      : Layer<Dtype>(param) {}
+      : Layer<Dtype>(param), weights_nhwc_memory_(NULL),
+        weights_nhwc_version_(0) {}
   virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
@@ -37,15 +43,35 @@ class BaseConvolutionLayer : public Layer<Dtype> {
  protected:
   // Helper functions that abstract away the column buffer and gemm arguments.
   // The last argument in forward_cpu_gemm is so that we can skip the im2col if
-  // we just called weight_cpu_gemm with the same input.
+  // we just called weight_cpu_gemm with the same input. forward_cpu_gemm
+  // takes the first of these paths that applies: the direct convolution
+  // (direct_forward_), the sparse weights, the packed weights (both set up by
+  // update_test_weights_cpu) and else the BLAS.
   void forward_cpu_gemm(const Dtype* input, const Dtype* weights,
       Dtype* output, bool skip_im2col = false);
   void forward_cpu_bias(Dtype* output, const Dtype* bias);
+  // With accumulate, backward_cpu_gemm adds to output instead of
+  // overwriting it.
   void backward_cpu_gemm(const Dtype* input, const Dtype* weights,
-      Dtype* output);
+      Dtype* output, bool accumulate = false);
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype*
       weights);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
+  // The forward pass for NHWC bottoms and tops (see NetParameter.layout).
+  // The weights are reordered to output x kernel_h x kernel_w x input by
+  // pack_weights_nhwc, once and again only after they are written.
+  void pack_weights_nhwc();
+  void forward_cpu_gemm_nhwc(const Dtype* input, Dtype* output);
+  void forward_cpu_bias_nhwc(Dtype* output, const Dtype* bias);
+  // The int8 forward pass, weights times input plus bias, for layers with a
+  // quantization_param. The weights are quantized again after they change.
+  void forward_cpu_gemm_s8(const Dtype* input, const Dtype* bias,
+      Dtype* output);
+  // In the TEST phase, converts the weights to sparse form for
+  // forward_cpu_gemm if they are sparse enough (see sparse_density), or else
+  // packs them if prepack_weights is set. Does nothing for the convolutions
+  // computed directly, which use neither.
+  void update_test_weights_cpu();
 
 #ifndef CPU_ONLY
   void forward_gpu_gemm(const Dtype* col_input, const Dtype* weights,
@@ -75,6 +101,8 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int height_out_, width_out_;
   bool bias_term_;
   bool is_1x1_;
+  // Whether forward_cpu_gemm convolves directly, without the column buffer.
+  bool direct_forward_;
 
  private:
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
@@ -109,6 +137,19 @@ class BaseConvolutionLayer : public Layer<Dtype> {
 
   Blob<Dtype> col_buffer_;
   Blob<Dtype> bias_multiplier_;
+  Blob<Dtype> weights_nhwc_;
+  // The weight data weights_nhwc_ was packed from, and its version then.
+  const SyncedMemory* weights_nhwc_memory_;
+  unsigned int weights_nhwc_version_;
+  // One input image, for the gradient that backward_cpu_gemm accumulates.
+  Blob<Dtype> input_buffer_;
+  // The quantized weights and their scale per output channel, and the
+  // quantized column buffer and int32 output of forward_cpu_gemm_s8.
+  QuantizedWeights<Dtype> weights_s8_;
+  vector<int8_t> col_s8_;
+  vector<int32_t> output_s32_;
+  SparseWeights<Dtype> sparse_weights_;
+  PackedWeights<Dtype> packed_weights_;
 };
 
 /**
@@ -329,6 +370,12 @@ class LRNLayer : public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top);
   virtual void CrossChannelForward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
+  virtual void CrossChannelForwardNHWC_cpu(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top);
+  // Adds the windowed sums of squares of the images [begin, end) to
+  // scale_data; the tasks of the parallel CrossChannelForward_cpu.
+  void CrossChannelScale_cpu(const Dtype* bottom_data, Dtype* scale_data,
+      int begin, int end);
   virtual void WithinChannelForward(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
   virtual void CrossChannelBackward_cpu(const vector<Blob<Dtype>*>& top,
@@ -407,6 +454,16 @@ class PoolingLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // MAX and AVE pooling of NHWC bottoms (see NetParameter.layout).
+  virtual void ForwardNHWC_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  // Pool the planes [begin, end) of the num * channels planes; the tasks of
+  // the parallel Forward_cpu. top_mask is NULL when the mask goes to mask.
+  void MaxPoolPlanes_cpu(const Dtype* bottom_data, Dtype* top_data,
+      int* mask, Dtype* top_mask, int begin, int end);
+  void AvePoolPlanes_cpu(const Dtype* bottom_data, Dtype* top_data,
+      int begin, int end);
+
   int kernel_h_, kernel_w_;
   int stride_h_, stride_w_;
   int pad_h_, pad_w_;
@@ -1,6 +1,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/syncedmem.hpp"
+#include "caffe/util/half.hpp"
 #include "caffe/util/math_functions.hpp"
 
 namespace caffe {
@@ -12,11 +13,15 @@ void Blob<Dtype>::Reshape(const int num, const int channels, const int height,
   CHECK_GE(channels, 0);
   CHECK_GE(height, 0);
   CHECK_GE(width, 0);
+  const int old_count = count_;
   num_ = num;
   channels_ = channels;
   height_ = height;
   width_ = width;
   count_ = num_ * channels_ * height_ * width_;
+  if (count_ != old_count) {
+    half_.reset();
+  }
   if (count_ > capacity_) {
     capacity_ = count_;
     data_.reset(new SyncedMemory(capacity_ * sizeof(Dtype)));
@@ -33,25 +38,29 @@ template <typename Dtype>
 Blob<Dtype>::Blob(const int num, const int channels, const int height,
     const int width)
   // capacity_ must be initialized before calling Reshape
-  : capacity_(0) {
+  : count_(0), capacity_(0), half_precision_(FLOAT32), half_memory_(NULL),
+    half_version_(0) {
   Reshape(num, channels, height, width);
 }
 
 template <typename Dtype>
 const Dtype* Blob<Dtype>::cpu_data() const {
   CHECK(data_);
+  UnpackHalf();
   return (const Dtype*)data_->cpu_data();
 }
 
 template <typename Dtype>
 void Blob<Dtype>::set_cpu_data(Dtype* data) {
   CHECK(data);
+  half_.reset();
   data_->set_cpu_data(data);
 }
 
 template <typename Dtype>
 const Dtype* Blob<Dtype>::gpu_data() const {
   CHECK(data_);
+  UnpackHalf();
   return (const Dtype*)data_->gpu_data();
 }
 
@@ -70,12 +79,16 @@ const Dtype* Blob<Dtype>::gpu_diff() const {
 template <typename Dtype>
 Dtype* Blob<Dtype>::mutable_cpu_data() {
   CHECK(data_);
+  UnpackHalf();
+  half_.reset();
   return static_cast<Dtype*>(data_->mutable_cpu_data());
 }
 
 template <typename Dtype>
 Dtype* Blob<Dtype>::mutable_gpu_data() {
   CHECK(data_);
+  UnpackHalf();
+  half_.reset();
   return static_cast<Dtype*>(data_->mutable_gpu_data());
 }
 
@@ -94,6 +107,7 @@ Dtype* Blob<Dtype>::mutable_gpu_diff() {
 template <typename Dtype>
 void Blob<Dtype>::ShareData(const Blob& other) {
   CHECK_EQ(count_, other.count());
+  half_.reset();
   data_ = other.data();
 }
 
@@ -103,6 +117,18 @@ void Blob<Dtype>::ShareDiff(const Blob& other) {
   diff_ = other.diff();
 }
 
+template <typename Dtype>
+void Blob<Dtype>::ShareSlice(const Blob& other, int offset) {
+  CHECK_GE(offset, 0);
+  CHECK_LE(offset + count_, other.count());
+  half_.reset();
+  data_.reset(new SyncedMemory(other.data(), offset * sizeof(Dtype),
+      count_ * sizeof(Dtype)));
+  diff_.reset(new SyncedMemory(other.diff(), offset * sizeof(Dtype),
+      count_ * sizeof(Dtype)));
+  capacity_ = count_;
+}
+
 // The "update" method is used for parameter blobs in a Net, which are stored
 // as Blob<float> or Blob<double> -- hence we do not define it for
 // Blob<int> or Blob<unsigned int>.
@@ -111,6 +137,8 @@ template <> void Blob<int>::Update() { NOT_IMPLEMENTED; }
 
 template <typename Dtype>
 void Blob<Dtype>::Update() {
+  UnpackHalf();
+  half_.reset();
   // We will perform update based on where the data is located.
   switch (data_->head()) {
   case SyncedMemory::HEAD_AT_CPU:
@@ -355,6 +383,9 @@ void Blob<Dtype>::CopyFrom(const Blob& source, bool copy_diff, bool reshape) {
       LOG(FATAL) << "Trying to copy blobs of different sizes.";
     }
   }
+  if (!copy_diff) {
+    half_.reset();
+  }
   switch (Caffe::mode()) {
   case Caffe::GPU:
     if (copy_diff) {
@@ -384,8 +415,26 @@ void Blob<Dtype>::FromProto(const BlobProto& proto) {
   Reshape(proto.num(), proto.channels(), proto.height(), proto.width());
   // copy data
   Dtype* data_vec = mutable_cpu_data();
-  for (int i = 0; i < count_; ++i) {
-    data_vec[i] = proto.data(i);
+  if (proto.has_half_data()) {
+    CHECK_EQ(proto.half_data().size(), count_ * sizeof(uint16_t));
+    const uint16_t* half_vec =
+        reinterpret_cast<const uint16_t*>(proto.half_data().data());
+    for (int i = 0; i < count_; ++i) {
+      data_vec[i] = HalfToFloat(half_vec[i], proto.half_precision());
+    }
+  } else if (proto.sparse_index_size() > 0) {
+    CHECK_EQ(proto.sparse_index_size(), proto.data_size());
+    caffe_set(count_, Dtype(0), data_vec);
+    for (int i = 0; i < proto.sparse_index_size(); ++i) {
+      const int index = proto.sparse_index(i);
+      CHECK_GE(index, 0);
+      CHECK_LT(index, count_);
+      data_vec[index] = proto.data(i);
+    }
+  } else {
+    for (int i = 0; i < count_; ++i) {
+      data_vec[i] = proto.data(i);
+    }
   }
   if (proto.diff_size() > 0) {
     Dtype* diff_vec = mutable_cpu_diff();
@@ -403,9 +452,17 @@ void Blob<Dtype>::ToProto(BlobProto* proto, bool write_diff) const {
   proto->set_width(width_);
   proto->clear_data();
   proto->clear_diff();
-  const Dtype* data_vec = cpu_data();
-  for (int i = 0; i < count_; ++i) {
-    proto->add_data(data_vec[i]);
+  proto->clear_half_data();
+  proto->clear_half_precision();
+  proto->clear_sparse_index();
+  if (HalfIsCurrent()) {
+    proto->set_half_data(half_->cpu_data(), count_ * sizeof(uint16_t));
+    proto->set_half_precision(half_precision_);
+  } else {
+    const Dtype* data_vec = cpu_data();
+    for (int i = 0; i < count_; ++i) {
+      proto->add_data(data_vec[i]);
+    }
   }
   if (write_diff) {
     const Dtype* diff_vec = cpu_diff();
@@ -415,6 +472,53 @@ void Blob<Dtype>::ToProto(BlobProto* proto, bool write_diff) const {
   }
 }
 
+template <typename Dtype>
+void Blob<Dtype>::StoreHalf(Precision precision) {
+  CHECK_NE(precision, FLOAT32);
+  if (!HalfIsCurrent() || half_precision_ != precision) {
+    const Dtype* data_vec = cpu_data();
+    shared_ptr<SyncedMemory> half(
+        new SyncedMemory(count_ * sizeof(uint16_t)));
+    uint16_t* half_vec = static_cast<uint16_t*>(half->mutable_cpu_data());
+    for (int i = 0; i < count_; ++i) {
+      half_vec[i] = FloatToHalf(data_vec[i], precision);
+    }
+    half_ = half;
+    half_precision_ = precision;
+    half_memory_ = data_.get();
+  }
+  if (data_.unique()) {
+    data_->release();
+  }
+  half_version_ = data_->version();
+}
+
+template <typename Dtype>
+const uint16_t* Blob<Dtype>::cpu_half_data() const {
+  return HalfIsCurrent() ?
+      static_cast<const uint16_t*>(half_->cpu_data()) : NULL;
+}
+
+template <typename Dtype>
+bool Blob<Dtype>::HalfIsCurrent() const {
+  return half_ && data_.get() == half_memory_ &&
+      data_->version() == half_version_;
+}
+
+template <typename Dtype>
+void Blob<Dtype>::UnpackHalf() const {
+  if (!HalfIsCurrent() || data_->head() != SyncedMemory::UNINITIALIZED) {
+    return;
+  }
+  const uint16_t* half_vec = static_cast<const uint16_t*>(half_->cpu_data());
+  Dtype* data_vec = static_cast<Dtype*>(data_->mutable_cpu_data());
+  for (int i = 0; i < count_; ++i) {
+    data_vec[i] = HalfToFloat(half_vec[i], half_precision_);
+  }
+  // Both copies hold the same values again.
+  half_version_ = data_->version();
+}
+
 INSTANTIATE_CLASS(Blob);
 template class Blob<int>;
 template class Blob<unsigned int>;
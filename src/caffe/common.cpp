@@ -1,9 +1,11 @@
+#include <boost/thread.hpp>
 #include <glog/logging.h>
 #include <cstdio>
 #include <ctime>
 
 #include "caffe/common.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
@@ -39,10 +41,42 @@ void GlobalInit(int* pargc, char*** pargv) {
   ::google::InstallFailureSignalHandler();
 }
 
+// Guards the creation and the replacement of the thread pool, which can
+// first be used from prefetch threads. Once created, the pool is only
+// replaced by set_cpu_threads, so that thread_pool() need not lock.
+static boost::mutex thread_pool_mutex;
+static boost::once_flag thread_pool_once = BOOST_ONCE_INIT;
+
+static ThreadPool* NewThreadPool(int threads) {
+  return new ThreadPool(threads > 0 ? threads :
+      boost::thread::hardware_concurrency());
+}
+
+void Caffe::CreateThreadPool() {
+  boost::mutex::scoped_lock lock(thread_pool_mutex);
+  if (!Get().thread_pool_) {
+    Get().thread_pool_.reset(NewThreadPool(Get().cpu_threads_));
+  }
+}
+
+ThreadPool& Caffe::thread_pool() {
+  boost::call_once(&Caffe::CreateThreadPool, thread_pool_once);
+  return *Get().thread_pool_;
+}
+
+void Caffe::set_cpu_threads(int threads) {
+  CHECK_GE(threads, 0);
+  boost::mutex::scoped_lock lock(thread_pool_mutex);
+  Get().cpu_threads_ = threads;
+  // The old workers are joined before the new ones start.
+  Get().thread_pool_.reset();
+  Get().thread_pool_.reset(NewThreadPool(threads));
+}
+
 #ifdef CPU_ONLY  // CPU-only Caffe.
 
 Caffe::Caffe()
-    : random_generator_(), mode_(Caffe::CPU) { }
+    : random_generator_(), cpu_threads_(0), mode_(Caffe::CPU) { }
 
 Caffe::~Caffe() { }
 
@@ -86,7 +120,7 @@ void* Caffe::RNG::generator() {
 
 Caffe::Caffe()
     : cublas_handle_(NULL), curand_generator_(NULL), random_generator_(),
-    mode_(Caffe::CPU) {
+    cpu_threads_(0), mode_(Caffe::CPU) {
   // Try to create a cublas handler, and report an error if failed (but we will
   // keep the program running as one might just want to run CPU code).
   if (cublasCreate(&cublas_handle_) != CUBLAS_STATUS_SUCCESS) {
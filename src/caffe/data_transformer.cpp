@@ -7,9 +7,48 @@
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
+// Transforms rows [begin, end) of the channels * height rows of a cropped
+// Datum; the tasks of Transform(const Datum&, Dtype*).
+template <typename Dtype>
+struct DatumRows {
+  const uint8_t* uint8_data;
+  const float* float_data;
+  // The mean image, the mean value of each channel, or neither.
+  const Dtype* mean;
+  const Dtype* mean_values;
+  Dtype scale;
+  bool do_mirror;
+  int datum_height, datum_width, height, width, h_off, w_off;
+  Dtype* transformed_data;
+  void operator()(int begin, int end) const {
+    for (int row = begin; row < end; ++row) {
+      const int c = row / height;
+      const int h = row % height;
+      for (int w = 0; w < width; ++w) {
+        const int data_index =
+            (c * datum_height + h_off + h) * datum_width + w_off + w;
+        const int top_index = row * width + (do_mirror ? width - 1 - w : w);
+        const Dtype datum_element = uint8_data ?
+            static_cast<Dtype>(uint8_data[data_index]) :
+            static_cast<Dtype>(float_data[data_index]);
+        if (mean) {
+          transformed_data[top_index] =
+            (datum_element - mean[data_index]) * scale;
+        } else if (mean_values) {
+          transformed_data[top_index] =
+            (datum_element - mean_values[c]) * scale;
+        } else {
+          transformed_data[top_index] = datum_element * scale;
+        }
+      }
+    }
+  }
+};
+
 template<typename Dtype>
 DataTransformer<Dtype>::DataTransformer(const TransformationParameter& param,
     Phase phase)
@@ -89,37 +128,13 @@ void DataTransformer<Dtype>::Transform(const Datum& datum,
     }
   }
 
-  Dtype datum_element;
-  int top_index, data_index;
-  for (int c = 0; c < datum_channels; ++c) {
-    for (int h = 0; h < height; ++h) {
-      for (int w = 0; w < width; ++w) {
-        data_index = (c * datum_height + h_off + h) * datum_width + w_off + w;
-        if (do_mirror) {
-          top_index = (c * height + h) * width + (width - 1 - w);
-        } else {
-          top_index = (c * height + h) * width + w;
-        }
-        if (has_uint8) {
-          datum_element =
-            static_cast<Dtype>(static_cast<uint8_t>(data[data_index]));
-        } else {
-          datum_element = datum.float_data(data_index);
-        }
-        if (has_mean_file) {
-          transformed_data[top_index] =
-            (datum_element - mean[data_index]) * scale;
-        } else {
-          if (has_mean_values) {
-            transformed_data[top_index] =
-              (datum_element - mean_values_[c]) * scale;
-          } else {
-            transformed_data[top_index] = datum_element * scale;
-          }
-        }
-      }
-    }
-  }
+  DatumRows<Dtype> rows = {
+      has_uint8 ? reinterpret_cast<const uint8_t*>(data.data()) : NULL,
+      datum.float_data().data(), mean,
+      has_mean_values ? &mean_values_[0] : NULL, scale, do_mirror,
+      datum_height, datum_width, height, width, h_off, w_off,
+      transformed_data };
+  parallel_for(datum_channels * height, GrainSize(width * 3), rows);
 }
 
 template<typename Dtype>
@@ -1,5 +1,6 @@
 #include <boost/thread.hpp>
 #include "caffe/internal_thread.hpp"
+#include "caffe/util/numa.hpp"
 
 namespace caffe {
 
@@ -18,13 +19,21 @@ bool InternalThread::StartInternalThread() {
   }
   try {
     thread_.reset(
-        new boost::thread(&InternalThread::InternalThreadEntry, this));
+        new boost::thread(&InternalThread::entry, this, CurrentNumaNode()));
   } catch (...) {
     return false;
   }
   return true;
 }
 
+void InternalThread::entry(int numa_node) {
+  // Run on the NUMA node of the thread that consumes our output.
+  if (numa_node >= 0) {
+    BindThreadToNumaNode(numa_node);
+  }
+  InternalThreadEntry();
+}
+
 /** Will not return until the internal thread has exited. */
 bool InternalThread::WaitForInternalThreadToExit() {
   if (is_started()) {
@@ -37,4 +46,11 @@ bool InternalThread::WaitForInternalThreadToExit() {
   return true;
 }
 
+bool InternalThread::StopInternalThread() {
+  if (is_started()) {
+    thread_->interrupt();
+  }
+  return WaitForInternalThreadToExit();
+}
+
 }  // namespace caffe
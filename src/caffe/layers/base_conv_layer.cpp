@@ -2,12 +2,21 @@
 
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/util/direct_conv.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/packed_gemm.hpp"
+#include "caffe/util/quantize.hpp"
+#include "caffe/util/sparse.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
+// Convolutions whose GEMMs would have at most this inner dimension, such as
+// first layers on 3 channel images and depthwise convolutions, are computed
+// directly rather than by GEMM on the column buffer.
+const int kMaxDirectConvKernelDim = 32;
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -96,6 +105,13 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   // Propagate gradients to the parameters (as directed by backward pass).
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  if (this->layer_param_.has_quantization_param()) {
+    CHECK(!reverse_dimensions()) << "Only convolution can be quantized";
+    CHECK_EQ(this->phase_, TEST) << "Quantized layers only run the TEST "
+        << "phase: training ignores quantization_param and its relu";
+    CHECK_GT(this->layer_param_.quantization_param().bottom_range(), 0)
+        << "A quantized layer needs the range of its bottom";
+  }
 }
 
 template <typename Dtype>
@@ -131,12 +147,15 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     conv_out_spatial_dim_ = height_out_ * width_out_;
   }
   kernel_dim_ = conv_in_channels_ * kernel_h_ * kernel_w_;
+  direct_forward_ = !reverse_dimensions() &&
+      kernel_dim_ / group_ <= kMaxDirectConvKernelDim;
   weight_offset_ = conv_out_channels_ * kernel_dim_ / group_ / group_;
   col_offset_ = kernel_dim_ * conv_out_spatial_dim_ / group_;
   output_offset_ = conv_out_channels_ * conv_out_spatial_dim_ / group_;
   // The im2col result buffer will only hold one image at a time to avoid
-  // overly large memory usage. In the special case of 1x1 convolution
-  // it goes lazily unused to save memory.
+  // overly large memory usage. In the special case of 1x1 convolution, and
+  // when only the direct forward pass runs, it goes lazily unused to save
+  // memory.
   if (reverse_dimensions()) {
     col_buffer_.Reshape(1, kernel_dim_, height_, width_);
   } else {
@@ -153,6 +172,12 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
     const Dtype* weights, Dtype* output, bool skip_im2col) {
+  if (direct_forward_) {
+    conv_direct_cpu(input, conv_in_channels_, conv_in_height_, conv_in_width_,
+        conv_out_channels_, group_, kernel_h_, kernel_w_, pad_h_, pad_w_,
+        stride_h_, stride_w_, weights, output);
+    return;
+  }
   const Dtype* col_buff = input;
   if (!is_1x1_) {
     if (!skip_im2col) {
@@ -160,6 +185,18 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
     }
     col_buff = col_buffer_.cpu_data();
   }
+  if (sparse_weights_.sparse) {
+    sparse_gemm_cpu(sparse_weights_, group_, conv_out_spatial_dim_, col_buff,
+        output);
+    return;
+  }
+  if (packed_weights_.packed) {
+    for (int g = 0; g < group_; ++g) {
+      gemm_packed_cpu(packed_weights_, g, false, conv_out_spatial_dim_,
+          col_buff + col_offset_ * g, output + output_offset_ * g);
+    }
+    return;
+  }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
         group_, conv_out_spatial_dim_, kernel_dim_ / group_,
@@ -168,6 +205,49 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
   }
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_gemm_s8(const Dtype* input,
+    const Dtype* bias, Dtype* output) {
+  const QuantizationParameter& quantization_param =
+      this->layer_param_.quantization_param();
+  update_quantized_weights(*this->blobs_[0], conv_out_channels_,
+      &weights_s8_);
+  const Dtype* col_buff = input;
+  if (!is_1x1_) {
+    conv_im2col_cpu(input, col_buffer_.mutable_cpu_data());
+    col_buff = col_buffer_.cpu_data();
+  }
+  const Dtype bottom_scale = Dtype(127) / quantization_param.bottom_range();
+  col_s8_.resize(kernel_dim_ * conv_out_spatial_dim_);
+  output_s32_.resize(conv_out_channels_ * conv_out_spatial_dim_);
+  quantize_s8_cpu(kernel_dim_ * conv_out_spatial_dim_, bottom_scale, col_buff,
+      &col_s8_[0]);
+  for (int g = 0; g < group_; ++g) {
+    gemm_s8_cpu(false, conv_out_channels_ / group_, conv_out_spatial_dim_,
+        kernel_dim_ / group_, &weights_s8_.data[0] + weight_offset_ * g,
+        &col_s8_[0] + col_offset_ * g, &output_s32_[0] + output_offset_ * g);
+  }
+  dequantize_s8_cpu(true, conv_out_channels_, conv_out_spatial_dim_,
+      &output_s32_[0], bottom_scale, &weights_s8_.scales[0], bias,
+      quantization_param.relu(), output);
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::update_test_weights_cpu() {
+  // The direct convolution reads the weights as they are.
+  if (this->phase_ != TEST || reverse_dimensions() || direct_forward_) {
+    return;
+  }
+  const ConvolutionParameter& conv_param =
+      this->layer_param_.convolution_param();
+  if (!update_sparse_weights(*this->blobs_[0], conv_out_channels_,
+      conv_param.sparse_density(), &sparse_weights_) &&
+      conv_param.prepack_weights()) {
+    update_packed_weights(*this->blobs_[0], conv_out_channels_, group_,
+        &packed_weights_);
+  }
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
     const Dtype* bias) {
@@ -178,7 +258,7 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
-    const Dtype* weights, Dtype* input) {
+    const Dtype* weights, Dtype* input, bool accumulate) {
   Dtype* col_buff = col_buffer_.mutable_cpu_data();
   if (is_1x1_) {
     col_buff = input;
@@ -187,10 +267,19 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
     caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_ / group_,
         conv_out_spatial_dim_, conv_out_channels_ / group_,
         (Dtype)1., weights + weight_offset_ * g, output + output_offset_ * g,
-        (Dtype)0., col_buff + col_offset_ * g);
+        (Dtype)(is_1x1_ && accumulate ? 1. : 0.), col_buff + col_offset_ * g);
   }
   if (!is_1x1_) {
-    conv_col2im_cpu(col_buff, input);
+    if (accumulate) {
+      // col2im overwrites, so go through a buffer.
+      input_buffer_.Reshape(1, conv_in_channels_, conv_in_height_,
+          conv_in_width_);
+      conv_col2im_cpu(col_buff, input_buffer_.mutable_cpu_data());
+      caffe_axpy<Dtype>(input_buffer_.count(), (Dtype)1.,
+          input_buffer_.cpu_data(), input);
+    } else {
+      conv_col2im_cpu(col_buff, input);
+    }
   }
 }
 
@@ -217,6 +306,57 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
       input, bias_multiplier_.cpu_data(), 1., bias);
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::pack_weights_nhwc() {
+  CHECK_EQ(group_, 1) << "Grouped convolution only supports NCHW";
+  const SyncedMemory* memory = this->blobs_[0]->data().get();
+  if (memory == weights_nhwc_memory_ &&
+      memory->version() == weights_nhwc_version_) {
+    return;
+  }
+  const Dtype* weights = this->blobs_[0]->cpu_data();
+  weights_nhwc_memory_ = memory;
+  weights_nhwc_version_ = memory->version();
+  const int kernel_spatial_dim = kernel_h_ * kernel_w_;
+  weights_nhwc_.Reshape(conv_out_channels_, kernel_h_, kernel_w_,
+      conv_in_channels_);
+  Dtype* packed = weights_nhwc_.mutable_cpu_data();
+  for (int o = 0; o < conv_out_channels_; ++o) {
+    for (int c = 0; c < conv_in_channels_; ++c) {
+      for (int k = 0; k < kernel_spatial_dim; ++k) {
+        packed[k * conv_in_channels_ + c] = weights[c * kernel_spatial_dim + k];
+      }
+    }
+    weights += kernel_dim_;
+    packed += kernel_dim_;
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_gemm_nhwc(const Dtype* input,
+    Dtype* output) {
+  // Each output pixel is a row of input patch (kernel_dim_) times the packed
+  // weights, and the output channels of a pixel are a row of the output.
+  const Dtype* row_buff = input;
+  if (!is_1x1_) {
+    im2row_nhwc_cpu(input, conv_in_channels_, conv_in_height_,
+        conv_in_width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_,
+        stride_w_, col_buffer_.mutable_cpu_data());
+    row_buff = col_buffer_.cpu_data();
+  }
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_spatial_dim_,
+      conv_out_channels_, kernel_dim_, (Dtype)1., row_buff,
+      weights_nhwc_.cpu_data(), (Dtype)0., output);
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_bias_nhwc(Dtype* output,
+    const Dtype* bias) {
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, height_out_ * width_out_,
+      num_output_, 1, (Dtype)1., bias_multiplier_.cpu_data(), bias,
+      (Dtype)1., output);
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
@@ -45,6 +45,8 @@ template <typename Dtype>
 void ConcatLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   Dtype* top_data = top[0]->mutable_cpu_data();
+  // caffe_copy skips the bottoms that already are their slice of the top
+  // (see NetParameter.zero_copy_concat), and so does Backward_cpu.
   if (concat_dim_== 0) {
     int offset_num = 0;
     for (int i = 0; i < bottom.size(); ++i) {
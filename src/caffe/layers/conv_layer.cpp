@@ -20,10 +20,31 @@ template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* weight = this->blobs_[0]->cpu_data();
+  const bool nhwc = this->layer_param_.layout() == NHWC;
+  if (nhwc) {
+    this->pack_weights_nhwc();
+  } else if (!this->layer_param_.has_quantization_param()) {
+    this->update_test_weights_cpu();
+  }
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->cpu_data();
     Dtype* top_data = top[i]->mutable_cpu_data();
     for (int n = 0; n < this->num_; ++n) {
+      if (nhwc) {
+        this->forward_cpu_gemm_nhwc(bottom_data + bottom[i]->offset(n),
+            top_data + top[i]->offset(n));
+        if (this->bias_term_) {
+          this->forward_cpu_bias_nhwc(top_data + top[i]->offset(n),
+              this->blobs_[1]->cpu_data());
+        }
+        continue;
+      }
+      if (this->layer_param_.has_quantization_param()) {
+        this->forward_cpu_gemm_s8(bottom_data + bottom[i]->offset(n),
+            this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL,
+            top_data + top[i]->offset(n));
+        continue;
+      }
       this->forward_cpu_gemm(bottom_data + bottom[i]->offset(n), weight,
           top_data + top[i]->offset(n));
       if (this->bias_term_) {
@@ -37,6 +58,10 @@ void ConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  CHECK_EQ(this->layer_param_.layout(), NCHW)
+      << "Backward is only implemented for NCHW";
+  CHECK(!this->layer_param_.has_quantization_param())
+      << "Backward is not implemented for quantized layers";
   const Dtype* weight = this->blobs_[0]->cpu_data();
   Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
   if (this->param_propagate_down_[0]) {
@@ -67,7 +92,8 @@ void ConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
         // gradient w.r.t. bottom data, if necessary.
         if (propagate_down[i]) {
           this->backward_cpu_gemm(top_diff + top[i]->offset(n), weight,
-              bottom_diff + bottom[i]->offset(n));
+              bottom_diff + bottom[i]->offset(n),
+              this->accumulate_bottom_diff(i));
         }
       }
     }
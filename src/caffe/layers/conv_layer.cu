@@ -11,6 +11,10 @@ namespace caffe {
 template <typename Dtype>
 void ConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  CHECK_EQ(this->layer_param_.layout(), NCHW)
+      << "The GPU only supports the NCHW layout";
+  CHECK(!this->layer_param_.has_quantization_param())
+      << "Quantized layers only run on the CPU";
   const Dtype* weight = this->blobs_[0]->gpu_data();
   for (int i = 0; i < bottom.size(); ++i) {
     const Dtype* bottom_data = bottom[i]->gpu_data();
@@ -13,6 +13,7 @@
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/sampling_cursor.hpp"
 
 namespace caffe {
 
@@ -25,9 +26,22 @@ template <typename Dtype>
 void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   // Initialize DB
-  db_.reset(db::GetDB(this->layer_param_.data_param().backend()));
+  db_.reset(db::GetDB(this->layer_param_.data_param()));
   db_->Open(this->layer_param_.data_param().source(), db::READ);
   cursor_.reset(db_->NewCursor());
+  // Optionally draw the records in a random order instead of db order
+  const DataParameter& data_param = this->layer_param_.data_param();
+  if (data_param.random_access()) {
+    LOG(INFO) << "Reading the db in random order";
+    cursor_.reset(new db::RandomAccessCursor(cursor_,
+        data_param.source() + ".keys", caffe_rng_rand(),
+        data_param.batch_size()));
+  } else if (data_param.shuffle_buffer_size() > 0) {
+    LOG(INFO) << "Shuffling the db through a buffer of "
+              << data_param.shuffle_buffer_size() << " records";
+    cursor_.reset(new db::ShuffleBufferCursor(cursor_,
+        data_param.shuffle_buffer_size(), caffe_rng_rand()));
+  }
 
   // Check if we should randomly skip a few data points
   if (this->layer_param_.data_param().rand_skip()) {
@@ -49,6 +63,12 @@ void DataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   // image
   int crop_size = this->layer_param_.transform_param().crop_size();
+  if (data_param.roi_decode()) {
+    CHECK_GT(crop_size, 0) << "roi_decode needs a crop_size";
+    CHECK(!this->layer_param_.transform_param().has_mean_file())
+        << "roi_decode cannot be used with a mean_file, which is cropped"
+        << " together with the image";
+  }
   if (crop_size > 0) {
     top[0]->Reshape(this->layer_param_.data_param().batch_size(),
         datum.channels(), crop_size, crop_size);
@@ -90,6 +110,7 @@ void DataLayer<Dtype>::InternalThreadEntry() {
   const int batch_size = this->layer_param_.data_param().batch_size();
   const int crop_size = this->layer_param_.transform_param().crop_size();
   bool force_color = this->layer_param_.data_param().force_encoded_color();
+  const bool roi_decode = this->layer_param_.data_param().roi_decode();
   if (batch_size == 1 && crop_size == 0) {
     Datum datum;
     datum.ParseFromString(cursor_->value());
@@ -119,7 +140,10 @@ void DataLayer<Dtype>::InternalThreadEntry() {
     datum.ParseFromString(cursor_->value());
 
     cv::Mat cv_img;
-    if (datum.encoded()) {
+    if (datum.encoded() && roi_decode) {
+      cv_img = DecodeCrop(datum.data(), crop_size, force_color);
+    }
+    if (datum.encoded() && !cv_img.data) {
       if (force_color) {
         cv_img = DecodeDatumToCVMat(datum, true);
       } else {
@@ -160,6 +184,30 @@ void DataLayer<Dtype>::InternalThreadEntry() {
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
 }
 
+// Decodes only the crop_size x crop_size window of a JPEG that the transformer
+// would have cropped from the full image: at random for TRAIN, centered for
+// TEST. The transformer then crops the window at offset 0. Returns an empty
+// image for data libjpeg cannot decode or that is smaller than the crop.
+template <typename Dtype>
+cv::Mat DataLayer<Dtype>::DecodeCrop(const string& data, int crop_size,
+    bool force_color) {
+  int height, width, channels;
+  if (!ReadJPEGHeader(data, &height, &width, &channels) ||
+      height < crop_size || width < crop_size) {
+    return cv::Mat();
+  }
+  int h_off, w_off;
+  if (this->phase_ == TRAIN) {
+    h_off = caffe_rng_rand() % (height - crop_size + 1);
+    w_off = caffe_rng_rand() % (width - crop_size + 1);
+  } else {
+    h_off = (height - crop_size) / 2;
+    w_off = (width - crop_size) / 2;
+  }
+  return DecodeJPEGCropToCVMat(data, force_color || channels > 1, h_off,
+      w_off, crop_size, crop_size);
+}
+
 INSTANTIATE_CLASS(DataLayer);
 REGISTER_LAYER_CLASS(Data);
 
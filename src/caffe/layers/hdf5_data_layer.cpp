@@ -1,11 +1,3 @@
-/*
-TODO:
-- load file in a separate thread ("prefetch")
-- can be smarter about the memcpy call instead of doing it row-by-row
-  :: use util functions caffe_copy, and Blob->offset()
-  :: don't forget to update hdf5_daa_layer.cu accordingly
-- add ability to shuffle filenames if flag is set
-*/
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <vector>
@@ -15,44 +7,118 @@ TODO:
 #include "stdint.h"
 
 #include "caffe/layer.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/rng.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
+// Chunk cache per dataset, so that batch-sized reads of compressed datasets
+// decompress each chunk once.
+const size_t kHDF5ChunkCacheBytes = 64 * 1024 * 1024;
+
 template <typename Dtype>
-HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() { }
+HDF5DataLayer<Dtype>::~HDF5DataLayer<Dtype>() {
+  CHECK(WaitForInternalThreadToExit()) << "Thread joining failed";
+  CloseHDF5File();
+}
 
-// Load data and label from HDF5 filename into the class property blobs.
+// Open the datasets of HDF5 filename for reading rows.
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::LoadHDF5FileData(const char* filename) {
-  DLOG(INFO) << "Loading HDF5 file: " << filename;
-  hid_t file_id = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
-  if (file_id < 0) {
+void HDF5DataLayer<Dtype>::OpenHDF5File(const char* filename) {
+  DLOG(INFO) << "Opening HDF5 file: " << filename;
+  HDF5Lock lock;
+  file_id_ = H5Fopen(filename, H5F_ACC_RDONLY, H5P_DEFAULT);
+  if (file_id_ < 0) {
     LOG(FATAL) << "Failed opening HDF5 file: " << filename;
   }
 
-  int top_size = this->layer_param_.top_size();
-  hdf_blobs_.resize(top_size);
-
+  const int top_size = this->layer_param_.top_size();
   const int MIN_DATA_DIM = 1;
   const int MAX_DATA_DIM = 4;
-
+  hid_t dapl = H5Pcreate(H5P_DATASET_ACCESS);
+  H5Pset_chunk_cache(dapl, H5D_CHUNK_CACHE_NSLOTS_DEFAULT,
+      kHDF5ChunkCacheBytes, H5D_CHUNK_CACHE_W0_DEFAULT);
+  dataset_ids_.resize(top_size);
   for (int i = 0; i < top_size; ++i) {
-    hdf_blobs_[i] = shared_ptr<Blob<Dtype> >(new Blob<Dtype>());
-    hdf5_load_nd_dataset(file_id, this->layer_param_.top(i).c_str(),
-        MIN_DATA_DIM, MAX_DATA_DIM, hdf_blobs_[i].get());
+    const char* dataset_name = this->layer_param_.top(i).c_str();
+    std::vector<hsize_t> dims;
+    hdf5_get_nd_dataset_dims(file_id_, dataset_name, MIN_DATA_DIM,
+        MAX_DATA_DIM, &dims);
+    // MinTopBlobs==1 guarantees at least one top blob
+    if (i == 0) {
+      file_rows_ = dims[0];
+    } else {
+      CHECK_EQ(dims[0], file_rows_);
+    }
+    if (hdf_blobs_.size() == top_size) {
+      // The rows of every file must match the batch blobs set up from the
+      // first one.
+      hsize_t row_dim = 1;
+      for (int j = 1; j < dims.size(); ++j) {
+        row_dim *= dims[j];
+      }
+      CHECK_EQ(row_dim, hdf_blobs_[i]->count() / hdf_blobs_[i]->num())
+          << "Dataset " << dataset_name << " of " << filename
+          << " has a different shape";
+    }
+    dataset_ids_[i] = H5Dopen2(file_id_, dataset_name, dapl);
+    CHECK_GE(dataset_ids_[i], 0) << "Failed to open dataset " << dataset_name;
   }
+  H5Pclose(dapl);
+  CHECK_GT(file_rows_, 0) << "No rows in " << filename;
 
-  herr_t status = H5Fclose(file_id);
-  CHECK_GE(status, 0) << "Failed to close HDF5 file: " << filename;
+  // Read the file in blocks of batch_size rows.
+  const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
+  block_permutation_.clear();
+  for (hsize_t row = 0; row < file_rows_; row += batch_size) {
+    block_permutation_.push_back(row);
+  }
+  if (this->layer_param_.hdf5_data_param().shuffle()) {
+    caffe::rng_t* rng = static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+    shuffle(block_permutation_.begin(), block_permutation_.end(), rng);
+  }
+  current_block_ = 0;
+  current_row_ = 0;
+  DLOG(INFO) << "Opened " << file_rows_ << " rows";
+}
 
-  // MinTopBlobs==1 guarantees at least one top blob
-  int num = hdf_blobs_[0]->num();
-  for (int i = 1; i < top_size; ++i) {
-    CHECK_EQ(hdf_blobs_[i]->num(), num);
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::CloseHDF5File() {
+  if (file_id_ < 0) {
+    return;
+  }
+  HDF5Lock lock;
+  for (int i = 0; i < dataset_ids_.size(); ++i) {
+    H5Dclose(dataset_ids_[i]);
+  }
+  dataset_ids_.clear();
+  herr_t status = H5Fclose(file_id_);
+  CHECK_GE(status, 0) << "Failed to close HDF5 file";
+  file_id_ = -1;
+}
+
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::NextHDF5File() {
+  const bool shuffle_data = this->layer_param_.hdf5_data_param().shuffle();
+  if (num_files_ > 1 || shuffle_data) {
+    ++current_file_;
+    if (current_file_ == num_files_) {
+      current_file_ = 0;
+      if (shuffle_data) {
+        caffe::rng_t* rng =
+            static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+        shuffle(file_permutation_.begin(), file_permutation_.end(), rng);
+      }
+      DLOG(INFO) << "Looping around to first file.";
+    }
+    CloseHDF5File();
+    OpenHDF5File(hdf_filenames_[file_permutation_[current_file_]].c_str());
+  } else {
+    current_block_ = 0;
+    current_row_ = 0;
   }
-  DLOG(INFO) << "Successully loaded " << hdf_blobs_[0]->num() << " rows";
 }
 
 template <typename Dtype>
@@ -61,6 +127,8 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   // Refuse transformation parameters since HDF5 is totally generic.
   CHECK(!this->layer_param_.has_transform_param()) <<
       this->type() << " does not transform data.";
+  // A repeated SetUp must not race a batch still being prefetched.
+  CHECK(WaitForInternalThreadToExit()) << "Thread joining failed";
   // Read the source to parse the filenames.
   const string& source = this->layer_param_.hdf5_data_param().source();
   LOG(INFO) << "Loading list of HDF5 filenames from: " << source;
@@ -81,44 +149,112 @@ void HDF5DataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   CHECK_GE(num_files_, 1) << "Must have at least 1 HDF5 filename listed in "
     << source;
 
-  // Load the first HDF5 file and initialize the line counter.
-  LoadHDF5FileData(hdf_filenames_[current_file_].c_str());
-  current_row_ = 0;
+  file_permutation_.resize(num_files_);
+  for (int i = 0; i < num_files_; ++i) {
+    file_permutation_[i] = i;
+  }
+  const unsigned int prefetch_rng_seed = caffe_rng_rand();
+  prefetch_rng_.reset(new Caffe::RNG(prefetch_rng_seed));
+  if (this->layer_param_.hdf5_data_param().shuffle()) {
+    caffe::rng_t* rng = static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+    shuffle(file_permutation_.begin(), file_permutation_.end(), rng);
+  }
+
+  // Open the first HDF5 file and initialize the line counter.
+  hdf_blobs_.clear();
+  CloseHDF5File();
+  OpenHDF5File(hdf_filenames_[file_permutation_[current_file_]].c_str());
 
   // Reshape blobs.
   const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
   const int top_size = this->layer_param_.top_size();
   for (int i = 0; i < top_size; ++i) {
-    top[i]->Reshape(batch_size, hdf_blobs_[i]->channels(),
-                    hdf_blobs_[i]->height(), hdf_blobs_[i]->width());
+    std::vector<hsize_t> dims;
+    hdf5_get_nd_dataset_dims(file_id_, this->layer_param_.top(i).c_str(),
+        1, 4, &dims);
+    top[i]->Reshape(batch_size,
+        (dims.size() > 1) ? dims[1] : 1,
+        (dims.size() > 2) ? dims[2] : 1,
+        (dims.size() > 3) ? dims[3] : 1);
+    hdf_blobs_.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    hdf_blobs_[i]->ReshapeLike(*top[i]);
+    // Allocate on this thread, see BasePrefetchingDataLayer::LayerSetUp.
+    hdf_blobs_[i]->mutable_cpu_data();
   }
+
+  // Start prefetching the first batch.
+  CHECK(StartInternalThread()) << "Thread execution failed";
 }
 
 template <typename Dtype>
-void HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
-      const vector<Blob<Dtype>*>& top) {
+void HDF5DataLayer<Dtype>::InternalThreadEntry() {
+  CPUTimer timer;
+  timer.Start();
   const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
-  for (int i = 0; i < batch_size; ++i, ++current_row_) {
-    if (current_row_ == hdf_blobs_[0]->num()) {
-      if (num_files_ > 1) {
-        ++current_file_;
-        if (current_file_ == num_files_) {
-          current_file_ = 0;
-          DLOG(INFO) << "Looping around to first file.";
-        }
-        LoadHDF5FileData(hdf_filenames_[current_file_].c_str());
-      }
+  const int top_size = this->layer_param_.top_size();
+  int filled = 0;
+  while (filled < batch_size) {
+    if (current_block_ == block_permutation_.size()) {
+      NextHDF5File();
+    }
+    // Read the longest run of rows left in the current block.
+    const hsize_t block_start = block_permutation_[current_block_];
+    const hsize_t block_rows =
+        std::min<hsize_t>(batch_size, file_rows_ - block_start);
+    const hsize_t num_rows = std::min<hsize_t>(block_rows - current_row_,
+        batch_size - filled);
+    for (int j = 0; j < top_size; ++j) {
+      hdf5_load_nd_dataset_rows(dataset_ids_[j], block_start + current_row_,
+          num_rows, hdf_blobs_[j]->mutable_cpu_data() +
+          hdf_blobs_[j]->offset(filled));
+    }
+    filled += num_rows;
+    current_row_ += num_rows;
+    if (current_row_ == block_rows) {
+      ++current_block_;
       current_row_ = 0;
     }
-    for (int j = 0; j < this->layer_param_.top_size(); ++j) {
-      int data_dim = top[j]->count() / top[j]->num();
-      caffe_copy(data_dim,
-          &hdf_blobs_[j]->cpu_data()[current_row_ * data_dim],
-          &top[j]->mutable_cpu_data()[i * data_dim]);
+  }
+  if (this->layer_param_.hdf5_data_param().shuffle()) {
+    ShuffleRows();
+  }
+  DLOG(INFO) << "Prefetch batch: " << timer.MilliSeconds() << " ms.";
+}
+
+// Permute the rows of the prefetched batch, identically for every top.
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::ShuffleRows() {
+  const int batch_size = this->layer_param_.hdf5_data_param().batch_size();
+  std::vector<int> permutation(batch_size);
+  for (int i = 0; i < batch_size; ++i) {
+    permutation[i] = i;
+  }
+  caffe::rng_t* rng = static_cast<caffe::rng_t*>(prefetch_rng_->generator());
+  shuffle(permutation.begin(), permutation.end(), rng);
+  Blob<Dtype> rows;
+  for (int j = 0; j < hdf_blobs_.size(); ++j) {
+    const int row_dim = hdf_blobs_[j]->count() / batch_size;
+    rows.ReshapeLike(*hdf_blobs_[j]);
+    caffe_copy(hdf_blobs_[j]->count(), hdf_blobs_[j]->cpu_data(),
+        rows.mutable_cpu_data());
+    for (int i = 0; i < batch_size; ++i) {
+      caffe_copy(row_dim, rows.cpu_data() + permutation[i] * row_dim,
+          hdf_blobs_[j]->mutable_cpu_data() + i * row_dim);
     }
   }
 }
 
+template <typename Dtype>
+void HDF5DataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  CHECK(WaitForInternalThreadToExit()) << "Thread joining failed";
+  for (int j = 0; j < this->layer_param_.top_size(); ++j) {
+    caffe_copy(hdf_blobs_[j]->count(), hdf_blobs_[j]->cpu_data(),
+        top[j]->mutable_cpu_data());
+  }
+  CHECK(StartInternalThread()) << "Thread execution failed";
+}
+
 #ifdef CPU_ONLY
 STUB_GPU_FORWARD(HDF5DataLayer, Forward);
 #endif
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <vector>
 
 #include "hdf5.h"
@@ -6,15 +7,20 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
+// Buffers filled by Forward while the writer thread flushes another one.
+const int kHDF5OutputBuffers = 2;
+
 template <typename Dtype>
 void HDF5OutputLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   file_name_ = this->layer_param_.hdf5_output_param().file_name();
+  HDF5Lock lock;
   file_id_ = H5Fcreate(file_name_.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
                        H5P_DEFAULT);
   CHECK_GE(file_id_, 0) << "Failed to open HDF5 file" << file_name_;
@@ -23,6 +29,19 @@ void HDF5OutputLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
 
 template <typename Dtype>
 HDF5OutputLayer<Dtype>::~HDF5OutputLayer<Dtype>() {
+  if (is_started()) {
+    // Flush the partially filled buffer, then stop the writer.
+    if (buffer_ != NULL && buffer_->rows_ > 0) {
+      buffer_full_.push(buffer_);
+    }
+    buffer_full_.push(NULL);
+    CHECK(WaitForInternalThreadToExit()) << "Thread joining failed";
+  }
+  HDF5Lock lock;
+  if (data_dataset_id_ >= 0) {
+    H5Dclose(data_dataset_id_);
+    H5Dclose(label_dataset_id_);
+  }
   if (file_opened_) {
     herr_t status = H5Fclose(file_id_);
     CHECK_GE(status, 0) << "Failed to close HDF5 file " << file_name_;
@@ -40,11 +59,101 @@ void HDF5OutputLayer<Dtype>::SaveBlobs() {
   LOG(INFO) << "Successfully saved " << data_blob_.num() << " rows";
 }
 
+// Creates the datasets and buffers from the shape of the first batch and
+// starts the writer thread.
+template <typename Dtype>
+void HDF5OutputLayer<Dtype>::SetUpAppend(const vector<Blob<Dtype>*>& bottom) {
+  const HDF5OutputParameter& param = this->layer_param_.hdf5_output_param();
+  const int num = bottom[0]->num();
+  const int chunk_rows = param.chunk_rows() > 0 ? param.chunk_rows() : num;
+  const int buffer_rows = std::max<int>(param.buffer_batches(), 1) * num;
+  std::vector<hsize_t> data_dims(3);
+  data_dims[0] = bottom[0]->channels();
+  data_dims[1] = bottom[0]->height();
+  data_dims[2] = bottom[0]->width();
+  std::vector<hsize_t> label_dims(3);
+  label_dims[0] = bottom[1]->channels();
+  label_dims[1] = bottom[1]->height();
+  label_dims[2] = bottom[1]->width();
+  data_dataset_id_ = hdf5_create_extendible_dataset<Dtype>(file_id_,
+      HDF5_DATA_DATASET_NAME, data_dims, chunk_rows, param.compression());
+  label_dataset_id_ = hdf5_create_extendible_dataset<Dtype>(file_id_,
+      HDF5_DATA_LABEL_NAME, label_dims, chunk_rows, param.compression());
+  for (int i = 0; i < kHDF5OutputBuffers; ++i) {
+    shared_ptr<HDF5OutputBuffer<Dtype> > buffer(new HDF5OutputBuffer<Dtype>());
+    buffer->data_.Reshape(buffer_rows, bottom[0]->channels(),
+        bottom[0]->height(), bottom[0]->width());
+    buffer->label_.Reshape(buffer_rows, bottom[1]->channels(),
+        bottom[1]->height(), bottom[1]->width());
+    buffers_.push_back(buffer);
+    buffer_free_.push(buffer.get());
+  }
+  DLOG(INFO) << "Appending to " << file_name_ << " in writes of "
+             << buffer_rows << " rows";
+  CHECK(StartInternalThread()) << "Thread execution failed";
+}
+
+template <typename Dtype>
+void HDF5OutputLayer<Dtype>::BufferBatch(const vector<Blob<Dtype>*>& bottom,
+    const Dtype* data, const Dtype* label) {
+  if (buffers_.empty()) {
+    SetUpAppend(bottom);
+  }
+  const int data_datum_dim = bottom[0]->count() / bottom[0]->num();
+  const int label_datum_dim = bottom[1]->count() / bottom[1]->num();
+  const Blob<Dtype>& data_shape = buffers_[0]->data_;
+  const Blob<Dtype>& label_shape = buffers_[0]->label_;
+  CHECK_EQ(data_datum_dim, data_shape.count() / data_shape.num())
+      << "data rows must keep their shape when appending";
+  CHECK_EQ(label_datum_dim, label_shape.count() / label_shape.num())
+      << "label rows must keep their shape when appending";
+  const int num = bottom[0]->num();
+  int copied = 0;
+  while (copied < num) {
+    if (buffer_ == NULL) {
+      buffer_ = buffer_free_.pop("Waiting for HDF5 writer");
+      buffer_->rows_ = 0;
+    }
+    const int rows = std::min(buffer_->data_.num() - buffer_->rows_,
+        num - copied);
+    caffe_copy(rows * data_datum_dim, data + copied * data_datum_dim,
+        buffer_->data_.mutable_cpu_data() + buffer_->rows_ * data_datum_dim);
+    caffe_copy(rows * label_datum_dim, label + copied * label_datum_dim,
+        buffer_->label_.mutable_cpu_data() +
+        buffer_->rows_ * label_datum_dim);
+    buffer_->rows_ += rows;
+    copied += rows;
+    if (buffer_->rows_ == buffer_->data_.num()) {
+      buffer_full_.push(buffer_);
+      buffer_ = NULL;
+    }
+  }
+}
+
+template <typename Dtype>
+void HDF5OutputLayer<Dtype>::InternalThreadEntry() {
+  CPUTimer timer;
+  while (HDF5OutputBuffer<Dtype>* buffer = buffer_full_.pop()) {
+    timer.Start();
+    hdf5_append_nd_dataset_rows(data_dataset_id_, buffer->rows_,
+        buffer->data_.cpu_data());
+    hdf5_append_nd_dataset_rows(label_dataset_id_, buffer->rows_,
+        buffer->label_.cpu_data());
+    DLOG(INFO) << "Appended " << buffer->rows_ << " rows to " << file_name_
+               << " in " << timer.MilliSeconds() << " ms.";
+    buffer_free_.push(buffer);
+  }
+}
+
 template <typename Dtype>
 void HDF5OutputLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   CHECK_GE(bottom.size(), 2);
   CHECK_EQ(bottom[0]->num(), bottom[1]->num());
+  if (this->layer_param_.hdf5_output_param().append()) {
+    BufferBatch(bottom, bottom[0]->cpu_data(), bottom[1]->cpu_data());
+    return;
+  }
   data_blob_.Reshape(bottom[0]->num(), bottom[0]->channels(),
                      bottom[0]->height(), bottom[0]->width());
   label_blob_.Reshape(bottom[1]->num(), bottom[1]->channels(),
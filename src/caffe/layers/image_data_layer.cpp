@@ -9,6 +9,7 @@
 #include "caffe/data_layers.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/benchmark.hpp"
+#include "caffe/util/image_cache.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
@@ -31,6 +32,9 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   CHECK((new_height == 0 && new_width == 0) ||
       (new_height > 0 && new_width > 0)) << "Current implementation requires "
       "new_height and new_width to be set at the same time.";
+  if (this->layer_param_.image_data_param().has_cache()) {
+    ImageCache::Get().Reserve(this->layer_param_.image_data_param().cache());
+  }
   // Read the file with filenames and labels
   const string& source = this->layer_param_.image_data_param().source();
   LOG(INFO) << "Opening file " << source;
@@ -61,7 +65,8 @@ void ImageDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   // Read an image, and use it to initialize the top blob.
   cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-                                    new_height, new_width, is_color);
+      new_height, new_width, is_color,
+      this->layer_param_.image_data_param().scaled_decode());
   const int channels = cv_img.channels();
   const int height = cv_img.rows;
   const int width = cv_img.cols;
@@ -108,6 +113,7 @@ void ImageDataLayer<Dtype>::InternalThreadEntry() {
   const int new_width = image_data_param.new_width();
   const int crop_size = this->layer_param_.transform_param().crop_size();
   const bool is_color = image_data_param.is_color();
+  const bool scaled_decode = image_data_param.scaled_decode();
   string root_folder = image_data_param.root_folder();
 
   // Reshape on single input batches for inputs of varying dimension.
@@ -129,8 +135,9 @@ void ImageDataLayer<Dtype>::InternalThreadEntry() {
     // get a blob
     timer.Start();
     CHECK_GT(lines_size, lines_id_);
-    cv::Mat cv_img = ReadImageToCVMat(root_folder + lines_[lines_id_].first,
-        new_height, new_width, is_color);
+    cv::Mat cv_img = ImageCache::Get().ReadImage(
+        root_folder + lines_[lines_id_].first, new_height, new_width,
+        is_color, scaled_decode);
     CHECK(cv_img.data) << "Could not load " << lines_[lines_id_].first;
     read_time += timer.MicroSeconds();
     timer.Start();
@@ -156,6 +163,9 @@ void ImageDataLayer<Dtype>::InternalThreadEntry() {
   DLOG(INFO) << "Prefetch batch: " << batch_timer.MilliSeconds() << " ms.";
   DLOG(INFO) << "     Read time: " << read_time / 1000 << " ms.";
   DLOG(INFO) << "Transform time: " << trans_time / 1000 << " ms.";
+  if (ImageCache::Get().enabled()) {
+    DLOG(INFO) << ImageCache::Get().DebugString();
+  }
 }
 
 INSTANTIATE_CLASS(ImageDataLayer);
@@ -4,7 +4,11 @@
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/util/half.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/packed_gemm.hpp"
+#include "caffe/util/quantize.hpp"
+#include "caffe/util/sparse.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -40,6 +44,14 @@ void InnerProductLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     }
   }  // parameter initialization
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  if (this->layer_param_.has_quantization_param()) {
+    CHECK_EQ(this->phase_, TEST) << "Quantized layers only run the TEST "
+        << "phase: training ignores quantization_param and its relu";
+    CHECK_GT(this->layer_param_.quantization_param().bottom_range(), 0)
+        << "A quantized layer needs the range of its bottom";
+    CHECK_EQ(this->layer_param_.inner_product_param().weight_precision(),
+        FLOAT32) << "Quantized weights are int8";
+  }
 }
 
 template <typename Dtype>
@@ -60,11 +72,34 @@ void InnerProductLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
+  if (this->layer_param_.has_quantization_param()) {
+    forward_cpu_s8(bottom, top);
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  const Dtype* weight = this->blobs_[0]->cpu_data();
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
-      bottom_data, weight, (Dtype)0., top_data);
+  const Precision precision =
+      this->layer_param_.inner_product_param().weight_precision();
+  if (precision != FLOAT32 && this->phase_ == TEST) {
+    // Stores the weights in 16 bits once, and again after they are written.
+    // Training keeps them in Dtype, since every update would round them.
+    this->blobs_[0]->StoreHalf(precision);
+    gemm_half_cpu(M_, N_, K_, bottom_data, this->blobs_[0]->cpu_half_data(),
+        precision, top_data);
+  } else if (this->phase_ == TEST && update_sparse_weights(*this->blobs_[0],
+      N_, this->layer_param_.inner_product_param().sparse_density(),
+      &sparse_weights_)) {
+    gemm_sparse_trans_cpu(M_, bottom_data, sparse_weights_, top_data);
+  } else if (this->phase_ == TEST &&
+      this->layer_param_.inner_product_param().prepack_weights()) {
+    // Packs the weights once, and again after they are written.
+    update_packed_weights(*this->blobs_[0], N_, 1, &packed_weights_);
+    gemm_packed_cpu(packed_weights_, 0, true, M_, bottom_data, top_data);
+  } else {
+    const Dtype* weight = this->blobs_[0]->cpu_data();
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M_, N_, K_, (Dtype)1.,
+        bottom_data, weight, (Dtype)0., top_data);
+  }
   if (bias_term_) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, 1, (Dtype)1.,
         bias_multiplier_.cpu_data(),
@@ -72,10 +107,30 @@ void InnerProductLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+void InnerProductLayer<Dtype>::forward_cpu_s8(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const QuantizationParameter& quantization_param =
+      this->layer_param_.quantization_param();
+  update_quantized_weights(*this->blobs_[0], N_, &weights_s8_);
+  const Dtype bottom_scale = Dtype(127) / quantization_param.bottom_range();
+  bottom_s8_.resize(M_ * K_);
+  top_s32_.resize(M_ * N_);
+  quantize_s8_cpu(M_ * K_, bottom_scale, bottom[0]->cpu_data(),
+      &bottom_s8_[0]);
+  gemm_s8_cpu(true, M_, N_, K_, &bottom_s8_[0], &weights_s8_.data[0],
+      &top_s32_[0]);
+  dequantize_s8_cpu(false, M_, N_, &top_s32_[0], bottom_scale,
+      &weights_s8_.scales[0], bias_term_ ? this->blobs_[1]->cpu_data() : NULL,
+      quantization_param.relu(), top[0]->mutable_cpu_data());
+}
+
 template <typename Dtype>
 void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
+  CHECK(!this->layer_param_.has_quantization_param())
+      << "Backward is not implemented for quantized layers";
   if (this->param_propagate_down_[0]) {
     const Dtype* top_diff = top[0]->cpu_diff();
     const Dtype* bottom_data = bottom[0]->cpu_data();
@@ -92,9 +147,11 @@ void InnerProductLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   }
   if (propagate_down[0]) {
     const Dtype* top_diff = top[0]->cpu_diff();
-    // Gradient with respect to bottom data
+    // Gradient with respect to bottom data, added to the diff if it is
+    // shared with other layers.
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, K_, N_, (Dtype)1.,
-        top_diff, this->blobs_[0]->cpu_data(), (Dtype)0.,
+        top_diff, this->blobs_[0]->cpu_data(),
+        (Dtype)(this->accumulate_bottom_diff(0) ? 1. : 0.),
         bottom[0]->mutable_cpu_diff());
   }
 }
@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/common_layers.hpp"
+#include "caffe/layer.hpp"
+
+namespace caffe {
+
+// Transposes each of the num rows x cols matrices of `in` into `out`, in
+// tiles that fit in cache.
+template <typename Dtype>
+static void TransposeBatch(const Dtype* in, const int num, const int rows,
+    const int cols, Dtype* out) {
+  const int kTile = 32;
+  for (int n = 0; n < num; ++n) {
+    for (int r0 = 0; r0 < rows; r0 += kTile) {
+      const int r1 = std::min(r0 + kTile, rows);
+      for (int c0 = 0; c0 < cols; c0 += kTile) {
+        const int c1 = std::min(c0 + kTile, cols);
+        for (int r = r0; r < r1; ++r) {
+          for (int c = c0; c < c1; ++c) {
+            out[c * rows + r] = in[r * cols + c];
+          }
+        }
+      }
+    }
+    in += rows * cols;
+    out += rows * cols;
+  }
+}
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  CHECK_NE(top[0], bottom[0]) << this->type() << " Layer does not "
+      "allow in-place computation.";
+  top[0]->ReshapeLike(*bottom[0]);
+}
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  const int spatial_dim = bottom[0]->height() * bottom[0]->width();
+  if (this->layer_param_.layout() == NHWC) {
+    TransposeBatch(bottom[0]->cpu_data(), bottom[0]->num(),
+        bottom[0]->channels(), spatial_dim, top[0]->mutable_cpu_data());
+  } else {
+    TransposeBatch(bottom[0]->cpu_data(), bottom[0]->num(), spatial_dim,
+        bottom[0]->channels(), top[0]->mutable_cpu_data());
+  }
+}
+
+template <typename Dtype>
+void LayoutLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (!propagate_down[0]) { return; }
+  const int spatial_dim = bottom[0]->height() * bottom[0]->width();
+  if (this->layer_param_.layout() == NHWC) {
+    TransposeBatch(top[0]->cpu_diff(), top[0]->num(), spatial_dim,
+        top[0]->channels(), bottom[0]->mutable_cpu_diff());
+  } else {
+    TransposeBatch(top[0]->cpu_diff(), top[0]->num(), top[0]->channels(),
+        spatial_dim, bottom[0]->mutable_cpu_diff());
+  }
+}
+
+INSTANTIATE_CLASS(LayoutLayer);
+REGISTER_LAYER_CLASS(Layout);
+
+}  // namespace caffe
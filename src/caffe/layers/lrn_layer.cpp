@@ -1,7 +1,10 @@
+#include <boost/bind.hpp>
+
 #include <vector>
 
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -106,6 +109,10 @@ void LRNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void LRNLayer<Dtype>::CrossChannelForward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (this->layer_param_.layout() == NHWC) {
+    CrossChannelForwardNHWC_cpu(bottom, top);
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   Dtype* scale_data = scale_.mutable_cpu_data();
@@ -113,19 +120,41 @@ void LRNLayer<Dtype>::CrossChannelForward_cpu(
   for (int i = 0; i < scale_.count(); ++i) {
     scale_data[i] = k_;
   }
+  // go through the images
+  parallel_for(num_, GrainSize(channels_ * height_ * width_ * 4),
+      boost::bind(&LRNLayer<Dtype>::CrossChannelScale_cpu, this,
+          bottom_data, scale_data, _1, _2));
+
+  // In the end, compute output
+  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, top_data);
+  caffe_mul<Dtype>(scale_.count(), top_data, bottom_data, top_data);
+}
+
+// y += alpha * x, as caffe_axpy, for the pool tasks that must not call BLAS
+// (see thread_pool.hpp).
+template <typename Dtype>
+static inline void AddScaled(const int n, const Dtype alpha, const Dtype* x,
+    Dtype* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] += alpha * x[i];
+  }
+}
+
+template <typename Dtype>
+void LRNLayer<Dtype>::CrossChannelScale_cpu(const Dtype* bottom_data,
+    Dtype* scale_data, int begin, int end) {
   Blob<Dtype> padded_square(1, channels_ + size_ - 1, height_, width_);
   Dtype* padded_square_data = padded_square.mutable_cpu_data();
   caffe_set(padded_square.count(), Dtype(0), padded_square_data);
   Dtype alpha_over_size = alpha_ / size_;
-  // go through the images
-  for (int n = 0; n < num_; ++n) {
+  for (int n = begin; n < end; ++n) {
     // compute the padded square
     caffe_sqr(channels_ * height_ * width_,
-        bottom_data + bottom[0]->offset(n),
+        bottom_data + scale_.offset(n),
         padded_square_data + padded_square.offset(0, pre_pad_));
     // Create the first channel scale
     for (int c = 0; c < size_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
+      AddScaled(height_ * width_, alpha_over_size,
           padded_square_data + padded_square.offset(0, c),
           scale_data + scale_.offset(n, 0));
     }
@@ -135,17 +164,48 @@ void LRNLayer<Dtype>::CrossChannelForward_cpu(
           scale_data + scale_.offset(n, c - 1),
           scale_data + scale_.offset(n, c));
       // add head
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
+      AddScaled(height_ * width_, alpha_over_size,
           padded_square_data + padded_square.offset(0, c + size_ - 1),
           scale_data + scale_.offset(n, c));
       // subtract tail
-      caffe_axpy<Dtype>(height_ * width_, -alpha_over_size,
+      AddScaled(height_ * width_, -alpha_over_size,
           padded_square_data + padded_square.offset(0, c - 1),
           scale_data + scale_.offset(n, c));
     }
   }
+}
 
-  // In the end, compute output
+// In NHWC the channels of each pixel are contiguous, so the window of each
+// channel slides over one short vector instead of over whole planes.
+template <typename Dtype>
+void LRNLayer<Dtype>::CrossChannelForwardNHWC_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  Dtype* scale_data = scale_.mutable_cpu_data();
+  const Dtype alpha_over_size = alpha_ / size_;
+  const int post_pad = size_ - 1 - pre_pad_;
+  vector<Dtype> square(channels_);
+  const int pixels = num_ * height_ * width_;
+  for (int i = 0; i < pixels; ++i) {
+    const Dtype* in = bottom_data + i * channels_;
+    Dtype* scale = scale_data + i * channels_;
+    caffe_sqr(channels_, in, &square[0]);
+    // The sum of the squares of channels [c - pre_pad_, c + post_pad].
+    Dtype window = 0;
+    for (int c = 0; c < post_pad && c < channels_; ++c) {
+      window += square[c];
+    }
+    for (int c = 0; c < channels_; ++c) {
+      if (c + post_pad < channels_) {
+        window += square[c + post_pad];
+      }
+      if (c - pre_pad_ - 1 >= 0) {
+        window -= square[c - pre_pad_ - 1];
+      }
+      scale[c] = k_ + alpha_over_size * window;
+    }
+  }
   caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, top_data);
   caffe_mul<Dtype>(scale_.count(), top_data, bottom_data, top_data);
 }
@@ -163,6 +223,8 @@ void LRNLayer<Dtype>::WithinChannelForward(
 template <typename Dtype>
 void LRNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  CHECK_EQ(this->layer_param_.layout(), NCHW)
+      << "Backward is only implemented for NCHW";
   switch (this->layer_param_.lrn_param().norm_region()) {
   case LRNParameter_NormRegion_ACROSS_CHANNELS:
     CrossChannelBackward_cpu(top, propagate_down, bottom);
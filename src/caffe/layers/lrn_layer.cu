@@ -56,6 +56,8 @@ __global__ void LRNFillScale(const int nthreads, const Dtype* in,
 template <typename Dtype>
 void LRNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
+  CHECK_EQ(this->layer_param_.layout(), NCHW)
+      << "The GPU only supports the NCHW layout";
   switch (this->layer_param_.lrn_param().norm_region()) {
   case LRNParameter_NormRegion_ACROSS_CHANNELS:
     CrossChannelForward_gpu(bottom, top);
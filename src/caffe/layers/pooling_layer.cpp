@@ -1,3 +1,5 @@
+#include <boost/bind.hpp>
+
 #include <algorithm>
 #include <cfloat>
 #include <vector>
@@ -6,6 +8,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -128,6 +131,10 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  if (this->layer_param_.layout() == NHWC) {
+    ForwardNHWC_cpu(bottom, top);
+    return;
+  }
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int top_count = top[0]->count();
@@ -148,88 +155,149 @@ void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       caffe_set(top_count, -1, mask);
     }
     caffe_set(top_count, Dtype(-FLT_MAX), top_data);
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_);
-            int wend = min(wstart + kernel_w_, width_);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            const int pool_index = ph * pooled_width_ + pw;
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                const int index = h * width_ + w;
-                if (bottom_data[index] > top_data[pool_index]) {
-                  top_data[pool_index] = bottom_data[index];
-                  if (use_top_mask) {
-                    top_mask[pool_index] = static_cast<Dtype>(index);
-                  } else {
-                    mask[pool_index] = index;
-                  }
-                }
+    parallel_for(top[0]->num() * channels_,
+        GrainSize(top[0]->offset(0, 1) * kernel_h_ * kernel_w_),
+        boost::bind(&PoolingLayer<Dtype>::MaxPoolPlanes_cpu, this,
+            bottom_data, top_data, mask, top_mask, _1, _2));
+    break;
+  case PoolingParameter_PoolMethod_AVE:
+    caffe_set(top_count, Dtype(0), top_data);
+    parallel_for(top[0]->num() * channels_,
+        GrainSize(top[0]->offset(0, 1) * kernel_h_ * kernel_w_),
+        boost::bind(&PoolingLayer<Dtype>::AvePoolPlanes_cpu, this,
+            bottom_data, top_data, _1, _2));
+    break;
+  case PoolingParameter_PoolMethod_STOCHASTIC:
+    NOT_IMPLEMENTED;
+    break;
+  default:
+    LOG(FATAL) << "Unknown pooling method.";
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::MaxPoolPlanes_cpu(const Dtype* bottom_data,
+    Dtype* top_data, int* mask, Dtype* top_mask, int begin, int end) {
+  const int bottom_dim = height_ * width_;
+  const int top_dim = pooled_height_ * pooled_width_;
+  for (int plane = begin; plane < end; ++plane) {
+    const Dtype* plane_data = bottom_data + plane * bottom_dim;
+    Dtype* plane_top = top_data + plane * top_dim;
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        int hstart = ph * stride_h_ - pad_h_;
+        int wstart = pw * stride_w_ - pad_w_;
+        int hend = min(hstart + kernel_h_, height_);
+        int wend = min(wstart + kernel_w_, width_);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        const int pool_index = ph * pooled_width_ + pw;
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            const int index = h * width_ + w;
+            if (plane_data[index] > plane_top[pool_index]) {
+              plane_top[pool_index] = plane_data[index];
+              if (top_mask) {
+                top_mask[plane * top_dim + pool_index] =
+                    static_cast<Dtype>(index);
+              } else {
+                mask[plane * top_dim + pool_index] = index;
               }
             }
           }
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
-        } else {
-          mask += top[0]->offset(0, 1);
-        }
       }
     }
-    break;
-  case PoolingParameter_PoolMethod_AVE:
-    for (int i = 0; i < top_count; ++i) {
-      top_data[i] = 0;
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::AvePoolPlanes_cpu(const Dtype* bottom_data,
+    Dtype* top_data, int begin, int end) {
+  const int bottom_dim = height_ * width_;
+  const int top_dim = pooled_height_ * pooled_width_;
+  for (int plane = begin; plane < end; ++plane) {
+    const Dtype* plane_data = bottom_data + plane * bottom_dim;
+    Dtype* plane_top = top_data + plane * top_dim;
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        int hstart = ph * stride_h_ - pad_h_;
+        int wstart = pw * stride_w_ - pad_w_;
+        int hend = min(hstart + kernel_h_, height_ + pad_h_);
+        int wend = min(wstart + kernel_w_, width_ + pad_w_);
+        int pool_size = (hend - hstart) * (wend - wstart);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        hend = min(hend, height_);
+        wend = min(wend, width_);
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            plane_top[ph * pooled_width_ + pw] +=
+                plane_data[h * width_ + w];
+          }
+        }
+        plane_top[ph * pooled_width_ + pw] /= pool_size;
+      }
     }
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                top_data[ph * pooled_width_ + pw] +=
-                    bottom_data[h * width_ + w];
+  }
+}
+
+// The channels of a pixel are contiguous, so each window position updates
+// all of them with one vectorizable loop.
+template <typename Dtype>
+void PoolingLayer<Dtype>::ForwardNHWC_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  CHECK_EQ(top.size(), 1) << "Pooling with a mask top only supports NCHW";
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  const bool max_pool = this->layer_param_.pooling_param().pool() ==
+      PoolingParameter_PoolMethod_MAX;
+  CHECK(max_pool || this->layer_param_.pooling_param().pool() ==
+      PoolingParameter_PoolMethod_AVE)
+      << "Only MAX and AVE pooling support NHWC";
+  for (int n = 0; n < bottom[0]->num(); ++n) {
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        int hstart = ph * stride_h_ - pad_h_;
+        int wstart = pw * stride_w_ - pad_w_;
+        int hend = min(hstart + kernel_h_, height_ + pad_h_);
+        int wend = min(wstart + kernel_w_, width_ + pad_w_);
+        const int pool_size = (hend - hstart) * (wend - wstart);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        hend = min(hend, height_);
+        wend = min(wend, width_);
+        Dtype* out = top_data + (ph * pooled_width_ + pw) * channels_;
+        caffe_set(channels_, max_pool ? Dtype(-FLT_MAX) : Dtype(0), out);
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            const Dtype* in = bottom_data + (h * width_ + w) * channels_;
+            if (max_pool) {
+              for (int c = 0; c < channels_; ++c) {
+                out[c] = in[c] > out[c] ? in[c] : out[c];
+              }
+            } else {
+              for (int c = 0; c < channels_; ++c) {
+                out[c] += in[c];
               }
             }
-            top_data[ph * pooled_width_ + pw] /= pool_size;
           }
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
+        if (!max_pool) {
+          caffe_scal(channels_, Dtype(1) / pool_size, out);
+        }
       }
     }
-    break;
-  case PoolingParameter_PoolMethod_STOCHASTIC:
-    NOT_IMPLEMENTED;
-    break;
-  default:
-    LOG(FATAL) << "Unknown pooling method.";
+    bottom_data += bottom[0]->offset(1);
+    top_data += top[0]->offset(1);
   }
 }
 
 template <typename Dtype>
 void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  CHECK_EQ(this->layer_param_.layout(), NCHW)
+      << "Backward is only implemented for NCHW";
   if (!propagate_down[0]) {
     return;
   }
@@ -2,10 +2,41 @@
 #include <vector>
 
 #include "caffe/layer.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
+template <typename Dtype>
+struct ReLUForwardRange {
+  const Dtype* bottom_data;
+  Dtype* top_data;
+  Dtype negative_slope;
+  void operator()(int begin, int end) const {
+    for (int i = begin; i < end; ++i) {
+      top_data[i] = std::max(bottom_data[i], Dtype(0))
+          + negative_slope * std::min(bottom_data[i], Dtype(0));
+    }
+  }
+};
+
+template <typename Dtype>
+struct ReLUBackwardRange {
+  const Dtype* bottom_data;
+  const Dtype* top_diff;
+  Dtype* bottom_diff;
+  Dtype negative_slope;
+  // Whether to add to bottom_diff (see Layer::accumulate_bottom_diff).
+  bool accumulate;
+  void operator()(int begin, int end) const {
+    for (int i = begin; i < end; ++i) {
+      const Dtype diff = top_diff[i] * ((bottom_data[i] > 0)
+          + negative_slope * (bottom_data[i] <= 0));
+      bottom_diff[i] = accumulate ? bottom_diff[i] + diff : diff;
+    }
+  }
+};
+
 template <typename Dtype>
 void ReLULayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
@@ -13,10 +44,8 @@ void ReLULayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int count = bottom[0]->count();
   Dtype negative_slope = this->layer_param_.relu_param().negative_slope();
-  for (int i = 0; i < count; ++i) {
-    top_data[i] = std::max(bottom_data[i], Dtype(0))
-        + negative_slope * std::min(bottom_data[i], Dtype(0));
-  }
+  ReLUForwardRange<Dtype> forward = { bottom_data, top_data, negative_slope };
+  parallel_for(count, GrainSize(1), forward);
 }
 
 template <typename Dtype>
@@ -29,10 +58,9 @@ void ReLULayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int count = bottom[0]->count();
     Dtype negative_slope = this->layer_param_.relu_param().negative_slope();
-    for (int i = 0; i < count; ++i) {
-      bottom_diff[i] = top_diff[i] * ((bottom_data[i] > 0)
-          + negative_slope * (bottom_data[i] <= 0));
-    }
+    ReLUBackwardRange<Dtype> backward = { bottom_data, top_diff, bottom_diff,
+        negative_slope, this->accumulate_bottom_diff(0) };
+    parallel_for(count, GrainSize(1), backward);
   }
 }
 
@@ -1,8 +1,11 @@
+#include <boost/bind.hpp>
+
 #include <algorithm>
 #include <vector>
 
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -27,33 +30,54 @@ void SoftmaxLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   Dtype* top_data = top[0]->mutable_cpu_data();
   Dtype* scale_data = scale_.mutable_cpu_data();
   int num = bottom[0]->num();
-  int channels = bottom[0]->channels();
   int dim = bottom[0]->count() / bottom[0]->num();
-  int spatial_dim = bottom[0]->height() * bottom[0]->width();
   caffe_copy(bottom[0]->count(), bottom_data, top_data);
+  // exp costs some 20 operations.
+  parallel_for(num, GrainSize(dim * 25),
+      boost::bind(&SoftmaxLayer<Dtype>::ForwardImages_cpu, this, bottom_data,
+          top_data, scale_data, _1, _2));
+}
+
+template <typename Dtype>
+void SoftmaxLayer<Dtype>::ForwardImages_cpu(const Dtype* bottom_data,
+    Dtype* top_data, Dtype* scale_data, int begin, int end) {
+  int channels = sum_multiplier_.count();
+  int spatial_dim = scale_.height() * scale_.width();
+  int dim = channels * spatial_dim;
   // We need to subtract the max to avoid numerical issues, compute the exp,
-  // and then normalize.
-  for (int i = 0; i < num; ++i) {
-    // initialize scale_data to the first plane
-    caffe_copy(spatial_dim, bottom_data + i * dim, scale_data);
+  // and then normalize. This runs in pool tasks, so it loops instead of
+  // calling BLAS (see thread_pool.hpp).
+  for (int i = begin; i < end; ++i) {
+    // Each image has its own plane of scale_.
+    Dtype* scale = scale_data + i * spatial_dim;
+    Dtype* top_image = top_data + i * dim;
+    // initialize scale to the first plane
+    caffe_copy(spatial_dim, bottom_data + i * dim, scale);
     for (int j = 0; j < channels; j++) {
       for (int k = 0; k < spatial_dim; k++) {
-        scale_data[k] = std::max(scale_data[k],
+        scale[k] = std::max(scale[k],
             bottom_data[i * dim + j * spatial_dim + k]);
       }
     }
     // subtraction
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, channels, spatial_dim,
-        1, -1., sum_multiplier_.cpu_data(), scale_data, 1., top_data + i * dim);
+    for (int j = 0; j < channels; j++) {
+      for (int k = 0; k < spatial_dim; k++) {
+        top_image[j * spatial_dim + k] -= scale[k];
+      }
+    }
     // exponentiation
-    caffe_exp<Dtype>(dim, top_data + i * dim, top_data + i * dim);
+    caffe_exp<Dtype>(dim, top_image, top_image);
     // sum after exp
-    caffe_cpu_gemv<Dtype>(CblasTrans, channels, spatial_dim, 1.,
-        top_data + i * dim, sum_multiplier_.cpu_data(), 0., scale_data);
+    caffe_set(spatial_dim, Dtype(0), scale);
+    for (int j = 0; j < channels; j++) {
+      for (int k = 0; k < spatial_dim; k++) {
+        scale[k] += top_image[j * spatial_dim + k];
+      }
+    }
     // division
     for (int j = 0; j < channels; j++) {
-      caffe_div(spatial_dim, top_data + top[0]->offset(i, j), scale_data,
-          top_data + top[0]->offset(i, j));
+      caffe_div(spatial_dim, top_data + i * dim + j * spatial_dim, scale,
+          top_data + i * dim + j * spatial_dim);
     }
   }
 }
@@ -5,19 +5,47 @@
 #include <vector>
 
 #include "caffe/layer.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
+template <typename Dtype>
+struct TanHForwardRange {
+  const Dtype* bottom_data;
+  Dtype* top_data;
+  void operator()(int begin, int end) const {
+    for (int i = begin; i < end; ++i) {
+      top_data[i] = tanh(bottom_data[i]);
+    }
+  }
+};
+
+template <typename Dtype>
+struct TanHBackwardRange {
+  const Dtype* top_data;
+  const Dtype* top_diff;
+  Dtype* bottom_diff;
+  // Whether to add to bottom_diff (see Layer::accumulate_bottom_diff).
+  bool accumulate;
+  void operator()(int begin, int end) const {
+    for (int i = begin; i < end; ++i) {
+      const Dtype tanhx = top_data[i];
+      const Dtype diff = top_diff[i] * (1 - tanhx * tanhx);
+      bottom_diff[i] = accumulate ? bottom_diff[i] + diff : diff;
+    }
+  }
+};
+
 template <typename Dtype>
 void TanHLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
   const int count = bottom[0]->count();
-  for (int i = 0; i < count; ++i) {
-    top_data[i] = tanh(bottom_data[i]);
-  }
+  TanHForwardRange<Dtype> forward = { bottom_data, top_data };
+  // tanh costs some 20 operations.
+  parallel_for(count, GrainSize(20), forward);
 }
 
 template <typename Dtype>
@@ -29,11 +57,9 @@ void TanHLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const Dtype* top_diff = top[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int count = bottom[0]->count();
-    Dtype tanhx;
-    for (int i = 0; i < count; ++i) {
-      tanhx = top_data[i];
-      bottom_diff[i] = top_diff[i] * (1 - tanhx * tanhx);
-    }
+    TanHBackwardRange<Dtype> backward = { top_data, top_diff, bottom_diff,
+        this->accumulate_bottom_diff(0) };
+    parallel_for(count, GrainSize(1), backward);
   }
 }
 
@@ -9,9 +9,11 @@
 #include "caffe/layer.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/insert_layouts.hpp"
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/rng.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -41,9 +43,25 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   FilterNet(in_param, &filtered_param);
   LOG(INFO) << "Initializing net from parameters: " << std::endl
             << filtered_param.DebugString();
+  if (filtered_param.accumulate_diffs() && Caffe::mode() != Caffe::CPU) {
+    LOG(INFO) << "Ignoring accumulate_diffs, which only nets on the CPU use";
+    filtered_param.set_accumulate_diffs(false);
+  }
   // Create a copy of filtered_param with splits added where necessary.
   NetParameter param;
   InsertSplits(filtered_param, &param);
+  // Run the layers that support it in another layout, converting around them.
+  map<string, string> layout_blobs;
+  if (param.layout() != NCHW) {
+    if (phase_ == TEST && !param.force_backward() &&
+        Caffe::mode() == Caffe::CPU) {
+      NetParameter split_param(param);
+      InsertLayouts(split_param, &param, &layout_blobs);
+    } else {
+      LOG(INFO) << "Ignoring the " << Layout_Name(param.layout())
+                << " layout, which only TEST nets on the CPU use";
+    }
+  }
   // Basically, build all the layers and set up its connections.
   name_ = param.name();
   map<string, int> blob_name_to_idx;
@@ -195,6 +213,9 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
       }
     }
   }
+  if (param.accumulate_diffs()) {
+    SetUpDiffAccumulation();
+  }
   // In the end, all remaining blobs are considered output blobs.
   for (set<string>::iterator it = available_blobs.begin();
       it != available_blobs.end(); ++it) {
@@ -208,12 +229,49 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   for (size_t layer_id = 0; layer_id < layer_names_.size(); ++layer_id) {
     layer_names_index_[layer_names_[layer_id]] = layer_id;
   }
+  SetUpLayoutViews(layout_blobs);
   GetLearningRateAndWeightDecay();
   debug_info_ = param.debug_info();
+  zero_copy_concat_ = param.zero_copy_concat();
+  replan_concats_ = false;
+  if (zero_copy_concat_) {
+    LOG(INFO) << "Concat bottoms written in place: " << PlanConcats();
+  }
+  if (param.checkpoint_size() > 0) {
+    SetUpCheckpoints(param);
+  }
+  layer_shapes_.resize(layers_.size());
+  layer_memory_.resize(layers_.size());
+  bucket_sizes_.assign(param.bucket_size().begin(), param.bucket_size().end());
+  std::sort(bucket_sizes_.begin(), bucket_sizes_.end());
+  if (!bucket_sizes_.empty()) {
+    SetUpBuckets(param);
+  }
   LOG(INFO) << "Network initialization done.";
   LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
 }
 
+template <typename Dtype>
+void Net<Dtype>::SetUpLayoutViews(const map<string, string>& layout_blobs) {
+  for (map<string, string>::const_iterator it = layout_blobs.begin();
+       it != layout_blobs.end(); ++it) {
+    if (has_blob(it->first)) {
+      continue;
+    }
+    LayerParameter layer_param;
+    layer_param.set_name(it->first + "_view");
+    layer_param.set_type("Layout");
+    layer_param.set_layout(NCHW);
+    shared_ptr<LayoutView> view(new LayoutView());
+    view->layer = LayerRegistry<Dtype>::CreateLayer(layer_param);
+    view->source = blobs_[blob_names_index_[it->second]];
+    view->blob.reset(new Blob<Dtype>());
+    view->memory = NULL;
+    view->version = 0;
+    layout_views_[it->first] = view;
+  }
+}
+
 template <typename Dtype>
 void Net<Dtype>::FilterNet(const NetParameter& param,
     NetParameter* param_filtered) {
@@ -457,6 +515,274 @@ void Net<Dtype>::GetLearningRateAndWeightDecay() {
   }
 }
 
+template <typename Dtype>
+void Net<Dtype>::SetUpCheckpoints(const NetParameter& param) {
+  if (phase_ != TRAIN || Caffe::mode() != Caffe::CPU) {
+    LOG(INFO) << "Ignoring the checkpoints, which only TRAIN nets on the CPU "
+              << "use";
+    return;
+  }
+  CHECK(!zero_copy_concat_)
+      << "checkpoint and zero_copy_concat cannot be used together";
+  const int num_layers = layers_.size();
+  vector<bool> checkpoint(num_layers, false);
+  for (int i = 0; i < param.checkpoint_size(); ++i) {
+    CHECK(has_layer(param.checkpoint(i)))
+        << "Unknown checkpoint layer " << param.checkpoint(i);
+    checkpoint[layer_names_index_[param.checkpoint(i)]] = true;
+  }
+  // Recomputing a data layer would read the next batch.
+  for (int i = 0; i < num_layers; ++i) {
+    checkpoint[i] = checkpoint[i] || bottom_vecs_[i].empty();
+  }
+  // The segment whose layers alone write and read each blob, before its
+  // checkpoint, or -1 for the kept blobs.
+  vector<int> blob_segment;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    layer_segment_.assign(num_layers, -1);
+    segment_begin_.clear();
+    segment_end_.clear();
+    int begin = 0;
+    for (int i = 0; i < num_layers; ++i) {
+      if (!checkpoint[i]) {
+        continue;
+      }
+      if (i > begin) {
+        for (int j = begin; j <= i; ++j) {
+          layer_segment_[j] = segment_begin_.size();
+        }
+        segment_begin_.push_back(begin);
+        segment_end_.push_back(i);
+      }
+      begin = i + 1;
+    }
+    const int kUnused = -2;
+    blob_segment.assign(blobs_.size(), kUnused);
+    for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+      blob_segment[net_input_blob_indices_[i]] = -1;
+    }
+    for (int i = 0; i < net_output_blob_indices_.size(); ++i) {
+      blob_segment[net_output_blob_indices_[i]] = -1;
+    }
+    for (int i = 0; i < num_layers; ++i) {
+      const int segment = layer_segment_[i];
+      for (int j = 0; j < bottom_id_vecs_[i].size(); ++j) {
+        int& blob = blob_segment[bottom_id_vecs_[i][j]];
+        blob = (blob == kUnused || blob == segment) ? segment : -1;
+      }
+      const int top_segment =
+          (segment >= 0 && i != segment_end_[segment]) ? segment : -1;
+      for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+        int& blob = blob_segment[top_id_vecs_[i][j]];
+        blob = (blob == kUnused || blob == top_segment) ? top_segment : -1;
+      }
+    }
+    // A layer working in place on a kept blob would apply twice if it were
+    // recomputed, so it becomes a checkpoint.
+    for (int i = 0; i < num_layers; ++i) {
+      for (int j = 0; j < top_id_vecs_[i].size() && !checkpoint[i]; ++j) {
+        const int blob_id = top_id_vecs_[i][j];
+        if (blob_segment[blob_id] < 0 &&
+            std::find(bottom_id_vecs_[i].begin(), bottom_id_vecs_[i].end(),
+                blob_id) != bottom_id_vecs_[i].end()) {
+          checkpoint[i] = true;
+          changed = true;
+        }
+      }
+    }
+  }
+  const int num_segments = segment_begin_.size();
+  segment_blob_ids_.assign(num_segments, vector<int>());
+  segment_released_.assign(num_segments, false);
+  segment_rng_.clear();
+  size_t freed = 0, total = 0;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    total += blobs_[blob_id]->count();
+    if (blob_segment[blob_id] >= 0) {
+      segment_blob_ids_[blob_segment[blob_id]].push_back(blob_id);
+      freed += blobs_[blob_id]->count();
+    }
+  }
+  int recomputed = 0;
+  for (int i = 0; i < num_segments; ++i) {
+    segment_rng_.push_back(shared_ptr<Caffe::RNG>(new Caffe::RNG()));
+    recomputed += segment_end_[i] - segment_begin_[i];
+  }
+  LOG(INFO) << "Checkpoints in " << num_segments << " segments free "
+            << freed * sizeof(Dtype) << " of " << total * sizeof(Dtype)
+            << " bytes of activations after forward, for " << recomputed
+            << " more layer forwards (out of " << num_layers
+            << ") in backward";
+}
+
+template <typename Dtype>
+void Net<Dtype>::ReleaseSegment(int segment) {
+  // Blobs sharing their memory with kept blobs, like the tops of a Split
+  // layer read in another segment, are not freed.
+  vector<bool> freed(blobs_.size(), false);
+  for (int i = 0; i < segment_blob_ids_[segment].size(); ++i) {
+    freed[segment_blob_ids_[segment][i]] = true;
+  }
+  set<SyncedMemory*> kept;
+  for (int blob_id = 0; blob_id < blobs_.size(); ++blob_id) {
+    if (!freed[blob_id] && blobs_[blob_id]->count() > 0) {
+      kept.insert(blobs_[blob_id]->data().get());
+    }
+  }
+  for (int i = 0; i < segment_blob_ids_[segment].size(); ++i) {
+    Blob<Dtype>* blob = blobs_[segment_blob_ids_[segment][i]].get();
+    if (blob->count() > 0 && !kept.count(blob->data().get())) {
+      blob->data()->release();
+    }
+  }
+  segment_released_[segment] = true;
+}
+
+template <typename Dtype>
+void Net<Dtype>::RecomputeSegment(int segment) {
+  // Replay the random numbers of the forward pass, e.g. for dropout masks.
+  const rng_t state = *caffe_rng();
+  *caffe_rng() = *static_cast<rng_t*>(segment_rng_[segment]->generator());
+  for (int i = segment_begin_[segment]; i < segment_end_[segment]; ++i) {
+    layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
+    layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+  }
+  *caffe_rng() = state;
+  segment_released_[segment] = false;
+}
+
+template <typename Dtype>
+void Net<Dtype>::SetUpDiffAccumulation() {
+  // The bottoms reading each version of each blob, keyed by the blob and the
+  // layer that last wrote it (-1 for the net inputs).
+  map<pair<int, int>, vector<pair<int, int> > > readers;
+  vector<int> last_writer(blobs_.size(), -1);
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int bottom_id = 0; bottom_id < bottom_vecs_[layer_id].size();
+         ++bottom_id) {
+      const int blob_id = bottom_id_vecs_[layer_id][bottom_id];
+      if (bottom_need_backward_[layer_id][bottom_id]) {
+        readers[make_pair(blob_id, last_writer[blob_id])].push_back(
+            make_pair(layer_id, bottom_id));
+      }
+    }
+    for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+      last_writer[top_id_vecs_[layer_id][top_id]] = layer_id;
+    }
+  }
+  // Backward runs the last reader first, which overwrites the diff; the
+  // others add to it.
+  int num_shared = 0;
+  for (map<pair<int, int>, vector<pair<int, int> > >::const_iterator it =
+       readers.begin(); it != readers.end(); ++it) {
+    const vector<pair<int, int> >& bottoms = it->second;
+    for (int i = 0; i + 1 < bottoms.size(); ++i) {
+      layers_[bottoms[i].first]->set_accumulate_bottom_diff(
+          bottoms[i].second, true);
+    }
+    num_shared += bottoms.size() > 1;
+  }
+  LOG(INFO) << "Blobs with diffs accumulated by their consumers: "
+            << num_shared;
+}
+
+template <typename Dtype>
+int Net<Dtype>::PlanConcats() {
+  // The layers writing each blob, in place or not; -1 for the net inputs.
+  vector<vector<int> > writers(blobs_.size());
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    writers[net_input_blob_indices_[i]].push_back(-1);
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+      writers[top_id_vecs_[layer_id][top_id]].push_back(layer_id);
+    }
+  }
+  vector<bool> planned(blobs_.size(), false);
+  int num_planned = 0;
+  concat_offsets_.assign(layers_.size(), vector<int>());
+  concat_slices_.assign(layers_.size(), vector<SyncedMemory*>());
+  concat_tops_.assign(layers_.size(), NULL);
+  replan_concats_ = false;
+  // From the last Concat back, so that a Concat feeding another one is a
+  // slice of it before its own bottoms become slices of its top.
+  for (int layer_id = layers_.size() - 1; layer_id >= 0; --layer_id) {
+    const LayerParameter& layer_param = layers_[layer_id]->layer_param();
+    if (layer_param.type() != "Concat") {
+      continue;
+    }
+    Blob<Dtype>* top = top_vecs_[layer_id][0];
+    const int concat_dim = layer_param.concat_param().concat_dim();
+    // Only then are the slices of the bottoms contiguous.
+    if (concat_dim != 0 && !(concat_dim == 1 && top->num() == 1)) {
+      continue;
+    }
+    concat_offsets_[layer_id].assign(bottom_vecs_[layer_id].size(), -1);
+    concat_slices_[layer_id].assign(bottom_vecs_[layer_id].size(), NULL);
+    concat_tops_[layer_id] = top->data().get();
+    int offset = 0;
+    for (int bottom_id = 0; bottom_id < bottom_vecs_[layer_id].size();
+         ++bottom_id) {
+      const int blob_id = bottom_id_vecs_[layer_id][bottom_id];
+      Blob<Dtype>* bottom = bottom_vecs_[layer_id][bottom_id];
+      // Data layers and inputs may replace the memory of their tops, and
+      // these layers alias their tops to other blobs on every Reshape.
+      bool can_share = !planned[blob_id];
+      for (int i = 0; i < writers[blob_id].size(); ++i) {
+        const int writer = writers[blob_id][i];
+        if (writer < 0 || bottom_vecs_[writer].empty()) {
+          can_share = false;
+        } else {
+          const string& type = layers_[writer]->layer_param().type();
+          can_share &= type != "Split" && type != "Flatten" &&
+              type != "SoftmaxWithLoss";
+        }
+      }
+      if (can_share) {
+        bottom->ShareSlice(*top, offset);
+        concat_offsets_[layer_id][bottom_id] = offset;
+        concat_slices_[layer_id][bottom_id] = bottom->data().get();
+        planned[blob_id] = true;
+        ++num_planned;
+      }
+      offset += bottom->count();
+    }
+  }
+  return num_planned;
+}
+
+template <typename Dtype>
+void Net<Dtype>::DropStaleConcatSlices(int layer_id) {
+  Blob<Dtype>* top = top_vecs_[layer_id][0];
+  const int concat_dim = layers_[layer_id]->layer_param().concat_param()
+      .concat_dim();
+  const bool contiguous = concat_dim == 0 || top->num() == 1;
+  int offset = 0;
+  for (int bottom_id = 0; bottom_id < bottom_vecs_[layer_id].size();
+       ++bottom_id) {
+    Blob<Dtype>* bottom = bottom_vecs_[layer_id][bottom_id];
+    const int planned_offset = concat_offsets_[layer_id][bottom_id];
+    if (planned_offset >= 0 && (!contiguous || offset != planned_offset ||
+        top->data().get() != concat_tops_[layer_id] ||
+        bottom->data().get() != concat_slices_[layer_id][bottom_id])) {
+      // The producer wrote into the old slice, which may overlap the new
+      // ones: move its data to memory of its own before the Concat copies.
+      if (bottom->data().get() == concat_slices_[layer_id][bottom_id]) {
+        Blob<Dtype> own(bottom->num(), bottom->channels(), bottom->height(),
+            bottom->width());
+        caffe_copy(bottom->count(), bottom->cpu_data(),
+            own.mutable_cpu_data());
+        bottom->ShareSlice(own, 0);
+      }
+      concat_offsets_[layer_id][bottom_id] = -1;
+      replan_concats_ = true;
+    }
+    offset += bottom->count();
+  }
+}
+
 template <typename Dtype>
 Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
   CHECK_GE(start, 0);
@@ -467,16 +793,155 @@ Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
       InputDebugInfo(i);
     }
   }
+  if (start == 0 && !bucket_sizes_.empty()) {
+    for (int i = 0; i < net_input_blobs_.size(); ++i) {
+      if (bucket_blobs_[net_input_blob_indices_[i]]) {
+        PadToBucket(net_input_blobs_[i]);
+      }
+    }
+  }
+  // Before any producer writes into the slices planned again.
+  if (start == 0 && replan_concats_) {
+    PlanConcats();
+  }
   for (int i = start; i <= end; ++i) {
+    const int segment = layer_segment_.empty() ? -1 : layer_segment_[i];
+    if (segment >= 0 && i == segment_begin_[segment]) {
+      *static_cast<rng_t*>(segment_rng_[segment]->generator()) =
+          *caffe_rng();
+    }
     // LOG(ERROR) << "Forwarding " << layer_names_[i];
-    layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
+    ReshapeLayer(i);
     Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+    if (!bucket_sizes_.empty()) {
+      for (int top_id = 0; top_id < top_vecs_[i].size(); ++top_id) {
+        if (bucket_blobs_[top_id_vecs_[i][top_id]]) {
+          PadToBucket(top_vecs_[i][top_id]);
+        }
+      }
+    }
     loss += layer_loss;
     if (debug_info_) { ForwardDebugInfo(i); }
+    // The segment can be recomputed if all of it ran.
+    if (segment >= 0 && i == segment_end_[segment] &&
+        segment_begin_[segment] >= start) {
+      ReleaseSegment(segment);
+    }
   }
   return loss;
 }
 
+template <typename Dtype>
+void Net<Dtype>::ReshapeLayer(int layer_id) {
+  const vector<Blob<Dtype>*>& bottom = bottom_vecs_[layer_id];
+  const vector<Blob<Dtype>*>& top = top_vecs_[layer_id];
+  const vector<int>& shapes = layer_shapes_[layer_id];
+  const vector<SyncedMemory*>& memory = layer_memory_[layer_id];
+  // Data layers have no bottoms to tell whether their tops change shape.
+  bool changed = bottom.empty() || shapes.empty();
+  for (int i = 0; !changed && i < bottom.size() + top.size(); ++i) {
+    const Blob<Dtype>* blob =
+        i < bottom.size() ? bottom[i] : top[i - bottom.size()];
+    changed = blob->num() != shapes[4 * i] ||
+        blob->channels() != shapes[4 * i + 1] ||
+        blob->height() != shapes[4 * i + 2] ||
+        blob->width() != shapes[4 * i + 3] ||
+        (blob->count() > 0 ? blob->data().get() : NULL) != memory[i];
+  }
+  if (changed) {
+    layers_[layer_id]->Reshape(bottom, top);
+    if (zero_copy_concat_ && !concat_offsets_[layer_id].empty()) {
+      DropStaleConcatSlices(layer_id);
+    }
+    RecordLayerShapes(layer_id);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::RecordLayerShapes(int layer_id) {
+  const vector<Blob<Dtype>*>& bottom = bottom_vecs_[layer_id];
+  const vector<Blob<Dtype>*>& top = top_vecs_[layer_id];
+  vector<int>& shapes = layer_shapes_[layer_id];
+  vector<SyncedMemory*>& memory = layer_memory_[layer_id];
+  shapes.clear();
+  memory.clear();
+  for (int i = 0; i < bottom.size() + top.size(); ++i) {
+    const Blob<Dtype>* blob =
+        i < bottom.size() ? bottom[i] : top[i - bottom.size()];
+    shapes.push_back(blob->num());
+    shapes.push_back(blob->channels());
+    shapes.push_back(blob->height());
+    shapes.push_back(blob->width());
+    memory.push_back(blob->count() > 0 ? blob->data().get() : NULL);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::SetUpBuckets(const NetParameter& param) {
+  // The blobs that data layers or the caller fill.
+  vector<bool> inputs(blobs_.size(), false);
+  for (int i = 0; i < net_input_blob_indices_.size(); ++i) {
+    inputs[net_input_blob_indices_[i]] = true;
+  }
+  for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+    if (bottom_vecs_[layer_id].empty()) {
+      for (int top_id = 0; top_id < top_id_vecs_[layer_id].size(); ++top_id) {
+        inputs[top_id_vecs_[layer_id][top_id]] = true;
+      }
+    }
+  }
+  bucket_blobs_.assign(blobs_.size(), false);
+  if (param.bucket_blob_size() > 0) {
+    for (int i = 0; i < param.bucket_blob_size(); ++i) {
+      const string& name = param.bucket_blob(i);
+      CHECK(blob_names_index_.count(name)) << "Unknown bucket blob " << name;
+      const int blob_id = blob_names_index_[name];
+      CHECK(inputs[blob_id]) << "Bucket blob " << name
+          << " is neither a net input nor a data layer top";
+      bucket_blobs_[blob_id] = true;
+    }
+  } else {
+    // The images come first: the first input, and the first top of the
+    // data layers, whose others are labels.
+    if (!net_input_blob_indices_.empty()) {
+      bucket_blobs_[net_input_blob_indices_[0]] = true;
+    }
+    for (int layer_id = 0; layer_id < layers_.size(); ++layer_id) {
+      if (bottom_vecs_[layer_id].empty() && !top_vecs_[layer_id].empty()) {
+        bucket_blobs_[top_id_vecs_[layer_id][0]] = true;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::PadToBucket(Blob<Dtype>* blob) {
+  const int height = blob->height();
+  const int width = blob->width();
+  vector<int>::const_iterator bucket = std::lower_bound(
+      bucket_sizes_.begin(), bucket_sizes_.end(), height);
+  const int padded_height = bucket == bucket_sizes_.end() ? height : *bucket;
+  bucket = std::lower_bound(bucket_sizes_.begin(), bucket_sizes_.end(), width);
+  const int padded_width = bucket == bucket_sizes_.end() ? width : *bucket;
+  if (padded_height == height && padded_width == width) {
+    return;
+  }
+  // The blob keeps the memory of the largest bucket it was padded to, so the
+  // smaller ones allocate nothing.
+  bucket_buffer_.CopyFrom(*blob, false, true);
+  blob->Reshape(blob->num(), blob->channels(), padded_height, padded_width);
+  const Dtype* source = bucket_buffer_.cpu_data();
+  Dtype* target = blob->mutable_cpu_data();
+  caffe_set(blob->count(), Dtype(0), target);
+  const int planes = blob->num() * blob->channels();
+  for (int p = 0; p < planes; ++p) {
+    for (int h = 0; h < height; ++h) {
+      caffe_copy(width, source + (p * height + h) * width,
+          target + (p * padded_height + h) * padded_width);
+    }
+  }
+}
+
 template <typename Dtype>
 Dtype Net<Dtype>::ForwardFrom(int start) {
   return ForwardFromTo(start, layers_.size() - 1);
@@ -726,11 +1191,20 @@ void Net<Dtype>::BackwardFromTo(int start, int end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
   for (int i = start; i >= end; --i) {
+    const int segment = layer_segment_.empty() ? -1 : layer_segment_[i];
     if (layer_need_backward_[i]) {
+      if (segment >= 0 && segment_released_[segment]) {
+        RecomputeSegment(segment);
+      }
       layers_[i]->Backward(
           top_vecs_[i], bottom_need_backward_[i], bottom_vecs_[i]);
       if (debug_info_) { BackwardDebugInfo(i); }
     }
+    // Free the segment again once its backward is done.
+    if (segment >= 0 && i == segment_begin_[segment] &&
+        !segment_released_[segment]) {
+      ReleaseSegment(segment);
+    }
   }
 }
 
@@ -876,6 +1350,11 @@ template <typename Dtype>
 void Net<Dtype>::Reshape() {
   for (int i = 0; i < layers_.size(); ++i) {
     layers_[i]->Reshape(bottom_vecs_[i], top_vecs_[i]);
+    RecordLayerShapes(i);
+  }
+  // A Reshape may have reallocated the tops of the Concat layers.
+  if (zero_copy_concat_) {
+    PlanConcats();
   }
 }
 
@@ -977,14 +1456,31 @@ void Net<Dtype>::Update() {
 
 template <typename Dtype>
 bool Net<Dtype>::has_blob(const string& blob_name) const {
-  return blob_names_index_.find(blob_name) != blob_names_index_.end();
+  return blob_names_index_.find(blob_name) != blob_names_index_.end() ||
+      layout_views_.find(blob_name) != layout_views_.end();
 }
 
 template <typename Dtype>
 const shared_ptr<Blob<Dtype> > Net<Dtype>::blob_by_name(
     const string& blob_name) const {
   shared_ptr<Blob<Dtype> > blob_ptr;
-  if (has_blob(blob_name)) {
+  typename map<string, shared_ptr<LayoutView> >::const_iterator view =
+      layout_views_.find(blob_name);
+  if (view != layout_views_.end()) {
+    // Converted to NCHW again only after the blob was written.
+    LayoutView& layout_view = *view->second;
+    const SyncedMemory* memory = layout_view.source->data().get();
+    const unsigned int version = memory->version();
+    if (memory != layout_view.memory || version != layout_view.version) {
+      vector<Blob<Dtype>*> bottom(1, layout_view.source.get());
+      vector<Blob<Dtype>*> top(1, layout_view.blob.get());
+      layout_view.layer->Reshape(bottom, top);
+      layout_view.layer->Forward(bottom, top);
+      layout_view.memory = memory;
+      layout_view.version = version;
+    }
+    blob_ptr = layout_view.blob;
+  } else if (blob_names_index_.find(blob_name) != blob_names_index_.end()) {
     blob_ptr = blobs_[blob_names_index_.find(blob_name)->second];
   } else {
     blob_ptr.reset((Blob<Dtype>*)(NULL));
@@ -9,6 +9,7 @@
 #include "caffe/solver.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 namespace caffe {
@@ -458,6 +459,31 @@ void SGDSolver<Dtype>::ClipGradients() {
   }
 }
 
+// The CPU update of SGDSolver for the elements [begin, end) of a parameter:
+// the regularized gradient goes into the history with momentum, and the
+// history into the diff.
+template <typename Dtype>
+struct SGDUpdateRange {
+  const Dtype* data;
+  Dtype* diff;
+  Dtype* history;
+  Dtype local_rate, local_decay;
+  bool l1;
+  Dtype momentum;
+  void operator()(int begin, int end) const {
+    for (int i = begin; i < end; ++i) {
+      Dtype gradient = diff[i];
+      if (local_decay) {
+        const Dtype decay = l1 ? Dtype((data[i] > 0) - (data[i] < 0)) :
+            data[i];
+        gradient += local_decay * decay;
+      }
+      history[i] = local_rate * gradient + momentum * history[i];
+      diff[i] = history[i];
+    }
+  }
+};
+
 template <typename Dtype>
 void SGDSolver<Dtype>::ComputeUpdateValue() {
   const vector<shared_ptr<Blob<Dtype> > >& net_params = this->net_->params();
@@ -475,38 +501,20 @@ void SGDSolver<Dtype>::ComputeUpdateValue() {
   string regularization_type = this->param_.regularization_type();
   switch (Caffe::mode()) {
   case Caffe::CPU:
+    CHECK(!weight_decay || regularization_type == "L2" ||
+        regularization_type == "L1")
+        << "Unknown regularization type: " << regularization_type;
     for (int param_id = 0; param_id < net_params.size(); ++param_id) {
-      // Compute the value to history, and then copy them to the blob's diff.
-      Dtype local_rate = rate * net_params_lr[param_id];
-      Dtype local_decay = weight_decay * net_params_weight_decay[param_id];
-
-      if (local_decay) {
-        if (regularization_type == "L2") {
-          // add weight decay
-          caffe_axpy(net_params[param_id]->count(),
-              local_decay,
-              net_params[param_id]->cpu_data(),
-              net_params[param_id]->mutable_cpu_diff());
-        } else if (regularization_type == "L1") {
-          caffe_cpu_sign(net_params[param_id]->count(),
-              net_params[param_id]->cpu_data(),
-              temp_[param_id]->mutable_cpu_data());
-          caffe_axpy(net_params[param_id]->count(),
-              local_decay,
-              temp_[param_id]->cpu_data(),
-              net_params[param_id]->mutable_cpu_diff());
-        } else {
-          LOG(FATAL) << "Unknown regularization type: " << regularization_type;
-        }
-      }
-
-      caffe_cpu_axpby(net_params[param_id]->count(), local_rate,
-                net_params[param_id]->cpu_diff(), momentum,
-                history_[param_id]->mutable_cpu_data());
-      // copy
-      caffe_copy(net_params[param_id]->count(),
-          history_[param_id]->cpu_data(),
-          net_params[param_id]->mutable_cpu_diff());
+      // Compute the value to history, and then copy them to the blob's diff,
+      // in one parallel pass.
+      SGDUpdateRange<Dtype> update = {
+          net_params[param_id]->cpu_data(),
+          net_params[param_id]->mutable_cpu_diff(),
+          history_[param_id]->mutable_cpu_data(),
+          rate * net_params_lr[param_id],
+          weight_decay * net_params_weight_decay[param_id],
+          regularization_type == "L1", momentum };
+      parallel_for(net_params[param_id]->count(), GrainSize(4), update);
     }
     break;
   case Caffe::GPU:
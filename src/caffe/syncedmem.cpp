@@ -6,6 +6,18 @@
 
 namespace caffe {
 
+SyncedMemory::SyncedMemory(const shared_ptr<SyncedMemory>& base,
+    size_t offset, size_t size)
+    : cpu_ptr_(NULL), gpu_ptr_(NULL), size_(size), head_(UNINITIALIZED),
+      own_cpu_data_(false), base_(base), offset_(offset), version_(0) {
+  // A view of a view is a view of the underlying memory.
+  if (base_->base_) {
+    offset_ += base_->offset_;
+    base_ = base_->base_;
+  }
+  CHECK_LE(offset_ + size_, base_->size());
+}
+
 SyncedMemory::~SyncedMemory() {
   if (cpu_ptr_ && own_cpu_data_) {
     CaffeFreeHost(cpu_ptr_);
@@ -69,22 +81,30 @@ inline void SyncedMemory::to_gpu() {
 }
 
 const void* SyncedMemory::cpu_data() {
+  if (base_) {
+    return static_cast<const char*>(base_->cpu_data()) + offset_;
+  }
   to_cpu();
   return (const void*)cpu_ptr_;
 }
 
 void SyncedMemory::set_cpu_data(void* data) {
   CHECK(data);
+  CHECK(!base_) << "Cannot set the data of a view";
   if (own_cpu_data_) {
     CaffeFreeHost(cpu_ptr_);
   }
   cpu_ptr_ = data;
   head_ = HEAD_AT_CPU;
   own_cpu_data_ = false;
+  ++version_;
 }
 
 const void* SyncedMemory::gpu_data() {
 #ifndef CPU_ONLY
+  if (base_) {
+    return static_cast<const char*>(base_->gpu_data()) + offset_;
+  }
   to_gpu();
   return (const void*)gpu_ptr_;
 #else
@@ -93,21 +113,48 @@ const void* SyncedMemory::gpu_data() {
 }
 
 void* SyncedMemory::mutable_cpu_data() {
+  if (base_) {
+    return static_cast<char*>(base_->mutable_cpu_data()) + offset_;
+  }
   to_cpu();
   head_ = HEAD_AT_CPU;
+  ++version_;
   return cpu_ptr_;
 }
 
 void* SyncedMemory::mutable_gpu_data() {
 #ifndef CPU_ONLY
+  if (base_) {
+    return static_cast<char*>(base_->mutable_gpu_data()) + offset_;
+  }
   to_gpu();
   head_ = HEAD_AT_GPU;
+  ++version_;
   return gpu_ptr_;
 #else
   NO_GPU;
 #endif
 }
 
+void SyncedMemory::release() {
+  if (base_) {
+    return;
+  }
+  if (cpu_ptr_ && own_cpu_data_) {
+    CaffeFreeHost(cpu_ptr_);
+  }
+  cpu_ptr_ = NULL;
+  own_cpu_data_ = false;
+#ifndef CPU_ONLY
+  if (gpu_ptr_) {
+    CUDA_CHECK(cudaFree(gpu_ptr_));
+    gpu_ptr_ = NULL;
+  }
+#endif  // CPU_ONLY
+  head_ = UNINITIALIZED;
+  ++version_;
+}
+
 
 }  // namespace caffe
 
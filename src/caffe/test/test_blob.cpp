@@ -54,6 +54,51 @@ TYPED_TEST(BlobSimpleTest, TestReshape) {
   EXPECT_EQ(this->blob_->count(), 120);
 }
 
+TYPED_TEST(BlobSimpleTest, TestStoreHalf) {
+  // Values exact in 16 bits survive StoreHalf, reads and a proto round trip
+  // in 16 bits; a write drops the 16-bit copy.
+  Blob<TypeParam>* blob = this->blob_preshaped_;
+  for (int i = 0; i < blob->count(); ++i) {
+    blob->mutable_cpu_data()[i] = (i - 60) * 0.25;
+  }
+  blob->StoreHalf(FLOAT16);
+  ASSERT_TRUE(blob->cpu_half_data());
+  BlobProto proto;
+  blob->ToProto(&proto);
+  EXPECT_EQ(0, proto.data_size());
+  EXPECT_EQ(blob->count() * 2, proto.half_data().size());
+  for (int i = 0; i < blob->count(); ++i) {
+    EXPECT_EQ((i - 60) * 0.25, blob->cpu_data()[i]);
+  }
+  Blob<TypeParam> copy;
+  copy.FromProto(proto);
+  for (int i = 0; i < copy.count(); ++i) {
+    EXPECT_EQ((i - 60) * 0.25, copy.cpu_data()[i]);
+  }
+  blob->mutable_cpu_data()[0] = 1;
+  EXPECT_FALSE(blob->cpu_half_data());
+  blob->StoreHalf(BFLOAT16);
+  EXPECT_EQ(1, blob->cpu_data()[0]);
+}
+
+TYPED_TEST(BlobSimpleTest, TestFromSparseProto) {
+  BlobProto proto;
+  proto.set_num(1);
+  proto.set_channels(2);
+  proto.set_height(3);
+  proto.set_width(4);
+  proto.add_sparse_index(3);
+  proto.add_data(1.5);
+  proto.add_sparse_index(17);
+  proto.add_data(-2);
+  Blob<TypeParam> blob;
+  blob.FromProto(proto);
+  ASSERT_EQ(24, blob.count());
+  for (int i = 0; i < blob.count(); ++i) {
+    EXPECT_EQ(i == 3 ? 1.5 : i == 17 ? -2 : 0, blob.cpu_data()[i]);
+  }
+}
+
 template <typename TypeParam>
 class BlobMathTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
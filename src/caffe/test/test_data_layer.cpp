@@ -104,6 +104,48 @@ class DataLayerTest : public MultiDeviceTest<TypeParam> {
     }
   }
 
+  // Reads batches of the whole db in random order, either through a
+  // shuffle buffer or by random access.
+  void TestReadShuffled(bool random_access) {
+    LayerParameter param;
+    param.set_phase(TRAIN);
+    DataParameter* data_param = param.mutable_data_param();
+    data_param->set_batch_size(5);
+    data_param->set_source(filename_->c_str());
+    data_param->set_backend(backend_);
+    if (random_access) {
+      data_param->set_random_access(true);
+    } else {
+      data_param->set_shuffle_buffer_size(3);
+    }
+    Caffe::set_random_seed(seed_);
+
+    DataLayer<Dtype> layer(param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    bool any_shuffled = false;
+    for (int iter = 0; iter < 20; ++iter) {
+      layer.Forward(blob_bottom_vec_, blob_top_vec_);
+      vector<int> num_label(5, 0);
+      for (int i = 0; i < 5; ++i) {
+        const int label = blob_top_label_->cpu_data()[i];
+        ASSERT_GE(label, 0);
+        ASSERT_LT(label, 5);
+        ++num_label[label];
+        any_shuffled |= (label != i);
+        for (int j = 0; j < 24; ++j) {
+          EXPECT_EQ(label, blob_top_data_->cpu_data()[i * 24 + j]);
+        }
+      }
+      if (random_access) {
+        // Every epoch, and here every batch, visits each record once.
+        for (int i = 0; i < 5; ++i) {
+          EXPECT_EQ(num_label[i], 1);
+        }
+      }
+    }
+    EXPECT_TRUE(any_shuffled);
+  }
+
   void TestReshape(DataParameter_DB backend) {
     const int num_inputs = 5;
     // Save data of varying shapes.
@@ -392,6 +434,26 @@ TYPED_TEST(DataLayerTest, TestReadLMDB) {
   this->TestRead();
 }
 
+TYPED_TEST(DataLayerTest, TestReadShuffleBufferLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadShuffled(false);
+}
+
+TYPED_TEST(DataLayerTest, TestReadRandomAccessLMDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LMDB);
+  this->TestReadShuffled(true);
+  // The second run reads the cached key index.
+  this->TestReadShuffled(true);
+}
+
+TYPED_TEST(DataLayerTest, TestReadRandomAccessLevelDB) {
+  const bool unique_pixels = false;  // all pixels the same; images different
+  this->Fill(unique_pixels, DataParameter_DB_LEVELDB);
+  this->TestReadShuffled(true);
+}
+
 TYPED_TEST(DataLayerTest, TestReshapeLMDB) {
   this->TestReshape(DataParameter_DB_LMDB);
 }
@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <string>
+#include <vector>
 
 #include "boost/scoped_ptr.hpp"
 #include "gtest/gtest.h"
@@ -7,6 +9,7 @@
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/db.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/sharded_db.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -116,6 +119,24 @@ TYPED_TEST(DBTest, TestKeyValue) {
   EXPECT_FALSE(cursor->valid());
 }
 
+TYPED_TEST(DBTest, TestSeekToKey) {
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  cursor->WillNeed("fish-bike.jpg");
+  EXPECT_TRUE(cursor->SeekToKey("fish-bike.jpg"));
+  EXPECT_TRUE(cursor->valid());
+  EXPECT_EQ(cursor->key(), "fish-bike.jpg");
+  Datum datum;
+  datum.ParseFromString(cursor->value());
+  EXPECT_EQ(datum.label(), 1);
+  EXPECT_TRUE(cursor->SeekToKey("cat.jpg"));
+  EXPECT_EQ(cursor->key(), "cat.jpg");
+  cursor->Next();
+  EXPECT_EQ(cursor->key(), "fish-bike.jpg");
+  EXPECT_FALSE(cursor->SeekToKey("dog.jpg"));
+}
+
 TYPED_TEST(DBTest, TestWrite) {
   scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
   db->Open(this->source_, db::WRITE);
@@ -131,4 +152,153 @@ TYPED_TEST(DBTest, TestWrite) {
   txn->Commit();
 }
 
+TYPED_TEST(DBTest, TestBulkLoad) {
+  string source;
+  MakeTempDir(&source);
+  source += "/bulk";
+  scoped_ptr<db::DB> db(db::GetDB(TypeParam::backend));
+  db->SetBulkLoad(true, true, false);
+  db->Open(source, db::NEW);
+  const int kNumKeys = 100;
+  char key[16];
+  for (int i = 0; i < kNumKeys; i += 10) {
+    scoped_ptr<db::Transaction> txn(db->NewTransaction());
+    for (int j = i; j < i + 10; ++j) {
+      snprintf(key, sizeof(key), "%08d", j);
+      txn->Put(key, string(j + 1, 'x'));
+    }
+    txn->Commit();
+  }
+  db->Close();
+  db->Open(source, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  for (int i = 0; i < kNumKeys; ++i) {
+    ASSERT_TRUE(cursor->valid());
+    snprintf(key, sizeof(key), "%08d", i);
+    EXPECT_EQ(cursor->key(), key);
+    EXPECT_EQ(cursor->value(), string(i + 1, 'x'));
+    cursor->Next();
+  }
+  EXPECT_FALSE(cursor->valid());
+}
+
+template <typename TypeParam>
+class ShardedDBTest : public DBTest<TypeParam> {
+ protected:
+  ShardedDBTest() : num_shards_(3), num_keys_(10) {}
+
+  virtual void SetUp() {
+    MakeTempDir(&source_);
+    source_ += "/sharded";
+    db::ShardedDB db;
+    db.SetShardLayout(TypeParam::backend == DataParameter_DB_LMDB ?
+        "lmdb" : "leveldb", num_shards_);
+    db.SetBulkLoad(true, false, false);
+    db.Open(source_, db::NEW);
+    scoped_ptr<db::Transaction> txn(db.NewTransaction());
+    for (int i = 0; i < num_keys_; ++i) {
+      txn->Put(Key(i), string(i + 1, 'x'));
+    }
+    txn->Commit();
+  }
+
+  string Key(int i) {
+    char key[16];
+    snprintf(key, sizeof(key), "%08d", i);
+    return key;
+  }
+
+  // Reads one epoch, checking that the values match the keys.
+  vector<string> ReadEpoch(db::Cursor* cursor) {
+    vector<string> keys;
+    while (cursor->valid()) {
+      keys.push_back(cursor->key());
+      EXPECT_EQ(cursor->value(), string(atoi(keys.back().c_str()) + 1, 'x'));
+      cursor->Next();
+    }
+    return keys;
+  }
+
+  const int num_shards_;
+  const int num_keys_;
+  string source_;
+};
+
+TYPED_TEST_CASE(ShardedDBTest, TestTypes);
+
+TYPED_TEST(ShardedDBTest, TestManifest) {
+  EXPECT_TRUE(db::ShardedDB::IsSharded(this->source_));
+  EXPECT_FALSE(db::ShardedDB::IsSharded(this->source_ + "/shard_00000"));
+  db::ShardedDB db;
+  db.Open(this->source_, db::READ);
+  ASSERT_EQ(db.manifest().shard_size(), this->num_shards_);
+  EXPECT_EQ(db.manifest().num_records(0), 4);
+  EXPECT_EQ(db.manifest().num_records(1), 3);
+  EXPECT_EQ(db.manifest().num_records(2), 3);
+}
+
+TYPED_TEST(ShardedDBTest, TestInterleavedOrder) {
+  // Shards are interleaved round-robin, one record per shard whichever
+  // reader reads it, which restores the write order for any number of
+  // readers.
+  for (int num_readers = 1; num_readers <= 4; ++num_readers) {
+    DataParameter param;
+    param.set_source(this->source_);
+    param.set_shard_readers(num_readers);
+    scoped_ptr<db::DB> db(db::GetDB(param));
+    db->Open(this->source_, db::READ);
+    scoped_ptr<db::Cursor> cursor(db->NewCursor());
+    for (int epoch = 0; epoch < 2; ++epoch) {
+      vector<string> keys = this->ReadEpoch(cursor.get());
+      ASSERT_EQ(keys.size(), this->num_keys_);
+      for (int i = 0; i < this->num_keys_; ++i) {
+        EXPECT_EQ(keys[i], this->Key(i));
+      }
+      cursor->SeekToFirst();
+    }
+  }
+}
+
+TYPED_TEST(ShardedDBTest, TestRanks) {
+  DataParameter param;
+  param.set_source(this->source_);
+  param.set_shard_rank(1);
+  param.set_num_shard_ranks(2);
+  scoped_ptr<db::DB> db(db::GetDB(param));
+  db->Open(this->source_, db::READ);
+  scoped_ptr<db::Cursor> cursor(db->NewCursor());
+  vector<string> keys = this->ReadEpoch(cursor.get());
+  ASSERT_EQ(keys.size(), 3);
+  EXPECT_EQ(keys[0], this->Key(1));
+  EXPECT_EQ(keys[1], this->Key(4));
+  EXPECT_EQ(keys[2], this->Key(7));
+}
+
+TYPED_TEST(ShardedDBTest, TestDeterministicShuffle) {
+  DataParameter param;
+  param.set_source(this->source_);
+  param.set_shard_readers(2);
+  param.set_shuffle_shards(true);
+  param.set_shard_seed(1701);
+  vector<vector<string> > epochs[2];
+  for (int run = 0; run < 2; ++run) {
+    scoped_ptr<db::DB> db(db::GetDB(param));
+    db->Open(this->source_, db::READ);
+    scoped_ptr<db::Cursor> cursor(db->NewCursor());
+    for (int epoch = 0; epoch < 4; ++epoch) {
+      epochs[run].push_back(this->ReadEpoch(cursor.get()));
+      cursor->SeekToFirst();
+    }
+  }
+  for (int epoch = 0; epoch < 4; ++epoch) {
+    EXPECT_TRUE(epochs[0][epoch] == epochs[1][epoch]);
+    vector<string> sorted = epochs[0][epoch];
+    std::sort(sorted.begin(), sorted.end());
+    ASSERT_EQ(sorted.size(), this->num_keys_);
+    for (int i = 0; i < this->num_keys_; ++i) {
+      EXPECT_EQ(sorted[i], this->Key(i));
+    }
+  }
+}
+
 }  // namespace caffe
@@ -134,4 +134,46 @@ TYPED_TEST(HDF5DataLayerTest, TestRead) {
   }
 }
 
+TYPED_TEST(HDF5DataLayerTest, TestReadShuffled) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter param;
+  param.add_top("data");
+  param.add_top("label");
+  param.add_top("label2");
+
+  HDF5DataParameter* hdf5_data_param = param.mutable_hdf5_data_param();
+  const int batch_size = 5;
+  hdf5_data_param->set_batch_size(batch_size);
+  hdf5_data_param->set_source(*(this->filename));
+  hdf5_data_param->set_shuffle(true);
+  const int data_size = 8 * 6 * 5;
+  // Two files of 10 rows each.
+  const int num_rows = 20;
+
+  HDF5DataLayer<Dtype> layer(param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int pass = 0; pass < 3; ++pass) {
+    // Every row is seen exactly once per pass, with its own labels.
+    vector<int> seen(num_rows, 0);
+    for (int iter = 0; iter < num_rows / batch_size; ++iter) {
+      layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+      for (int i = 0; i < batch_size; ++i) {
+        const Dtype* data = this->blob_top_data_->cpu_data() + i * data_size;
+        const int file_offset = (data[0] >= 2400) ? 2400 : 0;
+        const int row = (data[0] - file_offset) / data_size;
+        EXPECT_EQ(file_offset + row * data_size, data[0]);
+        for (int j = 1; j < data_size; ++j) {
+          EXPECT_EQ(data[0] + j, data[j]);
+        }
+        EXPECT_EQ(row + 1, this->blob_top_label_->cpu_data()[i]);
+        EXPECT_EQ(row + 2, this->blob_top_label2_->cpu_data()[i]);
+        ++seen[(file_offset ? 10 : 0) + row];
+      }
+    }
+    for (int r = 0; r < num_rows; ++r) {
+      EXPECT_EQ(1, seen[r]) << "row " << r << " pass " << pass;
+    }
+  }
+}
+
 }  // namespace caffe
@@ -0,0 +1,72 @@
+#include <stdint.h>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/host_allocator.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class HostAllocatorTest : public ::testing::Test {};
+
+TEST_F(HostAllocatorTest, TestAlignment) {
+  HostAllocator allocator;
+  const size_t sizes[] = { 1, 100, 4096, 100000, 3 << 20 };
+  for (int i = 0; i < 5; ++i) {
+    void* ptr = allocator.Allocate(sizes[i]);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(ptr) % 64);
+    EXPECT_GE(HostAllocator::SizeClass(sizes[i]), sizes[i]);
+    allocator.Free(ptr);
+  }
+  EXPECT_EQ(0, allocator.bytes_in_use());
+}
+
+TEST_F(HostAllocatorTest, TestPoolReuse) {
+  HostAllocator allocator;
+  void* ptr = allocator.Allocate(1 << 20);
+  EXPECT_EQ(1 << 20, allocator.bytes_in_use());
+  allocator.Free(ptr);
+  EXPECT_EQ(1 << 20, allocator.pooled_bytes());
+  // A slightly smaller buffer is in the same size class.
+  EXPECT_EQ(ptr, allocator.Allocate(1000000));
+  EXPECT_EQ(1, allocator.pool_hits());
+  EXPECT_EQ(0, allocator.pooled_bytes());
+  allocator.Free(ptr);
+  allocator.Trim();
+  EXPECT_EQ(0, allocator.pooled_bytes());
+  EXPECT_EQ(1 << 20, allocator.peak_bytes_in_use());
+}
+
+TEST_F(HostAllocatorTest, TestPoolLimit) {
+  HostAllocator allocator;
+  allocator.set_pool_limit(1 << 20);
+  void* a = allocator.Allocate(1 << 20);
+  void* b = allocator.Allocate(1 << 20);
+  allocator.Free(a);
+  allocator.Free(b);
+  EXPECT_EQ(1 << 20, allocator.pooled_bytes());
+}
+
+TEST_F(HostAllocatorTest, TestMallocMode) {
+  HostAllocator allocator;
+  allocator.set_mode(HostAllocator::MALLOC);
+  allocator.Free(allocator.Allocate(1 << 20));
+  EXPECT_EQ(0, allocator.pooled_bytes());
+  allocator.Free(allocator.Allocate(1 << 20));
+  EXPECT_EQ(0, allocator.pool_hits());
+}
+
+TEST_F(HostAllocatorTest, TestHugePages) {
+  HostAllocator allocator;
+  allocator.set_huge_pages(true);
+  char* ptr = static_cast<char*>(allocator.Allocate(5 << 20));
+  EXPECT_EQ(0, reinterpret_cast<uintptr_t>(ptr) % 64);
+  ptr[0] = 1;
+  ptr[(5 << 20) - 1] = 1;
+  allocator.Free(ptr);
+  EXPECT_EQ(HostAllocator::SizeClass(5 << 20), allocator.pooled_bytes());
+}
+
+}  // namespace caffe
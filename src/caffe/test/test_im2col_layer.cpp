@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -115,4 +116,71 @@ TYPED_TEST(Im2colLayerTest, TestRectGradient) {
       this->blob_top_vec_);
 }
 
+// Checks every output of the layer, and its backward pass, against im2col
+// and col2im computed element by element, for the kernel and stride sizes
+// that im2col_cpu and col2im_cpu specialize, and for a generic one.
+TYPED_TEST(Im2colLayerTest, TestSpecializations) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int kConfigs[][3] = {
+    // kernel, stride, pad
+    {1, 1, 0}, {1, 1, 1}, {3, 3, 0}, {3, 1, 1}, {3, 2, 1}, {5, 1, 2},
+    {11, 4, 1}, {4, 3, 2}
+  };
+  Blob<Dtype> bottom(2, 3, 13, 12);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&bottom);
+  vector<Blob<Dtype>*> bottom_vec(1, &bottom);
+  for (int i = 0; i < sizeof(kConfigs) / sizeof(kConfigs[0]); ++i) {
+    const int kernel = kConfigs[i][0];
+    const int stride = kConfigs[i][1];
+    const int pad = kConfigs[i][2];
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->set_kernel_size(kernel);
+    convolution_param->set_stride(stride);
+    convolution_param->set_pad(pad);
+    Im2colLayer<Dtype> layer(layer_param);
+    layer.SetUp(bottom_vec, this->blob_top_vec_);
+    layer.Forward(bottom_vec, this->blob_top_vec_);
+    Blob<Dtype>* top = this->blob_top_;
+    filler.Fill(top);
+    caffe_copy(top->count(), top->cpu_data(), top->mutable_cpu_diff());
+    vector<bool> propagate_down(1, true);
+    layer.Backward(this->blob_top_vec_, propagate_down, bottom_vec);
+    Blob<Dtype> expected_diff(2, 3, 13, 12);
+    Dtype* expected = expected_diff.mutable_cpu_data();
+    caffe_set(expected_diff.count(), Dtype(0), expected);
+    layer.Forward(bottom_vec, this->blob_top_vec_);
+    for (int n = 0; n < top->num(); ++n) {
+      for (int c = 0; c < top->channels(); ++c) {
+        const int c_im = c / (kernel * kernel);
+        const int h_offset = (c / kernel) % kernel;
+        const int w_offset = c % kernel;
+        for (int h = 0; h < top->height(); ++h) {
+          for (int w = 0; w < top->width(); ++w) {
+            const int h_im = h * stride - pad + h_offset;
+            const int w_im = w * stride - pad + w_offset;
+            if (h_im < 0 || h_im >= bottom.height() || w_im < 0 ||
+                w_im >= bottom.width()) {
+              EXPECT_EQ(0, top->data_at(n, c, h, w));
+              continue;
+            }
+            EXPECT_EQ(bottom.data_at(n, c_im, h_im, w_im),
+                top->data_at(n, c, h, w)) << "kernel " << kernel
+                << " stride " << stride << " pad " << pad;
+            expected[bottom.offset(n, c_im, h_im, w_im)] +=
+                top->diff_at(n, c, h, w);
+          }
+        }
+      }
+    }
+    for (int j = 0; j < bottom.count(); ++j) {
+      EXPECT_NEAR(expected[j], bottom.cpu_diff()[j], 1e-4)
+          << "kernel " << kernel << " stride " << stride << " pad " << pad;
+    }
+  }
+}
+
 }  // namespace caffe
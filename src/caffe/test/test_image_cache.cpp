@@ -0,0 +1,95 @@
+#include <opencv2/core/core.hpp>
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/image_cache.hpp"
+#include "caffe/util/io.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ImageCacheTest : public ::testing::Test {
+ protected:
+  // A 1 MB image filled with `value`.
+  cv::Mat MakeImage(int value) {
+    return cv::Mat(512, 1024, CV_8UC2, cv::Scalar(value, value));
+  }
+
+  bool Equal(const cv::Mat& a, const cv::Mat& b) {
+    return a.size() == b.size() && a.type() == b.type() &&
+        cv::countNonZero(a.reshape(1) != b.reshape(1)) == 0;
+  }
+};
+
+TEST_F(ImageCacheTest, TestDisabled) {
+  ImageCache cache;
+  EXPECT_FALSE(cache.enabled());
+  cache.Insert("a", MakeImage(1));
+  EXPECT_FALSE(cache.Lookup("a").data);
+  EXPECT_EQ(0, cache.memory_bytes());
+}
+
+TEST_F(ImageCacheTest, TestLRU) {
+  ImageCache cache;
+  ImageCacheParameter param;
+  param.set_size_mb(2);
+  cache.Reserve(param);
+  ASSERT_TRUE(cache.enabled());
+  EXPECT_FALSE(cache.Lookup("a").data);
+  cache.Insert("a", MakeImage(1));
+  cache.Insert("b", MakeImage(2));
+  EXPECT_EQ(2 << 20, cache.memory_bytes());
+  // Touch "a" so that "b" is the least recently used.
+  EXPECT_TRUE(Equal(MakeImage(1), cache.Lookup("a")));
+  cache.Insert("c", MakeImage(3));
+  EXPECT_EQ(2 << 20, cache.memory_bytes());
+  EXPECT_FALSE(cache.Lookup("b").data);
+  EXPECT_TRUE(Equal(MakeImage(1), cache.Lookup("a")));
+  EXPECT_TRUE(Equal(MakeImage(3), cache.Lookup("c")));
+  EXPECT_EQ(3, cache.hits());
+  EXPECT_EQ(2, cache.misses());
+}
+
+TEST_F(ImageCacheTest, TestSpill) {
+  ImageCache cache;
+  ImageCacheParameter param;
+  param.set_size_mb(1);
+  string spill_file;
+  MakeTempFilename(&spill_file);
+  param.set_spill_file(spill_file);
+  param.set_spill_size_mb(4);
+  cache.Reserve(param);
+  cache.Insert("a", MakeImage(1));
+  cache.Insert("b", MakeImage(2));
+  // "a" was evicted to the spill file and comes back from it.
+  EXPECT_EQ(1 << 20, cache.spill_bytes());
+  EXPECT_TRUE(Equal(MakeImage(1), cache.Lookup("a")));
+  EXPECT_EQ(1, cache.spill_hits());
+  EXPECT_TRUE(Equal(MakeImage(2), cache.Lookup("b")));
+  EXPECT_TRUE(Equal(MakeImage(1), cache.Lookup("a")));
+  EXPECT_EQ(0, cache.misses());
+}
+
+TEST_F(ImageCacheTest, TestReadImage) {
+  ImageCache cache;
+  ImageCacheParameter param;
+  param.set_size_mb(16);
+  cache.Reserve(param);
+  string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
+  cv::Mat reference = ReadImageToCVMat(filename, 100, 200, true);
+  cv::Mat image = cache.ReadImage(filename, 100, 200, true);
+  EXPECT_TRUE(Equal(reference, image));
+  EXPECT_EQ(1, cache.misses());
+  image = cache.ReadImage(filename, 100, 200, true);
+  EXPECT_TRUE(Equal(reference, image));
+  EXPECT_EQ(1, cache.hits());
+  // Decoding differently is a different image.
+  cache.ReadImage(filename, 100, 200, false);
+  EXPECT_EQ(2, cache.misses());
+}
+
+}  // namespace caffe
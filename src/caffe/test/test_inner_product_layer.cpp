@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -85,6 +86,210 @@ TYPED_TEST(InnerProductLayerTest, TestForward) {
   }
 }
 
+TYPED_TEST(InnerProductLayerTest, TestForwardQuantized) {
+  // The int8 forward pass is close to the float one with the same weights.
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    return;
+  }
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_weight_filler()->set_std(0.1);
+  inner_product_param->mutable_bias_filler()->set_type("uniform");
+  InnerProductLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> expected;
+  expected.CopyFrom(*this->blob_top_, false, true);
+  // The bottom is uniform in [0, 1].
+  layer_param.set_phase(TEST);
+  layer_param.mutable_quantization_param()->set_bottom_range(1);
+  InnerProductLayer<Dtype> quantized_layer(layer_param);
+  quantized_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    quantized_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  quantized_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_NEAR(expected.cpu_data()[i], this->blob_top_->cpu_data()[i], 0.05);
+  }
+  // The weights are quantized again once written.
+  Blob<Dtype>* weights = layer.blobs()[0].get();
+  caffe_scal(weights->count(), Dtype(-2), weights->mutable_cpu_data());
+  quantized_layer.blobs()[0]->CopyFrom(*weights);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  expected.CopyFrom(*this->blob_top_, false, true);
+  quantized_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_NEAR(expected.cpu_data()[i], this->blob_top_->cpu_data()[i], 0.1);
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardHalf) {
+  // Weights kept in 16 bits give the float result up to their rounding, in
+  // the TEST phase.
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    return;
+  }
+  LayerParameter layer_param;
+  layer_param.set_phase(TEST);
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("uniform");
+  InnerProductLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> expected;
+  expected.CopyFrom(*this->blob_top_, false, true);
+  const Precision precisions[] = { FLOAT16, BFLOAT16 };
+  const Dtype tolerances[] = { 1e-2, 1e-1 };
+  for (int p = 0; p < 2; ++p) {
+    inner_product_param->set_weight_precision(precisions[p]);
+    InnerProductLayer<Dtype> half_layer(layer_param);
+    half_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      half_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+    }
+    half_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    EXPECT_TRUE(half_layer.blobs()[0]->cpu_half_data());
+    for (int i = 0; i < expected.count(); ++i) {
+      EXPECT_NEAR(expected.cpu_data()[i], this->blob_top_->cpu_data()[i],
+          tolerances[p]);
+    }
+  }
+  // Training keeps the weights in full precision.
+  layer_param.set_phase(TRAIN);
+  InnerProductLayer<Dtype> train_layer(layer_param);
+  train_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  train_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_FALSE(train_layer.blobs()[0]->cpu_half_data());
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardHalfShared) {
+  // A TEST layer keeping in 16 bits the weights it shares with a training
+  // layer converts them again after training writes them.
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    return;
+  }
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("uniform");
+  InnerProductLayer<Dtype> train_layer(layer_param);
+  train_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer_param.set_phase(TEST);
+  inner_product_param->set_weight_precision(FLOAT16);
+  InnerProductLayer<Dtype> test_layer(layer_param);
+  test_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < train_layer.blobs().size(); ++i) {
+    test_layer.blobs()[i]->ShareData(*train_layer.blobs()[i]);
+  }
+  Blob<Dtype> expected;
+  for (int pass = 0; pass < 2; ++pass) {
+    if (pass == 1) {
+      Blob<Dtype>* weights = train_layer.blobs()[0].get();
+      caffe_scal(weights->count(), Dtype(-2), weights->mutable_cpu_data());
+    }
+    train_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    expected.CopyFrom(*this->blob_top_, false, true);
+    test_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < expected.count(); ++i) {
+      EXPECT_NEAR(expected.cpu_data()[i], this->blob_top_->cpu_data()[i],
+          2e-2);
+    }
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardSparse) {
+  // Pruned weights give the same result in sparse form, in the TEST phase.
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    return;
+  }
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("uniform");
+  InnerProductLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  Dtype* weights = layer.blobs()[0]->mutable_cpu_data();
+  for (int i = 0; i < layer.blobs()[0]->count(); ++i) {
+    if (i % 10 != 0) {
+      weights[i] = 0;
+    }
+  }
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> expected;
+  expected.CopyFrom(*this->blob_top_, false, true);
+  layer_param.set_phase(TEST);
+  InnerProductLayer<Dtype> sparse_layer(layer_param);
+  sparse_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    sparse_layer.blobs()[i]->ShareData(*layer.blobs()[i]);
+  }
+  sparse_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_NEAR(expected.cpu_data()[i], this->blob_top_->cpu_data()[i], 1e-4);
+  }
+  // Writing the shared weights through the other layer is seen.
+  caffe_set(layer.blobs()[0]->count(), Dtype(0),
+      layer.blobs()[0]->mutable_cpu_data());
+  sparse_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype* bias = layer.blobs()[1]->cpu_data();
+  for (int i = 0; i < expected.count(); ++i) {
+    EXPECT_NEAR(bias[i % 10], this->blob_top_->cpu_data()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(InnerProductLayerTest, TestForwardPrepacked) {
+  // Prepacked weights give the same result in the TEST phase, and are packed
+  // again after they are written.
+  typedef typename TypeParam::Dtype Dtype;
+  if (Caffe::mode() != Caffe::CPU) {
+    return;
+  }
+  LayerParameter layer_param;
+  InnerProductParameter* inner_product_param =
+      layer_param.mutable_inner_product_param();
+  inner_product_param->set_num_output(10);
+  inner_product_param->mutable_weight_filler()->set_type("gaussian");
+  inner_product_param->mutable_bias_filler()->set_type("uniform");
+  InnerProductLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer_param.set_phase(TEST);
+  inner_product_param->set_prepack_weights(true);
+  InnerProductLayer<Dtype> packed_layer(layer_param);
+  packed_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    packed_layer.blobs()[i]->ShareData(*layer.blobs()[i]);
+  }
+  Blob<Dtype> expected;
+  for (int pass = 0; pass < 2; ++pass) {
+    if (pass == 1) {
+      caffe_scal(layer.blobs()[0]->count(), Dtype(-2),
+          layer.blobs()[0]->mutable_cpu_data());
+    }
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    expected.CopyFrom(*this->blob_top_, false, true);
+    packed_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    for (int i = 0; i < expected.count(); ++i) {
+      EXPECT_NEAR(expected.cpu_data()[i], this->blob_top_->cpu_data()[i],
+          1e-4);
+    }
+  }
+}
+
 TYPED_TEST(InnerProductLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
   bool IS_VALID_CUDA = false;
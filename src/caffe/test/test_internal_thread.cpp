@@ -1,7 +1,10 @@
+#include <boost/thread.hpp>
+
 #include "glog/logging.h"
 #include "gtest/gtest.h"
 
 #include "caffe/internal_thread.hpp"
+#include "caffe/util/numa.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 
@@ -19,5 +22,36 @@ TEST_F(InternalThreadTest, TestStartAndExit) {
   EXPECT_FALSE(thread.is_started());
 }
 
+class NumaNodeThread : public InternalThread {
+ public:
+  NumaNodeThread() : node_(-2) {}
+  int node() const { return node_; }
+
+ protected:
+  virtual void InternalThreadEntry() { node_ = CurrentNumaNode(); }
+
+  int node_;
+};
+
+// Binds a thread to the last node and starts a NumaNodeThread from it.
+static void StartFromNumaNode(NumaNodeThread* thread) {
+  BindThreadToNumaNode(NumaNodeCount() - 1);
+  thread->StartInternalThread();
+  thread->WaitForInternalThreadToExit();
+}
+
+TEST_F(InternalThreadTest, TestNumaNode) {
+  ASSERT_GE(NumaNodeCount(), 1);
+  EXPECT_FALSE(NumaNodeCpus(0).empty());
+  NumaNodeThread unbound;
+  unbound.StartInternalThread();
+  unbound.WaitForInternalThreadToExit();
+  EXPECT_EQ(-1, unbound.node());
+  // Threads run on the node of the thread that starts them.
+  NumaNodeThread bound;
+  boost::thread(&StartFromNumaNode, &bound).join();
+  EXPECT_EQ(NumaNodeCount() - 1, bound.node());
+}
+
 }  // namespace caffe
 
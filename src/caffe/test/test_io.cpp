@@ -419,4 +419,65 @@ TEST_F(IOTest, TestDecodeDatumToCVMatContentNative) {
   }
 }
 
+#ifdef USE_LIBJPEG
+TEST_F(IOTest, TestReadJPEGHeader) {
+  string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
+  string data;
+  ASSERT_TRUE(ReadFileToString(filename, &data));
+  int height, width, channels;
+  EXPECT_TRUE(ReadJPEGHeader(data, &height, &width, &channels));
+  EXPECT_EQ(360, height);
+  EXPECT_EQ(480, width);
+  EXPECT_EQ(3, channels);
+  EXPECT_FALSE(ReadJPEGHeader("not a jpeg", &height, &width, &channels));
+}
+
+TEST_F(IOTest, TestDecodeJPEGScaled) {
+  string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
+  string data;
+  ASSERT_TRUE(ReadFileToString(filename, &data));
+  // 1/4 would be 90 rows, so the image is decoded at 1/2.
+  cv::Mat cv_img = DecodeJPEGToCVMat(data, true, 100, 100);
+  EXPECT_EQ(3, cv_img.channels());
+  EXPECT_EQ(180, cv_img.rows);
+  EXPECT_EQ(240, cv_img.cols);
+  cv_img = DecodeJPEGToCVMat(data, false, 0, 0);
+  EXPECT_EQ(1, cv_img.channels());
+  EXPECT_EQ(360, cv_img.rows);
+  EXPECT_EQ(480, cv_img.cols);
+  cv_img = ReadImageToCVMat(filename, 100, 100, true, true);
+  EXPECT_EQ(100, cv_img.rows);
+  EXPECT_EQ(100, cv_img.cols);
+}
+
+TEST_F(IOTest, TestDecodeJPEGCrop) {
+  string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
+  string data;
+  ASSERT_TRUE(ReadFileToString(filename, &data));
+  cv::Mat cv_img_ref = DecodeJPEGToCVMat(data, true, 0, 0);
+  cv::Mat cv_img = DecodeJPEGCropToCVMat(data, true, 37, 101, 227, 227);
+  ASSERT_EQ(227, cv_img.rows);
+  ASSERT_EQ(227, cv_img.cols);
+  for (int h = 0; h < cv_img.rows; ++h) {
+    for (int w = 0; w < cv_img.cols; ++w) {
+      for (int c = 0; c < 3; ++c) {
+        // Upsampling at the crop edges may differ by a rounding step.
+        EXPECT_NEAR(cv_img_ref.at<cv::Vec3b>(h + 37, w + 101)[c],
+            cv_img.at<cv::Vec3b>(h, w)[c], 1);
+      }
+    }
+  }
+}
+
+TEST_F(IOTest, TestDecodeJPEGBadCrop) {
+  // Crops out of the image give an empty image, for the callers to fall
+  // back to OpenCV.
+  string filename = EXAMPLES_SOURCE_DIR "images/cat.jpg";
+  string data;
+  ASSERT_TRUE(ReadFileToString(filename, &data));
+  EXPECT_FALSE(DecodeJPEGCropToCVMat(data, true, 200, 300, 227, 227).data);
+  EXPECT_FALSE(DecodeJPEGCropToCVMat(data, true, -1, 0, 227, 227).data);
+}
+#endif  // USE_LIBJPEG
+
 }  // namespace caffe
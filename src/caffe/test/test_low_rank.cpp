@@ -0,0 +1,90 @@
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/low_rank.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class LowRankTest : public ::testing::Test {
+ protected:
+  LowRankTest() : M_(20), N_(15) {}
+
+  virtual void SetUp() {
+    Caffe::set_random_seed(1701);
+    // W = a * b, of rank 3, with singular values far apart.
+    const int kRank = 3;
+    std::vector<Dtype> a(M_ * kRank);
+    std::vector<Dtype> b(kRank * N_);
+    caffe_rng_gaussian<Dtype>(a.size(), Dtype(0), Dtype(1), &a[0]);
+    caffe_rng_gaussian<Dtype>(b.size(), Dtype(0), Dtype(1), &b[0]);
+    for (int k = 0; k < kRank; ++k) {
+      caffe_scal<Dtype>(N_, Dtype(std::pow(4., -k)), &b[k * N_]);
+    }
+    W_.resize(M_ * N_);
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, kRank,
+        (Dtype)1., &a[0], &b[0], (Dtype)0., &W_[0]);
+  }
+
+  // The sum of the squares of the elements of W - U V.
+  Dtype Residual(const int rank, const Dtype* U, const Dtype* V) {
+    std::vector<Dtype> residual(W_);
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, M_, N_, rank,
+        (Dtype)-1., U, V, (Dtype)1., &residual[0]);
+    return caffe_cpu_dot<Dtype>(residual.size(), &residual[0], &residual[0]);
+  }
+
+  const int M_;
+  const int N_;
+  std::vector<Dtype> W_;
+};
+
+TYPED_TEST_CASE(LowRankTest, TestDtypes);
+
+TYPED_TEST(LowRankTest, TestExactRank) {
+  const int M = this->M_;
+  const int N = this->N_;
+  const int kRank = 3;
+  std::vector<TypeParam> U(M * kRank);
+  std::vector<TypeParam> V(kRank * N);
+  std::vector<TypeParam> energies(kRank);
+  low_rank_cpu(M, N, &this->W_[0], kRank, &U[0], &V[0], &energies[0]);
+  const TypeParam total = caffe_cpu_dot<TypeParam>(M * N, &this->W_[0],
+      &this->W_[0]);
+  EXPECT_LE(this->Residual(kRank, &U[0], &V[0]), 1e-6 * total);
+  EXPECT_NEAR(total, energies[0] + energies[1] + energies[2], 1e-4 * total);
+  EXPECT_GE(energies[0], energies[1]);
+  EXPECT_GE(energies[1], energies[2]);
+  // The columns of U are orthonormal.
+  for (int i = 0; i < kRank; ++i) {
+    for (int j = 0; j < kRank; ++j) {
+      TypeParam dot = 0;
+      for (int m = 0; m < M; ++m) {
+        dot += U[m * kRank + i] * U[m * kRank + j];
+      }
+      EXPECT_NEAR(i == j ? 1 : 0, dot, 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(LowRankTest, TestTruncated) {
+  // Rank 1 keeps the largest singular value, leaving the others' energy.
+  const int M = this->M_;
+  const int N = this->N_;
+  std::vector<TypeParam> U3(M * 3), V3(3 * N), energies3(3);
+  low_rank_cpu(M, N, &this->W_[0], 3, &U3[0], &V3[0], &energies3[0]);
+  std::vector<TypeParam> U(M), V(N);
+  TypeParam energy;
+  low_rank_cpu(M, N, &this->W_[0], 1, &U[0], &V[0], &energy);
+  EXPECT_NEAR(energies3[0], energy, 1e-3 * energies3[0]);
+  EXPECT_NEAR(energies3[1] + energies3[2], this->Residual(1, &U[0], &V[0]),
+      1e-3 * energies3[0]);
+}
+
+}  // namespace caffe
@@ -2223,4 +2223,379 @@ TYPED_TEST(NetTest, TestReshape) {
   }
 }
 
+TYPED_TEST(NetTest, TestNHWCLayout) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The same TEST net run in NCHW and in NHWC gives the same outputs and
+  // intermediate blobs, under the same names.
+  Caffe::set_random_seed(this->seed_);
+  Caffe::set_mode(Caffe::CPU);
+  const string proto =
+      "name: 'LayoutNet' "
+      "input: 'data' "
+      "input_dim: 2 input_dim: 3 input_dim: 9 input_dim: 8 "
+      "layer { name: 'conv1' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv1' convolution_param { num_output: 8 kernel_size: 3 "
+      "  pad: 1 weight_filler { type: 'gaussian' std: 0.1 } "
+      "  bias_filler { type: 'constant' value: 0.1 } } } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'conv1' top: 'conv1' } "
+      "layer { name: 'pool1' type: 'Pooling' bottom: 'conv1' top: 'pool1' "
+      "  pooling_param { pool: MAX kernel_size: 3 stride: 2 } } "
+      "layer { name: 'norm1' type: 'LRN' bottom: 'pool1' top: 'norm1' "
+      "  lrn_param { local_size: 3 alpha: 0.5 beta: 0.75 } } "
+      "layer { name: 'conv2' type: 'Convolution' bottom: 'norm1' "
+      "  top: 'conv2' convolution_param { num_output: 5 kernel_size: 1 "
+      "  weight_filler { type: 'gaussian' std: 0.1 } } } "
+      "layer { name: 'pool2' type: 'Pooling' bottom: 'conv2' top: 'pool2' "
+      "  pooling_param { pool: AVE kernel_size: 3 stride: 2 pad: 1 } } "
+      "layer { name: 'ip' type: 'InnerProduct' bottom: 'norm1' top: 'ip' "
+      "  inner_product_param { num_output: 4 "
+      "  weight_filler { type: 'gaussian' std: 0.1 } } } ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Net<Dtype> nchw_net(param);
+  param.set_layout(NHWC);
+  Net<Dtype> nhwc_net(param);
+  nhwc_net.ShareTrainedLayersWith(&nchw_net);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(nchw_net.input_blobs()[0]);
+  nhwc_net.input_blobs()[0]->CopyFrom(*nchw_net.input_blobs()[0]);
+  nchw_net.ForwardPrefilled();
+  nhwc_net.ForwardPrefilled();
+  EXPECT_TRUE(nhwc_net.has_blob("conv1_nhwc"));
+  ASSERT_EQ(nchw_net.output_blobs().size(), nhwc_net.output_blobs().size());
+  // conv1 and conv2 are only kept in NHWC, and converted when looked up:
+  // again after every forward pass.
+  const char* kBlobs[] = { "conv1", "conv2", "pool2", "ip" };
+  for (int pass = 0; pass < 2; ++pass) {
+    if (pass == 1) {
+      filler.Fill(nchw_net.input_blobs()[0]);
+      nhwc_net.input_blobs()[0]->CopyFrom(*nchw_net.input_blobs()[0]);
+      nchw_net.ForwardPrefilled();
+      nhwc_net.ForwardPrefilled();
+    }
+    for (int i = 0; i < 4; ++i) {
+      ASSERT_TRUE(nhwc_net.has_blob(kBlobs[i]));
+      const Blob<Dtype>* expected = nchw_net.blob_by_name(kBlobs[i]).get();
+      const Blob<Dtype>* actual = nhwc_net.blob_by_name(kBlobs[i]).get();
+      ASSERT_EQ(expected->num(), actual->num());
+      ASSERT_EQ(expected->channels(), actual->channels());
+      ASSERT_EQ(expected->height(), actual->height());
+      ASSERT_EQ(expected->width(), actual->width());
+      for (int j = 0; j < expected->count(); ++j) {
+        EXPECT_NEAR(expected->cpu_data()[j], actual->cpu_data()[j], 1e-4)
+            << kBlobs[i] << " " << j;
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestZeroCopyConcat) {
+  typedef typename TypeParam::Dtype Dtype;
+  // With the Concat bottoms planned into its top, the outputs and gradients
+  // are the same as with the copies.
+  const string proto =
+      "name: 'ConcatNet' "
+      "force_backward: true "
+      "input: 'data' "
+      "input_dim: 2 input_dim: 3 input_dim: 4 input_dim: 5 "
+      "input: 'target' "
+      "input_dim: 4 input_dim: 2 input_dim: 1 input_dim: 1 "
+      "layer { name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+      "  inner_product_param { num_output: 4 "
+      "  weight_filler { type: 'gaussian' std: 0.1 } } } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'ip1' top: 'ip1' } "
+      "layer { name: 'ip2' type: 'InnerProduct' bottom: 'data' top: 'ip2' "
+      "  inner_product_param { num_output: 4 "
+      "  weight_filler { type: 'gaussian' std: 0.1 } } } "
+      "layer { name: 'concat' type: 'Concat' bottom: 'ip1' bottom: 'ip2' "
+      "  top: 'concat' concat_param { concat_dim: 0 } } "
+      "layer { name: 'ip3' type: 'InnerProduct' bottom: 'concat' "
+      "  top: 'ip3' inner_product_param { num_output: 2 "
+      "  weight_filler { type: 'gaussian' std: 0.1 } } } "
+      "layer { name: 'loss' type: 'EuclideanLoss' bottom: 'ip3' "
+      "  bottom: 'target' top: 'loss' } ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> copy_net(param);
+  param.set_zero_copy_concat(true);
+  Net<Dtype> planned_net(param);
+  planned_net.ShareTrainedLayersWith(&copy_net);
+  const Blob<Dtype>* concat = planned_net.blob_by_name("concat").get();
+  EXPECT_EQ(concat->cpu_data(), planned_net.blob_by_name("ip1")->cpu_data());
+  EXPECT_EQ(concat->cpu_data() + 8,
+      planned_net.blob_by_name("ip2")->cpu_data());
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int i = 0; i < 2; ++i) {
+    filler.Fill(copy_net.input_blobs()[i]);
+    planned_net.input_blobs()[i]->CopyFrom(*copy_net.input_blobs()[i]);
+  }
+  copy_net.ForwardPrefilled();
+  copy_net.Backward();
+  planned_net.ForwardPrefilled();
+  planned_net.Backward();
+  const char* kBlobs[] = { "ip1", "ip2", "concat", "ip3", "data" };
+  for (int i = 0; i < 5; ++i) {
+    const Blob<Dtype>* expected = copy_net.blob_by_name(kBlobs[i]).get();
+    const Blob<Dtype>* actual = planned_net.blob_by_name(kBlobs[i]).get();
+    for (int j = 0; j < expected->count(); ++j) {
+      EXPECT_EQ(expected->cpu_data()[j], actual->cpu_data()[j]);
+      EXPECT_EQ(expected->cpu_diff()[j], actual->cpu_diff()[j]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestZeroCopyConcatReshape) {
+  typedef typename TypeParam::Dtype Dtype;
+  // When the inputs change shape between passes, the bottoms whose slice of
+  // the Concat moved are copied for that pass and planned again after it.
+  const string proto =
+      "name: 'ConcatNet' "
+      "input: 'data' "
+      "input_dim: 2 input_dim: 3 input_dim: 4 input_dim: 5 "
+      "layer { name: 'ip1' type: 'InnerProduct' bottom: 'data' top: 'ip1' "
+      "  inner_product_param { num_output: 4 "
+      "  weight_filler { type: 'gaussian' std: 0.1 } } } "
+      "layer { name: 'ip2' type: 'InnerProduct' bottom: 'data' top: 'ip2' "
+      "  inner_product_param { num_output: 4 "
+      "  weight_filler { type: 'gaussian' std: 0.1 } } } "
+      "layer { name: 'concat' type: 'Concat' bottom: 'ip1' bottom: 'ip2' "
+      "  top: 'concat' concat_param { concat_dim: 0 } } ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> copy_net(param);
+  param.set_zero_copy_concat(true);
+  Net<Dtype> planned_net(param);
+  planned_net.ShareTrainedLayersWith(&copy_net);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  const int kNums[] = { 2, 1, 1, 3 };
+  for (int pass = 0; pass < 4; ++pass) {
+    copy_net.input_blobs()[0]->Reshape(kNums[pass], 3, 4, 5);
+    planned_net.input_blobs()[0]->Reshape(kNums[pass], 3, 4, 5);
+    filler.Fill(copy_net.input_blobs()[0]);
+    planned_net.input_blobs()[0]->CopyFrom(*copy_net.input_blobs()[0]);
+    copy_net.ForwardPrefilled();
+    planned_net.ForwardPrefilled();
+    const Blob<Dtype>* expected = copy_net.blob_by_name("concat").get();
+    const Blob<Dtype>* actual = planned_net.blob_by_name("concat").get();
+    ASSERT_EQ(expected->count(), actual->count());
+    for (int j = 0; j < expected->count(); ++j) {
+      EXPECT_EQ(expected->cpu_data()[j], actual->cpu_data()[j]);
+    }
+  }
+  // The last pass grew the Concat, and the next one plans it again.
+  planned_net.ForwardPrefilled();
+  const Blob<Dtype>* concat = planned_net.blob_by_name("concat").get();
+  EXPECT_EQ(concat->cpu_data() + 12,
+      planned_net.blob_by_name("ip2")->cpu_data());
+}
+
+TYPED_TEST(NetTest, TestAccumulateDiffs) {
+  typedef typename TypeParam::Dtype Dtype;
+  // A blob read by several layers gets the same gradient when they add into
+  // its diff as when a Split layer sums their separate diffs.
+  Caffe::set_mode(Caffe::CPU);
+  const string proto =
+      "name: 'FanOutNet' "
+      "force_backward: true "
+      "input: 'data' "
+      "input_dim: 2 input_dim: 3 input_dim: 5 input_dim: 4 "
+      "input: 'target' "
+      "input_dim: 2 input_dim: 4 input_dim: 5 input_dim: 4 "
+      "layer { name: 'conv1' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv1' convolution_param { num_output: 4 kernel_size: 3 "
+      "  pad: 1 weight_filler { type: 'gaussian' std: 0.1 } } } "
+      "layer { name: 'conv2' type: 'Convolution' bottom: 'conv1' "
+      "  top: 'conv2' convolution_param { num_output: 4 kernel_size: 1 "
+      "  weight_filler { type: 'gaussian' std: 0.1 } } } "
+      "layer { name: 'conv3' type: 'Convolution' bottom: 'conv1' "
+      "  top: 'conv3' convolution_param { num_output: 4 kernel_size: 3 "
+      "  pad: 1 weight_filler { type: 'gaussian' std: 0.1 } } } "
+      "layer { name: 'sigmoid' type: 'Sigmoid' bottom: 'conv1' "
+      "  top: 'sigmoid' } "
+      "layer { name: 'tanh' type: 'TanH' bottom: 'conv1' top: 'tanh' } "
+      "layer { name: 'relu' type: 'ReLU' bottom: 'conv1' top: 'relu' } "
+      "layer { name: 'sum' type: 'Eltwise' bottom: 'conv2' bottom: 'conv3' "
+      "  bottom: 'sigmoid' bottom: 'tanh' bottom: 'relu' top: 'sum' } "
+      "layer { name: 'loss' type: 'EuclideanLoss' bottom: 'sum' "
+      "  bottom: 'target' top: 'loss' } ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Caffe::set_random_seed(this->seed_);
+  Net<Dtype> split_net(param);
+  param.set_accumulate_diffs(true);
+  Net<Dtype> shared_net(param);
+  shared_net.ShareTrainedLayersWith(&split_net);
+  EXPECT_EQ(split_net.layers().size(), shared_net.layers().size() + 1);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int i = 0; i < 2; ++i) {
+    filler.Fill(split_net.input_blobs()[i]);
+    shared_net.input_blobs()[i]->CopyFrom(*split_net.input_blobs()[i]);
+  }
+  // Backward twice, so that stale diffs would show.
+  for (int pass = 0; pass < 2; ++pass) {
+    split_net.ForwardPrefilled();
+    split_net.Backward();
+    shared_net.ForwardPrefilled();
+    shared_net.Backward();
+  }
+  const char* kBlobs[] = { "data", "conv1" };
+  for (int i = 0; i < 2; ++i) {
+    const Blob<Dtype>* expected = split_net.blob_by_name(kBlobs[i]).get();
+    const Blob<Dtype>* actual = shared_net.blob_by_name(kBlobs[i]).get();
+    ASSERT_EQ(expected->count(), actual->count());
+    for (int j = 0; j < expected->count(); ++j) {
+      EXPECT_NEAR(expected->cpu_diff()[j], actual->cpu_diff()[j], 1e-4)
+          << kBlobs[i] << " " << j;
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestCheckpoints) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Recomputing the activations between checkpoints in backward, dropout
+  // masks included, gives the same gradients as keeping them.
+  Caffe::set_mode(Caffe::CPU);
+  const string proto =
+      "name: 'CheckpointNet' "
+      "force_backward: true "
+      "state { phase: TRAIN } "
+      "input: 'data' "
+      "input_dim: 2 input_dim: 3 input_dim: 6 input_dim: 5 "
+      "input: 'target' "
+      "input_dim: 2 input_dim: 3 input_dim: 1 input_dim: 1 "
+      "layer { name: 'conv1' type: 'Convolution' bottom: 'data' "
+      "  top: 'conv1' convolution_param { num_output: 4 kernel_size: 3 "
+      "  pad: 1 weight_filler { type: 'gaussian' std: 0.1 } } } "
+      "layer { name: 'relu1' type: 'ReLU' bottom: 'conv1' top: 'conv1' } "
+      "layer { name: 'drop1' type: 'Dropout' bottom: 'conv1' top: 'drop1' } "
+      "layer { name: 'pool1' type: 'Pooling' bottom: 'drop1' top: 'pool1' "
+      "  pooling_param { pool: MAX kernel_size: 2 stride: 2 } } "
+      "layer { name: 'conv2' type: 'Convolution' bottom: 'pool1' "
+      "  top: 'conv2' convolution_param { num_output: 4 kernel_size: 1 "
+      "  weight_filler { type: 'gaussian' std: 0.1 } } } "
+      "layer { name: 'tanh2' type: 'TanH' bottom: 'conv2' top: 'tanh2' } "
+      "layer { name: 'drop2' type: 'Dropout' bottom: 'tanh2' top: 'drop2' } "
+      "layer { name: 'ip' type: 'InnerProduct' bottom: 'drop2' top: 'ip' "
+      "  inner_product_param { num_output: 3 "
+      "  weight_filler { type: 'gaussian' std: 0.1 } } } "
+      "layer { name: 'loss' type: 'EuclideanLoss' bottom: 'ip' "
+      "  bottom: 'target' top: 'loss' } ";
+  NetParameter param;
+  CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+  Net<Dtype> full_net(param);
+  param.add_checkpoint("pool1");
+  param.add_checkpoint("drop2");
+  Net<Dtype> checkpoint_net(param);
+  checkpoint_net.ShareTrainedLayersWith(&full_net);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  for (int i = 0; i < 2; ++i) {
+    filler.Fill(full_net.input_blobs()[i]);
+    checkpoint_net.input_blobs()[i]->CopyFrom(*full_net.input_blobs()[i]);
+  }
+  for (int pass = 0; pass < 2; ++pass) {
+    Caffe::set_random_seed(this->seed_ + pass);
+    full_net.ForwardPrefilled();
+    full_net.Backward();
+    Caffe::set_random_seed(this->seed_ + pass);
+    checkpoint_net.ForwardPrefilled();
+    // The activations before the checkpoints are freed.
+    EXPECT_EQ(SyncedMemory::UNINITIALIZED,
+        checkpoint_net.blob_by_name("drop1")->data()->head());
+    EXPECT_EQ(SyncedMemory::UNINITIALIZED,
+        checkpoint_net.blob_by_name("tanh2")->data()->head());
+    EXPECT_NE(SyncedMemory::UNINITIALIZED,
+        checkpoint_net.blob_by_name("pool1")->data()->head());
+    checkpoint_net.Backward();
+    const vector<shared_ptr<Blob<Dtype> > >& expected = full_net.params();
+    const vector<shared_ptr<Blob<Dtype> > >& actual =
+        checkpoint_net.params();
+    ASSERT_EQ(expected.size(), actual.size());
+    for (int i = 0; i < expected.size(); ++i) {
+      for (int j = 0; j < expected[i]->count(); ++j) {
+        EXPECT_NEAR(expected[i]->cpu_diff()[j], actual[i]->cpu_diff()[j],
+            1e-5) << "param " << i << " " << j;
+      }
+    }
+    const Blob<Dtype>* data = checkpoint_net.input_blobs()[0];
+    for (int j = 0; j < data->count(); ++j) {
+      EXPECT_NEAR(full_net.input_blobs()[0]->cpu_diff()[j],
+          data->cpu_diff()[j], 1e-5) << "data " << j;
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestBucketSize) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Inputs are zero-padded up to the bucket sizes, and the smaller buckets
+  // reuse the memory of the larger ones. The label input is left alone.
+  const string proto =
+      "name: 'BucketNet' "
+      "input: 'data' "
+      "input_dim: 1 input_dim: 2 input_dim: 3 input_dim: 5 "
+      "input: 'label' "
+      "input_dim: 1 input_dim: 1 input_dim: 1 input_dim: 1 "
+      "bucket_size: 8 bucket_size: 4 "
+      "layer { name: 'relu' type: 'ReLU' bottom: 'data' top: 'relu' } ";
+  this->InitNetFromProtoString(proto);
+  Blob<Dtype>* data = this->net_->input_blobs()[0];
+  const shared_ptr<Blob<Dtype> > relu = this->net_->blob_by_name("relu");
+  caffe_set(data->count(), Dtype(1), data->mutable_cpu_data());
+  this->net_->ForwardPrefilled();
+  EXPECT_EQ(1, relu->num());
+  EXPECT_EQ(2, relu->channels());
+  EXPECT_EQ(4, relu->height());
+  EXPECT_EQ(8, relu->width());
+  EXPECT_EQ(1, this->net_->input_blobs()[1]->height());
+  EXPECT_EQ(1, this->net_->input_blobs()[1]->width());
+  for (int c = 0; c < 2; ++c) {
+    for (int h = 0; h < 4; ++h) {
+      for (int w = 0; w < 8; ++w) {
+        EXPECT_EQ(Dtype(h < 3 && w < 5 ? 1 : 0),
+            relu->data_at(0, c, h, w));
+      }
+    }
+  }
+  const SyncedMemory* memory = relu->data().get();
+  data->Reshape(1, 2, 4, 4);
+  caffe_set(data->count(), Dtype(2), data->mutable_cpu_data());
+  this->net_->ForwardPrefilled();
+  EXPECT_EQ(4, relu->height());
+  EXPECT_EQ(4, relu->width());
+  EXPECT_EQ(memory, relu->data().get());
+  for (int i = 0; i < relu->count(); ++i) {
+    EXPECT_EQ(Dtype(2), relu->cpu_data()[i]);
+  }
+  // A size above all the buckets is kept.
+  data->Reshape(1, 2, 2, 9);
+  this->net_->ForwardPrefilled();
+  EXPECT_EQ(4, relu->height());
+  EXPECT_EQ(9, relu->width());
+}
+
+TYPED_TEST(NetTest, TestBucketBlob) {
+  // Only the inputs named in bucket_blob are padded.
+  const string proto =
+      "name: 'BucketNet' "
+      "input: 'data' "
+      "input_dim: 1 input_dim: 2 input_dim: 3 input_dim: 5 "
+      "input: 'mask' "
+      "input_dim: 1 input_dim: 1 input_dim: 3 input_dim: 5 "
+      "bucket_size: 8 "
+      "bucket_blob: 'mask' "
+      "layer { name: 'relu' type: 'ReLU' bottom: 'data' top: 'relu' } ";
+  this->InitNetFromProtoString(proto);
+  this->net_->ForwardPrefilled();
+  EXPECT_EQ(3, this->net_->input_blobs()[0]->height());
+  EXPECT_EQ(5, this->net_->input_blobs()[0]->width());
+  EXPECT_EQ(8, this->net_->input_blobs()[1]->height());
+  EXPECT_EQ(8, this->net_->input_blobs()[1]->width());
+}
+
 }  // namespace caffe
@@ -1042,4 +1042,83 @@ TEST_F(SplitLayerInsertionTest, TestWithInPlace) {
   this->RunInsertionTest(input_proto, expected_output_proto);
 }
 
+TEST_F(SplitLayerInsertionTest, TestAccumulateDiffs) {
+  // data feeds only InnerProduct layers, which add up their gradients in its
+  // diff, while innerprod2 still needs a split for the losses.
+  const string& input_proto =
+      "name: 'TestNetwork' "
+      "accumulate_diffs: true "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Data' "
+      "  top: 'data' "
+      "  top: 'label' "
+      "} "
+      "layer { "
+      "  name: 'innerprod1' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'data' "
+      "  top: 'innerprod1' "
+      "} "
+      "layer { "
+      "  name: 'innerprod2' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'data' "
+      "  top: 'innerprod2' "
+      "} "
+      "layer { "
+      "  name: 'loss1' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'innerprod1' "
+      "  bottom: 'innerprod2' "
+      "} "
+      "layer { "
+      "  name: 'loss2' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'innerprod2' "
+      "  bottom: 'label' "
+      "} ";
+  const string& expected_output_proto =
+      "name: 'TestNetwork' "
+      "accumulate_diffs: true "
+      "layer { "
+      "  name: 'data' "
+      "  type: 'Data' "
+      "  top: 'data' "
+      "  top: 'label' "
+      "} "
+      "layer { "
+      "  name: 'innerprod1' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'data' "
+      "  top: 'innerprod1' "
+      "} "
+      "layer { "
+      "  name: 'innerprod2' "
+      "  type: 'InnerProduct' "
+      "  bottom: 'data' "
+      "  top: 'innerprod2' "
+      "} "
+      "layer { "
+      "  name: 'innerprod2_innerprod2_0_split' "
+      "  type: 'Split' "
+      "  bottom: 'innerprod2' "
+      "  top: 'innerprod2_innerprod2_0_split_0' "
+      "  top: 'innerprod2_innerprod2_0_split_1' "
+      "} "
+      "layer { "
+      "  name: 'loss1' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'innerprod1' "
+      "  bottom: 'innerprod2_innerprod2_0_split_0' "
+      "} "
+      "layer { "
+      "  name: 'loss2' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'innerprod2_innerprod2_0_split_1' "
+      "  bottom: 'label' "
+      "} ";
+  this->RunInsertionTest(input_proto, expected_output_proto);
+}
+
 }  // namespace caffe
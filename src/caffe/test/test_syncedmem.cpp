@@ -68,6 +68,21 @@ TEST_F(SyncedMemoryTest, TestCPUWrite) {
   }
 }
 
+TEST_F(SyncedMemoryTest, TestView) {
+  shared_ptr<SyncedMemory> base(new SyncedMemory(10));
+  shared_ptr<SyncedMemory> view(new SyncedMemory(base, 4, 6));
+  SyncedMemory view_of_view(view, 2, 3);
+  EXPECT_EQ(view->size(), 6);
+  char* base_data = static_cast<char*>(base->mutable_cpu_data());
+  EXPECT_EQ(view->head(), SyncedMemory::HEAD_AT_CPU);
+  EXPECT_EQ(base_data + 4, view->cpu_data());
+  EXPECT_EQ(base_data + 6, view_of_view.cpu_data());
+  caffe_memset(view_of_view.size(), 3, view_of_view.mutable_cpu_data());
+  for (int i = 0; i < base->size(); ++i) {
+    EXPECT_EQ(i >= 6 && i < 9 ? 3 : 0, base_data[i]);
+  }
+}
+
 #ifndef CPU_ONLY  // GPU test
 
 TEST_F(SyncedMemoryTest, TestGPURead) {
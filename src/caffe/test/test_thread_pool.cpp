@@ -0,0 +1,97 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class ThreadPoolTest : public ::testing::Test {
+ protected:
+  virtual void TearDown() {
+    Caffe::set_cpu_threads(0);
+  }
+};
+
+// Adds one to each element of the range.
+struct Increment {
+  std::vector<int>* counts;
+  void operator()(int begin, int end) const {
+    for (int i = begin; i < end; ++i) {
+      ++(*counts)[i];
+    }
+  }
+};
+
+// Increments the elements of the range with a nested parallel_for.
+struct NestedIncrement {
+  std::vector<int>* counts;
+  void operator()(int begin, int end) const {
+    Increment increment = { counts };
+    parallel_for(end - begin, 1, OffsetBody(begin, increment));
+  }
+  struct OffsetBody {
+    OffsetBody(int offset, const Increment& body)
+        : offset(offset), body(body) {}
+    void operator()(int begin, int end) const {
+      body(offset + begin, offset + end);
+    }
+    int offset;
+    Increment body;
+  };
+};
+
+struct Sum {
+  const std::vector<double>* values;
+  double operator()(int begin, int end) const {
+    double sum = 0;
+    for (int i = begin; i < end; ++i) {
+      sum += (*values)[i];
+    }
+    return sum;
+  }
+};
+
+TEST_F(ThreadPoolTest, TestParallelFor) {
+  Caffe::set_cpu_threads(4);
+  EXPECT_EQ(4, Caffe::thread_pool().num_threads());
+  std::vector<int> counts(10007, 0);
+  Increment increment = { &counts };
+  for (int grain = 1; grain < 20000; grain *= 7) {
+    parallel_for(counts.size(), grain, increment);
+  }
+  for (int i = 0; i < counts.size(); ++i) {
+    EXPECT_EQ(6, counts[i]) << i;
+  }
+}
+
+TEST_F(ThreadPoolTest, TestNested) {
+  Caffe::set_cpu_threads(3);
+  std::vector<int> counts(1000, 0);
+  NestedIncrement increment = { &counts };
+  parallel_for(counts.size(), 10, increment);
+  for (int i = 0; i < counts.size(); ++i) {
+    EXPECT_EQ(1, counts[i]) << i;
+  }
+}
+
+TEST_F(ThreadPoolTest, TestDeterministicReduce) {
+  std::vector<double> values(100000);
+  for (int i = 0; i < values.size(); ++i) {
+    values[i] = 1. / (i + 1);
+  }
+  Sum sum = { &values };
+  Caffe::set_cpu_threads(1);
+  const double serial = parallel_reduce<double>(values.size(), 1000, sum);
+  EXPECT_NEAR(12.09, serial, 0.01);
+  for (int threads = 2; threads <= 8; threads *= 2) {
+    Caffe::set_cpu_threads(threads);
+    // Bitwise equal, not only close.
+    EXPECT_EQ(serial, parallel_reduce<double>(values.size(), 1000, sum));
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,77 @@
+#include <boost/thread.hpp>
+
+#include <string>
+#include <utility>
+
+#include "caffe/data_layers.hpp"
+#include "caffe/util/blocking_queue.hpp"
+
+namespace caffe {
+
+template <typename T>
+class BlockingQueue<T>::sync {
+ public:
+  mutable boost::mutex mutex_;
+  boost::condition_variable not_empty_;
+  boost::condition_variable not_full_;
+};
+
+template <typename T>
+BlockingQueue<T>::BlockingQueue(size_t capacity)
+    : capacity_(capacity), sync_(new sync()) {
+}
+
+template <typename T>
+void BlockingQueue<T>::push(const T& t) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  while (capacity_ > 0 && queue_.size() >= capacity_) {
+    sync_->not_full_.wait(lock);
+  }
+  queue_.push(t);
+  lock.unlock();
+  sync_->not_empty_.notify_one();
+}
+
+template <typename T>
+bool BlockingQueue<T>::try_pop(T* t) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  if (queue_.empty()) {
+    return false;
+  }
+  *t = queue_.front();
+  queue_.pop();
+  lock.unlock();
+  sync_->not_full_.notify_one();
+  return true;
+}
+
+template <typename T>
+T BlockingQueue<T>::pop(const string& log_on_wait) {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  while (queue_.empty()) {
+    if (!log_on_wait.empty()) {
+      LOG_EVERY_N(INFO, 1000) << log_on_wait;
+    }
+    sync_->not_empty_.wait(lock);
+  }
+  T t = queue_.front();
+  queue_.pop();
+  lock.unlock();
+  sync_->not_full_.notify_one();
+  return t;
+}
+
+template <typename T>
+size_t BlockingQueue<T>::size() const {
+  boost::mutex::scoped_lock lock(sync_->mutex_);
+  return queue_.size();
+}
+
+template class BlockingQueue<std::pair<int, std::pair<string, string> >*>;
+template class BlockingQueue<Datum*>;
+template class BlockingQueue<Blob<float>*>;
+template class BlockingQueue<Blob<double>*>;
+template class BlockingQueue<HDF5OutputBuffer<float>*>;
+template class BlockingQueue<HDF5OutputBuffer<double>*>;
+
+}  // namespace caffe
@@ -1,6 +1,10 @@
 #include "caffe/util/db.hpp"
+#include "caffe/util/sharded_db.hpp"
 
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
+
 #include <string>
 
 namespace caffe { namespace db {
@@ -29,11 +33,37 @@ void LMDB::Open(const string& source, Mode mode) {
   int flags = 0;
   if (mode == READ) {
     flags = MDB_RDONLY | MDB_NOTLS;
+  } else {
+    flags = env_flags_;
   }
   MDB_CHECK(mdb_env_open(mdb_env_, source.c_str(), flags, 0664));
   LOG(INFO) << "Opened lmdb " << source;
 }
 
+void LMDBCursor::WillNeed(const string& key) {
+  // The lookup itself touches the branch pages and the leaf page of the key.
+  // The value may span overflow pages, which are paged in asynchronously.
+  MDB_val mdb_key, mdb_value;
+  mdb_key.mv_data = const_cast<char*>(key.data());
+  mdb_key.mv_size = key.size();
+  if (mdb_get(mdb_txn_, mdb_cursor_dbi(mdb_cursor_), &mdb_key, &mdb_value)
+      != MDB_SUCCESS) {
+    return;
+  }
+  static const uintptr_t page_mask = sysconf(_SC_PAGESIZE) - 1;
+  const uintptr_t begin =
+      reinterpret_cast<uintptr_t>(mdb_value.mv_data) & ~page_mask;
+  const uintptr_t end =
+      reinterpret_cast<uintptr_t>(mdb_value.mv_data) + mdb_value.mv_size;
+  madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+}
+
+int64_t LMDBCursor::count() {
+  MDB_stat stat;
+  MDB_CHECK(mdb_stat(mdb_txn_, mdb_cursor_dbi(mdb_cursor_), &stat));
+  return stat.ms_entries;
+}
+
 LMDBCursor* LMDB::NewCursor() {
   MDB_txn* mdb_txn;
   MDB_cursor* mdb_cursor;
@@ -47,7 +77,13 @@ LMDBTransaction* LMDB::NewTransaction() {
   MDB_txn* mdb_txn;
   MDB_CHECK(mdb_txn_begin(mdb_env_, NULL, 0, &mdb_txn));
   MDB_CHECK(mdb_dbi_open(mdb_txn, NULL, 0, &mdb_dbi_));
-  return new LMDBTransaction(&mdb_dbi_, mdb_txn);
+  return new LMDBTransaction(&mdb_dbi_, mdb_txn, put_flags_);
+}
+
+void LMDB::SetBulkLoad(bool sorted_keys, bool no_sync, bool write_map) {
+  CHECK(mdb_env_ == NULL) << "SetBulkLoad must be called before Open";
+  put_flags_ = sorted_keys ? MDB_APPEND : 0;
+  env_flags_ = (no_sync ? MDB_NOSYNC : 0) | (write_map ? MDB_WRITEMAP : 0);
 }
 
 void LMDBTransaction::Put(const string& key, const string& value) {
@@ -56,7 +92,7 @@ void LMDBTransaction::Put(const string& key, const string& value) {
   mdb_key.mv_size = key.size();
   mdb_value.mv_data = const_cast<char*>(value.data());
   mdb_value.mv_size = value.size();
-  MDB_CHECK(mdb_put(mdb_txn_, *mdb_dbi_, &mdb_key, &mdb_value, 0));
+  MDB_CHECK(mdb_put(mdb_txn_, *mdb_dbi_, &mdb_key, &mdb_value, put_flags_));
 }
 
 DB* GetDB(DataParameter::DB backend) {
@@ -80,5 +116,14 @@ DB* GetDB(const string& backend) {
   }
 }
 
+DB* GetDB(const DataParameter& param) {
+  if (ShardedDB::IsSharded(param.source())) {
+    ShardedDB* db = new ShardedDB();
+    db->SetReadOptions(param);
+    return db;
+  }
+  return GetDB(param.backend());
+}
+
 }  // namespace db
 }  // namespace caffe
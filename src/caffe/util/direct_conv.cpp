@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <cstring>
+
+#include "caffe/util/direct_conv.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+// The number of output channels accumulated together, so that each input
+// value is loaded once for all of them.
+const int kDirectConvBlock = 4;
+
+// Adds weight[j] * in[x * STRIDE + offset] to out[j][x] for the BLOCK output
+// rows j and x in [begin, end). The weights are kept in registers and the
+// loop over x vectorizes for unit strides.
+template <typename Dtype, int BLOCK, int STRIDE>
+static inline void AccumulateRows(const Dtype* in, const int offset,
+    const int stride_arg,
+    const Dtype* weight, const int weight_step, Dtype* out,
+    const int out_step, const int begin, const int end) {
+  const int stride = STRIDE > 0 ? STRIDE : stride_arg;
+  Dtype w[BLOCK];
+  Dtype* o[BLOCK];
+  for (int j = 0; j < BLOCK; ++j) {
+    w[j] = weight[j * weight_step];
+    o[j] = out + j * out_step;
+  }
+  for (int x = begin; x < end; ++x) {
+    const Dtype v = in[x * stride + offset];
+    for (int j = 0; j < BLOCK; ++j) {
+      o[j][x] += w[j] * v;
+    }
+  }
+}
+
+template <typename Dtype, int BLOCK>
+static inline void AccumulateBlock(const Dtype* in, const int offset,
+    const int stride,
+    const Dtype* weight, const int weight_step, Dtype* out,
+    const int out_step, const int begin, const int end) {
+  if (stride == 1) {
+    AccumulateRows<Dtype, BLOCK, 1>(in, offset, stride, weight, weight_step,
+        out, out_step, begin, end);
+  } else {
+    AccumulateRows<Dtype, BLOCK, 0>(in, offset, stride, weight, weight_step,
+        out, out_step, begin, end);
+  }
+}
+
+// Computes the rows [y_begin, y_end) of the output channels of one block,
+// accumulating over the input channels of their group.
+template <typename Dtype>
+struct DirectConvRows {
+  const Dtype* data_im;
+  int height, width, height_out, width_out;
+  int in_per_group, out_per_group, blocks_per_group;
+  int kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w;
+  const Dtype* weights;
+  Dtype* data_out;
+
+  // The tasks of parallel_for are consecutive (block, row) pairs.
+  void operator()(int begin, int end) const {
+    for (int i = begin; i < end; ) {
+      const int y_begin = i % height_out;
+      const int y_end = std::min(height_out, y_begin + end - i);
+      Convolve(i / height_out, y_begin, y_end);
+      i += y_end - y_begin;
+    }
+  }
+
+  void Convolve(const int block_index, const int y_begin,
+      const int y_end) const {
+    const int out_dim = height_out * width_out;
+    // Distance between the weights of consecutive output channels.
+    const int weight_step = in_per_group * kernel_h * kernel_w;
+    const int g = block_index / blocks_per_group;
+    const int o = block_index % blocks_per_group * kDirectConvBlock;
+    const int block = std::min(kDirectConvBlock, out_per_group - o);
+    const int c_out = g * out_per_group + o;
+    Dtype* out = data_out + c_out * out_dim;
+    for (int j = 0; j < block; ++j) {
+      memset(out + j * out_dim + y_begin * width_out, 0,
+          sizeof(Dtype) * (y_end - y_begin) * width_out);
+    }
+    for (int k = 0; k < in_per_group; ++k) {
+      const Dtype* in = data_im + (g * in_per_group + k) * height * width;
+      for (int p = 0; p < kernel_h; ++p) {
+        for (int q = 0; q < kernel_w; ++q) {
+          const Dtype* weight = weights + c_out * weight_step +
+              (k * kernel_h + p) * kernel_w + q;
+          // Output columns [begin, end) read inside the image, the others
+          // only padding.
+          const int lead = pad_w - q;
+          const int trail = width + pad_w - q;
+          int begin = lead > 0 ? (lead + stride_w - 1) / stride_w : 0;
+          int end = trail > 0 ? (trail + stride_w - 1) / stride_w : 0;
+          end = std::min(end, width_out);
+          begin = std::min(begin, end);
+          for (int y = y_begin; y < y_end; ++y) {
+            const int in_y = y * stride_h - pad_h + p;
+            if (in_y < 0 || in_y >= height) {
+              continue;
+            }
+            const Dtype* in_row = in + in_y * width;
+            Dtype* out_row = out + y * width_out;
+            switch (block) {
+            case 4:
+              AccumulateBlock<Dtype, 4>(in_row, q - pad_w, stride_w,
+                  weight, weight_step, out_row, out_dim, begin, end);
+              break;
+            case 3:
+              AccumulateBlock<Dtype, 3>(in_row, q - pad_w, stride_w,
+                  weight, weight_step, out_row, out_dim, begin, end);
+              break;
+            case 2:
+              AccumulateBlock<Dtype, 2>(in_row, q - pad_w, stride_w,
+                  weight, weight_step, out_row, out_dim, begin, end);
+              break;
+            default:
+              AccumulateBlock<Dtype, 1>(in_row, q - pad_w, stride_w,
+                  weight, weight_step, out_row, out_dim, begin, end);
+            }
+          }
+        }
+      }
+    }
+  }
+};
+
+template <typename Dtype>
+void conv_direct_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int num_output, const int group,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const Dtype* weights,
+    Dtype* data_out) {
+  const int height_out = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  const int width_out = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  const int in_per_group = channels / group;
+  const int out_per_group = num_output / group;
+  const int blocks_per_group =
+      (out_per_group + kDirectConvBlock - 1) / kDirectConvBlock;
+  DirectConvRows<Dtype> body = { data_im, height, width, height_out,
+      width_out, in_per_group, out_per_group, blocks_per_group, kernel_h,
+      kernel_w, pad_h, pad_w, stride_h, stride_w, weights, data_out };
+  // The blocks of output channels and their rows are independent.
+  parallel_for(group * blocks_per_group * height_out, GrainSize(
+      kDirectConvBlock * in_per_group * kernel_h * kernel_w * width_out),
+      body);
+}
+
+// Explicit instantiation
+template void conv_direct_cpu<float>(const float* data_im,
+    const int channels, const int height, const int width,
+    const int num_output, const int group, const int kernel_h,
+    const int kernel_w, const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const float* weights, float* data_out);
+template void conv_direct_cpu<double>(const double* data_im,
+    const int channels, const int height, const int width,
+    const int num_output, const int group, const int kernel_h,
+    const int kernel_w, const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const double* weights, double* data_out);
+
+}  // namespace caffe
@@ -0,0 +1,96 @@
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "caffe/util/half.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+// The bytes of the rows of B converted to Dtype at a time by gemm_half_cpu,
+// and the fewest rows converted, so that each BLAS call still has enough
+// columns of C to be efficient when K is large.
+const int kHalfTileBytes = 1 << 22;
+const int kHalfTileMinRows = 64;
+
+template <typename Dtype>
+void half_to_cpu(const int n, const uint16_t* x, const Precision precision,
+    Dtype* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = HalfToFloat(x[i], precision);
+  }
+}
+
+template <>
+void half_to_cpu<float>(const int n, const uint16_t* x,
+    const Precision precision, float* y) {
+  int i = 0;
+  if (precision == BFLOAT16) {
+    for (; i < n; ++i) {
+      const uint32_t bits = static_cast<uint32_t>(x[i]) << 16;
+      memcpy(y + i, &bits, sizeof(bits));
+    }
+    return;
+  }
+#ifdef __F16C__
+  for (; i + 8 <= n; i += 8) {
+    const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i));
+    _mm256_storeu_ps(y + i, _mm256_cvtph_ps(h));
+  }
+#endif
+  for (; i < n; ++i) {
+    y[i] = HalfToFloat(x[i], precision);
+  }
+}
+
+template void half_to_cpu<double>(const int n, const uint16_t* x,
+    const Precision precision, double* y);
+
+// Converts the elements [begin, end) of x to Dtype in y.
+template <typename Dtype>
+struct HalfToCpuRange {
+  const uint16_t* x;
+  Precision precision;
+  Dtype* y;
+  void operator()(int begin, int end) const {
+    half_to_cpu(end - begin, x + begin, precision, y + begin);
+  }
+};
+
+template <typename Dtype>
+void gemm_half_cpu(const int M, const int N, const int K, const Dtype* A,
+    const uint16_t* B, const Precision precision, Dtype* C) {
+  const int rows = std::min(N, std::max(kHalfTileMinRows,
+      static_cast<int>(kHalfTileBytes / (sizeof(Dtype) * K))));
+  std::vector<Dtype> tile(rows * K);
+  // A single tile is multiplied straight into C.
+  std::vector<Dtype> product(rows < N ? M * rows : 0);
+  for (int first = 0; first < N; first += rows) {
+    const int tile_rows = std::min(rows, N - first);
+    HalfToCpuRange<Dtype> convert = { B + first * K, precision, &tile[0] };
+    parallel_for(tile_rows * K, GrainSize(1), convert);
+    if (rows == N) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M, N, K, (Dtype)1., A,
+          &tile[0], (Dtype)0., C);
+      break;
+    }
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, M, tile_rows, K,
+        (Dtype)1., A, &tile[0], (Dtype)0., &product[0]);
+    for (int i = 0; i < M; ++i) {
+      memcpy(C + i * N + first, &product[i * tile_rows],
+          sizeof(Dtype) * tile_rows);
+    }
+  }
+}
+
+template void gemm_half_cpu<float>(const int M, const int N, const int K,
+    const float* A, const uint16_t* B, const Precision precision, float* C);
+template void gemm_half_cpu<double>(const int M, const int N, const int K,
+    const double* A, const uint16_t* B, const Precision precision, double* C);
+
+}  // namespace caffe
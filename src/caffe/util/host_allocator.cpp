@@ -0,0 +1,232 @@
+#include <sys/mman.h>
+
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/util/host_allocator.hpp"
+#include "caffe/util/numa.hpp"
+
+namespace caffe {
+
+// Buffers start on cache line boundaries, which also suits SIMD loads.
+const size_t kAlignment = 64;
+// The block header takes a whole alignment unit so that buffers stay
+// aligned.
+const size_t kHeaderSize = kAlignment;
+// Smaller buffers are cheap to malloc and are not pooled.
+const size_t kMinPooledSize = 64 << 10;
+const size_t kHugePageSize = 2 << 20;
+
+struct HostAllocator::Header {
+  // The size class of the buffer.
+  size_t capacity;
+  // The length of the mapping for mmap backed blocks, 0 for heap blocks.
+  size_t mapped;
+  // The NUMA node of the thread the block was allocated for, or -1.
+  int node;
+};
+
+static size_t RoundUp(size_t size, size_t multiple) {
+  return (size + multiple - 1) / multiple * multiple;
+}
+
+HostAllocator& HostAllocator::Get() {
+  static HostAllocator* instance = new HostAllocator();
+  return *instance;
+}
+
+HostAllocator::HostAllocator()
+    : mutex_(new boost::mutex()), mode_(POOL), huge_pages_(false),
+      pool_limit_(static_cast<size_t>(1) << 30), allocations_(0),
+      pool_hits_(0), bytes_in_use_(0), peak_bytes_in_use_(0),
+      pooled_bytes_(0) {
+}
+
+HostAllocator::~HostAllocator() {
+  Trim();
+}
+
+size_t HostAllocator::SizeClass(size_t size) {
+  if (size < kMinPooledSize) {
+    return RoundUp(std::max<size_t>(size, 1), kAlignment);
+  }
+  // Four classes per power of two: at most a quarter of a buffer is wasted.
+  size_t power = kMinPooledSize;
+  while (power <= size / 2) {
+    power *= 2;
+  }
+  return RoundUp(size, power / 4);
+}
+
+void* HostAllocator::Allocate(size_t size) {
+  const size_t capacity = SizeClass(size);
+  const int node = CurrentNumaNode();
+  boost::mutex::scoped_lock lock(*mutex_);
+  ++allocations_;
+  bytes_in_use_ += capacity;
+  peak_bytes_in_use_ = std::max(peak_bytes_in_use_, bytes_in_use_);
+  char* block = NULL;
+  Pool::iterator it = pool_.find(std::make_pair(node, capacity));
+  if (it != pool_.end() && !it->second.empty()) {
+    block = it->second.back();
+    it->second.pop_back();
+    pooled_bytes_ -= capacity;
+    ++pool_hits_;
+  }
+  const bool huge_pages = huge_pages_;
+  lock.unlock();
+  if (block == NULL) {
+    block = AllocateBlock(capacity, node, huge_pages);
+  }
+  return block + kHeaderSize;
+}
+
+void HostAllocator::Free(void* ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  char* block = static_cast<char*>(ptr) - kHeaderSize;
+  const Header* header = reinterpret_cast<Header*>(block);
+  const size_t capacity = header->capacity;
+  boost::mutex::scoped_lock lock(*mutex_);
+  bytes_in_use_ -= capacity;
+  if (mode_ == POOL && capacity >= kMinPooledSize &&
+      pooled_bytes_ + capacity <= pool_limit_) {
+    pool_[std::make_pair(header->node, capacity)].push_back(block);
+    pooled_bytes_ += capacity;
+    return;
+  }
+  lock.unlock();
+  FreeBlock(block);
+}
+
+void HostAllocator::Trim() {
+  Pool pool;
+  {
+    boost::mutex::scoped_lock lock(*mutex_);
+    pool.swap(pool_);
+    pooled_bytes_ = 0;
+  }
+  for (Pool::iterator it = pool.begin(); it != pool.end(); ++it) {
+    for (int i = 0; i < it->second.size(); ++i) {
+      FreeBlock(it->second[i]);
+    }
+  }
+}
+
+char* HostAllocator::AllocateBlock(size_t capacity, int node,
+    bool huge_pages) {
+  const size_t size = capacity + kHeaderSize;
+  void* block = NULL;
+  size_t mapped = 0;
+  if (huge_pages && capacity >= kHugePageSize) {
+    mapped = RoundUp(size, kHugePageSize);
+    block = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    // Reserved huge pages, if the system has any left.
+    block = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (block == MAP_FAILED) {
+      block = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+          MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      CHECK(block != MAP_FAILED) << "host allocation of size " << capacity
+          << " failed";
+#ifdef MADV_HUGEPAGE
+      // Transparent huge pages; only a hint.
+      madvise(block, mapped, MADV_HUGEPAGE);
+#endif
+    }
+  } else {
+    CHECK_EQ(posix_memalign(&block, kAlignment, size), 0)
+        << "host allocation of size " << capacity << " failed";
+  }
+  Header* header = static_cast<Header*>(block);
+  header->capacity = capacity;
+  header->mapped = mapped;
+  header->node = node;
+  return static_cast<char*>(block);
+}
+
+void HostAllocator::FreeBlock(char* block) {
+  const size_t mapped = reinterpret_cast<Header*>(block)->mapped;
+  if (mapped > 0) {
+    munmap(block, mapped);
+  } else {
+    free(block);
+  }
+}
+
+void HostAllocator::set_mode(Mode mode) {
+  {
+    boost::mutex::scoped_lock lock(*mutex_);
+    mode_ = mode;
+  }
+  if (mode == MALLOC) {
+    Trim();
+  }
+}
+
+HostAllocator::Mode HostAllocator::mode() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return mode_;
+}
+
+void HostAllocator::set_huge_pages(bool huge_pages) {
+  boost::mutex::scoped_lock lock(*mutex_);
+  huge_pages_ = huge_pages;
+}
+
+void HostAllocator::set_pool_limit(size_t bytes) {
+  {
+    boost::mutex::scoped_lock lock(*mutex_);
+    pool_limit_ = bytes;
+    if (pooled_bytes_ <= pool_limit_) {
+      return;
+    }
+  }
+  Trim();
+}
+
+size_t HostAllocator::allocations() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return allocations_;
+}
+
+size_t HostAllocator::pool_hits() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return pool_hits_;
+}
+
+size_t HostAllocator::bytes_in_use() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return bytes_in_use_;
+}
+
+size_t HostAllocator::peak_bytes_in_use() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return peak_bytes_in_use_;
+}
+
+size_t HostAllocator::pooled_bytes() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return pooled_bytes_;
+}
+
+string HostAllocator::DebugString() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  std::ostringstream stats;
+  stats << "Host allocator: " << pool_hits_ << " of " << allocations_
+        << " allocations from the pool, " << (bytes_in_use_ >> 20)
+        << " MB in use (peak " << (peak_bytes_in_use_ >> 20) << " MB), "
+        << (pooled_bytes_ >> 20) << " MB pooled";
+  return stats.str();
+}
+
+}  // namespace caffe
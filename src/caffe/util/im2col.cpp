@@ -1,37 +1,136 @@
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
 
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/thread_pool.hpp"
 
 namespace caffe {
 
+// The channels of the image are lowered independently, so im2col and col2im
+// run their kernel on ranges of channels in parallel. `in` and `out` advance
+// by in_size and out_size per channel.
+template <typename Dtype>
+struct ChannelRange {
+  typedef void (*Kernel)(const Dtype*, const int, const int, const int,
+      const int, const int, const int, const int, const int, const int,
+      Dtype*);
+  Kernel kernel;
+  const Dtype* in;
+  int in_size;
+  Dtype* out;
+  int out_size;
+  int height, width, kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w;
+  void operator()(int begin, int end) const {
+    kernel(in + begin * in_size, end - begin, height, width, kernel_h,
+        kernel_w, pad_h, pad_w, stride_h, stride_w, out + begin * out_size);
+  }
+};
+
+// The output columns w in [*w_begin, *w_end) read input columns inside the
+// image; the columns before and after them fall in the padding.
+static inline void InsideSpan(const int width, const int width_col,
+    const int pad_w, const int stride_w, const int w_offset, int* w_begin,
+    int* w_end) {
+  // The first w with w * stride_w - pad_w + w_offset >= 0 ...
+  const int lead = pad_w - w_offset;
+  *w_begin = lead > 0 ? (lead + stride_w - 1) / stride_w : 0;
+  // ... and the first with w * stride_w - pad_w + w_offset >= width.
+  const int trail = width + pad_w - w_offset;
+  *w_end = trail > 0 ? (trail + stride_w - 1) / stride_w : 0;
+  *w_end = std::min(*w_end, width_col);
+  *w_begin = std::min(*w_begin, *w_end);
+}
+
+// im2col for a KERNEL_H x KERNEL_W kernel with stride STRIDE_H x STRIDE_W, or
+// for the runtime kernel and stride when they are 0. Each output row copies
+// one contiguous (or strided) segment of an input row and zeroes the padding
+// spans on either side of it, instead of testing every element.
+template <typename Dtype, int KERNEL_H, int KERNEL_W, int STRIDE_H,
+    int STRIDE_W>
+static void im2col_cpu_kernel(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h_arg,
+    const int kernel_w_arg, const int pad_h, const int pad_w,
+    const int stride_h_arg, const int stride_w_arg, Dtype* data_col) {
+  const int kernel_h = KERNEL_H > 0 ? KERNEL_H : kernel_h_arg;
+  const int kernel_w = KERNEL_W > 0 ? KERNEL_W : kernel_w_arg;
+  const int stride_h = STRIDE_H > 0 ? STRIDE_H : stride_h_arg;
+  const int stride_w = STRIDE_W > 0 ? STRIDE_W : stride_w_arg;
+  const int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  const int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  for (int c_im = 0; c_im < channels; ++c_im) {
+    const Dtype* channel_im = data_im + c_im * height * width;
+    for (int h_offset = 0; h_offset < kernel_h; ++h_offset) {
+      for (int w_offset = 0; w_offset < kernel_w; ++w_offset) {
+        int w_begin, w_end;
+        InsideSpan(width, width_col, pad_w, stride_w, w_offset, &w_begin,
+            &w_end);
+        for (int h = 0; h < height_col; ++h) {
+          const int h_pad = h * stride_h - pad_h + h_offset;
+          if (h_pad < 0 || h_pad >= height) {
+            memset(data_col, 0, sizeof(Dtype) * width_col);
+            data_col += width_col;
+            continue;
+          }
+          // Input column of output column w: w * stride_w + w_im.
+          const int w_im = w_offset - pad_w;
+          const Dtype* row_im = channel_im + h_pad * width;
+          for (int w = 0; w < w_begin; ++w) {
+            data_col[w] = 0;
+          }
+          if (stride_w == 1) {
+            memcpy(data_col + w_begin, row_im + w_begin + w_im,
+                sizeof(Dtype) * (w_end - w_begin));
+          } else {
+            for (int w = w_begin; w < w_end; ++w) {
+              data_col[w] = row_im[w * stride_w + w_im];
+            }
+          }
+          for (int w = w_end; w < width_col; ++w) {
+            data_col[w] = 0;
+          }
+          data_col += width_col;
+        }
+      }
+    }
+  }
+}
+
 template <typename Dtype>
 void im2col_cpu(const Dtype* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int stride_h, const int stride_w,
     Dtype* data_col) {
-  int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
-  int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
-  int channels_col = channels * kernel_h * kernel_w;
-  for (int c = 0; c < channels_col; ++c) {
-    int w_offset = c % kernel_w;
-    int h_offset = (c / kernel_w) % kernel_h;
-    int c_im = c / kernel_h / kernel_w;
-    for (int h = 0; h < height_col; ++h) {
-      for (int w = 0; w < width_col; ++w) {
-        int h_pad = h * stride_h - pad_h + h_offset;
-        int w_pad = w * stride_w - pad_w + w_offset;
-        if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
-          data_col[(c * height_col + h) * width_col + w] =
-            data_im[(c_im * height + h_pad) * width + w_pad];
-        else
-          data_col[(c * height_col + h) * width_col + w] = 0;
-      }
-    }
+  if (kernel_h == 1 && kernel_w == 1 && stride_h == 1 && stride_w == 1 &&
+      pad_h == 0 && pad_w == 0) {
+    // The columns are the image.
+    caffe_copy(channels * height * width, data_im, data_col);
+    return;
   }
+  // Specializations for the most common kernels, in which the loop bounds
+  // and strides are constants.
+  typename ChannelRange<Dtype>::Kernel kernel =
+      &im2col_cpu_kernel<Dtype, 0, 0, 0, 0>;
+#define IM2COL_KERNEL(KH, KW, SH, SW) \
+  if (kernel_h == KH && kernel_w == KW && stride_h == SH && stride_w == SW) { \
+    kernel = &im2col_cpu_kernel<Dtype, KH, KW, SH, SW>; \
+  }
+  IM2COL_KERNEL(1, 1, 1, 1);
+  IM2COL_KERNEL(3, 3, 1, 1);
+  IM2COL_KERNEL(3, 3, 2, 2);
+  IM2COL_KERNEL(5, 5, 1, 1);
+  IM2COL_KERNEL(11, 11, 4, 4);
+#undef IM2COL_KERNEL
+  const int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  const int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  const int col_size = kernel_h * kernel_w * height_col * width_col;
+  ChannelRange<Dtype> range = { kernel, data_im, height * width, data_col,
+      col_size, height, width, kernel_h, kernel_w, pad_h, pad_w, stride_h,
+      stride_w };
+  parallel_for(channels, GrainSize(col_size), range);
 }
 
 // Explicit instantiation
@@ -44,30 +143,83 @@ template void im2col_cpu<double>(const double* data_im, const int channels,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, double* data_col);
 
+// col2im for a KERNEL_H x KERNEL_W kernel with stride STRIDE_H x STRIDE_W, or
+// for the runtime kernel and stride when they are 0. The image is accumulated
+// one channel at a time, so that the channel stays in cache while all of its
+// kernel_h * kernel_w column rows are added to it; the additions happen in
+// the same order as in a plain scatter, so the result is identical.
+template <typename Dtype, int KERNEL_H, int KERNEL_W, int STRIDE_H,
+    int STRIDE_W>
+static void col2im_cpu_kernel(const Dtype* data_col, const int channels,
+    const int height, const int width, const int kernel_h_arg,
+    const int kernel_w_arg, const int pad_h, const int pad_w,
+    const int stride_h_arg, const int stride_w_arg, Dtype* data_im) {
+  const int kernel_h = KERNEL_H > 0 ? KERNEL_H : kernel_h_arg;
+  const int kernel_w = KERNEL_W > 0 ? KERNEL_W : kernel_w_arg;
+  const int stride_h = STRIDE_H > 0 ? STRIDE_H : stride_h_arg;
+  const int stride_w = STRIDE_W > 0 ? STRIDE_W : stride_w_arg;
+  const int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  const int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  for (int c_im = 0; c_im < channels; ++c_im) {
+    Dtype* channel_im = data_im + c_im * height * width;
+    memset(channel_im, 0, sizeof(Dtype) * height * width);
+    for (int h_offset = 0; h_offset < kernel_h; ++h_offset) {
+      for (int w_offset = 0; w_offset < kernel_w; ++w_offset) {
+        int w_begin, w_end;
+        InsideSpan(width, width_col, pad_w, stride_w, w_offset, &w_begin,
+            &w_end);
+        for (int h = 0; h < height_col; ++h, data_col += width_col) {
+          const int h_pad = h * stride_h - pad_h + h_offset;
+          if (h_pad < 0 || h_pad >= height) {
+            continue;
+          }
+          const int w_im = w_offset - pad_w;
+          Dtype* row_im = channel_im + h_pad * width;
+          if (stride_w == 1) {
+            for (int w = w_begin; w < w_end; ++w) {
+              row_im[w + w_im] += data_col[w];
+            }
+          } else {
+            for (int w = w_begin; w < w_end; ++w) {
+              row_im[w * stride_w + w_im] += data_col[w];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
 template <typename Dtype>
 void col2im_cpu(const Dtype* data_col, const int channels,
     const int height, const int width, const int patch_h, const int patch_w,
     const int pad_h, const int pad_w,
     const int stride_h, const int stride_w,
     Dtype* data_im) {
-  caffe_set(height * width * channels, Dtype(0), data_im);
-  int height_col = (height + 2 * pad_h - patch_h) / stride_h + 1;
-  int width_col = (width + 2 * pad_w - patch_w) / stride_w + 1;
-  int channels_col = channels * patch_h * patch_w;
-  for (int c = 0; c < channels_col; ++c) {
-    int w_offset = c % patch_w;
-    int h_offset = (c / patch_w) % patch_h;
-    int c_im = c / patch_h / patch_w;
-    for (int h = 0; h < height_col; ++h) {
-      for (int w = 0; w < width_col; ++w) {
-        int h_pad = h * stride_h - pad_h + h_offset;
-        int w_pad = w * stride_w - pad_w + w_offset;
-        if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width)
-          data_im[(c_im * height + h_pad) * width + w_pad] +=
-              data_col[(c * height_col + h) * width_col + w];
-      }
-    }
+  if (patch_h == 1 && patch_w == 1 && stride_h == 1 && stride_w == 1 &&
+      pad_h == 0 && pad_w == 0) {
+    caffe_copy(channels * height * width, data_col, data_im);
+    return;
   }
+  typename ChannelRange<Dtype>::Kernel kernel =
+      &col2im_cpu_kernel<Dtype, 0, 0, 0, 0>;
+#define COL2IM_KERNEL(KH, KW, SH, SW) \
+  if (patch_h == KH && patch_w == KW && stride_h == SH && stride_w == SW) { \
+    kernel = &col2im_cpu_kernel<Dtype, KH, KW, SH, SW>; \
+  }
+  COL2IM_KERNEL(1, 1, 1, 1);
+  COL2IM_KERNEL(3, 3, 1, 1);
+  COL2IM_KERNEL(3, 3, 2, 2);
+  COL2IM_KERNEL(5, 5, 1, 1);
+  COL2IM_KERNEL(11, 11, 4, 4);
+#undef COL2IM_KERNEL
+  const int height_col = (height + 2 * pad_h - patch_h) / stride_h + 1;
+  const int width_col = (width + 2 * pad_w - patch_w) / stride_w + 1;
+  const int col_size = patch_h * patch_w * height_col * width_col;
+  ChannelRange<Dtype> range = { kernel, data_col, col_size, data_im,
+      height * width, height, width, patch_h, patch_w, pad_h, pad_w,
+      stride_h, stride_w };
+  parallel_for(channels, GrainSize(col_size), range);
 }
 
 // Explicit instantiation
@@ -80,4 +232,41 @@ template void col2im_cpu<double>(const double* data_col, const int channels,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, double* data_im);
 
+template <typename Dtype>
+void im2row_nhwc_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, Dtype* data_row) {
+  const int height_col = (height + 2 * pad_h - kernel_h) / stride_h + 1;
+  const int width_col = (width + 2 * pad_w - kernel_w) / stride_w + 1;
+  for (int h = 0; h < height_col; ++h) {
+    for (int w = 0; w < width_col; ++w) {
+      for (int h_offset = 0; h_offset < kernel_h; ++h_offset) {
+        const int h_pad = h * stride_h - pad_h + h_offset;
+        for (int w_offset = 0; w_offset < kernel_w; ++w_offset) {
+          const int w_pad = w * stride_w - pad_w + w_offset;
+          // The channels of a pixel are contiguous in both.
+          if (h_pad >= 0 && h_pad < height && w_pad >= 0 && w_pad < width) {
+            memcpy(data_row, data_im + (h_pad * width + w_pad) * channels,
+                sizeof(Dtype) * channels);
+          } else {
+            memset(data_row, 0, sizeof(Dtype) * channels);
+          }
+          data_row += channels;
+        }
+      }
+    }
+  }
+}
+
+// Explicit instantiation
+template void im2row_nhwc_cpu<float>(const float* data_im,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, float* data_row);
+template void im2row_nhwc_cpu<double>(const double* data_im,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, double* data_row);
+
 }  // namespace caffe
@@ -0,0 +1,205 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <string>
+
+#include "caffe/util/image_cache.hpp"
+#include "caffe/util/io.hpp"
+
+namespace caffe {
+
+// Spilled images start on cache line boundaries.
+const size_t kSpillAlignment = 64;
+
+ImageCache& ImageCache::Get() {
+  static ImageCache instance;
+  return instance;
+}
+
+ImageCache::ImageCache()
+    : mutex_(new boost::mutex()), capacity_(0), memory_bytes_(0),
+      spill_fd_(-1), spill_data_(NULL), spill_capacity_(0), spill_used_(0),
+      hits_(0), spill_hits_(0), misses_(0) {
+}
+
+ImageCache::~ImageCache() {
+  if (spill_data_ != NULL) {
+    munmap(spill_data_, spill_capacity_);
+    close(spill_fd_);
+  }
+}
+
+void ImageCache::Reserve(const ImageCacheParameter& param) {
+  boost::mutex::scoped_lock lock(*mutex_);
+  capacity_ = std::max<size_t>(capacity_,
+      static_cast<size_t>(param.size_mb()) << 20);
+  if (!param.has_spill_file() || spill_fd_ >= 0) {
+    return;
+  }
+  CHECK_GT(param.spill_size_mb(), 0) << "spill_file needs a spill_size_mb";
+  spill_file_ = param.spill_file();
+  spill_capacity_ = static_cast<size_t>(param.spill_size_mb()) << 20;
+  spill_fd_ = open(spill_file_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+  CHECK_GE(spill_fd_, 0) << "Failed to open image cache spill file "
+      << spill_file_;
+  CHECK_EQ(ftruncate(spill_fd_, spill_capacity_), 0)
+      << "Failed to size image cache spill file " << spill_file_;
+  void* data = mmap(NULL, spill_capacity_, PROT_READ | PROT_WRITE,
+      MAP_SHARED, spill_fd_, 0);
+  CHECK(data != MAP_FAILED) << "Failed to map image cache spill file "
+      << spill_file_;
+  spill_data_ = static_cast<char*>(data);
+  // The spill file is scratch space: unlink it so that it goes away with
+  // the process.
+  unlink(spill_file_.c_str());
+  LOG(INFO) << "Spilling decoded images to " << spill_file_ << " ("
+            << param.spill_size_mb() << " MB)";
+}
+
+string ImageCache::ImageKey(const string& filename, int height, int width,
+    bool is_color, bool scaled_decode) {
+  std::ostringstream key;
+  key << filename << '|' << height << 'x' << width << (is_color ? 'c' : 'g');
+  if (scaled_decode) {
+    key << 's';
+  }
+  return key.str();
+}
+
+cv::Mat ImageCache::Lookup(const string& key) {
+  boost::mutex::scoped_lock lock(*mutex_);
+  if (!enabled()) {
+    return cv::Mat();
+  }
+  std::map<string, Entry>::iterator it = entries_.find(key);
+  if (it != entries_.end()) {
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    ++hits_;
+    return it->second.image;
+  }
+  std::map<string, SpillEntry>::const_iterator spilled = spilled_.find(key);
+  if (spilled == spilled_.end()) {
+    ++misses_;
+    return cv::Mat();
+  }
+  ++spill_hits_;
+  const SpillEntry& entry = spilled->second;
+  cv::Mat image = cv::Mat(entry.rows, entry.cols, entry.type,
+      spill_data_ + entry.offset).clone();
+  lock.unlock();
+  Insert(key, image);
+  return image;
+}
+
+void ImageCache::Insert(const string& key, const cv::Mat& image) {
+  const size_t bytes = image.total() * image.elemSize();
+  boost::mutex::scoped_lock lock(*mutex_);
+  if (!enabled() || bytes > capacity_ || entries_.count(key)) {
+    return;
+  }
+  lru_.push_front(key);
+  Entry& entry = entries_[key];
+  entry.image = image;
+  entry.lru = lru_.begin();
+  memory_bytes_ += bytes;
+  while (memory_bytes_ > capacity_) {
+    Evict();
+  }
+}
+
+void ImageCache::Evict() {
+  const string& key = lru_.back();
+  std::map<string, Entry>::iterator it = entries_.find(key);
+  const cv::Mat& image = it->second.image;
+  if (spill_data_ != NULL && !spilled_.count(key)) {
+    Spill(key, image);
+  }
+  memory_bytes_ -= image.total() * image.elemSize();
+  entries_.erase(it);
+  lru_.pop_back();
+}
+
+void ImageCache::Spill(const string& key, const cv::Mat& image) {
+  const size_t bytes = image.total() * image.elemSize();
+  const size_t offset = (spill_used_ + kSpillAlignment - 1) /
+      kSpillAlignment * kSpillAlignment;
+  if (offset + bytes > spill_capacity_) {
+    // The spill file is full: the image will be decoded again.
+    return;
+  }
+  const cv::Mat continuous = image.isContinuous() ? image : image.clone();
+  memcpy(spill_data_ + offset, continuous.data, bytes);
+  SpillEntry& entry = spilled_[key];
+  entry.offset = offset;
+  entry.rows = image.rows;
+  entry.cols = image.cols;
+  entry.type = image.type();
+  spill_used_ = offset + bytes;
+}
+
+cv::Mat ImageCache::ReadImage(const string& filename, int height, int width,
+    bool is_color, bool scaled_decode) {
+  if (!enabled()) {
+    return ReadImageToCVMat(filename, height, width, is_color, scaled_decode);
+  }
+  const string key = ImageKey(filename, height, width, is_color,
+      scaled_decode);
+  cv::Mat image = Lookup(key);
+  if (!image.data) {
+    image = ReadImageToCVMat(filename, height, width, is_color,
+        scaled_decode);
+    if (image.data) {
+      Insert(key, image);
+    }
+  }
+  return image;
+}
+
+size_t ImageCache::hits() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return hits_;
+}
+
+size_t ImageCache::spill_hits() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return spill_hits_;
+}
+
+size_t ImageCache::misses() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return misses_;
+}
+
+size_t ImageCache::memory_bytes() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return memory_bytes_;
+}
+
+size_t ImageCache::spill_bytes() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  return spill_used_;
+}
+
+string ImageCache::DebugString() const {
+  boost::mutex::scoped_lock lock(*mutex_);
+  const size_t lookups = hits_ + spill_hits_ + misses_;
+  std::ostringstream stats;
+  stats << "Image cache: hit rate "
+        << (lookups ? 100. * (hits_ + spill_hits_) / lookups : 0.) << "% ("
+        << hits_ << " hits, " << spill_hits_ << " spill hits, " << misses_
+        << " misses), " << entries_.size() << " images in "
+        << (memory_bytes_ >> 20) << " MB of " << (capacity_ >> 20) << " MB";
+  if (spill_data_ != NULL) {
+    stats << ", " << spilled_.size() << " images in " << (spill_used_ >> 20)
+          << " MB of " << (spill_capacity_ >> 20) << " MB spilled";
+  }
+  return stats.str();
+}
+
+}  // namespace caffe
@@ -0,0 +1,175 @@
+#include <algorithm>
+#include <cctype>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include "caffe/common.hpp"
+#include "caffe/util/insert_layouts.hpp"
+
+namespace caffe {
+
+bool LayerSupportsLayout(const LayerParameter& layer_param, Layout layout) {
+  if (layout != NHWC) {
+    return layout == NCHW;
+  }
+  const string& type = layer_param.type();
+  if (type == "Convolution") {
+    return layer_param.convolution_param().group() == 1 &&
+        !layer_param.has_quantization_param();
+  }
+  if (type == "Pooling") {
+    const PoolingParameter::PoolMethod pool =
+        layer_param.pooling_param().pool();
+    return layer_param.top_size() == 1 &&
+        (pool == PoolingParameter_PoolMethod_MAX ||
+         pool == PoolingParameter_PoolMethod_AVE);
+  }
+  if (type == "LRN") {
+    return layer_param.lrn_param().norm_region() ==
+        LRNParameter_NormRegion_ACROSS_CHANNELS;
+  }
+  return false;
+}
+
+bool LayerIsLayoutAgnostic(const LayerParameter& layer_param) {
+  static const char* kTypes[] = { "AbsVal", "BNLL", "Dropout", "Eltwise",
+      "Exp", "Power", "ReLU", "Sigmoid", "Split", "TanH", "Threshold" };
+  const int num_types = sizeof(kTypes) / sizeof(kTypes[0]);
+  return std::find(kTypes, kTypes + num_types, layer_param.type()) !=
+      kTypes + num_types;
+}
+
+namespace {
+
+// Returns `name`, or `name` with a number appended if it is already used,
+// and marks the result used.
+string UniqueBlobName(const string& name, std::set<string>* used) {
+  string unique = name;
+  for (int i = 1; used->count(unique); ++i) {
+    std::ostringstream numbered;
+    numbered << name << "_" << i;
+    unique = numbered.str();
+  }
+  used->insert(unique);
+  return unique;
+}
+
+void AddLayoutLayer(const string& bottom, const string& top, Layout layout,
+    NetParameter* param) {
+  LayerParameter* layer_param = param->add_layer();
+  layer_param->set_name(top + "_layout");
+  layer_param->set_type("Layout");
+  layer_param->add_bottom(bottom);
+  layer_param->add_top(top);
+  layer_param->set_layout(layout);
+}
+
+}  // namespace
+
+void InsertLayouts(const NetParameter& param, NetParameter* param_layout,
+    std::map<string, string>* layout_blobs) {
+  const Layout layout = param.layout();
+  CHECK_NE(layout, NCHW);
+  param_layout->CopyFrom(param);
+  param_layout->clear_layer();
+  string suffix = "_" + Layout_Name(layout);
+  std::transform(suffix.begin(), suffix.end(), suffix.begin(), ::tolower);
+  // The name of the latest version of each blob of `param`, in NCHW and in
+  // `layout`, or empty when it is not available in that layout.
+  std::map<string, string> nchw_name, layout_name;
+  // All the blob names of both nets, and the names produced so far.
+  std::set<string> used, produced;
+  // Like Net::Init, the blobs not consumed yet: the net outputs in the end.
+  std::set<string> available;
+  for (int i = 0; i < param.input_size(); ++i) {
+    nchw_name[param.input(i)] = param.input(i);
+    used.insert(param.input(i));
+    produced.insert(param.input(i));
+    available.insert(param.input(i));
+  }
+  for (int i = 0; i < param.layer_size(); ++i) {
+    for (int j = 0; j < param.layer(i).top_size(); ++j) {
+      used.insert(param.layer(i).top(j));
+    }
+  }
+  int converted = 0;
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const LayerParameter& layer_param = param.layer(i);
+    // Layers that support the layout always run in it. Elementwise layers
+    // run in it when all their bottoms are already in it.
+    bool in_layout = LayerSupportsLayout(layer_param, layout);
+    if (!in_layout && LayerIsLayoutAgnostic(layer_param) &&
+        layer_param.bottom_size() > 0) {
+      in_layout = true;
+      for (int j = 0; j < layer_param.bottom_size(); ++j) {
+        in_layout &= !layout_name[layer_param.bottom(j)].empty();
+      }
+    }
+    LayerParameter converted_param(layer_param);
+    for (int j = 0; j < layer_param.bottom_size(); ++j) {
+      const string& name = layer_param.bottom(j);
+      string& source = in_layout ? layout_name[name] : nchw_name[name];
+      if (source.empty()) {
+        const string& other = in_layout ? nchw_name[name] : layout_name[name];
+        CHECK(!other.empty()) << "Unknown bottom blob " << name;
+        source = in_layout || produced.count(name) ?
+            UniqueBlobName(name + (in_layout ? suffix : "_nchw"), &used) :
+            name;
+        AddLayoutLayer(other, source, in_layout ? layout : NCHW,
+            param_layout);
+        produced.insert(source);
+        available.erase(other);
+        available.insert(source);
+      }
+      converted_param.set_bottom(j, source);
+      available.erase(source);
+    }
+    for (int j = 0; j < layer_param.top_size(); ++j) {
+      const string& name = layer_param.top(j);
+      string top;
+      if (j < layer_param.bottom_size() && layer_param.bottom(j) == name) {
+        // In-place: the top is the bottom.
+        top = converted_param.bottom(j);
+      } else if (in_layout) {
+        top = UniqueBlobName(name + suffix, &used);
+      } else {
+        top = produced.count(name) ? UniqueBlobName(name, &used) : name;
+      }
+      converted_param.set_top(j, top);
+      nchw_name[name] = in_layout ? "" : top;
+      layout_name[name] = in_layout ? top : "";
+      produced.insert(top);
+      available.insert(top);
+    }
+    if (in_layout) {
+      converted_param.set_layout(layout);
+      ++converted;
+    }
+    param_layout->add_layer()->CopyFrom(converted_param);
+  }
+  // Convert the outputs back, under their own names if possible.
+  for (std::map<string, string>::const_iterator it = layout_name.begin();
+       it != layout_name.end(); ++it) {
+    if (!it->second.empty() && available.count(it->second)) {
+      const string top = produced.count(it->first) ?
+          UniqueBlobName(it->first, &used) : it->first;
+      AddLayoutLayer(it->second, top, NCHW, param_layout);
+      produced.insert(top);
+    }
+  }
+  if (layout_blobs) {
+    layout_blobs->clear();
+    for (std::map<string, string>::const_iterator it = layout_name.begin();
+         it != layout_name.end(); ++it) {
+      if (!it->second.empty() && !produced.count(it->first)) {
+        (*layout_blobs)[it->first] = it->second;
+      }
+    }
+  }
+  LOG(INFO) << converted << " layers run in the " << Layout_Name(layout)
+            << " layout";
+}
+
+}  // namespace caffe
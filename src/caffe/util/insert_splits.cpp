@@ -3,6 +3,7 @@
 #include <sstream>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "caffe/common.hpp"
 #include "caffe/util/insert_splits.hpp"
@@ -18,12 +19,16 @@ void InsertSplits(const NetParameter& param, NetParameter* param_split) {
   map<pair<int, int>, int> top_idx_to_bottom_count;
   map<pair<int, int>, float> top_idx_to_loss_weight;
   map<pair<int, int>, int> top_idx_to_bottom_split_idx;
+  // The layers consuming each top, and whether they all may share its diff.
+  map<pair<int, int>, vector<int> > top_idx_to_consumers;
+  map<pair<int, int>, bool> top_idx_to_accumulates;
   map<int, string> layer_idx_to_layer_name;
   layer_idx_to_layer_name[-1] = "input";
   // Determine the number of times each blob is used as an input (bottom) blob.
   for (int i = 0; i < param.input_size(); ++i) {
     const string& blob_name = param.input(i);
     blob_name_to_last_top_idx[blob_name] = make_pair(-1, i);
+    top_idx_to_accumulates[make_pair(-1, i)] = param.accumulate_diffs();
   }
   for (int i = 0; i < param.layer_size(); ++i) {
     const LayerParameter& layer_param = param.layer(i);
@@ -38,10 +43,18 @@ void InsertSplits(const NetParameter& param, NetParameter* param_split) {
       const pair<int, int>& top_idx = blob_name_to_last_top_idx[blob_name];
       bottom_idx_to_source_top_idx[bottom_idx] = top_idx;
       ++top_idx_to_bottom_count[top_idx];
+      vector<int>& consumers = top_idx_to_consumers[top_idx];
+      const bool in_place = std::find(layer_param.top().begin(),
+          layer_param.top().end(), blob_name) != layer_param.top().end();
+      top_idx_to_accumulates[top_idx] = top_idx_to_accumulates[top_idx] &&
+          LayerAccumulatesDiff(layer_param) && !in_place &&
+          std::find(consumers.begin(), consumers.end(), i) == consumers.end();
+      consumers.push_back(i);
     }
     for (int j = 0; j < layer_param.top_size(); ++j) {
       const string& blob_name = layer_param.top(j);
       blob_name_to_last_top_idx[blob_name] = make_pair(i, j);
+      top_idx_to_accumulates[make_pair(i, j)] = param.accumulate_diffs();
     }
     // A use of a top blob as a loss should be handled similarly to the use of
     // a top blob as an input (bottom) blob to another layer.
@@ -53,9 +66,19 @@ void InsertSplits(const NetParameter& param, NetParameter* param_split) {
       top_idx_to_loss_weight[top_idx] = layer_param.loss_weight(j);
       if (top_idx_to_loss_weight[top_idx]) {
         ++top_idx_to_bottom_count[top_idx];
+        top_idx_to_accumulates[top_idx] = false;
       }
     }
   }
+  // The blobs whose consumers add their gradients into its one diff need no
+  // split.
+  for (map<pair<int, int>, bool>::const_iterator it =
+       top_idx_to_accumulates.begin(); it != top_idx_to_accumulates.end();
+       ++it) {
+    if (it->second) {
+      top_idx_to_bottom_count[it->first] = 1;
+    }
+  }
   // Create split layer for any input blobs used by other layer as bottom
   // blobs more than once.
   for (int i = 0; i < param.input_size(); ++i) {
@@ -105,6 +128,14 @@ void InsertSplits(const NetParameter& param, NetParameter* param_split) {
   }
 }
 
+bool LayerAccumulatesDiff(const LayerParameter& layer_param) {
+  static const char* kTypes[] = { "Convolution", "InnerProduct", "ReLU",
+      "Sigmoid", "TanH" };
+  const int num_types = sizeof(kTypes) / sizeof(kTypes[0]);
+  return std::find(kTypes, kTypes + num_types, layer_param.type()) !=
+      kTypes + num_types;
+}
+
 void ConfigureSplitLayer(const string& layer_name, const string& blob_name,
     const int blob_idx, const int split_count, const float loss_weight,
     LayerParameter* split_layer_param) {
@@ -1,3 +1,4 @@
+#include <boost/thread/recursive_mutex.hpp>
 #include <fcntl.h>
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
@@ -8,6 +9,11 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include <stdint.h>
 
+#ifdef USE_LIBJPEG
+#include <jpeglib.h>
+#include <setjmp.h>
+#endif
+
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
 #include <string>
@@ -29,6 +35,11 @@ using google::protobuf::io::ZeroCopyOutputStream;
 using google::protobuf::io::CodedOutputStream;
 using google::protobuf::Message;
 
+static boost::recursive_mutex& hdf5_mutex() {
+  static boost::recursive_mutex mutex;
+  return mutex;
+}
+
 bool ReadProtoFromTextFile(const char* filename, Message* proto) {
   int fd = open(filename, O_RDONLY);
   CHECK_NE(fd, -1) << "File not found: " << filename;
@@ -67,12 +78,208 @@ void WriteProtoToBinaryFile(const Message& proto, const char* filename) {
   CHECK(proto.SerializeToOstream(&output));
 }
 
+#ifdef USE_LIBJPEG
+struct JPEGErrorManager {
+  jpeg_error_mgr pub;
+  jmp_buf setjmp_buffer;
+};
+
+// Returns to the setjmp of the decoder instead of exiting.
+static void JPEGErrorExit(j_common_ptr cinfo) {
+  JPEGErrorManager* err = reinterpret_cast<JPEGErrorManager*>(cinfo->err);
+  char message[JMSG_LENGTH_MAX];
+  (*cinfo->err->format_message)(cinfo, message);
+  DLOG(INFO) << "libjpeg: " << message;
+  longjmp(err->setjmp_buffer, 1);
+}
+
+static void JPEGOutputMessage(j_common_ptr cinfo) {
+}
+#endif
+
+static bool IsJPEG(const string& data) {
+  return data.size() > 3 && static_cast<uint8_t>(data[0]) == 0xFF &&
+      static_cast<uint8_t>(data[1]) == 0xD8 &&
+      static_cast<uint8_t>(data[2]) == 0xFF;
+}
+
+// Decodes the rows [h_off, h_off + height) and columns [w_off, w_off + width)
+// of a JPEG decoded at 1 / scale_denom of its size, scale_denom being the
+// largest of 8, 4, 2 and 1 that keeps the image at least min_height x
+// min_width. A zero height or width means the whole decoded image. Returns
+// an empty image if the data cannot be decoded by libjpeg or the crop is
+// out of the image.
+//
+// libjpeg errors longjmp back here, so no object with a destructor may be
+// created between a setjmp and the libjpeg calls it guards: the row buffer
+// comes from libjpeg's own pool, freed with cinfo, and the image is created
+// before the setjmp guarding the scanlines.
+static cv::Mat DecodeJPEG(const string& data, bool is_color,
+    int min_height, int min_width, int h_off, int w_off, int height,
+    int width) {
+  cv::Mat cv_img;
+#ifdef USE_LIBJPEG
+  if (!IsJPEG(data)) {
+    return cv_img;
+  }
+  jpeg_decompress_struct cinfo;
+  JPEGErrorManager jerr;
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = JPEGErrorExit;
+  jerr.pub.output_message = JPEGOutputMessage;
+  jpeg_create_decompress(&cinfo);
+  if (setjmp(jerr.setjmp_buffer)) {
+    // Unsupported or corrupt data, such as CMYK images: let OpenCV try.
+    jpeg_destroy_decompress(&cinfo);
+    return cv::Mat();
+  }
+  jpeg_mem_src(&cinfo, reinterpret_cast<unsigned char*>(
+      const_cast<char*>(data.data())), data.size());
+  jpeg_read_header(&cinfo, TRUE);
+#ifdef JCS_EXTENSIONS
+  cinfo.out_color_space = is_color ? JCS_EXT_BGR : JCS_GRAYSCALE;
+#else
+  cinfo.out_color_space = is_color ? JCS_RGB : JCS_GRAYSCALE;
+#endif
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = 1;
+  if (min_height > 0 && min_width > 0) {
+    for (int denom = 8; denom > 1; denom /= 2) {
+      if ((cinfo.image_height + denom - 1) / denom >= min_height &&
+          (cinfo.image_width + denom - 1) / denom >= min_width) {
+        cinfo.scale_denom = denom;
+        break;
+      }
+    }
+  }
+  jpeg_start_decompress(&cinfo);
+  if (height == 0 || width == 0) {
+    height = cinfo.output_height;
+    width = cinfo.output_width;
+  }
+  if (h_off < 0 || w_off < 0 || h_off + height > cinfo.output_height ||
+      w_off + width > cinfo.output_width) {
+    DLOG(INFO) << "Crop out of the " << cinfo.output_height << "x"
+               << cinfo.output_width << " image";
+    jpeg_destroy_decompress(&cinfo);
+    return cv::Mat();
+  }
+  const int channels = cinfo.output_components;
+  JDIMENSION x_off = w_off;
+  JDIMENSION row_width = cinfo.output_width;
+#ifdef LIBJPEG_TURBO_VERSION_NUMBER
+  // Decode only the iMCU columns and the rows of the crop.
+  if (width < cinfo.output_width) {
+    row_width = width;
+    jpeg_crop_scanline(&cinfo, &x_off, &row_width);
+  }
+  if (h_off > 0) {
+    jpeg_skip_scanlines(&cinfo, h_off);
+  }
+  const int skip_x = w_off - x_off;
+#else
+  const int skip_x = w_off;
+#endif
+  JSAMPROW row = (*cinfo.mem->alloc_sarray)(
+      reinterpret_cast<j_common_ptr>(&cinfo), JPOOL_IMAGE,
+      row_width * channels, 1)[0];
+  cv_img.create(height, width, CV_8UC(channels));
+  if (setjmp(jerr.setjmp_buffer)) {
+    jpeg_destroy_decompress(&cinfo);
+    return cv::Mat();
+  }
+#ifndef LIBJPEG_TURBO_VERSION_NUMBER
+  for (int h = 0; h < h_off; ++h) {
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+#endif
+  for (int h = 0; h < height; ++h) {
+    jpeg_read_scanlines(&cinfo, &row, 1);
+    memcpy(cv_img.ptr<uchar>(h), row + skip_x * channels, width * channels);
+  }
+  if (cinfo.output_scanline < cinfo.output_height) {
+    // Rows below the crop are never decoded.
+    jpeg_abort_decompress(&cinfo);
+  } else {
+    jpeg_finish_decompress(&cinfo);
+  }
+  jpeg_destroy_decompress(&cinfo);
+#ifndef JCS_EXTENSIONS
+  if (is_color) {
+    cv::cvtColor(cv_img, cv_img, CV_RGB2BGR);
+  }
+#endif
+#endif  // USE_LIBJPEG
+  return cv_img;
+}
+
+bool ReadJPEGHeader(const string& data, int* height, int* width,
+    int* channels) {
+#ifdef USE_LIBJPEG
+  if (!IsJPEG(data)) {
+    return false;
+  }
+  jpeg_decompress_struct cinfo;
+  JPEGErrorManager jerr;
+  cinfo.err = jpeg_std_error(&jerr.pub);
+  jerr.pub.error_exit = JPEGErrorExit;
+  jerr.pub.output_message = JPEGOutputMessage;
+  jpeg_create_decompress(&cinfo);
+  if (setjmp(jerr.setjmp_buffer)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_mem_src(&cinfo, reinterpret_cast<unsigned char*>(
+      const_cast<char*>(data.data())), data.size());
+  jpeg_read_header(&cinfo, TRUE);
+  *height = cinfo.image_height;
+  *width = cinfo.image_width;
+  *channels = cinfo.num_components == 1 ? 1 : 3;
+  jpeg_destroy_decompress(&cinfo);
+  return true;
+#else
+  return false;
+#endif
+}
+
+cv::Mat DecodeJPEGToCVMat(const string& data, bool is_color,
+    int min_height, int min_width) {
+  return DecodeJPEG(data, is_color, min_height, min_width, 0, 0, 0, 0);
+}
+
+cv::Mat DecodeJPEGCropToCVMat(const string& data, bool is_color,
+    int h_off, int w_off, int height, int width) {
+  return DecodeJPEG(data, is_color, 0, 0, h_off, w_off, height, width);
+}
+
+bool ReadFileToString(const string& filename, string* data) {
+  fstream file(filename.c_str(), ios::in|ios::binary|ios::ate);
+  if (!file.is_open()) {
+    return false;
+  }
+  std::streampos size = file.tellg();
+  data->resize(size);
+  file.seekg(0, ios::beg);
+  file.read(&(*data)[0], size);
+  return true;
+}
+
 cv::Mat ReadImageToCVMat(const string& filename,
-    const int height, const int width, const bool is_color) {
+    const int height, const int width, const bool is_color,
+    const bool scaled_decode) {
   cv::Mat cv_img;
-  int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
-    CV_LOAD_IMAGE_GRAYSCALE);
-  cv::Mat cv_img_origin = cv::imread(filename, cv_read_flag);
+  cv::Mat cv_img_origin;
+  if (scaled_decode && height > 0 && width > 0) {
+    string data;
+    if (ReadFileToString(filename, &data)) {
+      cv_img_origin = DecodeJPEGToCVMat(data, is_color, height, width);
+    }
+  }
+  if (!cv_img_origin.data) {
+    int cv_read_flag = (is_color ? CV_LOAD_IMAGE_COLOR :
+      CV_LOAD_IMAGE_GRAYSCALE);
+    cv_img_origin = cv::imread(filename, cv_read_flag);
+  }
   if (!cv_img_origin.data) {
     LOG(ERROR) << "Could not open or find file " << filename;
     return cv_img_origin;
@@ -113,8 +320,9 @@ static bool matchExt(const std::string & fn,
 }
 bool ReadImageToDatum(const string& filename, const int label,
     const int height, const int width, const bool is_color,
-    const std::string & encoding, Datum* datum) {
-  cv::Mat cv_img = ReadImageToCVMat(filename, height, width, is_color);
+    const std::string & encoding, Datum* datum, const bool scaled_decode) {
+  cv::Mat cv_img = ReadImageToCVMat(filename, height, width, is_color,
+      scaled_decode);
   if (cv_img.data) {
     if (encoding.size()) {
       if ( (cv_img.channels() == 3) == is_color && !height && !width &&
@@ -228,11 +436,18 @@ void CVMatToDatum(const cv::Mat& cv_img, Datum* datum) {
   datum->set_data(buffer);
 }
 
-// Verifies format of data stored in HDF5 file and reshapes blob accordingly.
-template <typename Dtype>
-void hdf5_load_nd_dataset_helper(
+HDF5Lock::HDF5Lock() {
+  hdf5_mutex().lock();
+}
+
+HDF5Lock::~HDF5Lock() {
+  hdf5_mutex().unlock();
+}
+
+void hdf5_get_nd_dataset_dims(
     hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
-    Blob<Dtype>* blob) {
+    std::vector<hsize_t>* dims) {
+  HDF5Lock lock;
   // Verify that the dataset exists.
   CHECK(H5LTfind_dataset(file_id, dataset_name_))
       << "Failed to find HDF5 dataset " << dataset_name_;
@@ -245,13 +460,60 @@ void hdf5_load_nd_dataset_helper(
   CHECK_LE(ndims, max_dim);
 
   // Verify that the data format is what we expect: float or double.
-  std::vector<hsize_t> dims(ndims);
+  dims->resize(ndims);
   H5T_class_t class_;
   status = H5LTget_dataset_info(
-      file_id, dataset_name_, dims.data(), &class_, NULL);
+      file_id, dataset_name_, dims->data(), &class_, NULL);
   CHECK_GE(status, 0) << "Failed to get dataset info for " << dataset_name_;
   CHECK_EQ(class_, H5T_FLOAT) << "Expected float or double data";
+}
+
+template <typename Dtype>
+static void hdf5_load_nd_dataset_rows(hid_t dataset_id, hsize_t row,
+    hsize_t num_rows, hid_t mem_type_id, Dtype* data) {
+  HDF5Lock lock;
+  hid_t file_space = H5Dget_space(dataset_id);
+  CHECK_GE(file_space, 0) << "Failed to get HDF5 dataspace";
+  const int ndims = H5Sget_simple_extent_ndims(file_space);
+  std::vector<hsize_t> start(ndims, 0);
+  std::vector<hsize_t> count(ndims);
+  H5Sget_simple_extent_dims(file_space, &count[0], NULL);
+  CHECK_LE(row + num_rows, count[0]) << "Rows out of range";
+  start[0] = row;
+  count[0] = num_rows;
+  herr_t status = H5Sselect_hyperslab(file_space, H5S_SELECT_SET,
+      &start[0], NULL, &count[0], NULL);
+  CHECK_GE(status, 0) << "Failed to select HDF5 hyperslab";
+  hid_t mem_space = H5Screate_simple(ndims, &count[0], NULL);
+  status = H5Dread(dataset_id, mem_type_id, mem_space, file_space,
+      H5P_DEFAULT, data);
+  CHECK_GE(status, 0) << "Failed to read rows " << row << " to "
+                      << row + num_rows;
+  H5Sclose(mem_space);
+  H5Sclose(file_space);
+}
+
+template <>
+void hdf5_load_nd_dataset_rows<float>(hid_t dataset_id, hsize_t row,
+    hsize_t num_rows, float* data) {
+  hdf5_load_nd_dataset_rows(dataset_id, row, num_rows, H5T_NATIVE_FLOAT,
+      data);
+}
+
+template <>
+void hdf5_load_nd_dataset_rows<double>(hid_t dataset_id, hsize_t row,
+    hsize_t num_rows, double* data) {
+  hdf5_load_nd_dataset_rows(dataset_id, row, num_rows, H5T_NATIVE_DOUBLE,
+      data);
+}
 
+// Verifies format of data stored in HDF5 file and reshapes blob accordingly.
+template <typename Dtype>
+void hdf5_load_nd_dataset_helper(
+    hid_t file_id, const char* dataset_name_, int min_dim, int max_dim,
+    Blob<Dtype>* blob) {
+  std::vector<hsize_t> dims;
+  hdf5_get_nd_dataset_dims(file_id, dataset_name_, min_dim, max_dim, &dims);
   blob->Reshape(
     dims[0],
     (dims.size() > 1) ? dims[1] : 1,
@@ -263,6 +525,7 @@ template <>
 void hdf5_load_nd_dataset<float>(hid_t file_id, const char* dataset_name_,
         int min_dim, int max_dim, Blob<float>* blob) {
   hdf5_load_nd_dataset_helper(file_id, dataset_name_, min_dim, max_dim, blob);
+  HDF5Lock lock;
   herr_t status = H5LTread_dataset_float(
     file_id, dataset_name_, blob->mutable_cpu_data());
   CHECK_GE(status, 0) << "Failed to read float dataset " << dataset_name_;
@@ -272,6 +535,7 @@ template <>
 void hdf5_load_nd_dataset<double>(hid_t file_id, const char* dataset_name_,
         int min_dim, int max_dim, Blob<double>* blob) {
   hdf5_load_nd_dataset_helper(file_id, dataset_name_, min_dim, max_dim, blob);
+  HDF5Lock lock;
   herr_t status = H5LTread_dataset_double(
     file_id, dataset_name_, blob->mutable_cpu_data());
   CHECK_GE(status, 0) << "Failed to read double dataset " << dataset_name_;
@@ -285,6 +549,7 @@ void hdf5_save_nd_dataset<float>(
   dims[1] = blob.channels();
   dims[2] = blob.height();
   dims[3] = blob.width();
+  HDF5Lock lock;
   herr_t status = H5LTmake_dataset_float(
       file_id, dataset_name.c_str(), HDF5_NUM_DIMS, dims, blob.cpu_data());
   CHECK_GE(status, 0) << "Failed to make float dataset " << dataset_name;
@@ -298,9 +563,99 @@ void hdf5_save_nd_dataset<double>(
   dims[1] = blob.channels();
   dims[2] = blob.height();
   dims[3] = blob.width();
+  HDF5Lock lock;
   herr_t status = H5LTmake_dataset_double(
       file_id, dataset_name.c_str(), HDF5_NUM_DIMS, dims, blob.cpu_data());
   CHECK_GE(status, 0) << "Failed to make double dataset " << dataset_name;
 }
 
+// Creates a dataset of rows of shape `row_dims` that can grow along the first
+// dimension, stored in chunks of `chunk_rows` rows.
+static hid_t hdf5_create_extendible_dataset(hid_t file_id,
+    const string& dataset_name, const std::vector<hsize_t>& row_dims,
+    hsize_t chunk_rows, int compression, hid_t type_id) {
+  HDF5Lock lock;
+  const int ndims = row_dims.size() + 1;
+  std::vector<hsize_t> dims(ndims, 0);
+  std::vector<hsize_t> max_dims(ndims, H5S_UNLIMITED);
+  std::vector<hsize_t> chunk_dims(ndims, chunk_rows);
+  for (int i = 1; i < ndims; ++i) {
+    max_dims[i] = chunk_dims[i] = dims[i] = row_dims[i - 1];
+  }
+  hid_t space = H5Screate_simple(ndims, &dims[0], &max_dims[0]);
+  hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+  herr_t status = H5Pset_chunk(dcpl, ndims, &chunk_dims[0]);
+  CHECK_GE(status, 0) << "Failed to set chunking of " << dataset_name;
+  if (compression > 0) {
+    CHECK_LE(compression, 9) << "gzip compression level must be in [1, 9]";
+    // Shuffling the bytes of floats first makes them compress much better.
+    H5Pset_shuffle(dcpl);
+    status = H5Pset_deflate(dcpl, compression);
+    CHECK_GE(status, 0) << "Failed to set compression of " << dataset_name;
+  }
+  hid_t dataset_id = H5Dcreate2(file_id, dataset_name.c_str(), type_id, space,
+      H5P_DEFAULT, dcpl, H5P_DEFAULT);
+  CHECK_GE(dataset_id, 0) << "Failed to create dataset " << dataset_name;
+  H5Pclose(dcpl);
+  H5Sclose(space);
+  return dataset_id;
+}
+
+template <>
+hid_t hdf5_create_extendible_dataset<float>(hid_t file_id,
+    const string& dataset_name, const std::vector<hsize_t>& row_dims,
+    hsize_t chunk_rows, int compression) {
+  return hdf5_create_extendible_dataset(file_id, dataset_name, row_dims,
+      chunk_rows, compression, H5T_NATIVE_FLOAT);
+}
+
+template <>
+hid_t hdf5_create_extendible_dataset<double>(hid_t file_id,
+    const string& dataset_name, const std::vector<hsize_t>& row_dims,
+    hsize_t chunk_rows, int compression) {
+  return hdf5_create_extendible_dataset(file_id, dataset_name, row_dims,
+      chunk_rows, compression, H5T_NATIVE_DOUBLE);
+}
+
+template <typename Dtype>
+static void hdf5_append_nd_dataset_rows(hid_t dataset_id, hsize_t num_rows,
+    hid_t mem_type_id, const Dtype* data) {
+  HDF5Lock lock;
+  hid_t file_space = H5Dget_space(dataset_id);
+  CHECK_GE(file_space, 0) << "Failed to get HDF5 dataspace";
+  const int ndims = H5Sget_simple_extent_ndims(file_space);
+  std::vector<hsize_t> dims(ndims);
+  H5Sget_simple_extent_dims(file_space, &dims[0], NULL);
+  H5Sclose(file_space);
+  std::vector<hsize_t> start(ndims, 0);
+  start[0] = dims[0];
+  dims[0] += num_rows;
+  herr_t status = H5Dset_extent(dataset_id, &dims[0]);
+  CHECK_GE(status, 0) << "Failed to extend HDF5 dataset";
+  file_space = H5Dget_space(dataset_id);
+  std::vector<hsize_t> count(dims);
+  count[0] = num_rows;
+  status = H5Sselect_hyperslab(file_space, H5S_SELECT_SET,
+      &start[0], NULL, &count[0], NULL);
+  CHECK_GE(status, 0) << "Failed to select HDF5 hyperslab";
+  hid_t mem_space = H5Screate_simple(ndims, &count[0], NULL);
+  status = H5Dwrite(dataset_id, mem_type_id, mem_space, file_space,
+      H5P_DEFAULT, data);
+  CHECK_GE(status, 0) << "Failed to append " << num_rows << " rows";
+  H5Sclose(mem_space);
+  H5Sclose(file_space);
+}
+
+template <>
+void hdf5_append_nd_dataset_rows<float>(hid_t dataset_id, hsize_t num_rows,
+    const float* data) {
+  hdf5_append_nd_dataset_rows(dataset_id, num_rows, H5T_NATIVE_FLOAT, data);
+}
+
+template <>
+void hdf5_append_nd_dataset_rows<double>(hid_t dataset_id, hsize_t num_rows,
+    const double* data) {
+  hdf5_append_nd_dataset_rows(dataset_id, num_rows, H5T_NATIVE_DOUBLE, data);
+}
+
 }  // namespace caffe
@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/low_rank.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// The number of power iterations refining the random subspace; each one
+// sharpens the decay of the singular values it separates.
+const int kLowRankIterations = 4;
+
+// Makes the rows of the rows x cols x orthonormal by Gram-Schmidt, applied
+// twice so that rounding does not build up. Rows that are dependent on the
+// previous ones are set to zero.
+template <typename Dtype>
+static void OrthonormalizeRows(const int rows, const int cols, Dtype* x) {
+  for (int i = 0; i < rows; ++i) {
+    Dtype* row = x + i * cols;
+    const Dtype norm = std::sqrt(caffe_cpu_dot(cols, row, row));
+    for (int pass = 0; pass < 2; ++pass) {
+      for (int j = 0; j < i; ++j) {
+        const Dtype* other = x + j * cols;
+        caffe_axpy(cols, -caffe_cpu_dot(cols, row, other), other, row);
+      }
+    }
+    const Dtype remaining = std::sqrt(caffe_cpu_dot(cols, row, row));
+    if (remaining <= norm * std::sqrt(std::numeric_limits<Dtype>::epsilon())) {
+      caffe_set(cols, Dtype(0), row);
+    } else {
+      caffe_scal(cols, Dtype(1) / remaining, row);
+    }
+  }
+}
+
+// Diagonalizes the symmetric n x n a by cyclic Jacobi rotations, leaving its
+// eigenvalues on the diagonal of a and its eigenvectors in the columns of e.
+template <typename Dtype>
+static void SymmetricEigen(const int n, Dtype* a, Dtype* e) {
+  caffe_set(n * n, Dtype(0), e);
+  for (int i = 0; i < n; ++i) {
+    e[i * n + i] = 1;
+  }
+  Dtype total = 0;
+  for (int i = 0; i < n * n; ++i) {
+    total += a[i] * a[i];
+  }
+  const Dtype tolerance = total * std::numeric_limits<Dtype>::epsilon() *
+      std::numeric_limits<Dtype>::epsilon();
+  const int kMaxSweeps = 50;
+  for (int sweep = 0; sweep < kMaxSweeps; ++sweep) {
+    Dtype off_diagonal = 0;
+    for (int p = 0; p < n; ++p) {
+      for (int q = p + 1; q < n; ++q) {
+        off_diagonal += 2 * a[p * n + q] * a[p * n + q];
+      }
+    }
+    if (off_diagonal <= tolerance) {
+      return;
+    }
+    for (int p = 0; p < n; ++p) {
+      for (int q = p + 1; q < n; ++q) {
+        const Dtype a_pq = a[p * n + q];
+        if (a_pq == 0) {
+          continue;
+        }
+        const Dtype theta = (a[q * n + q] - a[p * n + p]) / (2 * a_pq);
+        const Dtype t = (theta >= 0 ? 1 : -1) /
+            (std::fabs(theta) + std::sqrt(theta * theta + 1));
+        const Dtype c = 1 / std::sqrt(t * t + 1);
+        const Dtype s = t * c;
+        for (int k = 0; k < n; ++k) {
+          const Dtype a_kp = a[k * n + p];
+          const Dtype a_kq = a[k * n + q];
+          a[k * n + p] = c * a_kp - s * a_kq;
+          a[k * n + q] = s * a_kp + c * a_kq;
+        }
+        for (int k = 0; k < n; ++k) {
+          const Dtype a_pk = a[p * n + k];
+          const Dtype a_qk = a[q * n + k];
+          a[p * n + k] = c * a_pk - s * a_qk;
+          a[q * n + k] = s * a_pk + c * a_qk;
+        }
+        for (int k = 0; k < n; ++k) {
+          const Dtype e_kp = e[k * n + p];
+          const Dtype e_kq = e[k * n + q];
+          e[k * n + p] = c * e_kp - s * e_kq;
+          e[k * n + q] = s * e_kp + c * e_kq;
+        }
+      }
+    }
+  }
+  LOG(WARNING) << "Jacobi eigendecomposition did not converge";
+}
+
+template <typename Dtype>
+void low_rank_cpu(const int M, const int N, const Dtype* W, const int rank,
+    Dtype* U, Dtype* V, Dtype* energies) {
+  CHECK_GT(rank, 0);
+  CHECK_LE(rank, std::min(M, N));
+  // The rows of q span the approximation of the column space of W, and the
+  // rows of z that of its row space.
+  std::vector<Dtype> q(rank * M);
+  std::vector<Dtype> z(rank * N);
+  caffe_rng_gaussian<Dtype>(rank * N, Dtype(0), Dtype(1), &z[0]);
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, rank, M, N, (Dtype)1.,
+      &z[0], W, (Dtype)0., &q[0]);
+  OrthonormalizeRows(rank, M, &q[0]);
+  for (int i = 0; i < kLowRankIterations; ++i) {
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, rank, N, M, (Dtype)1.,
+        &q[0], W, (Dtype)0., &z[0]);
+    OrthonormalizeRows(rank, N, &z[0]);
+    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, rank, M, N, (Dtype)1.,
+        &z[0], W, (Dtype)0., &q[0]);
+    OrthonormalizeRows(rank, M, &q[0]);
+  }
+  // W ~ q^T b. The eigenvectors of b b^T rotate q and b to the singular
+  // vectors.
+  std::vector<Dtype> b(rank * N);
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, rank, N, M, (Dtype)1.,
+      &q[0], W, (Dtype)0., &b[0]);
+  std::vector<Dtype> gram(rank * rank);
+  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, rank, rank, N, (Dtype)1.,
+      &b[0], &b[0], (Dtype)0., &gram[0]);
+  std::vector<Dtype> eigenvectors(rank * rank);
+  SymmetricEigen(rank, &gram[0], &eigenvectors[0]);
+  std::vector<std::pair<Dtype, int> > order(rank);
+  for (int i = 0; i < rank; ++i) {
+    order[i] = std::make_pair(gram[i * rank + i], i);
+  }
+  std::sort(order.begin(), order.end(),
+      std::greater<std::pair<Dtype, int> >());
+  std::vector<Dtype> rotation(rank * rank);
+  for (int i = 0; i < rank; ++i) {
+    energies[i] = std::max(order[i].first, Dtype(0));
+    for (int k = 0; k < rank; ++k) {
+      rotation[k * rank + i] = eigenvectors[k * rank + order[i].second];
+    }
+  }
+  caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, M, rank, rank, (Dtype)1.,
+      &q[0], &rotation[0], (Dtype)0., U);
+  caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, rank, N, rank, (Dtype)1.,
+      &rotation[0], &b[0], (Dtype)0., V);
+}
+
+template void low_rank_cpu<float>(const int M, const int N, const float* W,
+    const int rank, float* U, float* V, float* energies);
+template void low_rank_cpu<double>(const int M, const int N, const double* W,
+    const int rank, double* U, double* V, double* energies);
+
+}  // namespace caffe
@@ -0,0 +1,91 @@
+#ifdef __linux__
+#include <sched.h>
+#endif
+
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>  // NOLINT(readability/streams)
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "caffe/common.hpp"
+#include "caffe/util/numa.hpp"
+
+namespace caffe {
+
+static boost::thread_specific_ptr<int> thread_numa_node;
+
+static string NodePath(int node) {
+  std::ostringstream path;
+  path << "/sys/devices/system/node/node" << node << "/cpulist";
+  return path.str();
+}
+
+int NumaNodeCount() {
+  static int count = 0;
+  if (count == 0) {
+    int nodes = 0;
+    while (std::ifstream(NodePath(nodes).c_str()).good()) {
+      ++nodes;
+    }
+    count = std::max(nodes, 1);
+  }
+  return count;
+}
+
+std::vector<int> NumaNodeCpus(int node) {
+  std::vector<int> cpus;
+  std::ifstream file(NodePath(node).c_str());
+  if (!file.good()) {
+    // No NUMA information: all the cpus are on the one node.
+    CHECK_EQ(node, 0) << "No NUMA node " << node;
+    const int count = boost::thread::hardware_concurrency();
+    for (int cpu = 0; cpu < count; ++cpu) {
+      cpus.push_back(cpu);
+    }
+    return cpus;
+  }
+  // A list of ranges such as "0-7,16-23".
+  string range;
+  while (std::getline(file, range, ',')) {
+    int first, last;
+    const int fields = sscanf(range.c_str(), "%d-%d", &first, &last);
+    if (fields < 1) {
+      continue;
+    }
+    if (fields == 1) {
+      last = first;
+    }
+    for (int cpu = first; cpu <= last; ++cpu) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+void BindThreadToNumaNode(int node) {
+  CHECK_GE(node, 0);
+  CHECK_LT(node, NumaNodeCount()) << "No NUMA node " << node;
+#ifdef __linux__
+  const std::vector<int> cpus = NumaNodeCpus(node);
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int i = 0; i < cpus.size(); ++i) {
+    CPU_SET(cpus[i], &set);
+  }
+  CHECK_EQ(sched_setaffinity(0, sizeof(set), &set), 0)
+      << "Failed to bind thread to NUMA node " << node;
+#else
+  LOG(WARNING) << "Threads can only be bound to NUMA nodes on Linux";
+#endif
+  thread_numa_node.reset(new int(node));
+}
+
+int CurrentNumaNode() {
+  return thread_numa_node.get() ? *thread_numa_node : -1;
+}
+
+}  // namespace caffe
@@ -0,0 +1,183 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "caffe/util/packed_gemm.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+// The micro-kernel computes panels of kPanelRows x kPanelCols of C, whose
+// accumulators stay in registers, over blocks of kBlockDepth columns of A
+// (and rows of B). B is packed kBlockDepth x kBlockWidth at a time, a block
+// sized to stay in cache while all the panels of A go through it.
+const int kPanelRows = 4;
+const int kPanelCols = 8;
+const int kBlockDepth = 256;
+const int kBlockWidth = 512;
+
+static inline int RoundUp(const int n, const int multiple) {
+  return (n + multiple - 1) / multiple * multiple;
+}
+
+template <typename Dtype>
+void update_packed_weights(const Blob<Dtype>& weights, const int rows,
+    const int groups, PackedWeights<Dtype>* packed) {
+  const Dtype* data = weights.cpu_data();
+  const SyncedMemory* memory = weights.data().get();
+  const unsigned int version = weights.data()->version();
+  if (packed->packed && memory == packed->memory &&
+      version == packed->version && rows == packed->rows &&
+      groups == packed->groups) {
+    return;
+  }
+  CHECK_EQ(rows % groups, 0);
+  const int cols = weights.count() / rows;
+  const int group_rows = rows / groups;
+  const int padded_rows = RoundUp(group_rows, kPanelRows);
+  packed->data.resize(groups * padded_rows * cols);
+  for (int g = 0; g < groups; ++g) {
+    const Dtype* w = data + g * group_rows * cols;
+    Dtype* out = &packed->data[g * padded_rows * cols];
+    for (int k0 = 0; k0 < cols; k0 += kBlockDepth) {
+      const int depth = std::min(kBlockDepth, cols - k0);
+      Dtype* block = out + k0 * padded_rows;
+      for (int p = 0; p < padded_rows / kPanelRows; ++p) {
+        Dtype* panel = block + p * kPanelRows * depth;
+        for (int k = 0; k < depth; ++k) {
+          for (int r = 0; r < kPanelRows; ++r) {
+            const int row = p * kPanelRows + r;
+            panel[k * kPanelRows + r] =
+                row < group_rows ? w[row * cols + k0 + k] : Dtype(0);
+          }
+        }
+      }
+    }
+  }
+  packed->packed = true;
+  packed->rows = rows;
+  packed->cols = cols;
+  packed->groups = groups;
+  packed->memory = memory;
+  packed->version = version;
+}
+
+template void update_packed_weights<float>(const Blob<float>& weights,
+    const int rows, const int groups, PackedWeights<float>* packed);
+template void update_packed_weights<double>(const Blob<double>& weights,
+    const int rows, const int groups, PackedWeights<double>* packed);
+
+// Computes the panels [begin, end) of rows of C for one block of A and B: the
+// product of each panel of A with each panel of B is added up in registers
+// and then written to C (or added to it, after the first block).
+template <typename Dtype>
+struct PackedPanels {
+  const Dtype* A;
+  const Dtype* B;
+  int depth, width, rows;
+  Dtype* C;
+  int row_stride, col_stride;
+  bool accumulate;
+  void operator()(int begin, int end) const {
+    Dtype acc[kPanelRows][kPanelCols];
+    for (int p = begin; p < end; ++p) {
+      const Dtype* a_panel = A + p * kPanelRows * depth;
+      const int panel_rows = std::min(kPanelRows, rows - p * kPanelRows);
+      for (int q = 0; q * kPanelCols < width; ++q) {
+        const Dtype* b = B + q * kPanelCols * depth;
+        const Dtype* a = a_panel;
+        const int panel_cols = std::min(kPanelCols, width - q * kPanelCols);
+        memset(acc, 0, sizeof(acc));
+        if (panel_cols == kPanelCols) {
+          for (int k = 0; k < depth; ++k) {
+            for (int r = 0; r < kPanelRows; ++r) {
+              const Dtype a_r = a[r];
+              for (int j = 0; j < kPanelCols; ++j) {
+                acc[r][j] += a_r * b[j];
+              }
+            }
+            a += kPanelRows;
+            b += kPanelCols;
+          }
+        } else {
+          // Only the columns of the last panel that exist, as for the few
+          // columns of a small batch.
+          for (int k = 0; k < depth; ++k) {
+            for (int r = 0; r < kPanelRows; ++r) {
+              const Dtype a_r = a[r];
+              for (int j = 0; j < panel_cols; ++j) {
+                acc[r][j] += a_r * b[j];
+              }
+            }
+            a += kPanelRows;
+            b += kPanelCols;
+          }
+        }
+        Dtype* c = C + p * kPanelRows * row_stride +
+            q * kPanelCols * col_stride;
+        for (int r = 0; r < panel_rows; ++r) {
+          for (int j = 0; j < panel_cols; ++j) {
+            Dtype* c_rj = c + r * row_stride + j * col_stride;
+            *c_rj = accumulate ? *c_rj + acc[r][j] : acc[r][j];
+          }
+        }
+      }
+    }
+  }
+};
+
+template <typename Dtype>
+void gemm_packed_cpu(const PackedWeights<Dtype>& A, const int group,
+    const bool trans, const int N, const Dtype* B, Dtype* C) {
+  CHECK(A.packed);
+  const int K = A.cols;
+  const int group_rows = A.rows / A.groups;
+  const int padded_rows = RoundUp(group_rows, kPanelRows);
+  const Dtype* a = &A.data[group * padded_rows * K];
+  const int row_stride = trans ? 1 : N;
+  const int col_stride = trans ? A.rows : 1;
+  std::vector<Dtype> b_block(
+      kBlockDepth * RoundUp(std::min(N, kBlockWidth), kPanelCols));
+  for (int n0 = 0; n0 < N; n0 += kBlockWidth) {
+    const int width = std::min(kBlockWidth, N - n0);
+    for (int k0 = 0; k0 < K; k0 += kBlockDepth) {
+      const int depth = std::min(kBlockDepth, K - k0);
+      // Pack the block of B into panels of kPanelCols columns, stored row by
+      // row, padded with zero columns.
+      for (int q = 0; q * kPanelCols < width; ++q) {
+        Dtype* panel = &b_block[q * kPanelCols * depth];
+        const int j0 = n0 + q * kPanelCols;
+        const int panel_cols = std::min(kPanelCols, n0 + width - j0);
+        if (panel_cols < kPanelCols) {
+          memset(panel, 0, sizeof(Dtype) * kPanelCols * depth);
+        }
+        if (trans) {
+          for (int c = 0; c < panel_cols; ++c) {
+            const Dtype* b = B + (j0 + c) * K + k0;
+            for (int k = 0; k < depth; ++k) {
+              panel[k * kPanelCols + c] = b[k];
+            }
+          }
+        } else {
+          for (int k = 0; k < depth; ++k) {
+            memcpy(panel + k * kPanelCols, B + (k0 + k) * N + j0,
+                sizeof(Dtype) * panel_cols);
+          }
+        }
+      }
+      PackedPanels<Dtype> body = { a + k0 * padded_rows, &b_block[0], depth,
+          width, group_rows, C + n0 * col_stride, row_stride, col_stride,
+          k0 > 0 };
+      parallel_for(padded_rows / kPanelRows,
+          GrainSize(kPanelRows * depth * width), body);
+    }
+  }
+}
+
+template void gemm_packed_cpu<float>(const PackedWeights<float>& A,
+    const int group, const bool trans, const int N, const float* B, float* C);
+template void gemm_packed_cpu<double>(const PackedWeights<double>& A,
+    const int group, const bool trans, const int N, const double* B,
+    double* C);
+
+}  // namespace caffe
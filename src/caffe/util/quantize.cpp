@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#include "caffe/util/quantize.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+static inline int8_t QuantizeS8(const Dtype x, const Dtype scale) {
+  const Dtype v = std::max(Dtype(-127), std::min(Dtype(127), x * scale));
+  return static_cast<int8_t>(v >= 0 ? v + Dtype(0.5) : v - Dtype(0.5));
+}
+
+template <typename Dtype>
+void quantize_s8_cpu(const int n, const Dtype scale, const Dtype* x,
+    int8_t* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = QuantizeS8(x[i], scale);
+  }
+}
+
+template void quantize_s8_cpu<float>(const int n, const float scale,
+    const float* x, int8_t* y);
+template void quantize_s8_cpu<double>(const int n, const double scale,
+    const double* x, int8_t* y);
+
+template <typename Dtype>
+void quantize_rows_s8_cpu(const int rows, const int cols, const Dtype* x,
+    int8_t* y, Dtype* scales) {
+  for (int i = 0; i < rows; ++i) {
+    Dtype max_abs = 0;
+    for (int j = 0; j < cols; ++j) {
+      max_abs = std::max(max_abs, std::fabs(x[j]));
+    }
+    // An all zero row quantizes to zeros with any scale.
+    scales[i] = max_abs > 0 ? Dtype(127) / max_abs : Dtype(1);
+    quantize_s8_cpu(cols, scales[i], x, y);
+    x += cols;
+    y += cols;
+  }
+}
+
+template void quantize_rows_s8_cpu<float>(const int rows, const int cols,
+    const float* x, int8_t* y, float* scales);
+template void quantize_rows_s8_cpu<double>(const int rows, const int cols,
+    const double* x, int8_t* y, double* scales);
+
+template <typename Dtype>
+void update_quantized_weights(const Blob<Dtype>& weights, const int rows,
+    QuantizedWeights<Dtype>* quantized) {
+  const Dtype* data = weights.cpu_data();
+  const SyncedMemory* memory = weights.data().get();
+  const unsigned int version = weights.data()->version();
+  if (memory == quantized->memory && version == quantized->version &&
+      rows == static_cast<int>(quantized->scales.size())) {
+    return;
+  }
+  quantized->data.resize(weights.count());
+  quantized->scales.resize(rows);
+  quantize_rows_s8_cpu(rows, weights.count() / rows, data,
+      &quantized->data[0], &quantized->scales[0]);
+  quantized->memory = memory;
+  quantized->version = version;
+}
+
+template void update_quantized_weights<float>(const Blob<float>& weights,
+    const int rows, QuantizedWeights<float>* quantized);
+template void update_quantized_weights<double>(const Blob<double>& weights,
+    const int rows, QuantizedWeights<double>* quantized);
+
+// Computes the rows [begin, end) of C = A * B, adding each row of B scaled by
+// an element of A so that the inner loop runs along the contiguous rows.
+struct GemmS8Rows {
+  int N, K;
+  const int8_t* A;
+  const int8_t* B;
+  int32_t* C;
+  void operator()(int begin, int end) const {
+    for (int i = begin; i < end; ++i) {
+      int32_t* c = C + i * N;
+      memset(c, 0, sizeof(int32_t) * N);
+      const int8_t* a = A + i * K;
+      for (int k = 0; k < K; ++k) {
+        const int32_t a_ik = a[k];
+        if (a_ik == 0) {
+          continue;
+        }
+        const int8_t* b = B + k * N;
+        for (int j = 0; j < N; ++j) {
+          c[j] += a_ik * b[j];
+        }
+      }
+    }
+  }
+};
+
+// Computes the columns [begin, end) of C = A * B^T as dot products of the
+// rows of A and B, which suits the few rows of A of small batches.
+struct GemmS8TransColumns {
+  int M, N, K;
+  const int8_t* A;
+  const int8_t* B;
+  int32_t* C;
+  void operator()(int begin, int end) const {
+    for (int j = begin; j < end; ++j) {
+      const int8_t* b = B + j * K;
+      for (int i = 0; i < M; ++i) {
+        const int8_t* a = A + i * K;
+        int32_t sum = 0;
+        for (int k = 0; k < K; ++k) {
+          sum += static_cast<int32_t>(a[k]) * b[k];
+        }
+        C[i * N + j] = sum;
+      }
+    }
+  }
+};
+
+void gemm_s8_cpu(const bool trans_b, const int M, const int N, const int K,
+    const int8_t* A, const int8_t* B, int32_t* C) {
+  if (trans_b) {
+    GemmS8TransColumns columns = { M, N, K, A, B, C };
+    parallel_for(N, GrainSize(M * K), columns);
+  } else {
+    GemmS8Rows rows = { N, K, A, B, C };
+    parallel_for(M, GrainSize(N * K), rows);
+  }
+}
+
+template <typename Dtype>
+void dequantize_s8_cpu(const bool outputs_in_rows, const int M, const int N,
+    const int32_t* x, const Dtype x_scale, const Dtype* scales,
+    const Dtype* bias, const bool relu, Dtype* y) {
+  const int outputs = outputs_in_rows ? M : N;
+  std::vector<Dtype> multiplier(outputs);
+  std::vector<Dtype> offset(outputs, Dtype(0));
+  for (int o = 0; o < outputs; ++o) {
+    multiplier[o] = Dtype(1) / (x_scale * scales[o]);
+    if (bias) {
+      offset[o] = bias[o];
+    }
+  }
+  for (int i = 0; i < M; ++i) {
+    const int32_t* x_row = x + i * N;
+    Dtype* y_row = y + i * N;
+    if (outputs_in_rows) {
+      for (int j = 0; j < N; ++j) {
+        y_row[j] = x_row[j] * multiplier[i] + offset[i];
+      }
+    } else {
+      for (int j = 0; j < N; ++j) {
+        y_row[j] = x_row[j] * multiplier[j] + offset[j];
+      }
+    }
+    if (relu) {
+      for (int j = 0; j < N; ++j) {
+        y_row[j] = std::max(y_row[j], Dtype(0));
+      }
+    }
+  }
+}
+
+template void dequantize_s8_cpu<float>(const bool outputs_in_rows,
+    const int M, const int N, const int32_t* x, const float x_scale,
+    const float* scales, const float* bias, const bool relu, float* y);
+template void dequantize_s8_cpu<double>(const bool outputs_in_rows,
+    const int M, const int N, const int32_t* x, const double x_scale,
+    const double* scales, const double* bias, const bool relu, double* y);
+
+}  // namespace caffe
@@ -0,0 +1,126 @@
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/io.hpp"
+#include "caffe/util/rng.hpp"
+#include "caffe/util/sampling_cursor.hpp"
+
+namespace caffe { namespace db {
+
+ShuffleBufferCursor::ShuffleBufferCursor(shared_ptr<Cursor> cursor,
+    int buffer_size, unsigned int seed)
+    : cursor_(cursor), buffer_size_(buffer_size), rng_(new Caffe::RNG(seed)),
+      current_(0) {
+  CHECK_GT(buffer_size_, 0);
+  SeekToFirst();
+}
+
+void ShuffleBufferCursor::SeekToFirst() {
+  cursor_->SeekToFirst();
+  CHECK(cursor_->valid()) << "Cannot shuffle an empty db";
+  // Fill the buffer with at most one pass over the db.
+  buffer_.clear();
+  while (cursor_->valid() && buffer_.size() < buffer_size_) {
+    buffer_.push_back(std::make_pair(cursor_->key(), cursor_->value()));
+    cursor_->Next();
+  }
+  LOG(INFO) << "Filled a shuffle buffer of " << buffer_.size() << " records";
+  Choose();
+}
+
+void ShuffleBufferCursor::Next() {
+  Pop(&buffer_[current_]);
+  Choose();
+}
+
+void ShuffleBufferCursor::Pop(std::pair<string, string>* record) {
+  if (!cursor_->valid()) {
+    cursor_->SeekToFirst();
+  }
+  record->first = cursor_->key();
+  record->second = cursor_->value();
+  cursor_->Next();
+}
+
+void ShuffleBufferCursor::Choose() {
+  caffe::rng_t* rng = static_cast<caffe::rng_t*>(rng_->generator());
+  current_ = (*rng)() % buffer_.size();
+}
+
+RandomAccessCursor::RandomAccessCursor(shared_ptr<Cursor> cursor,
+    const string& index_file, unsigned int seed, int lookahead)
+    : cursor_(cursor), lookahead_(lookahead), rng_(new Caffe::RNG(seed)),
+      position_(0) {
+  LoadOrBuildIndex(index_file);
+  CHECK_GT(keys_.size(), 0) << "Cannot sample an empty db";
+  order_.resize(keys_.size());
+  for (int i = 0; i < order_.size(); ++i) {
+    order_[i] = i;
+  }
+  SeekToFirst();
+}
+
+void RandomAccessCursor::LoadOrBuildIndex(const string& index_file) {
+  // The cached index is only trusted if the db still has as many records
+  // and the same first and last keys, which catches a db rebuilt or written
+  // to since. Backends that cannot count their records are indexed again.
+  DBKeyIndex index;
+  const int64_t count = cursor_->count();
+  std::ifstream cached(index_file.c_str(), ios::in | ios::binary);
+  if (count > 0 && cached.is_open() && index.ParseFromIstream(&cached) &&
+      index.key_size() == count && cursor_->SeekToKey(index.key(0)) &&
+      cursor_->SeekToKey(index.key(index.key_size() - 1))) {
+    LOG(INFO) << "Loaded the index of " << index.key_size() << " keys from "
+              << index_file;
+  } else {
+    LOG(INFO) << "Indexing the keys of the db";
+    index.Clear();
+    for (cursor_->SeekToFirst(); cursor_->valid(); cursor_->Next()) {
+      index.add_key(cursor_->key());
+    }
+    std::ofstream output;
+    if (count >= 0) {
+      output.open(index_file.c_str(), ios::out | ios::trunc | ios::binary);
+    }
+    if (output.is_open() && index.SerializeToOstream(&output)) {
+      LOG(INFO) << "Cached the index of " << index.key_size() << " keys in "
+                << index_file;
+    } else if (count >= 0) {
+      LOG(WARNING) << "Could not cache the key index in " << index_file;
+    }
+  }
+  keys_.assign(index.key().begin(), index.key().end());
+}
+
+void RandomAccessCursor::SeekToFirst() {
+  caffe::rng_t* rng = static_cast<caffe::rng_t*>(rng_->generator());
+  shuffle(order_.begin(), order_.end(), rng);
+  position_ = 0;
+  for (int i = 1; i < lookahead_ && i < order_.size(); ++i) {
+    cursor_->WillNeed(keys_[order_[i]]);
+  }
+  Position();
+}
+
+void RandomAccessCursor::Next() {
+  ++position_;
+  Position();
+}
+
+void RandomAccessCursor::Position() {
+  if (position_ >= order_.size()) {
+    return;
+  }
+  if (position_ + lookahead_ < order_.size()) {
+    cursor_->WillNeed(keys_[order_[position_ + lookahead_]]);
+  }
+  CHECK(cursor_->SeekToKey(keys_[order_[position_]]))
+      << "Key " << keys_[order_[position_]] << " of the index is missing "
+      << "from the db; delete the stale key index";
+}
+
+}  // namespace db
+}  // namespace caffe
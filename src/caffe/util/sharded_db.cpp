@@ -0,0 +1,341 @@
+#include <boost/thread.hpp>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "caffe/util/io.hpp"
+#include "caffe/util/rng.hpp"
+#include "caffe/util/sharded_db.hpp"
+
+namespace caffe { namespace db {
+
+const char* const kShardManifest = "shards.prototxt";
+// Records queued per reader. Each holds one serialized Datum.
+const size_t kShardReaderQueueSize = 64;
+
+// Fills `order` with 0..n-1, permuted for the given epoch if shuffling.
+static void EpochOrder(int n, bool shuffle, unsigned int seed, int epoch,
+    vector<int>* order) {
+  order->resize(n);
+  for (int i = 0; i < n; ++i) {
+    (*order)[i] = i;
+  }
+  if (shuffle) {
+    rng_t rng(seed + 104729 * epoch);
+    caffe::shuffle(order->begin(), order->end(), &rng);
+  }
+}
+
+ShardReader::ShardReader(const string& backend, const vector<string>& sources,
+    const vector<int>& shards, int num_shards, bool shuffle,
+    unsigned int seed)
+    : backend_(backend), sources_(sources), shards_(shards),
+      num_shards_(num_shards), shuffle_(shuffle), seed_(seed),
+      start_epoch_(0), queue_(kShardReaderQueueSize) {
+  CHECK_EQ(sources_.size(), shards_.size());
+}
+
+ShardReader::~ShardReader() {
+  Stop();
+}
+
+void ShardReader::Start(int epoch) {
+  Stop();
+  start_epoch_ = epoch;
+  CHECK(StartInternalThread()) << "Failed to start shard reader";
+}
+
+void ShardReader::Stop() {
+  CHECK(StopInternalThread()) << "Failed to stop shard reader";
+  ShardRecord* record;
+  while (queue_.try_pop(&record)) {
+    delete record;
+  }
+}
+
+void ShardReader::InternalThreadEntry() {
+  // The shards are opened on this thread, which is the only one using them.
+  vector<shared_ptr<DB> > dbs(sources_.size());
+  vector<shared_ptr<Cursor> > cursors(sources_.size());
+  vector<int> source_of_shard(num_shards_, -1);
+  for (int i = 0; i < sources_.size(); ++i) {
+    dbs[i].reset(GetDB(backend_));
+    dbs[i]->Open(sources_[i], READ);
+    cursors[i].reset(dbs[i]->NewCursor());
+    source_of_shard[shards_[i]] = i;
+  }
+  vector<int> shard_order, order;
+  for (int epoch = start_epoch_; ; ++epoch) {
+    // The epoch's shard order, restricted to the shards of this reader.
+    EpochOrder(num_shards_, shuffle_, seed_, epoch, &shard_order);
+    order.clear();
+    for (int i = 0; i < shard_order.size(); ++i) {
+      if (source_of_shard[shard_order[i]] >= 0) {
+        order.push_back(source_of_shard[shard_order[i]]);
+      }
+    }
+    for (int i = 0; i < cursors.size(); ++i) {
+      cursors[i]->SeekToFirst();
+    }
+    bool any_valid = true;
+    while (any_valid) {
+      any_valid = false;
+      for (int i = 0; i < order.size(); ++i) {
+        Cursor* cursor = cursors[order[i]].get();
+        if (!cursor->valid()) {
+          continue;
+        }
+        ShardRecord* record = new ShardRecord(shards_[order[i]],
+            KeyValue(cursor->key(), cursor->value()));
+        try {
+          queue_.push(record);
+        } catch (boost::thread_interrupted&) {
+          delete record;
+          throw;
+        }
+        cursor->Next();
+        any_valid = true;
+      }
+    }
+    queue_.push(NULL);
+  }
+}
+
+ShardedCursor::ShardedCursor(const vector<shared_ptr<ShardReader> >& readers,
+    const vector<int>& shard_reader, bool shuffle, unsigned int seed)
+    : readers_(readers), shard_reader_(shard_reader), shuffle_(shuffle),
+      seed_(seed), epoch_(0), pending_(readers.size(), NULL),
+      current_(NULL) {
+  CHECK_GT(readers_.size(), 0);
+  for (int i = 0; i < readers_.size(); ++i) {
+    readers_[i]->Start(epoch_);
+  }
+  StartEpoch();
+}
+
+ShardedCursor::~ShardedCursor() {
+  for (int i = 0; i < readers_.size(); ++i) {
+    readers_[i]->Stop();
+  }
+  DropRecords();
+}
+
+void ShardedCursor::DropRecords() {
+  delete current_;
+  current_ = NULL;
+  for (int i = 0; i < pending_.size(); ++i) {
+    delete pending_[i];
+    pending_[i] = NULL;
+  }
+}
+
+void ShardedCursor::SeekToFirst() {
+  if (current_ != NULL) {
+    // Restart the current epoch.
+    DropRecords();
+    for (int i = 0; i < readers_.size(); ++i) {
+      readers_[i]->Start(epoch_);
+    }
+  } else {
+    // The readers have already moved on to the next epoch.
+    ++epoch_;
+  }
+  StartEpoch();
+}
+
+void ShardedCursor::Next() {
+  delete current_;
+  current_ = NULL;
+  Fetch();
+}
+
+void ShardedCursor::StartEpoch() {
+  EpochOrder(shard_reader_.size(), shuffle_, seed_, epoch_, &shard_order_);
+  shard_done_.assign(shard_reader_.size(), false);
+  reader_done_.assign(readers_.size(), false);
+  turn_ = 0;
+  Fetch();
+}
+
+void ShardedCursor::Fetch() {
+  const int num_shards = shard_order_.size();
+  int num_done = 0;
+  while (num_done < num_shards) {
+    const int shard = shard_order_[turn_];
+    turn_ = (turn_ + 1) % num_shards;
+    if (shard_done_[shard]) {
+      ++num_done;
+      continue;
+    }
+    const int reader = shard_reader_[shard];
+    if (pending_[reader] == NULL && !reader_done_[reader]) {
+      pending_[reader] = readers_[reader]->Pop();
+      reader_done_[reader] = pending_[reader] == NULL;
+    }
+    if (pending_[reader] != NULL && pending_[reader]->first == shard) {
+      current_ = pending_[reader];
+      pending_[reader] = NULL;
+      return;
+    }
+    // The reader visits its shards in the same order and only skips those
+    // that have run out, so it is done with this one.
+    shard_done_[shard] = true;
+    num_done = 0;
+  }
+}
+
+class ShardedTransaction : public Transaction {
+ public:
+  explicit ShardedTransaction(ShardedDB* db)
+      : db_(db), txns_(db->shards_.size()),
+        num_pending_(db->shards_.size(), 0) {
+    for (int i = 0; i < txns_.size(); ++i) {
+      txns_[i].reset(db_->shards_[i]->NewTransaction());
+    }
+  }
+  virtual void Put(const string& key, const string& value) {
+    const int shard = db_->next_shard_;
+    db_->next_shard_ = (shard + 1) % txns_.size();
+    txns_[shard]->Put(key, value);
+    ++num_pending_[shard];
+  }
+  virtual void Commit() {
+    for (int i = 0; i < txns_.size(); ++i) {
+      txns_[i]->Commit();
+      db_->manifest_.set_num_records(i,
+          db_->manifest_.num_records(i) + num_pending_[i]);
+      num_pending_[i] = 0;
+    }
+  }
+
+ private:
+  ShardedDB* db_;
+  vector<shared_ptr<Transaction> > txns_;
+  vector<uint64_t> num_pending_;
+
+  DISABLE_COPY_AND_ASSIGN(ShardedTransaction);
+};
+
+ShardedDB::ShardedDB()
+    : mode_(READ), open_(false), num_new_shards_(0), sorted_keys_(false),
+      no_sync_(false), write_map_(false), num_readers_(1), rank_(0),
+      num_ranks_(1), shuffle_(false), seed_(0), next_shard_(0) {
+}
+
+bool ShardedDB::IsSharded(const string& source) {
+  struct stat info;
+  const string manifest = source + "/" + kShardManifest;
+  return stat(manifest.c_str(), &info) == 0 && S_ISREG(info.st_mode);
+}
+
+void ShardedDB::SetShardLayout(const string& backend, int num_shards) {
+  CHECK_GT(num_shards, 0);
+  manifest_.set_backend(backend);
+  num_new_shards_ = num_shards;
+}
+
+void ShardedDB::SetReadOptions(const DataParameter& param) {
+  num_readers_ = param.shard_readers();
+  rank_ = param.shard_rank();
+  num_ranks_ = param.num_shard_ranks();
+  shuffle_ = param.shuffle_shards();
+  seed_ = param.shard_seed();
+  CHECK_GT(num_readers_, 0);
+  CHECK_GT(num_ranks_, 0);
+  CHECK_LT(rank_, num_ranks_);
+}
+
+void ShardedDB::SetBulkLoad(bool sorted_keys, bool no_sync, bool write_map) {
+  sorted_keys_ = sorted_keys;
+  no_sync_ = no_sync;
+  write_map_ = write_map;
+}
+
+string ShardedDB::ShardSource(int shard) const {
+  return source_ + "/" + manifest_.shard(shard);
+}
+
+void ShardedDB::Open(const string& source, Mode mode) {
+  source_ = source;
+  mode_ = mode;
+  if (mode == NEW) {
+    CHECK_GT(num_new_shards_, 0) << "SetShardLayout must be called first";
+    CHECK_EQ(mkdir(source.c_str(), 0744), 0) << "mkdir " << source
+                                             << " failed";
+    manifest_.clear_shard();
+    manifest_.clear_num_records();
+    for (int i = 0; i < num_new_shards_; ++i) {
+      char name[32];
+      snprintf(name, sizeof(name), "shard_%05d", i);
+      manifest_.add_shard(name);
+      manifest_.add_num_records(0);
+    }
+  } else {
+    ReadProtoFromTextFileOrDie(source + "/" + kShardManifest, &manifest_);
+    CHECK_GT(manifest_.shard_size(), 0) << "No shards in " << source;
+    CHECK_EQ(manifest_.shard_size(), manifest_.num_records_size());
+  }
+  if (mode != READ) {
+    shards_.resize(manifest_.shard_size());
+    for (int i = 0; i < shards_.size(); ++i) {
+      shards_[i].reset(GetDB(manifest_.backend()));
+      shards_[i]->SetBulkLoad(sorted_keys_, no_sync_, write_map_);
+      shards_[i]->Open(ShardSource(i), mode);
+    }
+  }
+  open_ = true;
+  LOG(INFO) << "Opened sharded db " << source << " with "
+            << manifest_.shard_size() << " " << manifest_.backend()
+            << " shards";
+}
+
+void ShardedDB::Close() {
+  if (!open_) {
+    return;
+  }
+  if (mode_ != READ) {
+    for (int i = 0; i < shards_.size(); ++i) {
+      shards_[i]->Close();
+    }
+    shards_.clear();
+    WriteProtoToTextFile(manifest_, source_ + "/" + kShardManifest);
+  }
+  open_ = false;
+}
+
+ShardedCursor* ShardedDB::NewCursor() {
+  CHECK_EQ(mode_, READ) << "Sharded dbs are read through READ mode only";
+  // This rank reads shards rank_, rank_ + num_ranks_, ... and deals them
+  // round-robin to its readers.
+  vector<string> sources;
+  for (int i = rank_; i < manifest_.shard_size(); i += num_ranks_) {
+    sources.push_back(ShardSource(i));
+  }
+  CHECK_GT(sources.size(), 0) << "No shard for rank " << rank_ << " of "
+                              << num_ranks_;
+  const int num_readers = std::min<int>(num_readers_, sources.size());
+  vector<shared_ptr<ShardReader> > readers(num_readers);
+  vector<int> shard_reader(sources.size());
+  for (int r = 0; r < num_readers; ++r) {
+    vector<string> reader_sources;
+    vector<int> reader_shards;
+    for (int i = r; i < sources.size(); i += num_readers) {
+      reader_sources.push_back(sources[i]);
+      reader_shards.push_back(i);
+      shard_reader[i] = r;
+    }
+    readers[r].reset(new ShardReader(manifest_.backend(), reader_sources,
+        reader_shards, sources.size(), shuffle_, seed_));
+  }
+  return new ShardedCursor(readers, shard_reader, shuffle_, seed_);
+}
+
+Transaction* ShardedDB::NewTransaction() {
+  CHECK_NE(mode_, READ) << "Sharded db " << source_ << " opened read-only";
+  return new ShardedTransaction(this);
+}
+
+}  // namespace db
+}  // namespace caffe
@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#include "caffe/util/sparse.hpp"
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+bool update_sparse_weights(const Blob<Dtype>& weights, const int rows,
+    const float max_density, SparseWeights<Dtype>* sparse) {
+  const Dtype* data = weights.cpu_data();
+  const SyncedMemory* memory = weights.data().get();
+  const unsigned int version = weights.data()->version();
+  if (memory == sparse->memory && version == sparse->version &&
+      rows == sparse->rows) {
+    return sparse->sparse;
+  }
+  const int count = weights.count();
+  int nonzeros = 0;
+  for (int i = 0; i < count; ++i) {
+    nonzeros += data[i] != 0;
+  }
+  sparse->sparse = nonzeros <= max_density * count;
+  sparse->rows = rows;
+  sparse->cols = count / rows;
+  sparse->memory = memory;
+  sparse->version = version;
+  if (!sparse->sparse) {
+    // Free the arrays of weights that are no longer sparse.
+    std::vector<int>().swap(sparse->row_ptr);
+    std::vector<int>().swap(sparse->col);
+    std::vector<Dtype>().swap(sparse->values);
+    return false;
+  }
+  sparse->row_ptr.resize(rows + 1);
+  sparse->col.resize(nonzeros);
+  sparse->values.resize(nonzeros);
+  int k = 0;
+  for (int i = 0; i < rows; ++i) {
+    sparse->row_ptr[i] = k;
+    for (int j = 0; j < sparse->cols; ++j) {
+      const Dtype value = data[i * sparse->cols + j];
+      if (value != 0) {
+        sparse->col[k] = j;
+        sparse->values[k] = value;
+        ++k;
+      }
+    }
+  }
+  sparse->row_ptr[rows] = k;
+  return true;
+}
+
+template bool update_sparse_weights<float>(const Blob<float>& weights,
+    const int rows, const float max_density, SparseWeights<float>* sparse);
+template bool update_sparse_weights<double>(const Blob<double>& weights,
+    const int rows, const float max_density, SparseWeights<double>* sparse);
+
+// Computes the rows [begin, end) of C = A * B, adding the rows of B scaled by
+// the nonzeros of each row of A.
+template <typename Dtype>
+struct SparseGemmRows {
+  const SparseWeights<Dtype>* A;
+  int group_rows, N;
+  const Dtype* B;
+  Dtype* C;
+  void operator()(int begin, int end) const {
+    for (int i = begin; i < end; ++i) {
+      const Dtype* b = B + (i / group_rows) * A->cols * N;
+      Dtype* c = C + i * N;
+      memset(c, 0, sizeof(Dtype) * N);
+      for (int p = A->row_ptr[i]; p < A->row_ptr[i + 1]; ++p) {
+        const Dtype a_ik = A->values[p];
+        const Dtype* b_k = b + A->col[p] * N;
+        for (int j = 0; j < N; ++j) {
+          c[j] += a_ik * b_k[j];
+        }
+      }
+    }
+  }
+};
+
+template <typename Dtype>
+void sparse_gemm_cpu(const SparseWeights<Dtype>& A, const int groups,
+    const int N, const Dtype* B, Dtype* C) {
+  const int row_nonzeros = A.values.size() / std::max(A.rows, 1);
+  SparseGemmRows<Dtype> body = { &A, A.rows / groups, N, B, C };
+  parallel_for(A.rows, GrainSize(N * (row_nonzeros + 1)), body);
+}
+
+template void sparse_gemm_cpu<float>(const SparseWeights<float>& A,
+    const int groups, const int N, const float* B, float* C);
+template void sparse_gemm_cpu<double>(const SparseWeights<double>& A,
+    const int groups, const int N, const double* B, double* C);
+
+// Computes the columns [begin, end) of C = A * B^T as the sparse dot products
+// of the rows of B with the rows of A.
+template <typename Dtype>
+struct GemmSparseTransColumns {
+  int M;
+  const Dtype* A;
+  const SparseWeights<Dtype>* B;
+  Dtype* C;
+  void operator()(int begin, int end) const {
+    const int K = B->cols;
+    const int N = B->rows;
+    for (int j = begin; j < end; ++j) {
+      const int row_begin = B->row_ptr[j];
+      const int row_end = B->row_ptr[j + 1];
+      for (int i = 0; i < M; ++i) {
+        const Dtype* a = A + i * K;
+        Dtype sum = 0;
+        for (int p = row_begin; p < row_end; ++p) {
+          sum += a[B->col[p]] * B->values[p];
+        }
+        C[i * N + j] = sum;
+      }
+    }
+  }
+};
+
+template <typename Dtype>
+void gemm_sparse_trans_cpu(const int M, const Dtype* A,
+    const SparseWeights<Dtype>& B, Dtype* C) {
+  const int row_nonzeros = B.values.size() / std::max(B.rows, 1);
+  GemmSparseTransColumns<Dtype> body = { M, A, &B, C };
+  parallel_for(B.rows, GrainSize(M * (row_nonzeros + 1)), body);
+}
+
+template void gemm_sparse_trans_cpu<float>(const int M, const float* A,
+    const SparseWeights<float>& B, float* C);
+template void gemm_sparse_trans_cpu<double>(const int M, const double* A,
+    const SparseWeights<double>& B, double* C);
+
+}  // namespace caffe
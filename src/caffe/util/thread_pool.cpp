@@ -0,0 +1,202 @@
+#include <stdint.h>
+#include <boost/thread.hpp>
+
+#ifdef USE_MKL
+#include <mkl.h>
+#endif
+
+#include <deque>
+#include <vector>
+
+#include "caffe/util/thread_pool.hpp"
+
+namespace caffe {
+
+// How deep in pool tasks the thread is. Workers start at 1, so that any
+// Run from them is inline.
+static boost::thread_specific_ptr<int> task_depth;
+
+static int& TaskDepth() {
+  if (!task_depth.get()) {
+    task_depth.reset(new int(0));
+  }
+  return *task_depth;
+}
+
+class ThreadPool::Impl {
+ public:
+  explicit Impl(int num_workers);
+  ~Impl();
+  void Run(int num_tasks, void (*task)(void*, int), void* arg);
+
+ private:
+  struct Job {
+    void (*task)(void*, int);
+    void* arg;
+    // The tasks not done yet, guarded by mutex_.
+    int remaining;
+  };
+  struct Task {
+    Job* job;
+    int index;
+  };
+  struct Deque {
+    boost::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  // Takes the next task of the worker's own deque.
+  bool Pop(int worker, Task* task);
+  // Takes the last task of another deque; `thief` is -1 for the calling
+  // thread of Run.
+  bool Steal(int thief, Task* task);
+  void Execute(const Task& task);
+  void Work(int worker);
+
+  std::vector<shared_ptr<Deque> > deques_;
+  boost::mutex mutex_;
+  boost::condition_variable work_condition_;
+  boost::condition_variable done_condition_;
+  // The queued tasks, guarded by mutex_.
+  int pending_;
+  bool stop_;
+  boost::thread_group workers_;
+};
+
+ThreadPool::Impl::Impl(int num_workers) : pending_(0), stop_(false) {
+  for (int i = 0; i < num_workers; ++i) {
+    deques_.push_back(shared_ptr<Deque>(new Deque()));
+  }
+  for (int i = 0; i < num_workers; ++i) {
+    workers_.create_thread(boost::bind(&Impl::Work, this, i));
+  }
+}
+
+ThreadPool::Impl::~Impl() {
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    stop_ = true;
+  }
+  work_condition_.notify_all();
+  workers_.join_all();
+}
+
+void ThreadPool::Impl::Run(int num_tasks, void (*task)(void*, int),
+    void* arg) {
+  Job job = { task, arg, num_tasks };
+  // Counted before they are queued, so that pending_ never goes negative.
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    pending_ += num_tasks;
+  }
+  const int num_deques = deques_.size();
+  for (int d = 0; d < num_deques; ++d) {
+    Deque& deque = *deques_[d];
+    boost::mutex::scoped_lock lock(deque.mutex);
+    for (int i = static_cast<int64_t>(num_tasks) * d / num_deques;
+         i < static_cast<int64_t>(num_tasks) * (d + 1) / num_deques; ++i) {
+      Task queued = { &job, i };
+      deque.tasks.push_back(queued);
+    }
+  }
+  work_condition_.notify_all();
+  // Help rather than wait.
+  Task stolen;
+  while (Steal(-1, &stolen)) {
+    Execute(stolen);
+  }
+  boost::mutex::scoped_lock lock(mutex_);
+  while (job.remaining > 0) {
+    done_condition_.wait(lock);
+  }
+}
+
+bool ThreadPool::Impl::Pop(int worker, Task* task) {
+  Deque& deque = *deques_[worker];
+  {
+    boost::mutex::scoped_lock lock(deque.mutex);
+    if (deque.tasks.empty()) {
+      return false;
+    }
+    *task = deque.tasks.front();
+    deque.tasks.pop_front();
+  }
+  boost::mutex::scoped_lock lock(mutex_);
+  --pending_;
+  return true;
+}
+
+bool ThreadPool::Impl::Steal(int thief, Task* task) {
+  const int num_deques = deques_.size();
+  for (int i = 1; i <= num_deques; ++i) {
+    const int victim = (thief + i + num_deques) % num_deques;
+    if (victim == thief) {
+      continue;
+    }
+    Deque& deque = *deques_[victim];
+    {
+      boost::mutex::scoped_lock lock(deque.mutex);
+      if (deque.tasks.empty()) {
+        continue;
+      }
+      *task = deque.tasks.back();
+      deque.tasks.pop_back();
+    }
+    boost::mutex::scoped_lock lock(mutex_);
+    --pending_;
+    return true;
+  }
+  return false;
+}
+
+void ThreadPool::Impl::Execute(const Task& task) {
+  ++TaskDepth();
+  task.job->task(task.job->arg, task.index);
+  --TaskDepth();
+  boost::mutex::scoped_lock lock(mutex_);
+  if (--task.job->remaining == 0) {
+    done_condition_.notify_all();
+  }
+}
+
+void ThreadPool::Impl::Work(int worker) {
+#ifdef USE_MKL
+  // The pool provides the parallelism of the tasks.
+  mkl_set_num_threads_local(1);
+#endif
+  TaskDepth() = 1;
+  Task task;
+  while (true) {
+    if (Pop(worker, &task) || Steal(worker, &task)) {
+      Execute(task);
+      continue;
+    }
+    boost::mutex::scoped_lock lock(mutex_);
+    while (pending_ == 0 && !stop_) {
+      work_condition_.wait(lock);
+    }
+    if (pending_ == 0) {
+      return;
+    }
+  }
+}
+
+ThreadPool::ThreadPool(int num_threads)
+    : num_threads_(std::max(num_threads, 1)),
+      impl_(new Impl(num_threads_ - 1)) {
+}
+
+ThreadPool::~ThreadPool() {
+}
+
+void ThreadPool::Run(int num_tasks, void (*task)(void*, int), void* arg) {
+  if (num_threads_ == 1 || num_tasks == 1 || TaskDepth() > 0) {
+    for (int i = 0; i < num_tasks; ++i) {
+      task(arg, i);
+    }
+    return;
+  }
+  impl_->Run(num_tasks, task, arg);
+}
+
+}  // namespace caffe
@@ -1,11 +1,21 @@
 #include <glog/logging.h>
 
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+#include <algorithm>
+#include <cmath>
 #include <cstring>
 #include <map>
+#include <set>
+#include <sstream>
 #include <string>
 #include <vector>
 
 #include "caffe/caffe.hpp"
+#include "caffe/util/low_rank.hpp"
+#include "caffe/util/numa.hpp"
+#include "caffe/util/upgrade_proto.hpp"
 
 using caffe::Blob;
 using caffe::Caffe;
@@ -29,6 +39,37 @@ DEFINE_string(weights, "",
     "Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_string(host_allocator, "pool",
+    "How blob memory is allocated on the host: 'pool' keeps freed buffers "
+    "for reuse, 'malloc' frees them at once (for debugging).");
+DEFINE_bool(huge_pages, false,
+    "Back large host buffers with huge pages.");
+DEFINE_int32(threads, 0,
+    "Optional; the number of threads running the parallel loops of the CPU "
+    "layers (0: one per core). BLAS keeps its own threads, set by e.g. "
+    "OMP_NUM_THREADS.");
+DEFINE_bool(numa, false,
+    "Optional; time on the CPU one replica of the net per NUMA node, each "
+    "with its threads and memory bound to its node.");
+DEFINE_int32(replicas, 0,
+    "Optional; time the forward throughput of this many replicas of the "
+    "net running at once, on the CPU. With -numa they are spread over the "
+    "nodes, otherwise they are not bound.");
+DEFINE_string(output, "",
+    "The file to write the calibrated model definition, or the pruned "
+    "weights, to; for factorize, the prefix of the .prototxt and "
+    ".caffemodel files it writes.");
+DEFINE_double(sparsity, 0.9,
+    "The fraction of the weights of each layer that prune sets to zero.");
+DEFINE_string(layers, "",
+    "Optional; the comma separated names of the layers to prune, by default "
+    "all the convolution and inner product layers; the inner product "
+    "layers to factorize.");
+DEFINE_int32(rank, 0,
+    "The rank factorize keeps, or 0 to choose it by -energy.");
+DEFINE_double(energy, 0.9,
+    "The fraction of the squared singular values of the weights that "
+    "factorize keeps when -rank is 0.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -190,9 +231,378 @@ int test() {
 RegisterBrewFunction(test);
 
 
+// Calibrate: record the largest absolute bottom of each Convolution and
+// InnerProduct layer of a TEST net over `iterations` batches of its data, and
+// write the model with them as quantization_params for int8 inference. A ReLU
+// following such a layer in place is folded into it.
+int calibrate() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to calibrate.";
+  CHECK_GT(FLAGS_weights.size(), 0) << "Need model weights to calibrate.";
+  CHECK_GT(FLAGS_output.size(), 0) << "Need an output model definition.";
+  Caffe::set_mode(Caffe::CPU);
+  Net<float> caffe_net(FLAGS_model, caffe::TEST);
+  caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
+  LOG(INFO) << "Running for " << FLAGS_iterations << " iterations.";
+
+  const vector<shared_ptr<Layer<float> > >& layers = caffe_net.layers();
+  const vector<vector<Blob<float>*> >& bottom_vecs = caffe_net.bottom_vecs();
+  std::map<caffe::string, float> bottom_range;
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    // Layer by layer, so that in-place layers have not changed the bottoms
+    // yet.
+    for (int j = 0; j < layers.size(); ++j) {
+      caffe_net.ForwardFromTo(j, j);
+      const caffe::string type = layers[j]->type();
+      if (type != "Convolution" && type != "InnerProduct") {
+        continue;
+      }
+      float& range = bottom_range[caffe_net.layer_names()[j]];
+      for (int k = 0; k < bottom_vecs[j].size(); ++k) {
+        const float* data = bottom_vecs[j][k]->cpu_data();
+        for (int l = 0; l < bottom_vecs[j][k]->count(); ++l) {
+          range = std::max(range, std::fabs(data[l]));
+        }
+      }
+    }
+  }
+
+  caffe::NetParameter param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &param);
+  caffe::NetParameter calibrated(param);
+  calibrated.clear_layer();
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const caffe::LayerParameter& layer_param = param.layer(i);
+    calibrated.add_layer()->CopyFrom(layer_param);
+    std::map<caffe::string, float>::const_iterator range =
+        bottom_range.find(layer_param.name());
+    if (range == bottom_range.end()) {
+      continue;
+    }
+    if (range->second <= 0) {
+      LOG(INFO) << layer_param.name() << " has an all zero bottom; kept float.";
+      continue;
+    }
+    LOG(INFO) << layer_param.name() << " bottom range: " << range->second;
+    caffe::QuantizationParameter* quantization_param =
+        calibrated.mutable_layer(calibrated.layer_size() - 1)->
+        mutable_quantization_param();
+    quantization_param->set_bottom_range(range->second);
+    if (i + 1 < param.layer_size() && layer_param.top_size() == 1) {
+      const caffe::LayerParameter& next = param.layer(i + 1);
+      if (next.type() == "ReLU" && next.relu_param().negative_slope() == 0 &&
+          next.include_size() == 0 && next.exclude_size() == 0 &&
+          next.bottom_size() == 1 && next.bottom(0) == layer_param.top(0) &&
+          next.top_size() == 1 && next.top(0) == layer_param.top(0)) {
+        LOG(INFO) << "Folding " << next.name() << " into "
+                  << layer_param.name();
+        quantization_param->set_relu(true);
+        ++i;
+      }
+    }
+  }
+  caffe::WriteProtoToTextFile(calibrated, FLAGS_output);
+  LOG(INFO) << "Wrote the calibrated model to " << FLAGS_output;
+  return 0;
+}
+RegisterBrewFunction(calibrate);
+
+
+// Keeps only the nonzero data of proto, with their indices, if that is
+// smaller.
+static void SparsifyBlobProto(caffe::BlobProto* proto) {
+  const vector<float> data(proto->data().begin(), proto->data().end());
+  int nonzeros = 0;
+  for (int i = 0; i < data.size(); ++i) {
+    nonzeros += data[i] != 0;
+  }
+  if (nonzeros == 0 || 2 * nonzeros >= data.size()) {
+    return;
+  }
+  proto->clear_data();
+  for (int i = 0; i < data.size(); ++i) {
+    if (data[i] != 0) {
+      proto->add_sparse_index(i);
+      proto->add_data(data[i]);
+    }
+  }
+}
+
+// Prune: set the `sparsity` fraction of smallest weights of each Convolution
+// and InnerProduct layer (or of the `layers`) to zero, and write the weights
+// with the pruned ones in sparse form, for the sparse TEST forward pass.
+int prune() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to prune.";
+  CHECK_GT(FLAGS_weights.size(), 0) << "Need model weights to prune.";
+  CHECK_GT(FLAGS_output.size(), 0) << "Need an output weights file.";
+  CHECK(FLAGS_sparsity >= 0 && FLAGS_sparsity < 1)
+      << "The sparsity must be in [0, 1).";
+  Caffe::set_mode(Caffe::CPU);
+  Net<float> caffe_net(FLAGS_model, caffe::TEST);
+  caffe_net.CopyTrainedLayersFrom(FLAGS_weights);
+
+  std::set<caffe::string> names;
+  std::stringstream layers_stream(FLAGS_layers);
+  caffe::string name;
+  while (std::getline(layers_stream, name, ',')) {
+    names.insert(name);
+  }
+  const vector<shared_ptr<Layer<float> > >& layers = caffe_net.layers();
+  std::set<caffe::string> pruned_names;
+  for (int i = 0; i < layers.size(); ++i) {
+    const caffe::string& layer_name = caffe_net.layer_names()[i];
+    const caffe::string type = layers[i]->type();
+    if ((type != "Convolution" && type != "InnerProduct") ||
+        (!names.empty() && !names.count(layer_name))) {
+      continue;
+    }
+    Blob<float>* weights = layers[i]->blobs()[0].get();
+    const int pruned = static_cast<int>(FLAGS_sparsity * weights->count());
+    if (pruned == 0) {
+      continue;
+    }
+    float* data = weights->mutable_cpu_data();
+    vector<float> magnitudes(weights->count());
+    for (int j = 0; j < weights->count(); ++j) {
+      magnitudes[j] = std::fabs(data[j]);
+    }
+    std::nth_element(magnitudes.begin(), magnitudes.begin() + pruned - 1,
+        magnitudes.end());
+    const float threshold = magnitudes[pruned - 1];
+    int nonzeros = 0;
+    for (int j = 0; j < weights->count(); ++j) {
+      if (std::fabs(data[j]) <= threshold) {
+        data[j] = 0;
+      } else {
+        ++nonzeros;
+      }
+    }
+    LOG(INFO) << "Pruned " << layer_name << " to a density of "
+              << static_cast<float>(nonzeros) / weights->count();
+    pruned_names.insert(layer_name);
+  }
+  for (std::set<caffe::string>::const_iterator it = names.begin();
+      it != names.end(); ++it) {
+    CHECK(pruned_names.count(*it)) << "No weights to prune in " << *it;
+  }
+
+  caffe::NetParameter net_param;
+  caffe_net.ToProto(&net_param);
+  for (int i = 0; i < net_param.layer_size(); ++i) {
+    if (pruned_names.count(net_param.layer(i).name())) {
+      SparsifyBlobProto(net_param.mutable_layer(i)->mutable_blobs(0));
+    }
+  }
+  caffe::WriteProtoToBinaryFile(net_param, FLAGS_output);
+  LOG(INFO) << "Wrote the pruned weights to " << FLAGS_output;
+  return 0;
+}
+RegisterBrewFunction(prune);
+
+
+// Factorize: replace each InnerProduct layer of `layers`, with weights W, by
+// two stacked ones, `name`_lowrank computing V and `name` computing U (and
+// adding the bias) of the truncated SVD W ~ U V, of rank `rank` or keeping
+// `energy` of the squared singular values. Write the model definition and its
+// weights to `output`.prototxt and `output`.caffemodel, to score with test,
+// time with time or finetune with train.
+int factorize() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to factorize.";
+  CHECK_GT(FLAGS_weights.size(), 0) << "Need model weights to factorize.";
+  CHECK_GT(FLAGS_output.size(), 0) << "Need an output prefix.";
+  CHECK_GT(FLAGS_layers.size(), 0) << "Need the layers to factorize.";
+  CHECK(FLAGS_rank > 0 || (FLAGS_energy > 0 && FLAGS_energy <= 1))
+      << "Need a rank, or an energy in (0, 1].";
+  Caffe::set_mode(Caffe::CPU);
+  std::set<caffe::string> names;
+  std::stringstream layers_stream(FLAGS_layers);
+  caffe::string name;
+  while (std::getline(layers_stream, name, ',')) {
+    names.insert(name);
+  }
+
+  caffe::NetParameter weights;
+  caffe::ReadNetParamsFromBinaryFileOrDie(FLAGS_weights, &weights);
+  caffe::NetParameter factorized_weights(weights);
+  factorized_weights.clear_layer();
+  std::set<caffe::string> found_names;
+  std::map<caffe::string, int> ranks;
+  for (int i = 0; i < weights.layer_size(); ++i) {
+    const caffe::LayerParameter& layer = weights.layer(i);
+    if (!names.count(layer.name())) {
+      factorized_weights.add_layer()->CopyFrom(layer);
+      continue;
+    }
+    found_names.insert(layer.name());
+    CHECK_EQ(layer.type(), "InnerProduct")
+        << "Only InnerProduct layers can be factorized: " << layer.name();
+    Blob<float> W;
+    W.FromProto(layer.blobs(0));
+    const int M = W.height();
+    const int N = W.width();
+    const int max_rank = std::min(M, N);
+    const float total = W.sumsq_data();
+    // Without a rank, double it until enough energy is kept, then keep the
+    // fewest singular values that do.
+    int rank = FLAGS_rank > 0 ? std::min(FLAGS_rank, max_rank) :
+        std::min(64, max_rank);
+    vector<float> U, V, energies;
+    int kept = rank;
+    float kept_energy = 0;
+    for (;;) {
+      U.resize(M * rank);
+      V.resize(rank * N);
+      energies.resize(rank);
+      caffe::low_rank_cpu(M, N, W.cpu_data(), rank, &U[0], &V[0],
+          &energies[0]);
+      kept = rank;
+      kept_energy = 0;
+      bool enough = FLAGS_rank > 0;
+      for (int k = 0; k < rank; ++k) {
+        kept_energy += energies[k];
+        if (!enough && kept_energy >= FLAGS_energy * total) {
+          kept = k + 1;
+          enough = true;
+          break;
+        }
+      }
+      if (enough || rank == max_rank) {
+        break;
+      }
+      rank = std::min(2 * rank, max_rank);
+    }
+    LOG(INFO) << layer.name() << ": rank " << kept << " of " << max_rank
+              << ", relative error "
+              << std::sqrt(std::max(1 - kept_energy / total, 0.f));
+    if (kept * (M + N) >= M * N) {
+      LOG(WARNING) << "Kept " << layer.name() << ", which the factors "
+                   << "would not make smaller";
+      factorized_weights.add_layer()->CopyFrom(layer);
+      continue;
+    }
+    Blob<float> first_weights(1, 1, kept, N);
+    caffe::caffe_copy(kept * N, &V[0], first_weights.mutable_cpu_data());
+    Blob<float> second_weights(1, 1, M, kept);
+    float* second_data = second_weights.mutable_cpu_data();
+    for (int m = 0; m < M; ++m) {
+      caffe::caffe_copy(kept, &U[m * rank], second_data + m * kept);
+    }
+    caffe::LayerParameter* first = factorized_weights.add_layer();
+    first->set_name(layer.name() + "_lowrank");
+    first->set_type(layer.type());
+    first_weights.ToProto(first->add_blobs());
+    caffe::LayerParameter* second = factorized_weights.add_layer();
+    second->CopyFrom(layer);
+    second_weights.ToProto(second->mutable_blobs(0));
+    ranks[layer.name()] = kept;
+  }
+  for (std::set<caffe::string>::const_iterator it = names.begin();
+      it != names.end(); ++it) {
+    CHECK(found_names.count(*it)) << "No weights to factorize in " << *it;
+  }
+
+  caffe::NetParameter param;
+  caffe::ReadNetParamsFromTextFileOrDie(FLAGS_model, &param);
+  caffe::NetParameter factorized(param);
+  factorized.clear_layer();
+  for (int i = 0; i < param.layer_size(); ++i) {
+    const caffe::LayerParameter& layer_param = param.layer(i);
+    std::map<caffe::string, int>::const_iterator rank =
+        ranks.find(layer_param.name());
+    if (rank == ranks.end()) {
+      factorized.add_layer()->CopyFrom(layer_param);
+      continue;
+    }
+    const caffe::string lowrank = layer_param.name() + "_lowrank";
+    caffe::LayerParameter* first = factorized.add_layer();
+    first->CopyFrom(layer_param);
+    first->set_name(lowrank);
+    first->clear_top();
+    first->add_top(lowrank);
+    // The first factor has no bias, and takes the weights' param spec.
+    while (first->param_size() > 1) {
+      first->mutable_param()->RemoveLast();
+    }
+    caffe::InnerProductParameter* inner_product_param =
+        first->mutable_inner_product_param();
+    inner_product_param->set_num_output(rank->second);
+    inner_product_param->set_bias_term(false);
+    inner_product_param->clear_bias_filler();
+    caffe::LayerParameter* second = factorized.add_layer();
+    second->CopyFrom(layer_param);
+    second->clear_bottom();
+    second->add_bottom(lowrank);
+  }
+  caffe::WriteProtoToTextFile(factorized, FLAGS_output + ".prototxt");
+  caffe::WriteProtoToBinaryFile(factorized_weights,
+      FLAGS_output + ".caffemodel");
+  LOG(INFO) << "Wrote the factorized model to " << FLAGS_output
+            << ".prototxt and .caffemodel";
+  return 0;
+}
+RegisterBrewFunction(factorize);
+
+
+// Builds a replica of the model on `node`, if it is not negative, and times
+// its forward passes.
+static void TimeReplica(int node, boost::mutex* build_mutex, double* seconds,
+    int* batch_size) {
+  if (node >= 0) {
+    caffe::BindThreadToNumaNode(node);
+  }
+  shared_ptr<Net<float> > caffe_net;
+  {
+    // The nets share the random generator of their fillers.
+    boost::mutex::scoped_lock lock(*build_mutex);
+    caffe_net.reset(new Net<float>(FLAGS_model, caffe::TEST));
+  }
+  if (FLAGS_weights.size()) {
+    caffe_net->CopyTrainedLayersFrom(FLAGS_weights);
+  }
+  *batch_size = caffe_net->blobs()[0]->num();
+  // A first pass allocates the memory, on this node.
+  caffe_net->ForwardPrefilled();
+  caffe::CPUTimer timer;
+  timer.Start();
+  for (int i = 0; i < FLAGS_iterations; ++i) {
+    caffe_net->ForwardPrefilled();
+  }
+  *seconds = timer.Seconds();
+}
+
+// Times replicas of the model running at once, to measure the throughput of
+// a multi-socket host and the effect of -numa on it.
+int time_replicas() {
+  CHECK_LT(FLAGS_gpu, 0) << "Replicas only run on the CPU.";
+  Caffe::set_mode(Caffe::CPU);
+  const int nodes = caffe::NumaNodeCount();
+  const int replicas = FLAGS_replicas > 0 ? FLAGS_replicas : nodes;
+  LOG(INFO) << "Timing " << replicas << " replicas on " << nodes
+            << " NUMA nodes" << (FLAGS_numa ? "" : ", not bound");
+  boost::mutex build_mutex;
+  vector<double> seconds(replicas);
+  vector<int> batch_sizes(replicas);
+  boost::thread_group threads;
+  for (int i = 0; i < replicas; ++i) {
+    threads.create_thread(boost::bind(&TimeReplica, FLAGS_numa ? i % nodes : -1,
+        &build_mutex, &seconds[i], &batch_sizes[i]));
+  }
+  threads.join_all();
+  double images_per_second = 0;
+  for (int i = 0; i < replicas; ++i) {
+    LOG(INFO) << "Replica " << i << ": " << seconds[i] * 1000 /
+      FLAGS_iterations << " ms per forward pass.";
+    images_per_second += batch_sizes[i] * FLAGS_iterations / seconds[i];
+  }
+  LOG(INFO) << "Total throughput: " << images_per_second << " images/sec.";
+  return 0;
+}
+
 // Time: benchmark the execution time of a model.
 int time() {
   CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to time.";
+  if (FLAGS_numa || FLAGS_replicas > 0) {
+    return time_replicas();
+  }
 
   // Set device id and mode
   if (FLAGS_gpu >= 0) {
@@ -289,12 +699,26 @@ int main(int argc, char** argv) {
       "commands:\n"
       "  train           train or finetune a model\n"
       "  test            score a model\n"
+      "  calibrate       record the bottom ranges for int8 inference\n"
+      "  prune           zero the smallest weights for sparse inference\n"
+      "  factorize       split inner product layers into low-rank pairs\n"
       "  device_query    show GPU diagnostic information\n"
       "  time            benchmark model execution time");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
+  caffe::HostAllocator& allocator = caffe::HostAllocator::Get();
+  if (FLAGS_host_allocator == "malloc") {
+    allocator.set_mode(caffe::HostAllocator::MALLOC);
+  } else {
+    CHECK_EQ(FLAGS_host_allocator, "pool") << "Unknown host allocator "
+        << FLAGS_host_allocator;
+  }
+  allocator.set_huge_pages(FLAGS_huge_pages);
+  Caffe::set_cpu_threads(FLAGS_threads);
   if (argc == 2) {
-    return GetBrewFunction(caffe::string(argv[1]))();
+    const int result = GetBrewFunction(caffe::string(argv[1]))();
+    LOG(INFO) << allocator.DebugString();
+    return result;
   } else {
     gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/caffe");
   }
@@ -1,16 +1,31 @@
+// This program computes the mean image, or only the mean of each channel, of
+// a leveldb/lmdb of Datums.
+// Usage:
+//   compute_image_mean [FLAGS] INPUT_DB [OUTPUT_FILE]
+//
+// The main thread reads the db and --threads worker threads decode the Datums
+// and accumulate them in double precision; the sums are reduced at the end.
+
 #include <stdint.h>
 #include <algorithm>
+#include <fstream>  // NOLINT(readability/streams)
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
+#include "boost/random.hpp"
 #include "boost/scoped_ptr.hpp"
+#include "boost/thread.hpp"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
 #include "caffe/util/io.hpp"
+#include "caffe/util/rng.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
 
@@ -20,6 +35,112 @@ using boost::scoped_ptr;
 
 DEFINE_string(backend, "lmdb",
         "The backend {leveldb, lmdb} containing the images");
+DEFINE_int32(threads, 0,
+    "The number of threads decoding and accumulating images"
+    " (0: one per core)");
+DEFINE_double(sample, 1.,
+    "Optional: the fraction of images, picked at random, to compute the"
+    " mean of");
+DEFINE_int32(seed, 0, "The seed of --sample");
+DEFINE_bool(per_channel, false,
+    "Compute only the mean of each channel, and write OUTPUT_FILE as"
+    " mean_value lines for a transform_param. The images may then have"
+    " different sizes.");
+
+// Decodes Datums handed over by the reading thread and adds them up on a
+// pool of worker threads, each into its own sums. Datums are recycled
+// between the reader and the workers, so memory stays bounded.
+class MeanAccumulator {
+ public:
+  MeanAccumulator(int size, bool per_channel, int num_threads)
+      : per_channel_(per_channel), sums_(num_threads),
+        pixels_(num_threads, 0), datums_(4 * num_threads) {
+    for (int i = 0; i < datums_.size(); ++i) {
+      free_.push(&datums_[i]);
+    }
+    for (int i = 0; i < num_threads; ++i) {
+      sums_[i].resize(size, 0.);
+      workers_.create_thread(boost::bind(&MeanAccumulator::Work, this, i));
+    }
+  }
+
+  // Returns an unused Datum to read the next record into.
+  Datum* NextDatum() { return free_.pop(); }
+  void Add(Datum* datum) { full_.push(datum); }
+
+  // Waits for the workers and returns the sums, and the number of pixels
+  // per channel added up in per-channel mode.
+  void Finish(std::vector<double>* sum, int64_t* pixels) {
+    for (int i = 0; i < sums_.size(); ++i) {
+      full_.push(NULL);
+    }
+    workers_.join_all();
+    *sum = sums_[0];
+    *pixels = pixels_[0];
+    for (int i = 1; i < sums_.size(); ++i) {
+      for (int j = 0; j < sum->size(); ++j) {
+        (*sum)[j] += sums_[i][j];
+      }
+      *pixels += pixels_[i];
+    }
+  }
+
+ private:
+  void Work(int thread_id) {
+    std::vector<double>& sum = sums_[thread_id];
+    while (Datum* datum = full_.pop()) {
+      DecodeDatumNative(datum);
+      const std::string& data = datum->data();
+      const int size_in_datum = std::max<int>(data.size(),
+          datum->float_data_size());
+      const int dim = datum->height() * datum->width();
+      if (per_channel_) {
+        CHECK_EQ(datum->channels(), sum.size())
+            << "Incorrect number of channels " << datum->channels();
+        CHECK_EQ(size_in_datum, datum->channels() * dim)
+            << "Incorrect data field size " << size_in_datum;
+        pixels_[thread_id] += dim;
+      } else {
+        CHECK_EQ(size_in_datum, sum.size()) << "Incorrect data field size "
+            << size_in_datum;
+      }
+      if (data.size() != 0) {
+        const uint8_t* pixels = reinterpret_cast<const uint8_t*>(data.data());
+        Accumulate(pixels, dim, size_in_datum, &sum);
+      } else {
+        Accumulate(datum->float_data().data(), dim, size_in_datum, &sum);
+      }
+      free_.push(datum);
+    }
+  }
+
+  template <typename T>
+  void Accumulate(const T* data, int dim, int size, std::vector<double>* sum) {
+    if (per_channel_) {
+      for (int c = 0; c < sum->size(); ++c) {
+        double channel_sum = 0.;
+        for (int i = c * dim; i < (c + 1) * dim; ++i) {
+          channel_sum += data[i];
+        }
+        (*sum)[c] += channel_sum;
+      }
+    } else {
+      double* sum_data = &(*sum)[0];
+      for (int i = 0; i < size; ++i) {
+        sum_data[i] += data[i];
+      }
+    }
+  }
+
+  const bool per_channel_;
+  std::vector<std::vector<double> > sums_;
+  std::vector<int64_t> pixels_;
+  std::vector<Datum> datums_;
+  BlockingQueue<Datum*> free_;
+  // Datums to accumulate; NULL stops a worker.
+  BlockingQueue<Datum*> full_;
+  boost::thread_group workers_;
+};
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
@@ -39,81 +160,102 @@ int main(int argc, char** argv) {
     gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/compute_image_mean");
     return 1;
   }
+  CHECK(FLAGS_sample > 0 && FLAGS_sample <= 1)
+      << "--sample must be in (0, 1]";
 
   scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
   db->Open(argv[1], db::READ);
   scoped_ptr<db::Cursor> cursor(db->NewCursor());
 
-  BlobProto sum_blob;
-  int count = 0;
   // load first datum
   Datum datum;
-  datum.ParseFromString(cursor->value());
+  cursor->ParseValue(&datum);
 
   if (DecodeDatumNative(&datum)) {
     LOG(INFO) << "Decoding Datum";
   }
 
-  sum_blob.set_num(1);
-  sum_blob.set_channels(datum.channels());
-  sum_blob.set_height(datum.height());
-  sum_blob.set_width(datum.width());
+  const int channels = datum.channels();
   const int data_size = datum.channels() * datum.height() * datum.width();
-  int size_in_datum = std::max<int>(datum.data().size(),
-                                    datum.float_data_size());
-  for (int i = 0; i < size_in_datum; ++i) {
-    sum_blob.add_data(0.);
-  }
+  const int num_threads = FLAGS_threads > 0 ? FLAGS_threads :
+      std::max<int>(boost::thread::hardware_concurrency(), 1);
+  LOG(INFO) << "Using " << num_threads << " threads";
+  MeanAccumulator accumulator(FLAGS_per_channel ? channels : data_size,
+      FLAGS_per_channel, num_threads);
+
+  rng_t rng(FLAGS_seed);
+  boost::uniform_real<float> random_distribution(0, 1);
+  boost::variate_generator<rng_t*, boost::uniform_real<float> >
+      uniform(&rng, random_distribution);
+
   LOG(INFO) << "Starting Iteration";
+  CPUTimer timer;
+  timer.Start();
+  int count = 0;
   while (cursor->valid()) {
-    Datum datum;
-    datum.ParseFromString(cursor->value());
-    DecodeDatumNative(&datum);
-
-    const std::string& data = datum.data();
-    size_in_datum = std::max<int>(datum.data().size(),
-        datum.float_data_size());
-    CHECK_EQ(size_in_datum, data_size) << "Incorrect data field size " <<
-        size_in_datum;
-    if (data.size() != 0) {
-      CHECK_EQ(data.size(), size_in_datum);
-      for (int i = 0; i < size_in_datum; ++i) {
-        sum_blob.set_data(i, sum_blob.data(i) + (uint8_t)data[i]);
+    if (FLAGS_sample >= 1 || uniform() < FLAGS_sample) {
+      Datum* next = accumulator.NextDatum();
+      CHECK(cursor->ParseValue(next)) << "Failed to parse Datum";
+      accumulator.Add(next);
+      ++count;
+      if (count % 10000 == 0) {
+        LOG(INFO) << "Processed " << count << " files.";
       }
-    } else {
-      CHECK_EQ(datum.float_data_size(), size_in_datum);
-      for (int i = 0; i < size_in_datum; ++i) {
-        sum_blob.set_data(i, sum_blob.data(i) +
-            static_cast<float>(datum.float_data(i)));
-      }
-    }
-    ++count;
-    if (count % 10000 == 0) {
-      LOG(INFO) << "Processed " << count << " files.";
     }
     cursor->Next();
   }
+  std::vector<double> sum;
+  int64_t pixels;
+  accumulator.Finish(&sum, &pixels);
+  const double seconds = timer.Seconds();
 
   if (count % 10000 != 0) {
     LOG(INFO) << "Processed " << count << " files.";
   }
-  for (int i = 0; i < sum_blob.data_size(); ++i) {
-    sum_blob.set_data(i, sum_blob.data(i) / count);
-  }
-  // Write to disk
-  if (argc == 3) {
-    LOG(INFO) << "Write to " << argv[2];
-    WriteProtoToBinaryFile(sum_blob, argv[2]);
-  }
-  const int channels = sum_blob.channels();
-  const int dim = sum_blob.height() * sum_blob.width();
+  LOG(INFO) << "Processed " << count / seconds << " images/sec.";
+  CHECK_GT(count, 0) << "No images sampled";
+
   std::vector<float> mean_values(channels, 0.0);
+  if (FLAGS_per_channel) {
+    for (int c = 0; c < channels; ++c) {
+      mean_values[c] = sum[c] / pixels;
+    }
+  } else {
+    BlobProto sum_blob;
+    sum_blob.set_num(1);
+    sum_blob.set_channels(datum.channels());
+    sum_blob.set_height(datum.height());
+    sum_blob.set_width(datum.width());
+    sum_blob.mutable_data()->Resize(data_size, 0.);
+    float* mean_data = sum_blob.mutable_data()->mutable_data();
+    for (int i = 0; i < data_size; ++i) {
+      mean_data[i] = sum[i] / count;
+    }
+    // Write to disk
+    if (argc == 3) {
+      LOG(INFO) << "Write to " << argv[2];
+      WriteProtoToBinaryFile(sum_blob, argv[2]);
+    }
+    const int dim = sum_blob.height() * sum_blob.width();
+    for (int c = 0; c < channels; ++c) {
+      double channel_sum = 0.;
+      for (int i = 0; i < dim; ++i) {
+        channel_sum += mean_data[dim * c + i];
+      }
+      mean_values[c] = channel_sum / dim;
+    }
+  }
   LOG(INFO) << "Number of channels: " << channels;
   for (int c = 0; c < channels; ++c) {
-    for (int i = 0; i < dim; ++i) {
-      mean_values[c] += sum_blob.data(dim * c + i);
+    LOG(INFO) << "mean_value channel [" << c << "]:" << mean_values[c];
+  }
+  if (FLAGS_per_channel && argc == 3) {
+    LOG(INFO) << "Write to " << argv[2];
+    std::ofstream outfile(argv[2]);
+    CHECK(outfile.good()) << "Failed to open " << argv[2];
+    for (int c = 0; c < channels; ++c) {
+      outfile << "mean_value: " << mean_values[c] << std::endl;
     }
-    LOG(INFO) << "mean_value channel [" << c << "]:" << mean_values[c] / dim;
   }
   return 0;
 }
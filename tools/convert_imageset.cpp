@@ -7,21 +7,30 @@
 // should be a list of files as well as their labels, in the format as
 //   subfolder1/file1.JPEG 7
 //   ....
+//
+// Images are decoded, resized and encoded on --threads worker threads while
+// the main thread writes them in list order, so the records are the same
+// for any number of threads.
 
 #include <algorithm>
 #include <fstream>  // NOLINT(readability/streams)
+#include <map>
 #include <string>
 #include <utility>
 #include <vector>
 
+#include "boost/bind.hpp"
 #include "boost/scoped_ptr.hpp"
+#include "boost/thread.hpp"
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/benchmark.hpp"
 #include "caffe/util/db.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/rng.hpp"
+#include "caffe/util/sharded_db.hpp"
 
 using namespace caffe;  // NOLINT(build/namespaces)
 using std::pair;
@@ -41,6 +50,136 @@ DEFINE_bool(encoded, false,
     "When this option is on, the encoded image will be save in datum");
 DEFINE_string(encode_type, "",
     "Optional: What type should we encode the image as ('png','jpg',...).");
+DEFINE_bool(scaled_decode, false,
+    "Optional: decode JPEGs that are resized at a fraction of their size with"
+    " libjpeg (USE_LIBJPEG builds), which is faster for large images");
+DEFINE_int32(threads, 0,
+    "Number of threads reading, resizing and encoding images "
+    "(0 = one per core). The db is always written in list order.");
+DEFINE_int32(commit_interval, 1000,
+    "Number of images written per db transaction");
+DEFINE_int32(shards, 0,
+    "Optional: split the db into this many shard dbs of the chosen backend, "
+    "listed in DB_NAME/shards.prototxt, that data layers read in parallel");
+DEFINE_bool(lmdb_nosync, false,
+    "Optional: do not fsync lmdb on each commit; it is synced once at close");
+DEFINE_bool(lmdb_writemap, false,
+    "Optional: write lmdb through its memory map (sparse 1 TB data file)");
+
+// Reads, resizes and encodes images on a pool of worker threads and hands the
+// serialized Datums back strictly in list order. Workers only run up to
+// `window` images ahead of the consumer so memory stays bounded.
+class ImageConverter {
+ public:
+  ImageConverter(const std::string& root_folder,
+      const std::vector<std::pair<std::string, int> >& lines,
+      int resize_height, int resize_width, bool is_color, bool encoded,
+      const std::string& encode_type, bool scaled_decode, int num_threads)
+      : root_folder_(root_folder), lines_(lines),
+        resize_height_(resize_height), resize_width_(resize_width),
+        is_color_(is_color), encoded_(encoded), encode_type_(encode_type),
+        scaled_decode_(scaled_decode), window_(64 * num_threads),
+        next_read_(0), next_pop_(0) {
+    for (int i = 0; i < num_threads; ++i) {
+      workers_.create_thread(boost::bind(&ImageConverter::Work, this));
+    }
+  }
+  ~ImageConverter() {
+    workers_.interrupt_all();
+    workers_.join_all();
+  }
+
+  // Blocks until line `next_pop_` is converted. Returns false if the image
+  // could not be read, in which case it is skipped.
+  bool Pop(Datum* datum, std::string* value) {
+    boost::mutex::scoped_lock lock(mutex_);
+    std::map<int, Result>::iterator it;
+    while ((it = done_.find(next_pop_)) == done_.end()) {
+      popped_.wait(lock);
+    }
+    const bool status = it->second.status;
+    if (status) {
+      datum->Swap(&it->second.datum);
+      value->swap(it->second.value);
+    }
+    done_.erase(it);
+    ++next_pop_;
+    pushed_.notify_all();
+    return status;
+  }
+
+ private:
+  struct Result {
+    bool status;
+    Datum datum;
+    std::string value;
+  };
+
+  void Work() {
+    try {
+      while (true) {
+        int line_id;
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          while (next_read_ < lines_.size() &&
+                 next_read_ >= next_pop_ + window_) {
+            pushed_.wait(lock);
+          }
+          if (next_read_ >= lines_.size()) {
+            return;
+          }
+          line_id = next_read_++;
+        }
+        Result result;
+        result.status = Convert(lines_[line_id], &result.datum);
+        if (result.status) {
+          CHECK(result.datum.SerializeToString(&result.value));
+        }
+        boost::mutex::scoped_lock lock(mutex_);
+        Result& slot = done_[line_id];
+        slot.status = result.status;
+        slot.datum.Swap(&result.datum);
+        slot.value.swap(result.value);
+        popped_.notify_all();
+      }
+    } catch (boost::thread_interrupted&) {
+      // Interrupted while waiting for the consumer, exit.
+    }
+  }
+
+  bool Convert(const std::pair<std::string, int>& line, Datum* datum) {
+    std::string enc = encode_type_;
+    if (encoded_ && !enc.size()) {
+      // Guess the encoding type from the file name
+      string fn = line.first;
+      size_t p = fn.rfind('.');
+      if ( p == fn.npos )
+        LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
+      enc = fn.substr(p);
+      std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
+    }
+    return ReadImageToDatum(root_folder_ + line.first, line.second,
+        resize_height_, resize_width_, is_color_, enc, datum, scaled_decode_);
+  }
+
+  const std::string root_folder_;
+  const std::vector<std::pair<std::string, int> >& lines_;
+  const int resize_height_;
+  const int resize_width_;
+  const bool is_color_;
+  const bool encoded_;
+  const std::string encode_type_;
+  const bool scaled_decode_;
+  const size_t window_;
+
+  boost::mutex mutex_;
+  boost::condition_variable pushed_;
+  boost::condition_variable popped_;
+  size_t next_read_;
+  size_t next_pop_;
+  std::map<int, Result> done_;
+  boost::thread_group workers_;
+};
 
 int main(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
@@ -86,36 +225,42 @@ int main(int argc, char** argv) {
 
   int resize_height = std::max<int>(0, FLAGS_resize_height);
   int resize_width = std::max<int>(0, FLAGS_resize_width);
+  int num_threads = FLAGS_threads > 0 ? FLAGS_threads :
+      std::max<int>(1, boost::thread::hardware_concurrency());
+  const int commit_interval = std::max<int>(1, FLAGS_commit_interval);
 
-  // Create new DB
-  scoped_ptr<db::DB> db(db::GetDB(FLAGS_backend));
+  // Create new DB. Keys are written in ascending order, so lmdb can append
+  // them instead of inserting into the B-tree.
+  scoped_ptr<db::DB> db;
+  if (FLAGS_shards > 0) {
+    db::ShardedDB* sharded_db = new db::ShardedDB();
+    sharded_db->SetShardLayout(FLAGS_backend, FLAGS_shards);
+    db.reset(sharded_db);
+  } else {
+    db.reset(db::GetDB(FLAGS_backend));
+  }
+  db->SetBulkLoad(true, FLAGS_lmdb_nosync, FLAGS_lmdb_writemap);
   db->Open(argv[3], db::NEW);
   scoped_ptr<db::Transaction> txn(db->NewTransaction());
 
   // Storing to db
   std::string root_folder(argv[1]);
+  LOG(INFO) << "Converting with " << num_threads << " threads.";
+  ImageConverter converter(root_folder, lines, resize_height, resize_width,
+      is_color, encoded, encode_type, FLAGS_scaled_decode, num_threads);
   Datum datum;
+  string out;
   int count = 0;
   const int kMaxKeyLength = 256;
   char key_cstr[kMaxKeyLength];
   int data_size = 0;
   bool data_size_initialized = false;
+  CPUTimer timer;
+  double seconds = 0;
+  timer.Start();
 
   for (int line_id = 0; line_id < lines.size(); ++line_id) {
-    bool status;
-    std::string enc = encode_type;
-    if (encoded && !enc.size()) {
-      // Guess the encoding type from the file name
-      string fn = lines[line_id].first;
-      size_t p = fn.rfind('.');
-      if ( p == fn.npos )
-        LOG(WARNING) << "Failed to guess the encoding of '" << fn << "'";
-      enc = fn.substr(p);
-      std::transform(enc.begin(), enc.end(), enc.begin(), ::tolower);
-    }
-    status = ReadImageToDatum(root_folder + lines[line_id].first,
-        lines[line_id].second, resize_height, resize_width, is_color,
-        enc, &datum);
+    bool status = converter.Pop(&datum, &out);
     if (status == false) continue;
     if (check_size) {
       if (!data_size_initialized) {
@@ -132,21 +277,26 @@ int main(int argc, char** argv) {
         lines[line_id].first.c_str());
 
     // Put in db
-    string out;
-    CHECK(datum.SerializeToString(&out));
     txn->Put(string(key_cstr, length), out);
 
-    if (++count % 1000 == 0) {
+    if (++count % commit_interval == 0) {
       // Commit db
       txn->Commit();
       txn.reset(db->NewTransaction());
-      LOG(ERROR) << "Processed " << count << " files.";
+      seconds += timer.Seconds();
+      timer.Start();
+      LOG(ERROR) << "Processed " << count << " files ("
+          << count / seconds << " images/sec).";
     }
   }
   // write the last batch
-  if (count % 1000 != 0) {
+  if (count % commit_interval != 0) {
     txn->Commit();
-    LOG(ERROR) << "Processed " << count << " files.";
+    seconds += timer.Seconds();
+    LOG(ERROR) << "Processed " << count << " files ("
+        << count / seconds << " images/sec).";
   }
+  txn.reset();
+  db->Close();
   return 0;
 }
@@ -0,0 +1,126 @@
+// This program measures how fast a list of images is decoded the way the data
+// layers decode them: whole with OpenCV, then resized, and with libjpeg at a
+// reduced scale or only the crop the data transformer would take.
+// Usage:
+//   decode_benchmark [FLAGS] ROOTFOLDER/ LISTFILE
+//
+// LISTFILE lists one image per line, as for convert_imageset; anything after
+// the file name is ignored. The scaled and cropped decodes need a build with
+// USE_LIBJPEG.
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/highgui/highgui.hpp>
+#include <opencv2/highgui/highgui_c.h>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <fstream>  // NOLINT(readability/streams)
+#include <string>
+#include <vector>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+
+#include "caffe/util/benchmark.hpp"
+#include "caffe/util/io.hpp"
+
+using namespace caffe;  // NOLINT(build/namespaces)
+using std::string;
+
+DEFINE_bool(gray, false, "Decode the images as grayscale");
+DEFINE_int32(resize_height, 256, "Height images are resized to");
+DEFINE_int32(resize_width, 256, "Width images are resized to");
+DEFINE_int32(crop_size, 227, "Size of the center crop decoded from the"
+    " full size image");
+DEFINE_int32(iterations, 1, "The number of passes over the list");
+
+// Decodes all the images `mode` way and returns the images per second.
+static double Benchmark(const std::vector<string>& data, const string& mode) {
+  const bool is_color = !FLAGS_gray;
+  CPUTimer timer;
+  timer.Start();
+  int count = 0;
+  for (int iter = 0; iter < FLAGS_iterations; ++iter) {
+    for (int i = 0; i < data.size(); ++i) {
+      cv::Mat image;
+      if (mode == "opencv") {
+        std::vector<uchar> buffer(data[i].begin(), data[i].end());
+        cv::Mat full = cv::imdecode(buffer, is_color ? CV_LOAD_IMAGE_COLOR :
+            CV_LOAD_IMAGE_GRAYSCALE);
+        cv::resize(full, image,
+            cv::Size(FLAGS_resize_width, FLAGS_resize_height));
+      } else if (mode == "scaled") {
+        cv::Mat scaled = DecodeJPEGToCVMat(data[i], is_color,
+            FLAGS_resize_height, FLAGS_resize_width);
+        if (scaled.data) {
+          cv::resize(scaled, image,
+              cv::Size(FLAGS_resize_width, FLAGS_resize_height));
+        }
+      } else {
+        int height, width, channels;
+        if (ReadJPEGHeader(data[i], &height, &width, &channels) &&
+            height >= FLAGS_crop_size && width >= FLAGS_crop_size) {
+          image = DecodeJPEGCropToCVMat(data[i], is_color,
+              (height - FLAGS_crop_size) / 2, (width - FLAGS_crop_size) / 2,
+              FLAGS_crop_size, FLAGS_crop_size);
+        }
+      }
+      if (!image.data) {
+        // Not a JPEG, or too small to crop.
+        LOG(WARNING) << "Cannot decode image " << i << " with " << mode;
+        return 0;
+      }
+      ++count;
+    }
+  }
+  return count / timer.Seconds();
+}
+
+int main(int argc, char** argv) {
+  ::google::InitGoogleLogging(argv[0]);
+
+#ifndef GFLAGS_GFLAGS_H_
+  namespace gflags = google;
+#endif
+
+  gflags::SetUsageMessage("Measure the image decoding throughput of a list of"
+        " images\n"
+        "Usage:\n"
+        "    decode_benchmark [FLAGS] ROOTFOLDER/ LISTFILE\n");
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+
+  if (argc != 3) {
+    gflags::ShowUsageWithFlagsRestrict(argv[0], "tools/decode_benchmark");
+    return 1;
+  }
+
+  // Read the files up front so that only decoding is timed.
+  std::ifstream infile(argv[2]);
+  CHECK(infile.good()) << "Failed to open " << argv[2];
+  std::vector<string> data;
+  string line;
+  while (std::getline(infile, line)) {
+    const string filename = line.substr(0, line.find(' '));
+    if (filename.empty()) {
+      continue;
+    }
+    data.push_back(string());
+    CHECK(ReadFileToString(argv[1] + filename, &data.back()))
+        << "Failed to read " << argv[1] + filename;
+  }
+  CHECK_GT(data.size(), 0) << "No images in " << argv[2];
+  LOG(INFO) << "Decoding " << data.size() << " images "
+            << FLAGS_iterations << " times";
+
+  LOG(INFO) << "OpenCV decode and resize: " << Benchmark(data, "opencv")
+            << " images/sec";
+#ifdef USE_LIBJPEG
+  LOG(INFO) << "Scaled decode and resize: " << Benchmark(data, "scaled")
+            << " images/sec";
+  LOG(INFO) << "Center crop decode:       " << Benchmark(data, "crop")
+            << " images/sec";
+#else
+  LOG(INFO) << "Build with USE_LIBJPEG to measure the scaled and cropped"
+            << " decodes";
+#endif
+  return 0;
+}
@@ -1,26 +1,206 @@
 #include <stdio.h>  // for snprintf
+#include <algorithm>
+#include <cstdlib>
 #include <string>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
+#include "boost/scoped_ptr.hpp"
+#include "gflags/gflags.h"
 #include "google/protobuf/text_format.h"
+#include "hdf5.h"
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
+#include "caffe/internal_thread.hpp"
 #include "caffe/net.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
 #include "caffe/util/db.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/vision_layers.hpp"
 
 using caffe::Blob;
+using caffe::BlockingQueue;
 using caffe::Caffe;
 using caffe::Datum;
 using caffe::Net;
+using boost::scoped_ptr;
 using boost::shared_ptr;
 using std::string;
 namespace db = caffe::db;
 
+DEFINE_int32(num_images, 0,
+    "If positive, extract the features of exactly this many images instead"
+    " of num_mini_batches full batches, which may then be left out; the last"
+    " batch is truncated.");
+DEFINE_int32(chunk_rows, 1024,
+    "The number of rows per chunk of hdf5 feature datasets.");
+
+// Writes rows of features to one dataset. Only used by the writer thread.
+class FeatureSink {
+ public:
+  virtual ~FeatureSink() {}
+  virtual void Write(const float* data, int num, int dim) = 0;
+  virtual void Close() = 0;
+};
+
+// Stores every row as a Datum with float_data, keyed by its index, in a
+// leveldb or lmdb.
+class DBFeatureSink : public FeatureSink {
+ public:
+  DBFeatureSink(const string& backend, const string& name)
+      : name_(name), num_rows_(0), db_(db::GetDB(backend)) {
+    db_->Open(name, db::NEW);
+    txn_.reset(db_->NewTransaction());
+  }
+  virtual void Write(const float* data, int num, int dim) {
+    const int kMaxKeyStrLength = 100;
+    char key_str[kMaxKeyStrLength];
+    datum_.set_height(dim);
+    datum_.set_width(1);
+    datum_.set_channels(1);
+    datum_.clear_data();
+    datum_.mutable_float_data()->Resize(dim, 0);
+    string out;
+    for (int n = 0; n < num; ++n) {
+      std::copy(data + n * dim, data + (n + 1) * dim,
+          datum_.mutable_float_data()->mutable_data());
+      int length = snprintf(key_str, kMaxKeyStrLength, "%d", num_rows_);
+      CHECK(datum_.SerializeToString(&out));
+      txn_->Put(string(key_str, length), out);
+      ++num_rows_;
+      if (num_rows_ % 1000 == 0) {
+        txn_->Commit();
+        txn_.reset(db_->NewTransaction());
+        LOG(ERROR)<< "Extracted features of " << num_rows_ <<
+            " query images for dataset " << name_;
+      }
+    }
+  }
+  virtual void Close() {
+    if (num_rows_ % 1000 != 0) {
+      txn_->Commit();
+    }
+    db_->Close();
+  }
+
+ private:
+  string name_;
+  int num_rows_;
+  scoped_ptr<db::DB> db_;
+  scoped_ptr<db::Transaction> txn_;
+  Datum datum_;
+};
+
+// Stores the rows as contiguous row-major float32, without a header.
+class BinaryFeatureSink : public FeatureSink {
+ public:
+  explicit BinaryFeatureSink(const string& name) : name_(name) {
+    file_ = fopen(name.c_str(), "wb");
+    CHECK(file_) << "Failed to open " << name;
+  }
+  virtual void Write(const float* data, int num, int dim) {
+    CHECK_EQ(fwrite(data, sizeof(float) * dim, num, file_),
+        static_cast<size_t>(num))
+        << "Failed to write to " << name_;
+  }
+  virtual void Close() {
+    CHECK_EQ(fclose(file_), 0) << "Failed to close " << name_;
+  }
+
+ private:
+  string name_;
+  FILE* file_;
+};
+
+// Appends the rows to the chunked float32 dataset "data" of an HDF5 file.
+class HDF5FeatureSink : public FeatureSink {
+ public:
+  explicit HDF5FeatureSink(const string& name)
+      : name_(name), dataset_id_(-1) {
+    caffe::HDF5Lock lock;
+    file_id_ = H5Fcreate(name.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT,
+        H5P_DEFAULT);
+    CHECK_GE(file_id_, 0) << "Failed to open HDF5 file " << name;
+  }
+  virtual void Write(const float* data, int num, int dim) {
+    if (dataset_id_ < 0) {
+      std::vector<hsize_t> row_dims(3, 1);
+      row_dims[0] = dim;
+      dataset_id_ = caffe::hdf5_create_extendible_dataset<float>(file_id_,
+          HDF5_DATA_DATASET_NAME, row_dims, FLAGS_chunk_rows, 0);
+    }
+    caffe::hdf5_append_nd_dataset_rows(dataset_id_, num, data);
+  }
+  virtual void Close() {
+    caffe::HDF5Lock lock;
+    if (dataset_id_ >= 0) {
+      H5Dclose(dataset_id_);
+    }
+    CHECK_GE(H5Fclose(file_id_), 0) << "Failed to close HDF5 file " << name_;
+  }
+
+ private:
+  string name_;
+  hid_t file_id_;
+  hid_t dataset_id_;
+};
+
+FeatureSink* GetFeatureSink(const string& type, const string& name) {
+  if (type == "binary") {
+    return new BinaryFeatureSink(name);
+  } else if (type == "hdf5") {
+    return new HDF5FeatureSink(name);
+  }
+  return new DBFeatureSink(type, name);
+}
+
+// Hands batches of features to a sink on its own thread, so that they are
+// stored while the net computes the next batch. Two buffers are used: Write
+// only waits when the sink falls more than a batch behind.
+class FeatureWriter : public caffe::InternalThread {
+ public:
+  explicit FeatureWriter(FeatureSink* sink) : sink_(sink) {
+    for (int i = 0; i < 2; ++i) {
+      free_.push(&buffers_[i]);
+    }
+    CHECK(StartInternalThread()) << "Thread execution failed";
+  }
+
+  // Queues the first num rows of a blob.
+  template <typename Dtype>
+  void Write(const Blob<Dtype>& blob, int num) {
+    const int dim = blob.count() / blob.num();
+    Blob<float>* buffer = free_.pop("Waiting for feature writer");
+    buffer->Reshape(num, dim, 1, 1);
+    std::copy(blob.cpu_data(), blob.cpu_data() + num * dim,
+        buffer->mutable_cpu_data());
+    full_.push(buffer);
+  }
+
+  // Writes the queued batches and closes the sink.
+  void Finish() {
+    full_.push(NULL);
+    CHECK(WaitForInternalThreadToExit()) << "Thread joining failed";
+    sink_->Close();
+  }
+
+ protected:
+  virtual void InternalThreadEntry() {
+    while (Blob<float>* buffer = full_.pop()) {
+      sink_->Write(buffer->cpu_data(), buffer->num(), buffer->channels());
+      free_.push(buffer);
+    }
+  }
+
+  scoped_ptr<FeatureSink> sink_;
+  Blob<float> buffers_[2];
+  BlockingQueue<Blob<float>*> free_;
+  // NULL stops the thread.
+  BlockingQueue<Blob<float>*> full_;
+};
+
 template<typename Dtype>
 int feature_extraction_pipeline(int argc, char** argv);
 
@@ -29,22 +209,39 @@ int main(int argc, char** argv) {
 //  return feature_extraction_pipeline<double>(argc, argv);
 }
 
+static bool IsInteger(const char* arg) {
+  char* end;
+  strtol(arg, &end, 10);
+  return *arg != '\0' && *end == '\0';
+}
+
 template<typename Dtype>
 int feature_extraction_pipeline(int argc, char** argv) {
   ::google::InitGoogleLogging(argv[0]);
-  const int num_required_args = 7;
+  gflags::ParseCommandLineFlags(&argc, &argv, true);
+  // num_mini_batches is only required without --num_images.
+  const bool has_num_mini_batches = FLAGS_num_images <= 0 ||
+      (argc > 5 && IsInteger(argv[5]));
+  const int num_required_args = has_num_mini_batches ? 7 : 6;
   if (argc < num_required_args) {
     LOG(ERROR)<<
     "This program takes in a trained network and an input data layer, and then"
     " extract features of the input data produced by the net.\n"
-    "Usage: extract_features  pretrained_net_param"
+    "Usage: extract_features pretrained_net_param"
     "  feature_extraction_proto_file  extract_feature_blob_name1[,name2,...]"
     "  save_feature_dataset_name1[,name2,...]  num_mini_batches  db_type"
     "  [CPU/GPU] [DEVICE_ID=0]\n"
+    "   or: extract_features --num_images=N pretrained_net_param"
+    "  feature_extraction_proto_file  extract_feature_blob_name1[,name2,...]"
+    "  save_feature_dataset_name1[,name2,...]  db_type  [CPU/GPU]"
+    "  [DEVICE_ID=0]\n"
     "Note: you can extract multiple features in one pass by specifying"
     " multiple feature blob names and dataset names seperated by ','."
     " The names cannot contain white space characters and the number of blobs"
-    " and datasets must be equal.";
+    " and datasets must be equal.\n"
+    "db_type is leveldb or lmdb to store a Datum per image, hdf5 to store a"
+    " chunked float32 dataset \"data\" of one row per image, or binary to"
+    " store the rows as raw row-major float32.";
     return 1;
   }
   int arg_pos = num_required_args;
@@ -118,71 +315,46 @@ int feature_extraction_pipeline(int argc, char** argv) {
         << " in the network " << feature_extraction_proto;
   }
 
-  int num_mini_batches = atoi(argv[++arg_pos]);
+  int num_mini_batches = 0;
+  if (has_num_mini_batches) {
+    num_mini_batches = atoi(argv[++arg_pos]);
+  }
+  const char* db_type = argv[++arg_pos];
 
-  std::vector<shared_ptr<db::DB> > feature_dbs;
-  std::vector<shared_ptr<db::Transaction> > txns;
+  std::vector<shared_ptr<FeatureWriter> > feature_writers;
   for (size_t i = 0; i < num_features; ++i) {
     LOG(INFO)<< "Opening dataset " << dataset_names[i];
-    shared_ptr<db::DB> db(db::GetDB(argv[++arg_pos]));
-    db->Open(dataset_names.at(i), db::NEW);
-    feature_dbs.push_back(db);
-    shared_ptr<db::Transaction> txn(db->NewTransaction());
-    txns.push_back(txn);
+    feature_writers.push_back(shared_ptr<FeatureWriter>(new FeatureWriter(
+        GetFeatureSink(db_type, dataset_names.at(i)))));
   }
 
   LOG(ERROR)<< "Extacting Features";
 
-  Datum datum;
-  const int kMaxKeyStrLength = 100;
-  char key_str[kMaxKeyStrLength];
   std::vector<Blob<float>*> input_vec;
-  std::vector<int> image_indices(num_features, 0);
-  for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index) {
+  int num_images = 0;
+  for (int batch_index = 0; FLAGS_num_images > 0 ?
+       num_images < FLAGS_num_images : batch_index < num_mini_batches;
+       ++batch_index) {
     feature_extraction_net->Forward(input_vec);
+    int batch_size = 0;
     for (int i = 0; i < num_features; ++i) {
       const shared_ptr<Blob<Dtype> > feature_blob = feature_extraction_net
           ->blob_by_name(blob_names[i]);
-      int batch_size = feature_blob->num();
-      int dim_features = feature_blob->count() / batch_size;
-      const Dtype* feature_blob_data;
-      for (int n = 0; n < batch_size; ++n) {
-        datum.set_height(dim_features);
-        datum.set_width(1);
-        datum.set_channels(1);
-        datum.clear_data();
-        datum.clear_float_data();
-        feature_blob_data = feature_blob->cpu_data() +
-            feature_blob->offset(n);
-        for (int d = 0; d < dim_features; ++d) {
-          datum.add_float_data(feature_blob_data[d]);
-        }
-        int length = snprintf(key_str, kMaxKeyStrLength, "%d",
-            image_indices[i]);
-        string out;
-        CHECK(datum.SerializeToString(&out));
-        txns.at(i)->Put(std::string(key_str, length), out);
-        ++image_indices[i];
-        if (image_indices[i] % 1000 == 0) {
-          txns.at(i)->Commit();
-          txns.at(i).reset(feature_dbs.at(i)->NewTransaction());
-          LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
-              " query images for feature blob " << blob_names[i];
-        }
-      }  // for (int n = 0; n < batch_size; ++n)
+      batch_size = feature_blob->num();
+      if (FLAGS_num_images > 0) {
+        batch_size = std::min(batch_size, FLAGS_num_images - num_images);
+      }
+      feature_writers[i]->Write(*feature_blob, batch_size);
     }  // for (int i = 0; i < num_features; ++i)
-  }  // for (int batch_index = 0; batch_index < num_mini_batches; ++batch_index)
+    num_images += batch_size;
+  }  // for (int batch_index = 0; ...; ++batch_index)
   // write the last batch
   for (int i = 0; i < num_features; ++i) {
-    if (image_indices[i] % 1000 != 0) {
-      txns.at(i)->Commit();
-    }
-    LOG(ERROR)<< "Extracted features of " << image_indices[i] <<
+    feature_writers[i]->Finish();
+    LOG(ERROR)<< "Extracted features of " << num_images <<
         " query images for feature blob " << blob_names[i];
-    feature_dbs.at(i)->Close();
   }
 
   LOG(ERROR)<< "Successfully extracted the features!";
   return 0;
 }
-